@@ -0,0 +1,129 @@
+//	AutoExposure.cpp
+//	Implementation of AutoExposure class and the frame histogram.  The histogram kernel
+//	uses GCC vector extensions, which compile to SSE2 on the x86 ground machines and to
+//	NEON on the Odroid.
+
+// System includes
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// Local includes
+#include "AutoExposure.h"
+
+// System namespace
+using namespace std;
+
+typedef uint16_t v8hu __attribute__ ((vector_size (16)));
+
+
+// Pixel value below which the given fraction of the sampled pixels lie, interpolated
+// within the bin
+double ExposureHistogram::level(double fraction) const
+{
+	double wanted = fraction * count;
+	double below = 0;
+	for ( int i = 0; i < AE_BINS; i++ )
+	{
+		if ( below + bins[i] >= wanted && bins[i] > 0 )
+			return ((i + (wanted - below) / bins[i]) * (1 << AE_BIN_SHIFT));
+		below += bins[i];
+	}
+	return AE_BINS << AE_BIN_SHIFT;
+}
+
+
+double ExposureHistogram::saturated() const
+{
+	uint64_t n = 0;
+	for ( int i = AE_SATURATED_BIN; i < AE_BINS; i++ )
+		n += bins[i];
+	return count? (double) n / count : 0;
+}
+
+
+// Histogram of a pair of rows every row_step rows
+void frame_histogram(const Frame &frame, int row_step, ExposureHistogram &histogram)
+{
+	const v8hu top = { AE_BINS - 1, AE_BINS - 1, AE_BINS - 1, AE_BINS - 1, AE_BINS - 1, AE_BINS - 1, AE_BINS - 1, AE_BINS - 1 };
+	uint32_t t[4][AE_BINS];
+	memset(t, 0, sizeof(t));
+
+	size_t width = frame.width;
+	uint64_t count = 0;
+	for ( uint32_t y = 0; y < frame.height; y += max(row_step, 2) )
+		for ( uint32_t r = y; r < y + 2 && r < frame.height; r++ )
+		{
+			const uint16_t* p = frame.pixels + r * width;
+			size_t x = 0;
+			for ( ; x + 8 <= width; x += 8 )
+			{
+				v8hu v;
+				memcpy(&v, p + x, sizeof(v));
+				v = v >> AE_BIN_SHIFT;
+				v = (v > top)? top : v;
+				t[0][v[0]]++;
+				t[1][v[1]]++;
+				t[2][v[2]]++;
+				t[3][v[3]]++;
+				t[0][v[4]]++;
+				t[1][v[5]]++;
+				t[2][v[6]]++;
+				t[3][v[7]]++;
+			}
+			for ( ; x < width; x++ )
+				t[0][min(p[x] >> AE_BIN_SHIFT, AE_BINS - 1)]++;
+			count += width;
+		}
+
+	for ( int i = 0; i < AE_BINS; i++ )
+		histogram.bins[i] = t[0][i] + t[1][i] + t[2][i] + t[3][i];
+	histogram.count = count;
+}
+
+
+AutoExposure::AutoExposure() : exposure_us(0), level(0), saturated(0), updates(0), min_us(0), max_us(0)
+{
+}
+
+
+// Bounds of the exposure time over all automatic exposures of the camera.  The first
+// exposure is in the middle of the range on a log scale.
+void AutoExposure::setLimits(double min, double max)
+{
+	min_us = min;
+	max_us = max;
+	exposure_us = sqrt(min * max);
+}
+
+
+// Exposure time to use for an image whose own bounds are min and max
+double AutoExposure::exposure(double min, double max) const
+{
+	return std::min(std::max(exposure_us, min), max);
+}
+
+
+// Pick the next exposure time from a grabbed frame.  The frame gives the exposure time
+// that would have put the scene at the target, and the controller steps from its own
+// exposure time towards it.
+void AutoExposure::update(const Frame &frame)
+{
+	if ( !frame.valid() || frame.exposure_us <= 0 || max_us <= 0 )
+		return;
+
+	frame_histogram(frame, AE_ROW_STEP, histogram);
+	double black = histogram.level(AE_DARK_PERCENTILE);
+	level = histogram.level(AE_PERCENTILE) - black;
+	saturated = histogram.saturated();
+
+	// Saturated pixels limit the exposure time too, as their number grows about in
+	// proportion to the exposure time
+	double wanted = frame.exposure_us * AE_TARGET / max(level, 1.0);
+	if ( saturated > 0 )
+		wanted = min(wanted, frame.exposure_us * AE_MAX_SATURATED / saturated);
+
+	double ratio = min(max(pow(wanted / exposure_us, AE_GAIN), 1 / AE_MAX_STEP), AE_MAX_STEP);
+	exposure_us = min(max(exposure_us * ratio, min_us), max_us);
+	updates++;
+}
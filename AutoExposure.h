@@ -0,0 +1,68 @@
+//	AutoExposure.h
+//	Interface for AutoExposure class.  The controller picks a camera's next exposure
+//	time from the histogram of the frames it grabs, so that a bright part of the scene
+//	(AE_PERCENTILE of the pixels are darker) sits at AE_TARGET above the black level,
+//	or lower if more than AE_MAX_SATURATED of the pixels would saturate.  Each step
+//	moves part of the way there, in proportion on a log scale, and never by more than
+//	AE_MAX_STEP, so a single odd frame doesn't swing the exposure.  The exposure stays
+//	within the bounds that the imaging plan gives.
+//
+//	The histogram is taken from a pair of rows, which holds every Bayer colour, every
+//	AE_ROW_STEP rows.  Bin numbers for eight pixels at a time are computed with SSE2 or
+//	NEON, and the counts are spread over four tables so that runs of equal pixels don't
+//	wait on each other's increments.
+
+#ifndef _AutoExposure_H_
+#define _AutoExposure_H_
+
+#include <cstdint>
+
+#include "Frame.h"
+
+const int AE_BINS = 256;		// Histogram bins of 16 ADU
+const int AE_BIN_SHIFT = 4;
+const int AE_ROW_STEP = 16;		// Rows between sampled row pairs
+const double AE_PERCENTILE = 0.99;	// Part of the scene put at the target
+const double AE_DARK_PERCENTILE = 0.01;	// Taken as the black level
+const double AE_TARGET = 2800;		// ADU above black level
+const int AE_SATURATED_BIN = 252;	// Pixels at 4032 ADU and above are saturated
+const double AE_MAX_SATURATED = 0.002;	// Part of the pixels allowed to saturate
+const double AE_GAIN = 0.5;		// Part of the log exposure error corrected per step
+const double AE_MAX_STEP = 2.0;		// Largest change of exposure time per step
+
+
+// Histogram of a frame
+struct ExposureHistogram
+{
+	uint32_t bins[AE_BINS];
+	uint64_t count;		// Pixels sampled
+
+	double level(double fraction) const;
+	double saturated() const;
+};
+
+
+// AutoExposure class definition
+class AutoExposure
+{
+public:
+	AutoExposure();
+	void setLimits(double min_us, double max_us);
+	double exposure(double min_us, double max_us) const;
+	void update(const Frame &frame);
+
+	// State after the last update
+	double exposure_us;	// Next exposure time
+	double level;		// ADU above black at AE_PERCENTILE
+	double saturated;	// Part of the pixels saturated
+	uint64_t updates;
+
+private:
+	double min_us;
+	double max_us;
+	ExposureHistogram histogram;
+};
+
+extern void frame_histogram(const Frame &frame, int row_step, ExposureHistogram &histogram);
+
+#endif
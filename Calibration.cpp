@@ -0,0 +1,408 @@
+//	Calibration.cpp
+//	Implementation of Calibration class and the calibration kernels.  Dark subtraction
+//	works on eight pixels at a time with GCC vector extensions, which compile to SSE2 on
+//	x86 and NEON on the Odroid, in even and odd 32-bit lanes so that the interpolated dark
+//	and the rounding fit.  Strips of rows are corrected by the threads of the
+//	calibration's own TilePool, each replacing the hot pixels of its own rows once their
+//	darks are subtracted.
+
+// System includes
+#include <algorithm>
+#include <system_error>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Local includes
+#include "Calibration.h"
+
+// System namespace
+using namespace std;
+
+typedef uint16_t v8hu __attribute__ ((vector_size (16)));
+typedef uint32_t v4su __attribute__ ((vector_size (16)));
+typedef int32_t v4si __attribute__ ((vector_size (16)));
+
+const int WEIGHT_BITS = 12;		// Fraction bits of the interpolation weight
+const int32_t PIXEL_MAX = 4095;
+
+
+static inline v8hu load(const uint16_t* p)
+{
+	v8hu v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+static inline void store(uint16_t* p, v8hu v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+
+// Corrected values of four pixels in 32-bit lanes, from the pixels and the two darks.
+// Saturated pixels stay saturated.
+static inline v4si correct(v4si p, v4si a, v4si b, int32_t weight)
+{
+	const int32_t offset = (CALIBRATION_PEDESTAL << CALIBRATION_SHIFT) + (1 << (CALIBRATION_SHIFT - 1));
+	v4si dark = a + (((b - a) * weight + (1 << (WEIGHT_BITS - 1))) >> WEIGHT_BITS);
+	v4si v = (p << CALIBRATION_SHIFT) + offset - dark;
+	v = (v & (v > 0)) >> CALIBRATION_SHIFT;
+	v4si over = (v > PIXEL_MAX) | (p >= PIXEL_MAX);
+	return (v & ~over) | (PIXEL_MAX & over);
+}
+
+
+// Subtract the dark a + (b - a) * weight / 2^WEIGHT_BITS from count pixels in place,
+// leaving saturated pixels at PIXEL_MAX
+void subtract_dark(uint16_t* pixels, const uint16_t* a, const uint16_t* b, int32_t weight, size_t count)
+{
+	size_t i = 0;
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		v4su p = (v4su) load(pixels + i);
+		v4su da = (v4su) load(a + i);
+		v4su db = (v4su) load(b + i);
+		v4si even = correct((v4si) (p & 0xffff), (v4si) (da & 0xffff), (v4si) (db & 0xffff), weight);
+		v4si odd = correct((v4si) (p >> 16), (v4si) (da >> 16), (v4si) (db >> 16), weight);
+		store(pixels + i, (v8hu) ((v4su) even | ((v4su) odd << 16)));
+	}
+	for ( ; i < count; i++ )
+	{
+		int32_t dark = a[i] + (((b[i] - a[i]) * weight + (1 << (WEIGHT_BITS - 1))) >> WEIGHT_BITS);
+		int32_t v = (pixels[i] << CALIBRATION_SHIFT) + (CALIBRATION_PEDESTAL << CALIBRATION_SHIFT) +
+			(1 << (CALIBRATION_SHIFT - 1)) - dark;
+		pixels[i] = (pixels[i] >= PIXEL_MAX)? PIXEL_MAX : min(max(v, 0) >> CALIBRATION_SHIFT, PIXEL_MAX);
+	}
+}
+
+
+// Replace the hot pixels numbered from begin to end, which must be whole rows, by the
+// mean of the pixels two to either side that are not hot
+void replace_hot_pixels(uint16_t* pixels, uint32_t width, const uint32_t* hot, size_t count,
+	size_t begin, size_t end)
+{
+	const uint32_t* last = hot + count;
+	for ( const uint32_t* h = lower_bound(hot, last, begin); h < last && *h < end; h++ )
+	{
+		uint32_t x = *h % width;
+		bool left = x >= 2 && !binary_search(hot, last, *h - 2);
+		bool right = x + 2 < width && !binary_search(hot, last, *h + 2);
+		if ( left && right )
+			pixels[*h] = (pixels[*h - 2] + pixels[*h + 2] + 1) / 2;
+		else if ( left )
+			pixels[*h] = pixels[*h - 2];
+		else if ( right )
+			pixels[*h] = pixels[*h + 2];
+	}
+}
+
+
+// Add the pixels whose dark current is more than CALIBRATION_HOT_ADU above the median
+// of a dark to hot, which is left sorted without repeats
+void find_hot_pixels(const uint16_t* dark, size_t count, vector<uint32_t> &hot)
+{
+	if ( count == 0 )
+		return;
+	vector<uint16_t> values(dark, dark + count);
+	nth_element(values.begin(), values.begin() + count / 2, values.end());
+	uint32_t limit = values[count / 2] + (CALIBRATION_HOT_ADU << CALIBRATION_SHIFT);
+
+	for ( size_t i = 0; i < count; i++ )
+		if ( dark[i] > limit )
+			hot.push_back(i);
+	sort(hot.begin(), hot.end());
+	hot.erase(unique(hot.begin(), hot.end()), hot.end());
+}
+
+
+// Write size bytes at offset
+static void write_at(int fd, const string &path, const void* buffer, size_t size, uint64_t offset)
+{
+	const char* p = (const char*) buffer;
+	while ( size > 0 )
+	{
+		ssize_t n = pwrite(fd, p, size, offset);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n < 0 )
+			throw system_error{errno, system_category(), path};
+		p += n;
+		size -= n;
+		offset += n;
+	}
+}
+
+
+// Write a calibration file.  The offsets of the entries are filled in here.
+void write_calibration(const string &path, const string &serial, uint32_t width, uint32_t height,
+	const vector<CalibrationDark> &entries, const vector<const uint16_t*> &darks, const vector<uint32_t> &hot)
+{
+	CalibrationHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "NCAL", 4);
+	header.version = CALIBRATION_VERSION;
+	header.header_size = sizeof(header);
+	header.width = width;
+	header.height = height;
+	header.darks = entries.size();
+	header.hot_pixels = hot.size();
+	memcpy(header.serial, serial.data(), min(serial.size(), sizeof(header.serial) - 1));
+	header.shift = CALIBRATION_SHIFT;
+
+	size_t dark_size = (size_t) width * height * sizeof(uint16_t);
+	vector<CalibrationDark> table(entries);
+	uint64_t offset = sizeof(header) + table.size() * sizeof(CalibrationDark);
+	for ( size_t i = 0; i < table.size(); i++ )
+	{
+		offset = (offset + CALIBRATION_ALIGN - 1) / CALIBRATION_ALIGN * CALIBRATION_ALIGN;
+		table[i].offset = offset;
+		offset += dark_size;
+	}
+	header.hot_offset = offset;
+
+	int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), path};
+	try
+	{
+		write_at(fd, path, &header, sizeof(header), 0);
+		write_at(fd, path, table.data(), table.size() * sizeof(CalibrationDark), sizeof(header));
+		for ( size_t i = 0; i < table.size(); i++ )
+			write_at(fd, path, darks[i], dark_size, table[i].offset);
+		write_at(fd, path, hot.data(), hot.size() * sizeof(uint32_t), header.hot_offset);
+	}
+	catch (...)
+	{
+		::close(fd);
+		unlink(path.c_str());
+		throw;
+	}
+	::close(fd);
+}
+
+
+Calibration::Calibration() :
+	map(NULL), map_size(0), header(NULL), table(NULL), hot(NULL)
+{
+}
+
+
+Calibration::~Calibration()
+{
+	close();
+}
+
+
+// Map a calibration file and check that its tables and darks lie within it.  Only the
+// header and tables are read now.
+void Calibration::open(const string &path)
+{
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), path};
+	struct stat st;
+	if ( fstat(fd, &st) < 0 )
+	{
+		int error = errno;
+		::close(fd);
+		throw system_error{error, system_category(), path};
+	}
+	map_size = st.st_size;
+	void* p = (map_size > 0)? mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	int error = (map_size > 0)? errno : EINVAL;
+	::close(fd);
+	if ( p == MAP_FAILED )
+	{
+		map_size = 0;
+		throw system_error{error, system_category(), path};
+	}
+	map = (const uint8_t*) p;
+
+	header = (const CalibrationHeader*) map;
+	bool ok = map_size >= sizeof(CalibrationHeader) && memcmp(header->magic, "NCAL", 4) == 0 &&
+		header->version <= CALIBRATION_VERSION && header->header_size >= sizeof(CalibrationHeader) &&
+		header->shift == CALIBRATION_SHIFT &&
+		header->header_size + (uint64_t) header->darks * sizeof(CalibrationDark) <= map_size &&
+		header->hot_offset + (uint64_t) header->hot_pixels * sizeof(uint32_t) <= map_size &&
+		header->hot_offset % sizeof(uint32_t) == 0;
+	if ( ok )
+	{
+		table = (const CalibrationDark*) (map + header->header_size);
+		hot = (const uint32_t*) (map + header->hot_offset);
+		uint64_t dark_size = (uint64_t) header->width * header->height * sizeof(uint16_t);
+		for ( uint32_t i = 0; ok && i < header->darks; i++ )
+			ok = table[i].offset % sizeof(uint16_t) == 0 && table[i].offset + dark_size <= map_size;
+		for ( uint32_t i = 0; ok && i < header->hot_pixels; i++ )
+			ok = hot[i] < header->width * header->height && (i == 0 || hot[i - 1] < hot[i]);
+	}
+	if ( !ok )
+	{
+		close();
+		throw system_error{EINVAL, system_category(), path + ": not a valid calibration file"};
+	}
+	if ( !own_pool )
+		own_pool.reset(new TilePool(CALIBRATION_THREADS));
+}
+
+
+void Calibration::close()
+{
+	if ( map != NULL )
+		munmap((void*) map, map_size);
+	map = NULL;
+	map_size = 0;
+	header = NULL;
+	table = NULL;
+	hot = NULL;
+}
+
+
+bool Calibration::loaded() const
+{
+	return map != NULL;
+}
+
+
+uint32_t Calibration::darks() const
+{
+	return loaded()? header->darks : 0;
+}
+
+
+uint32_t Calibration::hotPixels() const
+{
+	return loaded()? header->hot_pixels : 0;
+}
+
+
+// The two darks of the nearest temperature bin to interpolate or extrapolate between,
+// and the weight of b in 2^WEIGHT_BITS.
+// Return value: false if there are no darks within CALIBRATION_TEMP_BIN of temperature
+bool Calibration::choose(double exposure_us, double temperature, const uint16_t* &a, const uint16_t* &b,
+	int32_t &weight) const
+{
+	if ( header->darks == 0 )
+		return false;
+	float bin = table[0].temperature;
+	for ( uint32_t i = 1; i < header->darks; i++ )
+		if ( fabs(table[i].temperature - temperature) < fabs(bin - temperature) )
+			bin = table[i].temperature;
+	if ( fabs(bin - temperature) > CALIBRATION_TEMP_BIN )
+		return false;
+
+	// Nearest darks below and above the exposure time, and the next ones out
+	int below = -1, above = -1, below2 = -1, above2 = -1;
+	for ( uint32_t i = 0; i < header->darks; i++ )
+	{
+		if ( table[i].temperature != bin )
+			continue;
+		double e = table[i].exposure_us;
+		if ( e <= exposure_us )
+		{
+			if ( below < 0 || e > table[below].exposure_us )
+			{
+				below2 = below;
+				below = i;
+			}
+			else if ( below2 < 0 || e > table[below2].exposure_us )
+				below2 = i;
+		}
+		else
+		{
+			if ( above < 0 || e < table[above].exposure_us )
+			{
+				above2 = above;
+				above = i;
+			}
+			else if ( above2 < 0 || e < table[above2].exposure_us )
+				above2 = i;
+		}
+	}
+
+	int first = below, second = above;
+	if ( below < 0 )
+	{
+		first = above;
+		second = above2;
+	}
+	else if ( above < 0 )
+	{
+		first = below2;
+		second = below;
+	}
+
+	weight = 0;
+	if ( first < 0 || second < 0 || table[second].exposure_us == table[first].exposure_us )
+		first = second = (first < 0)? second : first;
+	else
+	{
+		double w = (exposure_us - table[first].exposure_us) / (table[second].exposure_us - table[first].exposure_us);
+		w = min(max(w, (double) -CALIBRATION_MAX_WEIGHT), (double) CALIBRATION_MAX_WEIGHT);
+		weight = (int32_t) lround(w * (1 << WEIGHT_BITS));
+	}
+	a = (const uint16_t*) (map + table[first].offset);
+	b = (const uint16_t*) (map + table[second].offset);
+	return true;
+}
+
+
+// Correct a frame in place on the calibration's own pool
+CalibrationStatus Calibration::apply(Frame &frame, double temperature) const
+{
+	if ( !loaded() )
+		return CALIBRATION_NONE;
+	return apply(frame, temperature, *own_pool);
+}
+
+
+// Correct a frame in place, which owns its buffer until it is released.  Frames of
+// another size are left as they are, and frames with no darks near their temperature
+// only have their hot pixels replaced.
+CalibrationStatus Calibration::apply(Frame &frame, double temperature, TilePool &pool) const
+{
+	if ( !loaded() )
+		return CALIBRATION_NONE;
+	if ( frame.width != header->width || frame.height != header->height )
+		return CALIBRATION_SIZE;
+
+	const uint16_t* a = NULL;
+	const uint16_t* b = NULL;
+	int32_t weight = 0;
+	bool dark = choose(frame.exposure_us, temperature, a, b, weight);
+	uint16_t* pixels = const_cast<uint16_t*>(frame.pixels);
+	uint32_t width = frame.width;
+
+	int tiles = (frame.height + CALIBRATION_ROWS - 1) / CALIBRATION_ROWS;
+	pool.run(tiles, [&](int t) {
+		size_t begin = (size_t) t * CALIBRATION_ROWS * width;
+		size_t end = min((size_t) (t + 1) * CALIBRATION_ROWS, (size_t) frame.height) * width;
+		if ( dark )
+			subtract_dark(pixels + begin, a + begin, b + begin, weight, end - begin);
+		replace_hot_pixels(pixels, width, hot, header->hot_pixels, begin, end);
+	});
+	return dark? CALIBRATION_OK : CALIBRATION_NO_DARK;
+}
+
+
+// Why a frame was or wasn't dark corrected
+const char* calibration_status_string(CalibrationStatus status)
+{
+	switch ( status )
+	{
+	case CALIBRATION_OK:
+		return "dark corrected";
+	case CALIBRATION_NO_DARK:
+		return "no darks near the camera temperature";
+	case CALIBRATION_SIZE:
+		return "frame size differs from the calibration file";
+	default:
+		return "no calibration file";
+	}
+}
@@ -0,0 +1,152 @@
+//	Calibration.h
+//	Interface for Calibration class.  Removes the dark current and bias of each frame and
+//	replaces its hot pixels on board, before the frame is stacked, compressed or written,
+//	using master darks made on the ground.  Each camera has one calibration file (.cal),
+//	named by its serial number, which is memory-mapped at startup; a dark is only read
+//	from the card when frames first use it.
+//
+//	The darks of a file are indexed by exposure time and by sensor temperature bin.  A
+//	frame uses the darks of the temperature bin nearest its camera's temperature, linearly
+//	interpolated between the two darks whose exposure times are either side of its own,
+//	or extrapolated from the two nearest, up to CALIBRATION_MAX_WEIGHT times their
+//	difference.  A bin with one dark uses it as it is.  Dark current doubles every few
+//	degrees, so if the nearest bin is more than CALIBRATION_TEMP_BIN away no dark is
+//	subtracted, and apply() says so.  The corrected pixel is
+//		p - dark + CALIBRATION_PEDESTAL
+//	rounded and clipped to 12 bits, the pedestal keeping the noise of a dark sky above 0.
+//	Saturated pixels are left at 4095, so that the source catalog and auto exposure still
+//	know them as saturated.  A hot pixel is then replaced by the mean of its nearest
+//	neighbours of the same colour in its row that are not hot.
+//
+//	Frames are corrected in the camera's thread as they are grabbed, so each Calibration
+//	has a TilePool of its own, of CALIBRATION_THREADS threads counting the camera's.  The
+//	shared pool is left to the image writers, whose batches would otherwise hold up the
+//	cameras, and the cameras don't wait for each other.
+//
+//	Darks are kept as combined images are written (see Stacker.h), 16 times the pixel
+//	value, so the mean of a baslerctrl "combine mean raw" stack of dark frames is a master
+//	dark as it is.  The rawpack program builds calibration files from them.
+//
+//	File layout, all values in host (little-endian) byte order:
+//
+//	Header (64 bytes)
+//		char[4]	magic "NCAL"
+//		u16	version (1)
+//		u16	header size in bytes, the dark table starts here
+//		u32	width
+//		u32	height
+//		u32	number of darks D
+//		u32	number of hot pixels H
+//		u64	offset of the hot pixel list
+//		char[16] camera serial number, NUL padded
+//		u32	fraction bits of the dark values (4)
+//		char[12] reserved
+//	Dark table, D entries of 32 bytes
+//		f64	exposure time in us
+//		f32	temperature in degrees C, the centre of the bin
+//		u32	reserved
+//		u64	offset of the dark, a multiple of CALIBRATION_ALIGN
+//		u64	reserved
+//	Darks, width x height u16 each, rows top to bottom
+//	Hot pixel list, H u32 pixel numbers y * width + x in ascending order
+
+#ifndef _Calibration_H_
+#define _Calibration_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "Frame.h"
+#include "TilePool.h"
+
+using namespace std;
+
+const uint16_t CALIBRATION_VERSION = 1;
+const uint32_t CALIBRATION_SHIFT = 4;		// Fraction bits of a dark, as a combined image
+const uint16_t CALIBRATION_PEDESTAL = 64;	// ADU added back after the dark is subtracted
+const double CALIBRATION_TEMP_BIN = 5;		// Degrees C per temperature bin
+const int32_t CALIBRATION_MAX_WEIGHT = 4;	// Extrapolation limit, in dark differences
+const uint16_t CALIBRATION_HOT_ADU = 100;	// Dark current that makes a pixel hot
+const size_t CALIBRATION_ALIGN = 4096;		// Darks start on a page
+const size_t CALIBRATION_ROWS = 64;		// Rows per tile on the pool
+const int CALIBRATION_THREADS = 2;		// Threads correcting a camera's frames
+const char* const CALIBRATION_EXTENSION = ".cal";
+
+
+// What apply() did to a frame
+enum CalibrationStatus
+{
+	CALIBRATION_OK,		// Dark subtracted and hot pixels replaced
+	CALIBRATION_NO_DARK,	// No dark near the temperature, only hot pixels replaced
+	CALIBRATION_SIZE,	// Frame size differs from the file's, frame left as it is
+	CALIBRATION_NONE	// No file loaded
+};
+
+
+// Header of a calibration file
+struct CalibrationHeader
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t darks;
+	uint32_t hot_pixels;
+	uint64_t hot_offset;
+	char serial[16];
+	uint32_t shift;
+	char reserved[12];
+};
+
+
+// Entry of the dark table
+struct CalibrationDark
+{
+	double exposure_us;
+	float temperature;
+	uint32_t reserved;
+	uint64_t offset;
+	uint64_t reserved2;
+};
+
+
+// Calibration class definition
+class Calibration
+{
+public:
+	Calibration();
+	~Calibration();
+	void open(const string &path);
+	void close();
+	bool loaded() const;
+	uint32_t darks() const;
+	uint32_t hotPixels() const;
+	CalibrationStatus apply(Frame &frame, double temperature) const;
+	CalibrationStatus apply(Frame &frame, double temperature, TilePool &pool) const;
+
+private:
+	const uint8_t* map;
+	size_t map_size;
+	const CalibrationHeader* header;
+	const CalibrationDark* table;
+	const uint32_t* hot;
+	unique_ptr<TilePool> own_pool;	// Made when a file is opened
+
+	Calibration(const Calibration&) = delete;
+	Calibration& operator=(const Calibration&) = delete;
+	bool choose(double exposure_us, double temperature, const uint16_t* &a, const uint16_t* &b, int32_t &weight) const;
+};
+
+extern void subtract_dark(uint16_t* pixels, const uint16_t* a, const uint16_t* b, int32_t weight, size_t count);
+extern void replace_hot_pixels(uint16_t* pixels, uint32_t width, const uint32_t* hot, size_t count,
+	size_t begin, size_t end);
+extern void find_hot_pixels(const uint16_t* dark, size_t count, vector<uint32_t> &hot);
+extern void write_calibration(const string &path, const string &serial, uint32_t width, uint32_t height,
+	const vector<CalibrationDark> &entries, const vector<const uint16_t*> &darks, const vector<uint32_t> &hot);
+extern const char* calibration_status_string(CalibrationStatus status);
+
+#endif
@@ -0,0 +1,158 @@
+//	CameraSource.cpp
+//	Implementation of CameraSource, the SoftwareCamera base and the source factory.
+//	A software camera frame is ready at the later of the end of its exposure and one
+//	frame period after the previous frame, and retrieve() sleeps until then.
+
+// System includes
+#include <string>
+#include <cstdlib>
+
+// Local includes
+#include "CameraSource.h"
+#include "SyntheticCamera.h"
+#include "ReplayCamera.h"
+#include "OBCHistory.h"
+
+// System namespace
+using namespace std;
+
+
+// Capture one frame with the given exposure time.  trigger_ns is set to the monotonic
+// time the trigger was sent.  Returns false with error set if the grab failed.
+bool CameraSource::grab(double exposure_us, Frame &frame, int64_t &trigger_ns, string &error)
+{
+	arm(exposure_us);
+	trigger_ns = trigger();
+	return retrieve(frame, error);
+}
+
+
+SoftwareCamera::SoftwareCamera(const string &sn, uint32_t w, uint32_t h, double fps) :
+	serial(sn), width(w), height(h), count(0), period_ns((fps > 0)? (int64_t) (1e9 / fps) : 0),
+	exposure_us(0), trigger_ns(0), ready_ns(0), pool(SOURCE_BUFFERS, (size_t) w * h * sizeof(uint16_t))
+{
+}
+
+
+string SoftwareCamera::serialNumber()
+{
+	return serial;
+}
+
+
+double SoftwareCamera::temperature()
+{
+	return 40.0;
+}
+
+
+void SoftwareCamera::sample()
+{
+}
+
+
+void SoftwareCamera::arm(double us)
+{
+	exposure_us = us;
+}
+
+
+int64_t SoftwareCamera::trigger()
+{
+	trigger_ns = monotonic_ns();
+	return trigger_ns;
+}
+
+
+// Wait for the triggered frame.  Like a camera whose buffers are all queued for
+// writing, this times out when no buffer comes free.
+bool SoftwareCamera::retrieve(Frame &frame, string &error)
+{
+	if ( trigger_ns == 0 )
+	{
+		error = "not triggered";
+		return false;
+	}
+
+	int64_t done = max(trigger_ns + (int64_t) (exposure_us * 1000), ready_ns + period_ns);
+	int64_t triggered = trigger_ns;
+	trigger_ns = 0;
+
+	shared_ptr<void> buffer = pool.acquire((int) (exposure_us / 1000) + SOURCE_TIMEOUT_MS);
+	if ( !buffer )
+		throw CameraTimeout(serial + ": no free frame buffer");
+
+	fill((uint16_t*) buffer.get(), exposure_us);
+	sleep_until_ns(done);
+	ready_ns = max(done, monotonic_ns());
+
+	frame.pixels = (const uint16_t*) buffer.get();
+	frame.width = width;
+	frame.height = height;
+	frame.size = pool.bufferSize();
+	frame.trigger_ns = triggered;
+	frame.exposure_us = exposure_us;
+	frame.metadata = true;
+	frame.timestamp = triggered;
+	frame.gain_db = 0;
+	frame.counter = count;
+	frame.owner = buffer;
+	count++;
+	return true;
+}
+
+
+bool SoftwareCamera::removed()
+{
+	return false;
+}
+
+
+void SoftwareCamera::close()
+{
+}
+
+
+// Parse the [:WxH][@fps] options of a source spec
+void parse_source_options(const string &text, uint32_t &width, uint32_t &height, double &fps)
+{
+	size_t at = text.find('@');
+	string size = text.substr(0, at);
+	if ( at != string::npos )
+		fps = atof(text.c_str() + at + 1);
+	if ( !size.empty() )
+	{
+		char* end;
+		width = strtoul(size.c_str(), &end, 10);
+		if ( *end != 'x' || width == 0 || (height = strtoul(end + 1, &end, 10)) == 0 || *end != '\0' )
+			throw CameraError("bad frame size " + size + ", expected WxH");
+	}
+}
+
+
+// Create the software camera given by spec.  index numbers the camera among all sources.
+CameraSource* open_camera_source(const string &spec, int index)
+{
+	uint32_t width = DEFAULT_WIDTH;
+	uint32_t height = DEFAULT_HEIGHT;
+	double fps = DEFAULT_FPS;
+
+	if ( spec.compare(0, 9, "synthetic") == 0 && (spec.size() == 9 || spec[9] == ':' || spec[9] == '@') )
+	{
+		size_t start = (spec.size() > 9 && spec[9] == ':')? 10 : 9;
+		parse_source_options(spec.substr(start), width, height, fps);
+		return new SyntheticCamera("SYN" + to_string(index), width, height, fps);
+	}
+	if ( spec.compare(0, 7, "replay:") == 0 )
+	{
+		string dir = spec.substr(7);
+		size_t colon = dir.rfind(':');
+		if ( colon != string::npos )
+		{
+			parse_source_options(dir.substr(colon + 1), width, height, fps);
+			dir = dir.substr(0, colon);
+		}
+		return new ReplayCamera(dir, width, height, fps);
+	}
+	throw CameraError("unknown camera source " + spec);
+}
@@ -0,0 +1,110 @@
+//	CameraSource.h
+//	Interface for camera sources.  The capture code works with a CameraSource, so the
+//	same capture, write and metadata path runs on a Basler USB camera (PylonCamera), on
+//	frames generated in memory (SyntheticCamera) or on previously saved raw files
+//	(ReplayCamera).  A frame is captured in three steps so that cameras can be triggered
+//	together: arm() sets the exposure and waits until the camera can take a trigger,
+//	trigger() starts the exposure and retrieve() waits for the frame.
+//
+//	Values that rarely change are not read while capturing: the serial number is read
+//	once, and sample() refreshes the temperature between imaging cycles.  Per frame
+//	metadata comes with the frame.
+//
+//	Errors are reported by throwing CameraError, or CameraTimeout when the camera took
+//	too long.
+//
+//	Sources are chosen with a spec string:
+//		pylon				All Basler USB cameras (only with pylon)
+//		synthetic[:WxH][@fps]		Generated BayerRG12 star field
+//		replay:dir[:WxH][@fps]		The .raw, .r12 or .rlc files in dir, in name order, repeated
+
+#ifndef _CameraSource_H_
+#define _CameraSource_H_
+
+#include <string>
+#include <stdexcept>
+#include <memory>
+#include <cstdint>
+
+#include "Frame.h"
+
+using namespace std;
+
+const uint32_t DEFAULT_WIDTH = 2448;		// Default size of software camera frames
+const uint32_t DEFAULT_HEIGHT = 2048;
+const double DEFAULT_FPS = 0;			// No frame rate limit beyond the exposure time
+const size_t SOURCE_BUFFERS = 8;		// Frame buffers per software camera
+const unsigned SOURCE_TIMEOUT_MS = 1000;	// Allowed for a frame beyond its exposure time
+
+
+// Error reported by a camera source
+class CameraError : public runtime_error
+{
+public:
+	CameraError(const string &what) : runtime_error(what) {}
+};
+
+
+// The camera did not become ready or deliver a frame in time
+class CameraTimeout : public CameraError
+{
+public:
+	CameraTimeout(const string &what) : CameraError(what) {}
+};
+
+
+// CameraSource class definition
+class CameraSource
+{
+public:
+	virtual ~CameraSource() {}
+	virtual string serialNumber() = 0;
+	virtual string modelName() = 0;
+	virtual double temperature() = 0;
+	virtual void sample() = 0;
+	virtual void arm(double exposure_us) = 0;
+	virtual int64_t trigger() = 0;
+	virtual bool retrieve(Frame &frame, string &error) = 0;
+	virtual bool removed() = 0;
+	virtual void close() = 0;
+
+	bool grab(double exposure_us, Frame &frame, int64_t &trigger_ns, string &error);
+};
+
+
+// Base for sources without a camera: frames come out of a buffer pool, paced as a
+// camera with the given frame rate would deliver them
+class SoftwareCamera : public CameraSource
+{
+public:
+	SoftwareCamera(const string &serial, uint32_t width, uint32_t height, double fps);
+	string serialNumber();
+	double temperature();
+	void sample();
+	void arm(double exposure_us);
+	int64_t trigger();
+	bool retrieve(Frame &frame, string &error);
+	bool removed();
+	void close();
+
+protected:
+	string serial;
+	uint32_t width;
+	uint32_t height;
+	uint64_t count;		// Frames delivered
+
+	// Fill buffer with the next frame
+	virtual void fill(uint16_t* buffer, double exposure_us) = 0;
+
+private:
+	int64_t period_ns;	// Minimum time between frames, 0 for none
+	double exposure_us;
+	int64_t trigger_ns;	// Time of the pending trigger, 0 if none
+	int64_t ready_ns;	// Time the previous frame finished
+	BufferPool pool;
+};
+
+extern void parse_source_options(const string &text, uint32_t &width, uint32_t &height, double &fps);
+extern CameraSource* open_camera_source(const string &spec, int index);
+
+#endif
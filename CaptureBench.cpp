@@ -0,0 +1,267 @@
+//	CaptureBench.cpp
+//	Frame rate of the first camera found, grabbing with GrabOne() the way take_exposures()
+//	used to against grabbing through a CaptureEngine.  Each cycle is the imaging_cycle()
+//	sequence for one camera: five frames at 50 ms and one at 100 ms.  Nothing is saved,
+//	so the numbers are the capture path alone.
+//
+//	With -m every camera found is opened, and the cycle time over 1..N cameras is
+//	measured with the cameras run one after another and with a CycleCoordinator.
+//
+//	With -s the cameras are also run with synchronized triggers, and the distribution
+//	of the trigger skew between them is reported.
+//
+//	CaptureBench [-e] [-m] [-s] [cycles]
+//		-e	Use the pylon camera emulator instead of a connected camera; with -m
+//			or -s three emulated cameras
+//		-m	Multi-camera cycle times
+//		-s	Multi-camera cycle times and trigger skew with synchronized triggers
+
+// System includes
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <cstdlib>
+
+// Pylon API header files
+#include <pylon/PylonIncludes.h>
+
+// Local includes
+#include "CaptureEngine.h"
+#include "CycleCoordinator.h"
+#include "SyncTrigger.h"
+#include "OBCData.h"
+
+// System namespace
+using namespace std;
+
+// Pylon namespaces
+using namespace Pylon;
+using namespace GenApi;
+
+const int CYCLE_FRAMES = 6;
+const int cycle_exposure_ms[CYCLE_FRAMES] = { 50, 50, 50, 50, 50, 100 };
+
+
+// Frame time statistics of one run
+struct RunStats
+{
+	int frames;
+	int failed;
+	double seconds;
+	double max_ms;
+};
+
+
+void report(const char* name, const RunStats &stats, double exposure_s)
+{
+	cout << setw(10) << name << ": " << stats.frames << " frames, " << stats.failed << " failed, ";
+	cout << fixed << setprecision(2) << stats.frames / stats.seconds << " frames/s, ";
+	cout << stats.seconds * 1000 / max(stats.frames, 1) << " ms/frame mean, " << stats.max_ms << " max, ";
+	cout << setprecision(1) << 100 * exposure_s / stats.seconds << "% of the time exposing" << endl;
+}
+
+
+// The old take_exposures() loop: set the exposure, then GrabOne()
+RunStats run_grab_one(CInstantCamera &camera, int cycles)
+{
+	INodeMap &nodes = camera.GetNodeMap();
+	CFloatPtr exposure(nodes.GetNode("ExposureTime"));
+	if ( !IsWritable(exposure) )
+		exposure = nodes.GetNode("ExposureTimeAbs");
+
+	RunStats stats = { 0, 0, 0, 0 };
+	CGrabResultPtr result;
+	auto start = chrono::steady_clock::now();
+	for ( int c = 0; c < cycles; c++ )
+		for ( int i = 0; i < CYCLE_FRAMES; i++ )
+		{
+			auto t1 = chrono::steady_clock::now();
+			exposure->SetValue(cycle_exposure_ms[i] * 1000);
+			if ( camera.GrabOne(1000, result, TimeoutHandling_Return) && result->GrabSucceeded() )
+				stats.frames++;
+			else
+				stats.failed++;
+			auto t2 = chrono::steady_clock::now();
+			stats.max_ms = max(stats.max_ms, chrono::duration<double, milli>(t2 - t1).count());
+		}
+	stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+
+RunStats run_engine(CInstantCamera &camera, int cycles)
+{
+	CaptureEngine engine(camera);
+	engine.start();
+
+	RunStats stats = { 0, 0, 0, 0 };
+	CGrabResultPtr result;
+	int64_t trigger_ns;
+	auto start = chrono::steady_clock::now();
+	for ( int c = 0; c < cycles; c++ )
+		for ( int i = 0; i < CYCLE_FRAMES; i++ )
+		{
+			auto t1 = chrono::steady_clock::now();
+			try
+			{
+				if ( engine.grab(cycle_exposure_ms[i] * 1000, result, trigger_ns) )
+					stats.frames++;
+				else
+					stats.failed++;
+			}
+			catch (const TimeoutException &e)
+			{
+				stats.failed++;
+			}
+			auto t2 = chrono::steady_clock::now();
+			stats.max_ms = max(stats.max_ms, chrono::duration<double, milli>(t2 - t1).count());
+		}
+	stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	engine.stop();
+	return stats;
+}
+
+
+// One imaging_cycle() sequence on one camera, triggered together with the others if
+// sync is set
+void engine_cycle(CaptureEngine &engine, SyncTrigger* sync, int camera, CycleResult &result)
+{
+	CGrabResultPtr grab_result;
+	for ( int i = 0; i < CYCLE_FRAMES; i++ )
+	{
+		SyncArrival arrival(sync, i);
+		engine.arm(cycle_exposure_ms[i] * 1000);
+		bool together = arrival.wait();
+		int64_t trigger_ns = engine.trigger();
+		if ( sync != NULL && together )
+			sync->record(camera, i, trigger_ns);
+		if ( !engine.retrieve(grab_result) )
+		{
+			result.ok = false;
+			result.error = "grab failed";
+		}
+	}
+}
+
+
+// Mean cycle time over 1..N cameras, sequential and with a worker per camera, and
+// with synchronized triggers if synchronized is set
+void run_multi(int cycles, bool synchronized)
+{
+	CTlFactory &factory = CTlFactory::GetInstance();
+	DeviceInfoList_t devices;
+	factory.EnumerateDevices(devices);
+
+	vector<CInstantCamera*> cameras;
+	vector<CaptureEngine*> engines;
+	for ( DeviceInfoList_t::const_iterator it = devices.begin(); it != devices.end(); ++it )
+	{
+		cameras.push_back(new CInstantCamera(factory.CreateDevice(*it)));
+		cameras.back()->Open();
+		engines.push_back(new CaptureEngine(*cameras.back()));
+	}
+	cout << cameras.size() << " cameras, " << cycles << " cycles" << endl;
+
+	for ( size_t n = 1; n <= cameras.size(); n++ )
+	{
+		CycleResult result;
+		auto t1 = chrono::steady_clock::now();
+		for ( int c = 0; c < cycles; c++ )
+			for ( size_t i = 0; i < n; i++ )
+				engine_cycle(*engines[i], NULL, i, result);
+		auto t2 = chrono::steady_clock::now();
+		double sequential = chrono::duration<double, milli>(t2 - t1).count() / cycles;
+
+		CycleCoordinator coordinator(n, [&engines](int idx, CycleResult &r) { engine_cycle(*engines[idx], NULL, idx, r); });
+		double parallel = 0;
+		int failed = 0;
+		for ( int c = 0; c < cycles; c++ )
+		{
+			parallel += coordinator.runCycle() * 1000 / cycles;
+			for ( size_t i = 0; i < n; i++ )
+				failed += !coordinator.results()[i].ok;
+		}
+
+		cout << n << " camera" << ((n > 1)? "s" : " ") << ": sequential " << fixed << setprecision(1) << sequential;
+		cout << " ms/cycle, parallel " << parallel << " ms/cycle, " << failed << " failed" << endl;
+
+		if ( synchronized && n > 1 )
+		{
+			SyncTrigger sync;
+			CycleCoordinator synced(n, [&engines, &sync](int idx, CycleResult &r) { engine_cycle(*engines[idx], &sync, idx, r); });
+			double seconds = 0;
+			for ( int c = 0; c < cycles; c++ )
+			{
+				sync.begin(n);
+				seconds += synced.runCycle() * 1000 / cycles;
+			}
+			SkewStats skew = sync.stats();
+			cout << "           synchronized " << seconds << " ms/cycle, skew over " << skew.frames << " frames (" << skew.partial << " partial): ";
+			cout << "median " << skew.median_us << " us, 90% " << skew.p90_us << " us, 99% " << skew.p99_us << " us, max " << skew.max_us << " us" << endl;
+		}
+	}
+
+	for ( size_t i = 0; i < cameras.size(); i++ )
+	{
+		delete engines[i];
+		cameras[i]->Close();
+		delete cameras[i];
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	int cycles = 20;
+	bool emulator = false;
+	bool multi = false;
+	bool synchronized = false;
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( string("-e") == argv[i] )
+			emulator = true;
+		else if ( string("-m") == argv[i] )
+			multi = true;
+		else if ( string("-s") == argv[i] )
+			multi = synchronized = true;
+		else
+			cycles = atoi(argv[i]);
+	}
+	if ( emulator )
+		setenv("PYLON_CAMEMU", multi? "3" : "1", 0);
+
+	PylonInitialize();
+	try
+	{
+		if ( multi )
+		{
+			run_multi(cycles, synchronized);
+			PylonTerminate();
+			exit(0);
+		}
+
+		CInstantCamera camera(CTlFactory::GetInstance().CreateFirstDevice());
+		camera.Open();
+		cout << "Camera " << camera.GetDeviceInfo().GetModelName() << ", " << cycles << " cycles" << endl;
+
+		double exposure_s = 0;
+		for ( int i = 0; i < CYCLE_FRAMES; i++ )
+			exposure_s += cycles * cycle_exposure_ms[i] / 1000.0;
+
+		report("GrabOne", run_grab_one(camera, cycles), exposure_s);
+		report("engine", run_engine(camera, cycles), exposure_s);
+		camera.Close();
+	}
+	catch (const GenericException &e)
+	{
+		cerr << get_time_string() << " An exception occurred: " << e.what() << endl;
+		PylonTerminate();
+		exit(-1);
+	}
+
+	PylonTerminate();
+	exit(0);
+}
@@ -0,0 +1,286 @@
+//	CaptureEngine.cpp
+//	Implementation of CaptureEngine class.  A frame is captured by setting the exposure
+//	time if it changed, waiting until the camera accepts a trigger, and retrieving the
+//	result of the software trigger.  The stream grabber stays running between frames and
+//	between imaging cycles.  If a frame times out, grabbing is stopped so that a late
+//	frame can't be taken for the next one, and the next grab starts it again.
+
+// System includes
+#include <iostream>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+// Local includes
+#include "CaptureEngine.h"
+#include "OBCData.h"
+#include "OBCHistory.h"
+
+// System namespace
+using namespace std;
+
+// Pylon namespaces
+using namespace Pylon;
+using namespace GenApi;
+
+
+// Allocate count buffers of size bytes.  The pages are touched now so the first frames
+// don't take page faults.
+FramePool::FramePool(size_t count, size_t bytes) : size(bytes), in_use(count, false)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	for ( size_t i = 0; i < count; i++ )
+	{
+		void* p;
+		if ( posix_memalign(&p, page, size) != 0 )
+		{
+			for ( size_t j = 0; j < buffers.size(); j++ )
+				free(buffers[j]);
+			throw bad_alloc();
+		}
+		memset(p, 0, size);
+		buffers.push_back(p);
+	}
+}
+
+
+FramePool::~FramePool()
+{
+	for ( size_t i = 0; i < buffers.size(); i++ )
+		free(buffers[i]);
+}
+
+
+size_t FramePool::bufferSize() const
+{
+	return size;
+}
+
+
+// Number of buffers not handed to the stream grabber
+size_t FramePool::available()
+{
+	lock_guard<mutex> guard(lock);
+	size_t n = 0;
+	for ( size_t i = 0; i < in_use.size(); i++ )
+		if ( !in_use[i] )
+			n++;
+	return n;
+}
+
+
+// Called by the stream grabber when grabbing starts.  The context is the buffer index.
+void FramePool::AllocateBuffer(size_t bytes, void** buffer, intptr_t &context)
+{
+	lock_guard<mutex> guard(lock);
+	if ( bytes <= size )
+		for ( size_t i = 0; i < buffers.size(); i++ )
+			if ( !in_use[i] )
+			{
+				in_use[i] = true;
+				*buffer = buffers[i];
+				context = i;
+				return;
+			}
+	throw bad_alloc();
+}
+
+
+// Called by the stream grabber when grabbing stops
+void FramePool::FreeBuffer(void* buffer, intptr_t context)
+{
+	lock_guard<mutex> guard(lock);
+	if ( context >= 0 && (size_t) context < in_use.size() && buffers[context] == buffer )
+		in_use[context] = false;
+}
+
+
+// The pool is owned by its CaptureEngine, not by the camera
+void FramePool::DestroyBufferFactory()
+{
+}
+
+
+CaptureEngine::CaptureEngine(CInstantCamera &cam, size_t count) :
+	frames(0), failures(0), chunks(false), camera(cam), buffers(count), pool(NULL), exposure_us(0)
+{
+}
+
+
+CaptureEngine::~CaptureEngine()
+{
+	try
+	{
+		stop();
+	}
+	catch (const GenericException &e)
+	{
+		cerr << get_time_string() << " Exception in ~CaptureEngine(): " << e.what() << endl;
+	}
+	delete pool;
+}
+
+
+// Put the camera in software trigger mode and start grabbing.  The camera must be open.
+void CaptureEngine::start()
+{
+	if ( camera.IsGrabbing() )
+		return;
+
+	INodeMap &nodes = camera.GetNodeMap();
+	exposure = nodes.GetNode("ExposureTime");
+	if ( !IsWritable(exposure) )
+		exposure = nodes.GetNode("ExposureTimeAbs");
+	exposure_us = 0;
+	enableChunks();
+
+	// The pool is kept across restarts unless the payload grew
+	CIntegerPtr payload(nodes.GetNode("PayloadSize"));
+	size_t size = payload->GetValue();
+	if ( pool == NULL || pool->bufferSize() < size )
+	{
+		delete pool;
+		pool = NULL;
+		pool = new FramePool(buffers, size);
+		camera.SetBufferFactory(pool, Cleanup_None);
+	}
+	camera.MaxNumBuffer.SetValue(buffers);
+
+	CEnumerationPtr(nodes.GetNode("TriggerSelector"))->FromString("FrameStart");
+	setTriggerMode("On");
+	CEnumerationPtr(nodes.GetNode("TriggerSource"))->FromString("Software");
+
+	camera.StartGrabbing(GrabStrategy_OneByOne);
+}
+
+
+// Stop grabbing and leave the camera in free running mode, where GrabOne() works
+void CaptureEngine::stop()
+{
+	if ( camera.IsGrabbing() )
+		camera.StopGrabbing();
+	if ( camera.IsOpen() )
+		setTriggerMode("Off");
+}
+
+
+bool CaptureEngine::grabbing() const
+{
+	return camera.IsGrabbing();
+}
+
+
+// Capture one frame with the given exposure time.  trigger_ns is set to the monotonic
+// time the trigger was sent.  Returns false if the grab failed; pylon exceptions,
+// including timeouts, are passed on to the caller.
+bool CaptureEngine::grab(double us, CGrabResultPtr &result, int64_t &trigger_ns)
+{
+	arm(us);
+	trigger_ns = trigger();
+	return retrieve(result);
+}
+
+
+// First step of grab(): set the exposure time and wait until the camera accepts a
+// trigger.  Synchronized captures arm every camera before triggering any of them.
+void CaptureEngine::arm(double us)
+{
+	start();
+	if ( us != exposure_us )
+	{
+		exposure->SetValue(us);
+		exposure_us = us;
+	}
+
+	try
+	{
+		camera.WaitForFrameTriggerReady(timeout(), TimeoutHandling_ThrowException);
+	}
+	catch (const TimeoutException &e)
+	{
+		timedOut();
+		throw;
+	}
+}
+
+
+// Send the software trigger.  Returns the monotonic time halfway through sending it,
+// the best estimate of when the camera received it.
+int64_t CaptureEngine::trigger()
+{
+	int64_t t1 = monotonic_ns();
+	camera.ExecuteSoftwareTrigger();
+	int64_t t2 = monotonic_ns();
+	return t1 + (t2 - t1) / 2;
+}
+
+
+// Wait for the triggered frame
+bool CaptureEngine::retrieve(CGrabResultPtr &result)
+{
+	try
+	{
+		camera.RetrieveResult(timeout(), result, TimeoutHandling_ThrowException);
+	}
+	catch (const TimeoutException &e)
+	{
+		timedOut();
+		throw;
+	}
+
+	if ( !result->GrabSucceeded() )
+	{
+		failures++;
+		return false;
+	}
+	frames++;
+	return true;
+}
+
+
+void CaptureEngine::setTriggerMode(const char* mode)
+{
+	CEnumerationPtr(camera.GetNodeMap().GetNode("TriggerMode"))->FromString(mode);
+}
+
+
+// Turn on the chunks with the metadata of a frame.  The names cover USB cameras and the
+// frame counter of GigE cameras and the emulator; chunks the camera lacks are left out.
+void CaptureEngine::enableChunks()
+{
+	static const char* const names[] = { "Timestamp", "ExposureTime", "Gain", "CounterValue", "Framecounter" };
+
+	INodeMap &nodes = camera.GetNodeMap();
+	CBooleanPtr active(nodes.GetNode("ChunkModeActive"));
+	CEnumerationPtr selector(nodes.GetNode("ChunkSelector"));
+	CBooleanPtr enable(nodes.GetNode("ChunkEnable"));
+	if ( !IsWritable(active) || !IsWritable(selector) )
+		return;
+
+	active->SetValue(true);
+	for ( const char* name : names )
+	{
+		if ( !IsAvailable(selector->GetEntryByName(name)) )
+			continue;
+		selector->FromString(name);
+		if ( IsWritable(enable) )
+			enable->SetValue(true);
+	}
+	chunks = true;
+}
+
+
+// Time allowed for the camera to become ready or deliver a frame
+unsigned CaptureEngine::timeout() const
+{
+	return (unsigned) (exposure_us / 1000) + CAPTURE_TIMEOUT_MS;
+}
+
+
+// Stop grabbing after a timeout so that a late frame can't be taken for the next one
+void CaptureEngine::timedOut()
+{
+	failures++;
+	camera.StopGrabbing();
+}
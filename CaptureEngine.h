@@ -0,0 +1,85 @@
+//	CaptureEngine.h
+//	Interface for CaptureEngine class.  This class keeps one camera grabbing continuously
+//	instead of starting and stopping the stream grabber for every frame the way GrabOne()
+//	does.  The camera runs in software trigger mode, so each frame is exposed with the
+//	exposure time that was set before its trigger, and the grab buffers come from a
+//	FramePool that is allocated once.
+//
+//	Camera features are reached through the generic node map, so the engine works with
+//	USB cameras and with the pylon camera emulator, which names the exposure time
+//	ExposureTimeAbs.
+//
+//	Where the camera supports it, chunk mode is turned on so that each frame carries its
+//	timestamp, exposure time, gain and frame counter, and the exposure time is only
+//	written when it changes.  Capturing then needs no control transfers besides the
+//	trigger, which would otherwise queue behind the frame transfers on the USB link.
+
+#ifndef _CaptureEngine_H_
+#define _CaptureEngine_H_
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+#include <pylon/PylonIncludes.h>
+
+using namespace std;
+
+const size_t CAPTURE_BUFFERS = 8;		// Grab buffers per camera
+const unsigned CAPTURE_TIMEOUT_MS = 1000;	// Allowed for a frame beyond its exposure time
+
+
+// Grab buffers allocated once and handed to the pylon stream grabber
+class FramePool : public Pylon::IBufferFactory
+{
+public:
+	FramePool(size_t count, size_t size);
+	~FramePool();
+	size_t bufferSize() const;
+	size_t available();
+
+	// IBufferFactory
+	void AllocateBuffer(size_t size, void** buffer, intptr_t &context);
+	void FreeBuffer(void* buffer, intptr_t context);
+	void DestroyBufferFactory();
+
+private:
+	size_t size;
+	vector<void*> buffers;
+	vector<bool> in_use;
+	mutex lock;
+};
+
+
+// CaptureEngine class definition
+class CaptureEngine
+{
+public:
+	uint64_t frames;	// Frames grabbed
+	uint64_t failures;	// Grabs that failed or timed out
+	bool chunks;		// Frames carry chunk data
+
+	CaptureEngine(Pylon::CInstantCamera &camera, size_t buffers = CAPTURE_BUFFERS);
+	~CaptureEngine();
+	void start();
+	void stop();
+	bool grabbing() const;
+	bool grab(double exposure_us, Pylon::CGrabResultPtr &result, int64_t &trigger_ns);
+	void arm(double exposure_us);
+	int64_t trigger();
+	bool retrieve(Pylon::CGrabResultPtr &result);
+
+private:
+	Pylon::CInstantCamera &camera;
+	size_t buffers;
+	FramePool* pool;
+	GenApi::CFloatPtr exposure;	// ExposureTime or ExposureTimeAbs
+	double exposure_us;		// Exposure time currently set, 0 if unknown
+
+	void setTriggerMode(const char* mode);
+	void enableChunks();
+	unsigned timeout() const;
+	void timedOut();
+};
+
+#endif
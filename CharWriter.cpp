@@ -0,0 +1,159 @@
+//	CharWriter.cpp
+//	Implementation of CharWriter class.
+//
+//	fixed() rounds exactly like printf("%.*f"), which is what the iostreams use.  The value
+//	is scaled by 10^precision and rounded to the nearest integer.  A double product isn't
+//	exact, so when the scaled value lands exactly on a half the rounding error of the
+//	product is recovered (Dekker's two-product) to decide which way the true decimal value
+//	lies, and an exact tie rounds to even.  Values too large to scale exactly fall back to
+//	snprintf().
+
+// System includes
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+
+// Local includes
+#include "CharWriter.h"
+
+// System namespace
+using namespace std;
+
+// Largest precision handled without snprintf()
+const int MAX_PRECISION = 15;
+
+static const double pow10_table[MAX_PRECISION + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+// Scaled values below this are integers or halves exactly representable in a double
+const double MAX_SCALED = 4503599627370496.0;	// 2^52
+
+
+CharWriter::CharWriter(char* buffer, size_t size) : buf(buffer), p(buffer), end(buffer + size - 1), overflow(false)
+{
+	*p = '\0';
+}
+
+
+// Number of characters written, not counting the terminating NUL
+size_t CharWriter::length() const
+{
+	return p - buf;
+}
+
+
+// True if some output didn't fit in the buffer
+bool CharWriter::truncated() const
+{
+	return overflow;
+}
+
+
+void CharWriter::put(const char* s, size_t len)
+{
+	if ( len > (size_t) (end - p) )
+	{
+		len = end - p;
+		overflow = true;
+	}
+	memcpy(p, s, len);
+	p += len;
+	*p = '\0';
+}
+
+
+CharWriter& CharWriter::str(const char* s)
+{
+	put(s, strlen(s));
+	return *this;
+}
+
+
+CharWriter& CharWriter::ch(char c)
+{
+	put(&c, 1);
+	return *this;
+}
+
+
+// Integer right-aligned in a field of at least width characters, padded on the left
+// with fill as iostreams do (a fill of '0' goes before the sign).
+CharWriter& CharWriter::integer(long v, int width, char fill)
+{
+	char digits[24];
+	char* q = digits + sizeof(digits);
+	unsigned long u = (v < 0)? 0UL - (unsigned long) v : v;
+	do {
+		*--q = '0' + u % 10;
+		u /= 10;
+	} while ( u != 0 );
+	if ( v < 0 )
+		*--q = '-';
+
+	size_t len = digits + sizeof(digits) - q;
+	for ( int pad = width - (int) len; pad > 0; pad-- )
+		put(&fill, 1);
+	put(q, len);
+	return *this;
+}
+
+
+// Exact error of the product a * b, i.e. a * b - (a * b rounded), by Dekker's algorithm
+static double product_error(double a, double b, double product)
+{
+	const double split = 134217729.0;	// 2^27 + 1
+	double t = split * a;
+	double ahi = t - (t - a), alo = a - ahi;
+	t = split * b;
+	double bhi = t - (t - b), blo = b - bhi;
+	return ((ahi * bhi - product) + ahi * blo + alo * bhi) + alo * blo;
+}
+
+
+// Fixed-point decimal with precision digits after the point
+CharWriter& CharWriter::fixed(double v, int precision)
+{
+	double a = fabs(v);
+	double scaled = (precision >= 0 && precision <= MAX_PRECISION)? a * pow10_table[precision] : INFINITY;
+	if ( !(scaled < MAX_SCALED) )
+	{
+		// Large, infinite or NaN
+		char tmp[512];
+		int n = snprintf(tmp, sizeof(tmp), "%.*f", precision, v);
+		put(tmp, (n < 0)? 0 : ((size_t) n < sizeof(tmp))? n : sizeof(tmp) - 1);
+		return *this;
+	}
+
+	// Round to nearest, ties to even, by the exact value of a * 10^precision
+	double whole = floor(scaled);
+	double d = (scaled - whole) - 0.5;
+	bool up = d > 0;
+	if ( d == 0 )
+	{
+		double err = product_error(a, pow10_table[precision], scaled);
+		up = err > 0 || (err == 0 && fmod(whole, 2) != 0);
+	}
+	uint64_t n = (uint64_t) whole + up;
+
+	// Integer and fraction digits
+	char digits[40];
+	char* q = digits + sizeof(digits);
+	for ( int i = 0; i < precision; i++ )
+	{
+		*--q = '0' + n % 10;
+		n /= 10;
+	}
+	if ( precision > 0 )
+		*--q = '.';
+	do {
+		*--q = '0' + n % 10;
+		n /= 10;
+	} while ( n != 0 );
+	if ( signbit(v) )
+		*--q = '-';
+
+	put(q, digits + sizeof(digits) - q);
+	return *this;
+}
@@ -0,0 +1,37 @@
+//	CharWriter.h
+//	Interface for CharWriter class.  This class formats text into a caller supplied char
+//	buffer with no heap allocation and no locale lookups.  Numbers are formatted the way
+//	the iostream manipulators used elsewhere in this program format them, so output is
+//	identical to the ostringstream code it replaces:
+//		integer(v, w, f)	<< setw(w) << setfill(f) << v
+//		fixed(v, p)		<< fixed << setprecision(p) << v
+//	Output that doesn't fit is truncated and the buffer is always NUL terminated.
+
+#ifndef _CharWriter_H_
+#define _CharWriter_H_
+
+#include <cstddef>
+
+
+// CharWriter class definition
+class CharWriter
+{
+public:
+	CharWriter(char* buf, size_t size);
+	CharWriter& str(const char* s);
+	CharWriter& ch(char c);
+	CharWriter& integer(long v, int width = 0, char fill = '0');
+	CharWriter& fixed(double v, int precision);
+	size_t length() const;
+	bool truncated() const;
+
+private:
+	char* buf;
+	char* p;	// Next character
+	char* end;	// Last usable character, reserved for the terminating NUL
+	bool overflow;	// Some output didn't fit
+
+	void put(const char* s, size_t len);
+};
+
+#endif
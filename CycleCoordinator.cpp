@@ -0,0 +1,98 @@
+//	CycleCoordinator.cpp
+//	Implementation of CycleCoordinator class.  A cycle number protected by a mutex is
+//	the start signal: each worker waits until it changes, runs its sequence, and the last
+//	one to finish wakes runCycle().
+
+// System includes
+#include <chrono>
+#include <exception>
+
+// Local includes
+#include "CycleCoordinator.h"
+
+// System namespace
+using namespace std;
+
+
+CycleCoordinator::CycleCoordinator(int cameras, CycleSequence seq) :
+	sequence(seq), cycle_results(cameras), cycle(0), pending(0), quit(false)
+{
+	for ( int i = 0; i < cameras; i++ )
+		workers.push_back(thread(&CycleCoordinator::work, this, i));
+}
+
+
+CycleCoordinator::~CycleCoordinator()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		quit = true;
+	}
+	start_cv.notify_all();
+	for ( size_t i = 0; i < workers.size(); i++ )
+		workers[i].join();
+}
+
+
+// Run the sequence on every camera at once and wait for all of them.
+// Returns the wall time of the cycle in seconds.
+double CycleCoordinator::runCycle()
+{
+	auto t1 = chrono::steady_clock::now();
+	unique_lock<mutex> guard(lock);
+	if ( workers.empty() )
+		return 0;
+	pending = workers.size();
+	cycle++;
+	start_cv.notify_all();
+	done_cv.wait(guard, [this] { return pending == 0; });
+	return chrono::duration<double>(chrono::steady_clock::now() - t1).count();
+}
+
+
+// Results of the last cycle, indexed by camera
+const vector<CycleResult>& CycleCoordinator::results() const
+{
+	return cycle_results;
+}
+
+
+void CycleCoordinator::work(int camera)
+{
+	uint64_t done = 0;
+	while ( true )
+	{
+		{
+			unique_lock<mutex> guard(lock);
+			start_cv.wait(guard, [this, done] { return quit || cycle != done; });
+			if ( quit )
+				return;
+			done = cycle;
+		}
+
+		// Only this worker touches its result until pending says it's done
+		CycleResult &result = cycle_results[camera];
+		result.ok = true;
+		result.error.clear();
+		auto t1 = chrono::steady_clock::now();
+		try
+		{
+			sequence(camera, result);
+		}
+		catch (const exception &e)
+		{
+			result.ok = false;
+			result.error = e.what();
+		}
+		catch (...)
+		{
+			result.ok = false;
+			result.error = "unknown exception";
+		}
+		result.seconds = chrono::duration<double>(chrono::steady_clock::now() - t1).count();
+
+		lock_guard<mutex> guard(lock);
+		if ( --pending == 0 )
+			done_cv.notify_one();
+	}
+}
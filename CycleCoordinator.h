@@ -0,0 +1,57 @@
+//	CycleCoordinator.h
+//	Interface for CycleCoordinator class.  This class runs one imaging sequence per camera
+//	in parallel.  Each camera has a worker thread that lives as long as the coordinator;
+//	runCycle() releases all workers together and returns when every camera has finished,
+//	so a cycle takes as long as the slowest camera rather than the sum of all of them.
+
+#ifndef _CycleCoordinator_H_
+#define _CycleCoordinator_H_
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+using namespace std;
+
+
+// Outcome of one camera's sequence in a cycle
+struct CycleResult
+{
+	bool ok;		// Sequence completed without an error
+	string error;		// Description of the error otherwise
+	double seconds;		// Time the sequence took
+};
+
+// Sequence run for camera number camera in each cycle.  It reports errors it handles
+// itself through result; exceptions that escape it are caught and recorded.
+typedef function<void(int camera, CycleResult &result)> CycleSequence;
+
+
+// CycleCoordinator class definition
+class CycleCoordinator
+{
+public:
+	CycleCoordinator(int cameras, CycleSequence sequence);
+	~CycleCoordinator();
+	double runCycle();
+	const vector<CycleResult>& results() const;
+
+private:
+	CycleSequence sequence;
+	vector<thread> workers;
+	vector<CycleResult> cycle_results;
+	mutex lock;
+	condition_variable start_cv;	// Signals a new cycle or shutdown to the workers
+	condition_variable done_cv;	// Signals the last worker finishing to runCycle()
+	uint64_t cycle;			// Number of the current cycle
+	int pending;			// Workers still running in the current cycle
+	bool quit;
+
+	void work(int camera);
+};
+
+#endif
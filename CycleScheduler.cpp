@@ -0,0 +1,113 @@
+//	CycleScheduler.cpp
+//	Implementation of CycleScheduler class.  Histogram buckets are decades of
+//	microseconds, which spans scheduling noise through whole missed periods.
+
+// System includes
+#include <algorithm>
+#include <cmath>
+
+// Local includes
+#include "CycleScheduler.h"
+#include "OBCHistory.h"
+
+// System namespace
+using namespace std;
+
+
+CycleScheduler::CycleScheduler(double period_s, OverrunPolicy p) :
+	period_ns((int64_t) (max(period_s, 0.0) * 1e9)), policy(p), deadline(0), released(0)
+{
+	reset();
+}
+
+
+// Sleep until the next cycle is due and return its deadline.  The first cycle is due
+// at once and sets the phase of the grid.
+int64_t CycleScheduler::wait()
+{
+	int64_t now = monotonic_ns();
+	if ( deadline == 0 )
+		deadline = now;
+	else
+	{
+		deadline += period_ns;
+		if ( now > deadline && period_ns > 0 )
+		{
+			counters.overruns++;
+			if ( policy == OVERRUN_SKIP )
+			{
+				int64_t missed = (now - deadline) / period_ns + 1;
+				deadline += missed * period_ns;
+				counters.skipped += missed;
+			}
+		}
+	}
+
+	sleep_until_ns(deadline);
+	int64_t release = monotonic_ns();
+
+	// With catch up, a late release counts its lateness as jitter
+	double jitter = max(release - deadline, (int64_t) 0) / 1000.0;
+	counters.cycles++;
+	jitter_total_us += jitter;
+	counters.jitter_max_us = max(counters.jitter_max_us, jitter);
+	counters.jitter[schedule_bucket(jitter)]++;
+
+	if ( released != 0 )
+	{
+		double period = (release - released) / 1e9;
+		periods++;
+		period_total_s += period;
+		counters.period_min_s = min(counters.period_min_s, period);
+		counters.period_max_s = max(counters.period_max_s, period);
+		counters.period[schedule_bucket(fabs(period * 1e6 - period_ns / 1000.0))]++;
+	}
+	released = release;
+	return deadline;
+}
+
+
+// Get the counters and histograms since the last call, and clear them
+ScheduleStats CycleScheduler::stats()
+{
+	ScheduleStats stats = counters;
+	stats.jitter_mean_us = counters.cycles? jitter_total_us / counters.cycles : 0;
+	stats.period_mean_s = periods? period_total_s / periods : 0;
+	if ( periods == 0 )
+		stats.period_min_s = 0;
+	reset();
+	return stats;
+}
+
+
+void CycleScheduler::reset()
+{
+	counters = ScheduleStats();
+	counters.period_min_s = HUGE_VAL;
+	jitter_total_us = 0;
+	period_total_s = 0;
+	periods = 0;
+}
+
+
+// Histogram bucket of a time in microseconds
+int schedule_bucket(double us)
+{
+	int bucket = 0;
+	for ( double limit = 10; us >= limit && bucket < SCHEDULE_BUCKETS - 1; limit *= 10 )
+		bucket++;
+	return bucket;
+}
+
+
+const char* schedule_bucket_string(int bucket)
+{
+	static const char* const names[SCHEDULE_BUCKETS] = { "<10us", "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s" };
+	return names[bucket];
+}
+
+
+const char* overrun_policy_string(OverrunPolicy policy)
+{
+	return (policy == OVERRUN_SKIP)? "skip" : "catchup";
+}
@@ -0,0 +1,74 @@
+//	CycleScheduler.h
+//	Interface for CycleScheduler class.  Imaging cycles are released on a fixed grid of
+//	absolute monotonic deadlines, one period apart, so the cadence doesn't depend on how
+//	long each cycle takes and doesn't drift over a flight.  A cycle that runs past the
+//	next deadline is an overrun, handled by the overrun policy:
+//		skip		Drop the deadlines that have passed and wait for the next one
+//				on the grid.  The cadence stays regular with gaps.
+//		catchup		Start the late cycles at once, back to back, until the
+//				schedule is caught up.  No cycle is lost but some are early.
+//
+//	The scheduler records how late each cycle was released (jitter) and the time
+//	between releases (period) in histograms.
+
+#ifndef _CycleScheduler_H_
+#define _CycleScheduler_H_
+
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+const int SCHEDULE_BUCKETS = 7;		// Histogram buckets, see schedule_bucket_string()
+
+
+// What wait() does when the deadline has already passed
+enum OverrunPolicy
+{
+	OVERRUN_SKIP,
+	OVERRUN_CATCH_UP
+};
+
+
+// Counters since the last call to stats()
+struct ScheduleStats
+{
+	uint64_t cycles;
+	uint64_t overruns;		// Cycles that ran past the next deadline
+	uint64_t skipped;		// Deadlines dropped by the skip policy
+	double jitter_mean_us;		// Release time after the deadline
+	double jitter_max_us;
+	double period_mean_s;		// Time between releases
+	double period_min_s;
+	double period_max_s;
+	uint64_t jitter[SCHEDULE_BUCKETS];	// Release jitter histogram
+	uint64_t period[SCHEDULE_BUCKETS];	// Histogram of the period's error from nominal
+};
+
+
+// CycleScheduler class definition
+class CycleScheduler
+{
+public:
+	CycleScheduler(double period_s, OverrunPolicy policy = OVERRUN_SKIP);
+	int64_t wait();
+	ScheduleStats stats();
+
+private:
+	int64_t period_ns;
+	OverrunPolicy policy;
+	int64_t deadline;	// Next release, 0 before the first
+	int64_t released;	// Time of the previous release
+	ScheduleStats counters;
+	double jitter_total_us;
+	double period_total_s;
+	uint64_t periods;	// Periods in period_total_s
+
+	void reset();
+};
+
+extern int schedule_bucket(double us);
+extern const char* schedule_bucket_string(int bucket);
+extern const char* overrun_policy_string(OverrunPolicy policy);
+
+#endif
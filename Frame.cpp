@@ -0,0 +1,128 @@
+//	Frame.cpp
+//	Implementation of Frame and BufferPool.
+
+// System includes
+#include <new>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+// Local includes
+#include "Frame.h"
+
+// System namespace
+using namespace std;
+
+
+Frame::Frame() : pixels(NULL), width(0), height(0), size(0), trigger_ns(0), exposure_us(0),
+	metadata(false), timestamp(0), gain_db(0), counter(0)
+{
+}
+
+
+bool Frame::valid() const
+{
+	return owner != NULL;
+}
+
+
+// Give the buffer back, or drop this copy's hold on it
+void Frame::release()
+{
+	owner.reset();
+	pixels = NULL;
+}
+
+
+// Allocate count buffers of size bytes.  The pages are touched now so the first frames
+// don't take page faults.
+BufferPool::BufferPool(size_t count, size_t bytes) : size(bytes), in_use(count, false)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	for ( size_t i = 0; i < count; i++ )
+	{
+		void* p;
+		if ( posix_memalign(&p, page, size) != 0 )
+		{
+			for ( size_t j = 0; j < buffers.size(); j++ )
+				free(buffers[j]);
+			throw bad_alloc();
+		}
+		memset(p, 0, size);
+		buffers.push_back(p);
+	}
+}
+
+
+BufferPool::~BufferPool()
+{
+	for ( size_t i = 0; i < buffers.size(); i++ )
+		free(buffers[i]);
+}
+
+
+size_t BufferPool::bufferSize() const
+{
+	return size;
+}
+
+
+// Number of buffers not taken
+size_t BufferPool::available()
+{
+	lock_guard<mutex> guard(lock);
+	size_t n = 0;
+	for ( size_t i = 0; i < in_use.size(); i++ )
+		if ( !in_use[i] )
+			n++;
+	return n;
+}
+
+
+// Take a free buffer and its index, or NULL if all are taken
+void* BufferPool::take(intptr_t &index)
+{
+	lock_guard<mutex> guard(lock);
+	for ( size_t i = 0; i < buffers.size(); i++ )
+		if ( !in_use[i] )
+		{
+			in_use[i] = true;
+			index = i;
+			return buffers[i];
+		}
+	return NULL;
+}
+
+
+// Return the buffer taken with the given index
+void BufferPool::give(intptr_t index)
+{
+	{
+		lock_guard<mutex> guard(lock);
+		if ( index >= 0 && (size_t) index < in_use.size() )
+			in_use[index] = false;
+	}
+	freed.notify_one();
+}
+
+
+// Take a free buffer, waiting up to timeout_ms for one, and return it as an owner for a
+// Frame that gives it back when the last copy is released.  Empty if none came free.
+shared_ptr<void> BufferPool::acquire(int timeout_ms)
+{
+	unique_lock<mutex> guard(lock);
+	size_t i = 0;
+	auto is_free = [this, &i] {
+		for ( i = 0; i < in_use.size(); i++ )
+			if ( !in_use[i] )
+				return true;
+		return false;
+	};
+	if ( !freed.wait_for(guard, chrono::milliseconds(timeout_ms), is_free) )
+		return shared_ptr<void>();
+
+	in_use[i] = true;
+	intptr_t index = i;
+	return shared_ptr<void>(buffers[i], [this, index](void*) { give(index); });
+}
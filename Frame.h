@@ -0,0 +1,64 @@
+//	Frame.h
+//	Interface for camera frames and the buffer pool they are grabbed into.  A Frame is a
+//	view of a grabbed image that keeps the buffer holding it alive; copies of a Frame
+//	share the buffer, and the buffer goes back to where it came from when the last copy
+//	is released.  Nothing here depends on the camera library, so the capture, write and
+//	metadata code builds and runs with any camera source.
+
+#ifndef _Frame_H_
+#define _Frame_H_
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+
+// A grabbed image.  Pixels are BayerRG12 with an RG/GB pattern starting at the top left,
+// one pixel per little-endian 16-bit word with the value in the low 12 bits, rows packed
+// without padding.
+struct Frame
+{
+	const uint16_t* pixels;
+	uint32_t width;
+	uint32_t height;
+	size_t size;		// Bytes of pixel data
+	int64_t trigger_ns;	// Monotonic time the frame was triggered
+	double exposure_us;	// Exposure time the frame was taken with
+	bool metadata;		// The camera sent the values below with the frame, 0 if it lacks one
+	int64_t timestamp;	// Camera clock at the start of the exposure, ns on USB cameras
+	double gain_db;
+	int64_t counter;	// Camera's frame counter
+	shared_ptr<void> owner;	// Keeps the pixel buffer alive
+
+	Frame();
+	bool valid() const;
+	void release();
+};
+
+
+// Fixed set of equally sized, page aligned buffers allocated up front
+class BufferPool
+{
+public:
+	BufferPool(size_t count, size_t size);
+	~BufferPool();
+	size_t bufferSize() const;
+	size_t available();
+	void* take(intptr_t &index);
+	void give(intptr_t index);
+	shared_ptr<void> acquire(int timeout_ms);
+
+private:
+	size_t size;
+	vector<void*> buffers;
+	vector<bool> in_use;
+	mutex lock;
+	condition_variable freed;
+};
+
+#endif
@@ -0,0 +1,278 @@
+//	ImageFile.cpp
+//	Implementation of the image file writers.  Errors throw system_error with the path
+//	in the message, and a partly written file is removed.
+
+// System includes
+#include <vector>
+#include <system_error>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <sys/uio.h>
+
+// Local includes
+#include "ImageFile.h"
+#include "RawPack.h"
+#include "RawCodec.h"
+#include "QuickLook.h"
+#include "SourceCatalog.h"
+
+// System namespace
+using namespace std;
+
+const int TIFF_ENTRIES = 10;
+const size_t TIFF_HEADER = 8 + 2 + TIFF_ENTRIES * 12 + 4 + 2;	// Header, IFD, padding to 4
+const size_t TIFF_RGB_HEADER = TIFF_HEADER - 2 + 3 * 2 + 2;	// BitsPerSample values after the IFD
+
+
+// Write the buffers to a new file at path
+static void write_file(const string &path, struct iovec* iov, int count)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), path};
+
+	while ( count > 0 )
+	{
+		ssize_t n = writev(fd, iov, min(count, IOV_MAX));
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n < 0 )
+		{
+			int error = errno;
+			::close(fd);
+			unlink(path.c_str());
+			throw system_error{error, system_category(), path};
+		}
+		while ( count > 0 && (size_t) n >= iov->iov_len )
+		{
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if ( count > 0 )
+		{
+			iov->iov_base = (char*) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	if ( ::close(fd) < 0 )
+	{
+		int error = errno;
+		unlink(path.c_str());
+		throw system_error{error, system_category(), path};
+	}
+}
+
+
+void write_raw(const string &path, const Frame &frame)
+{
+	struct iovec iov = { (void*) frame.pixels, frame.size };
+	write_file(path, &iov, 1);
+}
+
+
+// Put a little-endian value into a TIFF header
+static void put16(unsigned char* p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+
+static void put32(unsigned char* p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+
+// Add a tag with a single SHORT or LONG value to the IFD at p
+static unsigned char* put_tag(unsigned char* p, uint16_t tag, uint32_t value, bool is_long = false)
+{
+	put16(p, tag);
+	put16(p + 2, is_long? 4 : 3);
+	put32(p + 4, 1);
+	put32(p + 8, 0);
+	if ( is_long )
+		put32(p + 8, value);
+	else
+		put16(p + 8, value);
+	return p + 12;
+}
+
+
+// Single strip, uncompressed, little-endian 16-bit grayscale (1 sample per pixel) or
+// RGB (3 samples)
+static void write_tiff16(const string &path, uint32_t width, uint32_t height, int samples, const void* pixels, size_t size)
+{
+	unsigned char header[TIFF_RGB_HEADER];
+	size_t header_size = (samples == 1)? TIFF_HEADER : TIFF_RGB_HEADER;
+	memset(header, 0, sizeof(header));
+	memcpy(header, "II*\0", 4);
+	put32(header + 4, 8);
+	put16(header + 8, TIFF_ENTRIES);
+
+	unsigned char* p = header + 10;
+	p = put_tag(p, 256, width, true);		// ImageWidth
+	p = put_tag(p, 257, height, true);		// ImageLength
+	if ( samples == 1 )
+		p = put_tag(p, 258, 16);		// BitsPerSample
+	else
+	{
+		// BitsPerSample has a value per sample, stored after the IFD
+		put16(p, 258);
+		put16(p + 2, 3);
+		put32(p + 4, samples);
+		put32(p + 8, TIFF_HEADER - 2);
+		p += 12;
+		for ( int i = 0; i < samples; i++ )
+			put16(header + TIFF_HEADER - 2 + 2 * i, 16);
+	}
+	p = put_tag(p, 259, 1);				// Compression: none
+	p = put_tag(p, 262, (samples == 1)? 1 : 2);	// PhotometricInterpretation: BlackIsZero or RGB
+	p = put_tag(p, 273, header_size, true);		// StripOffsets
+	p = put_tag(p, 277, samples);			// SamplesPerPixel
+	p = put_tag(p, 278, height, true);		// RowsPerStrip
+	p = put_tag(p, 279, size, true);		// StripByteCounts
+	p = put_tag(p, 284, 1);				// PlanarConfiguration: contiguous
+	put32(p, 0);					// No further IFD
+
+	struct iovec iov[2] = { { header, header_size }, { (void*) pixels, size } };
+	write_file(path, iov, 2);
+}
+
+
+void write_tiff(const string &path, const Frame &frame)
+{
+	write_tiff16(path, frame.width, frame.height, 1, frame.pixels, frame.size);
+}
+
+
+// Demosaiced RGB TIFF reduced by scale, see QuickLook.h.  Each writer thread keeps its
+// image buffer for the next frame.
+void write_quicklook(const string &path, const Frame &frame, int scale)
+{
+	static thread_local vector<uint16_t> rgb;
+	uint32_t width, height;
+	make_quicklook(frame, scale, rgb, width, height);
+	write_tiff16(path, width, height, 3, rgb.data(), rgb.size() * sizeof(uint16_t));
+}
+
+
+// Packed 12-bit pixels behind a metadata header.  Each writer thread packs into its own
+// buffer, which is kept for the next frame.
+void write_packed(const string &path, const Frame &frame)
+{
+	static thread_local vector<uint8_t> buffer;
+
+	PackedHeader header;
+	packed_header(frame, header);
+	if ( buffer.size() < header.data_size )
+		buffer.resize(header.data_size);
+	pack12(frame.pixels, (size_t) frame.width * frame.height, buffer.data());
+
+	struct iovec iov[2] = { { &header, sizeof(header) }, { buffer.data(), header.data_size } };
+	write_file(path, iov, 2);
+}
+
+
+// Compress with the tiles spread over all cores, and write the tiles where they were
+// coded
+void write_lossless(const string &path, const Frame &frame)
+{
+	static thread_local LosslessFrame coded;
+	static thread_local vector<struct iovec> iov;
+
+	encode_lossless(frame, tile_pool(), coded);
+	uint32_t tiles = coded.table[1];
+	iov.resize(2 + tiles);
+	iov[0] = { &coded.header, sizeof(coded.header) };
+	iov[1] = { coded.table.data(), coded.table.size() * sizeof(uint32_t) };
+	for ( uint32_t t = 0; t < tiles; t++ )
+		iov[2 + t] = { (void*) coded.tile(t), coded.table[2 + t] };
+	write_file(path, iov.data(), iov.size());
+}
+
+
+// Catalog of the sources in a frame, tagged with the OBC position, see SourceCatalog.h.
+// Each writer thread keeps its extractor's buffers for the next frame.
+void write_catalog(const string &path, const Frame &frame, const CatalogPosition &position)
+{
+	static thread_local SourceExtractor extractor;
+	static thread_local vector<CatalogSource> sources;
+
+	CatalogHeader header;
+	extractor.extract(frame, tile_pool(), header, sources);
+	header.position = position;
+
+	struct iovec iov[2] = { { &header, sizeof(header) }, { sources.data(), sources.size() * sizeof(CatalogSource) } };
+	write_file(path, iov, 2);
+}
+
+
+// Write a frame in a format; scale is only used by quick-look images.  A catalog written
+// here has no OBC position.
+void write_image(ImageFormat format, const string &path, const Frame &frame, int scale)
+{
+	if ( format == IMAGE_TIFF )
+		write_tiff(path, frame);
+	else if ( format == IMAGE_PACKED )
+		write_packed(path, frame);
+	else if ( format == IMAGE_LOSSLESS )
+		write_lossless(path, frame);
+	else if ( format == IMAGE_QUICKLOOK )
+		write_quicklook(path, frame, scale);
+	else if ( format == IMAGE_CATALOG )
+	{
+		CatalogPosition position;
+		catalog_position(frame.trigger_ns + (int64_t) (frame.exposure_us * 500), HISTORY_EMPTY, OBCData(), position);
+		write_catalog(path, frame, position);
+	}
+	else
+		write_raw(path, frame);
+}
+
+
+const char* image_extension(ImageFormat format)
+{
+	switch ( format )
+	{
+	case IMAGE_TIFF:
+		return ".tiff";
+	case IMAGE_PACKED:
+		return ".r12";
+	case IMAGE_LOSSLESS:
+		return ".rlc";
+	case IMAGE_QUICKLOOK:
+		return "_ql.tiff";
+	case IMAGE_CATALOG:
+		return ".src";
+	default:
+		return ".raw";
+	}
+}
+
+
+// Name of a format in the imaging plan
+const char* image_format_string(ImageFormat format)
+{
+	switch ( format )
+	{
+	case IMAGE_TIFF:
+		return "tiff";
+	case IMAGE_PACKED:
+		return "packed";
+	case IMAGE_LOSSLESS:
+		return "lossless";
+	case IMAGE_QUICKLOOK:
+		return "quicklook";
+	case IMAGE_CATALOG:
+		return "catalog";
+	default:
+		return "raw";
+	}
+}
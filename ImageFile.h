@@ -0,0 +1,44 @@
+//	ImageFile.h
+//	Writing frames to image files without the camera library.  A raw file is the pixel
+//	data exactly as grabbed, the same bytes pylon saves as ImageFileFormat_Raw.  A TIFF
+//	file is an uncompressed 16-bit grayscale image of the CFA, which keeps every sensor
+//	value; the Bayer pattern is RGGB starting at the top left.  A packed file holds the
+//	pixels in 12 bits each with a metadata header, see RawPack.h, and is a quarter
+//	smaller than a raw file.  A lossless file is compressed with the same header, see
+//	RawCodec.h.  A quick-look file is a 16-bit RGB TIFF demosaiced from the CFA and
+//	possibly reduced in size, see QuickLook.h.  A catalog file lists the light sources
+//	found in the frame, see SourceCatalog.h.
+
+#ifndef _ImageFile_H_
+#define _ImageFile_H_
+
+#include <string>
+
+#include "Frame.h"
+#include "SourceCatalog.h"
+
+using namespace std;
+
+
+// File format of a saved frame
+enum ImageFormat
+{
+	IMAGE_RAW,
+	IMAGE_TIFF,
+	IMAGE_PACKED,
+	IMAGE_LOSSLESS,
+	IMAGE_QUICKLOOK,
+	IMAGE_CATALOG
+};
+
+extern void write_image(ImageFormat format, const string &path, const Frame &frame, int scale = 1);
+extern void write_raw(const string &path, const Frame &frame);
+extern void write_tiff(const string &path, const Frame &frame);
+extern void write_packed(const string &path, const Frame &frame);
+extern void write_lossless(const string &path, const Frame &frame);
+extern void write_quicklook(const string &path, const Frame &frame, int scale);
+extern void write_catalog(const string &path, const Frame &frame, const CatalogPosition &position);
+extern const char* image_extension(ImageFormat format);
+extern const char* image_format_string(ImageFormat format);
+
+#endif
@@ -0,0 +1,181 @@
+//	ImageWriter.cpp
+//	Implementation of ImageWriter class.  Jobs are written in the order they were
+//	submitted.  Dropping an image calls its done function with ok false, so the image log
+//	still has a line for it.
+
+// System includes
+#include <algorithm>
+#include <exception>
+
+// Local includes
+#include "ImageWriter.h"
+#include "OBCHistory.h"
+
+// System namespace
+using namespace std;
+
+
+ImageWriter::ImageWriter(int cameras, size_t d, int threads, WriterPolicy p) :
+	depth(max(d, (size_t) 1)), policy(p), queued(cameras, 0), active(0), quit(false),
+	counters(), wait_total_ms(0), write_total_ms(0)
+{
+	for ( int i = 0; i < threads; i++ )
+		writers.push_back(thread(&ImageWriter::work, this));
+}
+
+
+// Write everything still queued, then stop the writer threads
+ImageWriter::~ImageWriter()
+{
+	flush();
+	{
+		lock_guard<mutex> guard(lock);
+		quit = true;
+	}
+	not_empty.notify_all();
+	for ( size_t i = 0; i < writers.size(); i++ )
+		writers[i].join();
+}
+
+
+// Queue an image for writing.  The job is moved into the queue.  Returns false if the
+// image was dropped instead; a queued image may be dropped to make room for it, and
+// either way the dropped image's done function has been called.
+bool ImageWriter::submit(WriteJob &job)
+{
+	WriteJob dropped;
+	bool accepted = true;
+	{
+		unique_lock<mutex> guard(lock);
+		size_t &count = queued[job.camera];
+		if ( count >= depth && policy == WRITER_BLOCK )
+		{
+			counters.blocked++;
+			changed.wait(guard, [&count, this] { return count < depth; });
+		}
+		else if ( count >= depth )
+		{
+			// Lowest priority queued image of this camera, the oldest of equals
+			deque<WriteJob>::iterator victim = queue.end();
+			for ( deque<WriteJob>::iterator it = queue.begin(); it != queue.end(); ++it )
+				if ( it->camera == job.camera && (victim == queue.end() || it->priority < victim->priority) )
+					victim = it;
+
+			counters.dropped++;
+			if ( victim == queue.end() || victim->priority >= job.priority )
+			{
+				dropped = move(job);
+				accepted = false;
+			}
+			else
+			{
+				dropped = move(*victim);
+				queue.erase(victim);
+				count--;
+			}
+		}
+
+		if ( accepted )
+		{
+			job.queued_ns = monotonic_ns();
+			queue.push_back(move(job));
+			count++;
+			counters.max_depth = max(counters.max_depth, queue.size());
+			not_empty.notify_one();
+		}
+	}
+
+	if ( dropped.done )
+		dropped.done(false, "dropped, writer queue full");
+	return accepted;
+}
+
+
+// Wait until every queued image has been written
+void ImageWriter::flush()
+{
+	unique_lock<mutex> guard(lock);
+	changed.wait(guard, [this] { return queue.empty() && active == 0; });
+}
+
+
+// Queue depth and latencies since the previous call
+WriterStats ImageWriter::stats()
+{
+	lock_guard<mutex> guard(lock);
+	WriterStats s = counters;
+	s.depth = queue.size();
+	uint64_t taken = counters.written + counters.failed;
+	s.wait_mean_ms = taken? wait_total_ms / taken : 0;
+	s.write_mean_ms = taken? write_total_ms / taken : 0;
+
+	counters = WriterStats();
+	counters.max_depth = queue.size();
+	wait_total_ms = write_total_ms = 0;
+	return s;
+}
+
+
+void ImageWriter::work()
+{
+	while ( true )
+	{
+		WriteJob job;
+		int64_t start;
+		{
+			unique_lock<mutex> guard(lock);
+			not_empty.wait(guard, [this] { return quit || !queue.empty(); });
+			if ( queue.empty() )
+				return;
+			job = move(queue.front());
+			queue.pop_front();
+			active++;
+			start = monotonic_ns();
+			double wait = (start - job.queued_ns) / 1e6;
+			wait_total_ms += wait;
+			counters.wait_max_ms = max(counters.wait_max_ms, wait);
+		}
+
+		bool ok = true;
+		string error;
+		try
+		{
+			if ( job.write )
+				job.write(job.filename, job.image);
+			else
+				write_image(job.format, job.filename, job.image, job.scale);
+		}
+		catch (const exception &e)
+		{
+			// Any failure, such as running out of memory in a codec, costs only
+			// this image
+			ok = false;
+			error = e.what();
+		}
+		catch (...)
+		{
+			ok = false;
+			error = "unknown exception";
+		}
+
+		// Give the grab buffer back before reporting
+		job.image.release();
+		double write = (monotonic_ns() - start) / 1e6;
+		if ( job.done )
+			job.done(ok, error);
+
+		lock_guard<mutex> guard(lock);
+		active--;
+		queued[job.camera]--;
+		(ok? counters.written : counters.failed)++;
+		write_total_ms += write;
+		counters.write_max_ms = max(counters.write_max_ms, write);
+		changed.notify_all();
+	}
+}
+
+
+const char* writer_policy_string(WriterPolicy policy)
+{
+	return (policy == WRITER_BLOCK)? "block" : "drop";
+}
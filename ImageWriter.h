@@ -0,0 +1,98 @@
+//	ImageWriter.h
+//	Interface for ImageWriter class.  Grabbed images are saved by writer threads instead
+//	of the camera threads, so a slow card doesn't hold up the next exposure.  Each camera
+//	has a bounded share of the queue, no larger than its grab buffer pool allows, since a
+//	queued image keeps its grab buffer until it has been written.  When a camera's share
+//	is full the writer either blocks the camera thread or drops the lowest priority image.
+
+#ifndef _ImageWriter_H_
+#define _ImageWriter_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+#include "Frame.h"
+#include "ImageFile.h"
+
+using namespace std;
+
+const int WRITER_THREADS = 2;		// Default number of writer threads
+const size_t WRITER_DEPTH = 6;		// Default images queued per camera
+
+
+// What submit() does when the camera's queue is full
+enum WriterPolicy
+{
+	WRITER_BLOCK,	// Wait for a queued image to be written
+	WRITER_DROP	// Drop the lowest priority image, queued or new
+};
+
+
+// An image waiting to be written
+struct WriteJob
+{
+	int camera;				// Queue the image is counted against
+	int priority;				// Higher values are dropped last
+	ImageFormat format;
+	int scale;				// Reduction of a quick-look image
+	string filename;
+	Frame image;				// Holds the grab buffer until written
+	function<void(const string &path, const Frame &image)> write;	// Writes the file instead of write_image() if set
+	function<void(bool ok, const string &error)> done;	// Called after writing or dropping
+	int64_t queued_ns;			// Set by submit()
+};
+
+
+// Counters since the last call to stats(), or for depth the current value
+struct WriterStats
+{
+	size_t depth;		// Images queued now
+	size_t max_depth;	// Most images queued at once
+	uint64_t written;
+	uint64_t failed;
+	uint64_t dropped;
+	uint64_t blocked;	// Submits that had to wait for room
+	double wait_mean_ms;	// Time from submit until a writer took the image
+	double wait_max_ms;
+	double write_mean_ms;	// Time to save the image
+	double write_max_ms;
+};
+
+
+// ImageWriter class definition
+class ImageWriter
+{
+public:
+	ImageWriter(int cameras, size_t depth = WRITER_DEPTH, int threads = WRITER_THREADS, WriterPolicy policy = WRITER_BLOCK);
+	~ImageWriter();
+	bool submit(WriteJob &job);
+	void flush();
+	WriterStats stats();
+
+private:
+	size_t depth;
+	WriterPolicy policy;
+	vector<thread> writers;
+	deque<WriteJob> queue;
+	vector<size_t> queued;		// Images queued per camera
+	size_t active;			// Images being written
+	mutex lock;
+	condition_variable not_empty;	// Signals writers
+	condition_variable changed;	// Signals room in a queue, or all writes finished
+	bool quit;
+	WriterStats counters;
+	double wait_total_ms;
+	double write_total_ms;
+
+	void work();
+};
+
+extern const char* writer_policy_string(WriterPolicy policy);
+
+#endif
@@ -0,0 +1,321 @@
+//	ImagingPlan.cpp
+//	Implementation of ImagingPlan class.  Parsing and checking happen in load(), and
+//	compile() lays out the steps; neither is used once imaging has started.
+
+// System includes
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cerrno>
+#include <system_error>
+
+// Local includes
+#include "ImagingPlan.h"
+#include "QuickLook.h"
+
+// System namespace
+using namespace std;
+
+
+// Image format named in a plan file
+static bool parse_format(const string &word, ImageFormat &format)
+{
+	if ( word == "raw" )
+		format = IMAGE_RAW;
+	else if ( word == "packed" )
+		format = IMAGE_PACKED;
+	else if ( word == "lossless" )
+		format = IMAGE_LOSSLESS;
+	else if ( word == "tiff" )
+		format = IMAGE_TIFF;
+	else
+		return false;
+	return true;
+}
+
+
+// Default plan: 5 raw images at 50 ms and one TIFF image at 100 ms
+ImagingPlan::ImagingPlan() : max_frames(0)
+{
+	add("", vector<int>(1, 50), 5, IMAGE_RAW);
+	add("", vector<int>(1, 100), 1, IMAGE_TIFF);
+}
+
+
+void ImagingPlan::add(const string &camera, const vector<int> &exposures, int count, ImageFormat format, int min_ms, int max_ms)
+{
+	PlanStack stack;
+	stack.camera = camera;
+	stack.exposures = exposures;
+	stack.min_ms = min_ms;
+	stack.max_ms = max_ms;
+	stack.count = count;
+	stack.format = format;
+	stack.quicklook = 0;
+	stack.combine = STACK_NONE;
+	stack.combined = IMAGE_RAW;
+	stack.keep = true;
+	stack.catalog = false;
+	stacks.push_back(stack);
+}
+
+
+// Read the plan from a file, replacing the default plan
+void ImagingPlan::load(const string &path)
+{
+	ifstream in(path.c_str());
+	if ( !in )
+		throw system_error{errno, system_category(), "Failed to open plan file " + path};
+
+	vector<PlanStack> defaults;
+	defaults.swap(stacks);
+	string camera;
+	int min_ms = PLAN_AUTO_MIN_MS;
+	int max_ms = PLAN_AUTO_MAX_MS;
+	string line;
+	for ( int number = 1; getline(in, line); number++ )
+	{
+		string where = path + ":" + to_string(number) + ": ";
+		line = line.substr(0, line.find('#'));
+		istringstream words(line);
+		string directive;
+		if ( !(words >> directive) )
+			continue;
+
+		if ( directive == "camera" )
+		{
+			if ( !(words >> camera) )
+				throw PlanError(where + "camera number or serial number missing");
+			if ( camera == "*" )
+				camera.clear();
+			min_ms = PLAN_AUTO_MIN_MS;
+			max_ms = PLAN_AUTO_MAX_MS;
+		}
+		else if ( directive == "auto" )
+		{
+			if ( !(words >> min_ms >> max_ms) || min_ms < 1 || max_ms < min_ms || max_ms > PLAN_MAX_EXPOSURE_MS )
+				throw PlanError(where + "expected auto <min> <max> with 1 <= min <= max <= " + to_string(PLAN_MAX_EXPOSURE_MS) + " ms");
+		}
+		else if ( directive == "quicklook" )
+		{
+			int scale;
+			if ( !(words >> scale) || !quicklook_scale_ok(scale) )
+				throw PlanError(where + "expected quicklook <scale> with scale 1, 2, 4, 8 or 16");
+			if ( stacks.empty() || stacks.back().camera != camera )
+				throw PlanError(where + "quicklook must follow a stack");
+			stacks.back().quicklook = scale;
+		}
+		else if ( directive == "combine" )
+		{
+			string method, format, keep;
+			StackMethod stack_method;
+			ImageFormat image_format;
+			if ( !(words >> method >> format) )
+				throw PlanError(where + "expected combine <method> <format> [keep]");
+			if ( method == "mean" )
+				stack_method = STACK_MEAN;
+			else if ( method == "median" )
+				stack_method = STACK_MEDIAN;
+			else if ( method == "clip" )
+				stack_method = STACK_CLIP;
+			else
+				throw PlanError(where + "unknown method " + method + ", expected mean, median or clip");
+
+			// Packed images hold 12 bits, and combined pixels have 16
+			if ( !parse_format(format, image_format) || image_format == IMAGE_PACKED )
+				throw PlanError(where + "combined images are saved as raw, lossless or tiff, not " + format);
+			if ( (words >> keep) && keep != "keep" )
+				throw PlanError(where + "unexpected " + keep);
+			if ( stacks.empty() || stacks.back().camera != camera )
+				throw PlanError(where + "combine must follow a stack");
+			if ( stacks.back().count < 2 || stacks.back().count > STACK_MAX_FRAMES )
+				throw PlanError(where + "a combined stack needs 2 to " + to_string(STACK_MAX_FRAMES) + " images per exposure");
+			stacks.back().combine = stack_method;
+			stacks.back().combined = image_format;
+			stacks.back().keep = stacks.back().keep && !keep.empty();
+		}
+		else if ( directive == "catalog" )
+		{
+			string only;
+			if ( (words >> only) && only != "only" )
+				throw PlanError(where + "unexpected " + only);
+			if ( stacks.empty() || stacks.back().camera != camera )
+				throw PlanError(where + "catalog must follow a stack");
+			stacks.back().catalog = true;
+			stacks.back().keep = stacks.back().keep && only.empty();
+		}
+		else if ( directive == "stack" )
+		{
+			string list, format;
+			int count;
+			if ( !(words >> list >> count >> format) )
+				throw PlanError(where + "expected stack <exposures> <count> <format>");
+
+			vector<int> exposures;
+			istringstream items(list);
+			string item;
+			while ( getline(items, item, ',') )
+			{
+				if ( item == "auto" )
+				{
+					exposures.push_back(0);
+					continue;
+				}
+				char* end;
+				long ms = strtol(item.c_str(), &end, 10);
+				if ( item.empty() || *end != '\0' || ms < 1 || ms > PLAN_MAX_EXPOSURE_MS )
+					throw PlanError(where + "bad exposure time '" + item + "', expected 1 to " + to_string(PLAN_MAX_EXPOSURE_MS) + " ms");
+				exposures.push_back(ms);
+			}
+			if ( count < 1 )
+				throw PlanError(where + "stack count must be at least 1");
+			ImageFormat image_format;
+			if ( !parse_format(format, image_format) )
+				throw PlanError(where + "unknown format " + format + ", expected raw, packed, lossless or tiff");
+			add(camera, exposures, count, image_format, min_ms, max_ms);
+		}
+		else
+			throw PlanError(where + "unknown directive " + directive);
+
+		string extra;
+		if ( words >> extra )
+			throw PlanError(where + "unexpected " + extra);
+	}
+
+	bool any = false;
+	for ( size_t i = 0; i < stacks.size(); i++ )
+		any = any || stacks[i].camera.empty();
+	if ( !any )
+		throw PlanError(path + ": no default stacks");
+}
+
+
+// Lay out the steps of each camera.  A camera uses the section named by its number or
+// its serial number, and the default stacks otherwise.
+void ImagingPlan::compile(const vector<string> &serials)
+{
+	schedule.clear();
+	start.clear();
+	names.clear();
+	max_frames = 0;
+
+	for ( size_t camera = 0; camera < serials.size(); camera++ )
+	{
+		string name;
+		for ( size_t i = 0; i < stacks.size(); i++ )
+			if ( stacks[i].camera == to_string(camera) || stacks[i].camera == serials[camera] )
+				name = stacks[i].camera;
+
+		start.push_back(schedule.size());
+		names.push_back(name);
+		int frame = 0;
+		for ( size_t i = 0; i < stacks.size(); i++ )
+		{
+			const PlanStack &stack = stacks[i];
+			if ( stack.camera != name )
+				continue;
+			for ( size_t e = 0; e < stack.exposures.size(); e++ )
+				for ( int idx = 0; idx < stack.count; idx++ )
+				{
+					PlanStep step;
+					step.exposure_ms = stack.exposures[e];
+					step.min_ms = stack.min_ms;
+					step.max_ms = stack.max_ms;
+					step.index = idx;
+					step.format = stack.format;
+					step.frame = frame++;
+					step.quicklook = 0;
+					step.combine = stack.combine;
+					step.combined = stack.combined;
+					step.keep = stack.keep;
+					step.count = stack.count;
+					step.catalog = stack.catalog;
+					schedule.push_back(step);
+				}
+			if ( stack.quicklook > 0 )
+				schedule.back().quicklook = stack.quicklook;
+		}
+		if ( frame > PLAN_MAX_STEPS )
+			throw PlanError("plan has " + to_string(frame) + " images per cycle for camera " + to_string(camera) +
+				", at most " + to_string(PLAN_MAX_STEPS) + " allowed");
+		max_frames = max(max_frames, frame);
+	}
+	start.push_back(schedule.size());
+}
+
+
+// Steps of a camera in a cycle, in order
+const PlanStep* ImagingPlan::steps(int camera) const
+{
+	return schedule.data() + start[camera];
+}
+
+
+size_t ImagingPlan::size(int camera) const
+{
+	return start[camera + 1] - start[camera];
+}
+
+
+// Frame numbers used in a cycle, from the longest camera sequence
+int ImagingPlan::frames() const
+{
+	return max_frames;
+}
+
+
+// Widest bounds of the automatic exposure times of a camera.  Returns false if the
+// camera has none.
+bool ImagingPlan::autoLimits(int camera, int &min_ms, int &max_ms) const
+{
+	bool any = false;
+	for ( size_t i = start[camera]; i < start[camera + 1]; i++ )
+		if ( schedule[i].exposure_ms == 0 )
+		{
+			min_ms = any? min(min_ms, schedule[i].min_ms) : schedule[i].min_ms;
+			max_ms = any? max(max_ms, schedule[i].max_ms) : schedule[i].max_ms;
+			any = true;
+		}
+	return any;
+}
+
+
+// Describe the compiled plan, one line per camera starting with prefix
+void ImagingPlan::print(ostream &out, const string &prefix) const
+{
+	for ( size_t camera = 0; camera + 1 < start.size(); camera++ )
+	{
+		out << prefix << "Camera " << camera << " (" << (names[camera].empty()? "default" : names[camera]) << "):";
+		double total_ms = 0;
+		for ( size_t i = start[camera]; i < start[camera + 1]; )
+		{
+			size_t j = i;
+			while ( j < start[camera + 1] && schedule[j].exposure_ms == schedule[i].exposure_ms && schedule[j].format == schedule[i].format &&
+				schedule[j].combine == schedule[i].combine && schedule[j].keep == schedule[i].keep &&
+				schedule[j].catalog == schedule[i].catalog &&
+				(j == i || (schedule[j - 1].quicklook == 0 &&
+				(schedule[j - 1].combine == STACK_NONE || schedule[j - 1].index + 1 < schedule[j - 1].count))) )
+				total_ms += schedule[j++].exposure_ms;
+			out << " " << (j - i) << "x";
+			if ( schedule[i].exposure_ms == 0 )
+				out << "auto " << schedule[i].min_ms << "-" << schedule[i].max_ms;
+			else
+				out << schedule[i].exposure_ms;
+			out << " ms";
+			if ( schedule[i].keep )
+				out << " " << image_format_string(schedule[i].format);
+			if ( schedule[i].combine != STACK_NONE )
+				out << (schedule[i].keep? " + " : " ") << stack_method_string(schedule[i].combine) << " stack " <<
+					image_format_string(schedule[i].combined);
+			if ( schedule[i].catalog )
+				out << ((schedule[i].keep || schedule[i].combine != STACK_NONE)? " + " : " ") << "catalog";
+			if ( schedule[j - 1].quicklook == 1 )
+				out << " + quicklook";
+			else if ( schedule[j - 1].quicklook > 1 )
+				out << " + quicklook 1/" << schedule[j - 1].quicklook;
+			i = j;
+		}
+		out << ", " << total_ms << " ms fixed exposure" << endl;
+	}
+}
@@ -0,0 +1,125 @@
+//	ImagingPlan.h
+//	Interface for ImagingPlan class.  The plan says which images each camera takes in an
+//	imaging cycle.  It is read from a plan file at startup and compiled into a flat table
+//	of steps per camera, so the capture loop only walks an array.
+//
+//	Plan file format, one directive per line, '#' starts a comment:
+//		stack <exposures> <count> <format>
+//			Take count images at each exposure time in the comma separated list
+//			of milliseconds, saved as raw, packed (12-bit raw, see RawPack.h),
+//			lossless (compressed raw, see RawCodec.h) or tiff.  Stacks run in
+//			file order.
+//			An exposure time of auto is set by the auto exposure controller.
+//		quicklook <scale>
+//			Also save a colour quick-look TIFF of the last image of the stack
+//			before it, demosaiced and reduced by scale (1, 2, 4, 8 or 16), see
+//			QuickLook.h.  It is made by the image writer from a frame that is
+//			taken anyway, so it replaces a separate TIFF exposure.
+//		combine <method> <format> [keep]
+//			Combine the images of the stack before it at each exposure time on
+//			board by mean, median or clip (sigma-clipped mean), see Stacker.h,
+//			and save the result as raw, lossless or tiff.  The images
+//			themselves are only saved with keep.  The stack count must be 2 to
+//			STACK_MAX_FRAMES.
+//		catalog [only]
+//			Also save a catalog of the light sources in each image of the stack
+//			before it, tagged with the OBC position, see SourceCatalog.h.  With
+//			only, the images themselves are not saved.
+//		auto <min> <max>
+//			Bounds in milliseconds of the automatic exposure times of the stacks
+//			that follow, up to the next camera line.  The default is
+//			PLAN_AUTO_MIN_MS to PLAN_AUTO_MAX_MS.
+//		camera <number or serial number>
+//			The stacks that follow replace the default stacks for that camera.
+//		camera *
+//			The stacks that follow are the default stacks again.
+//
+//	Without a plan file the default plan is 5 raw images at 50 ms and one TIFF at 100 ms.
+
+#ifndef _ImagingPlan_H_
+#define _ImagingPlan_H_
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdexcept>
+
+#include "ImageFile.h"
+#include "Stacker.h"
+
+using namespace std;
+
+const int PLAN_MAX_EXPOSURE_MS = 60000;
+const int PLAN_MAX_STEPS = 1000;		// Images per camera per cycle
+const int PLAN_AUTO_MIN_MS = 10;		// Default bounds of automatic exposure times
+const int PLAN_AUTO_MAX_MS = 500;
+
+
+// Error in a plan file
+class PlanError : public runtime_error
+{
+public:
+	PlanError(const string &what) : runtime_error(what) {}
+};
+
+
+// One image of a camera's sequence
+struct PlanStep
+{
+	int exposure_ms;	// 0 for an automatic exposure time
+	int min_ms;		// Bounds of an automatic exposure time
+	int max_ms;
+	int index;		// Image number within its stack at this exposure
+	ImageFormat format;
+	int frame;		// Image number within the cycle, for synchronized triggering
+	int quicklook;		// Scale of a quick-look image made from this one, 0 for none
+	StackMethod combine;	// How the images of its stack at this exposure are combined
+	ImageFormat combined;	// Format of the combined image
+	bool keep;		// Save this image itself
+	int count;		// Images of its stack at this exposure
+	bool catalog;		// Save a source catalog of this image
+};
+
+
+// Stacks as written in the plan file
+struct PlanStack
+{
+	string camera;		// Empty for the default stacks
+	vector<int> exposures;	// 0 for automatic
+	int min_ms;		// Bounds of automatic exposure times
+	int max_ms;
+	int count;
+	ImageFormat format;
+	int quicklook;		// Scale of a quick-look image of the last image, 0 for none
+	StackMethod combine;	// How the images at each exposure are combined
+	ImageFormat combined;
+	bool keep;		// Save the images themselves
+	bool catalog;		// Save a source catalog of each image
+};
+
+
+// ImagingPlan class definition
+class ImagingPlan
+{
+public:
+	ImagingPlan();
+	void load(const string &path);
+	void compile(const vector<string> &serials);
+	const PlanStep* steps(int camera) const;
+	size_t size(int camera) const;
+	int frames() const;
+	bool autoLimits(int camera, int &min_ms, int &max_ms) const;
+	void print(ostream &out, const string &prefix) const;
+
+private:
+	vector<PlanStack> stacks;
+	vector<PlanStep> schedule;	// Steps of all cameras, camera by camera
+	vector<size_t> start;		// Index of each camera's first step, and the end
+	vector<string> names;		// Plan section used by each camera
+	int max_frames;			// Longest camera sequence
+
+	void add(const string &camera, const vector<int> &exposures, int count, ImageFormat format,
+		int min_ms = PLAN_AUTO_MIN_MS, int max_ms = PLAN_AUTO_MAX_MS);
+};
+
+#endif
@@ -0,0 +1,332 @@
+//	OBCAttitude.cpp
+//	Implementation of the IMU attitude estimator.
+//
+//	The filter step is Madgwick's MARG gradient descent update, written once as a
+//	template.  The real-time filter instantiates it for double.  The batch version
+//	instantiates it for a vector of four floats (SSE or NEON through the GCC vector
+//	extension) and gives each lane a quarter of the flight.  A filter step depends on the
+//	previous one, so a lane can't start in the middle of the flight cold: each lane after
+//	the first starts ATTITUDE_WARMUP samples early from an accel/mag attitude and only
+//	its own segment is kept, by which time it has converged onto the sequential result.
+
+// System includes
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Local includes
+#include "OBCAttitude.h"
+
+// System namespace
+using namespace std;
+
+const double RAD_TO_DEG = 180 / 3.14159265358979323846;
+const int LANES = 4;
+
+AttitudeFilter obc_attitude;
+
+typedef float v4sf __attribute__ ((vector_size (16)));
+typedef int32_t v4si __attribute__ ((vector_size (16)));
+
+
+// Helpers with scalar and vector versions
+
+static inline double vsqrt(double x)
+{
+	return sqrt(x);
+}
+
+static inline v4sf vsqrt(v4sf x)
+{
+#if defined(__SSE__)
+	return _mm_sqrt_ps(x);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	return vsqrtq_f32(x);
+#else
+	v4sf r;
+	for ( int i = 0; i < LANES; i++ )
+		r[i] = sqrtf(x[i]);
+	return r;
+#endif
+}
+
+static inline double rsqrt(double x)
+{
+	return (x > 0)? 1 / sqrt(x) : 0;
+}
+
+// The tiny offset keeps zero vectors finite; their correction is gated off by usable()
+static inline v4sf rsqrt(v4sf x)
+{
+	const v4sf tiny = { 1e-30f, 1e-30f, 1e-30f, 1e-30f };
+	return 1 / vsqrt(x + tiny);
+}
+
+// 1 where both squared norms are non-zero, i.e. the accel/mag correction is usable
+static inline double usable(double a2, double m2)
+{
+	return (a2 > 0 && m2 > 0)? 1 : 0;
+}
+
+static inline v4sf usable(v4sf a2, v4sf m2)
+{
+	const v4sf zero = { 0, 0, 0, 0 }, one = { 1, 1, 1, 1 };
+	return (v4sf) ((a2 > zero) & (m2 > zero) & (v4si) one);
+}
+
+
+// One Madgwick MARG update of q with gyro g in rad/s, accel a, mag m and time step dt.
+template <class V, class S>
+static inline void madgwick_step(V q[4], V gx, V gy, V gz, V ax, V ay, V az, V mx, V my, V mz, V dt, S beta)
+{
+	V q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	const S half = 0.5, two = 2, four = 4;
+
+	// Rate of change of quaternion from gyroscope
+	V qDot1 = half * (-q1 * gx - q2 * gy - q3 * gz);
+	V qDot2 = half * (q0 * gx + q2 * gz - q3 * gy);
+	V qDot3 = half * (q0 * gy - q1 * gz + q3 * gx);
+	V qDot4 = half * (q0 * gz + q1 * gy - q2 * gx);
+
+	// Normalise accelerometer and magnetometer measurements
+	V a2 = ax * ax + ay * ay + az * az;
+	V m2 = mx * mx + my * my + mz * mz;
+	V gain = beta * usable(a2, m2);
+	V recipNorm = rsqrt(a2);
+	ax *= recipNorm;
+	ay *= recipNorm;
+	az *= recipNorm;
+	recipNorm = rsqrt(m2);
+	mx *= recipNorm;
+	my *= recipNorm;
+	mz *= recipNorm;
+
+	// Auxiliary variables to avoid repeated arithmetic
+	V _2q0mx = two * q0 * mx;
+	V _2q0my = two * q0 * my;
+	V _2q0mz = two * q0 * mz;
+	V _2q1mx = two * q1 * mx;
+	V _2q0 = two * q0;
+	V _2q1 = two * q1;
+	V _2q2 = two * q2;
+	V _2q3 = two * q3;
+	V _2q0q2 = two * q0 * q2;
+	V _2q2q3 = two * q2 * q3;
+	V q0q0 = q0 * q0;
+	V q0q1 = q0 * q1;
+	V q0q2 = q0 * q2;
+	V q0q3 = q0 * q3;
+	V q1q1 = q1 * q1;
+	V q1q2 = q1 * q2;
+	V q1q3 = q1 * q3;
+	V q2q2 = q2 * q2;
+	V q2q3 = q2 * q3;
+	V q3q3 = q3 * q3;
+
+	// Reference direction of Earth's magnetic field
+	V hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+	V hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+	V _2bx = vsqrt(hx * hx + hy * hy);
+	V _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+	V _4bx = two * _2bx;
+	V _4bz = two * _2bz;
+
+	// Gradient descent corrective step
+	V ex = _2bx * (half - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx;
+	V ey = _2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my;
+	V ez = _2bx * (q0q2 + q1q3) + _2bz * (half - q1q1 - q2q2) - mz;
+	V fx = two * q1q3 - _2q0q2 - ax;
+	V fy = two * q0q1 + _2q2q3 - ay;
+	V fz = S(1) - two * q1q1 - two * q2q2 - az;
+	V s0 = -_2q2 * fx + _2q1 * fy - _2bz * q2 * ex + (-_2bx * q3 + _2bz * q1) * ey + _2bx * q2 * ez;
+	V s1 = _2q3 * fx + _2q0 * fy - four * q1 * fz + _2bz * q3 * ex + (_2bx * q2 + _2bz * q0) * ey + (_2bx * q3 - _4bz * q1) * ez;
+	V s2 = -_2q0 * fx + _2q3 * fy - four * q2 * fz + (-_4bx * q2 - _2bz * q0) * ex + (_2bx * q1 + _2bz * q3) * ey + (_2bx * q0 - _4bz * q2) * ez;
+	V s3 = _2q1 * fx + _2q2 * fy + (-_4bx * q3 + _2bz * q1) * ex + (-_2bx * q0 + _2bz * q2) * ey + _2bx * q1 * ez;
+	recipNorm = rsqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3) * gain;
+
+	// Apply feedback step and integrate rate of change of quaternion
+	q0 += (qDot1 - s0 * recipNorm) * dt;
+	q1 += (qDot2 - s1 * recipNorm) * dt;
+	q2 += (qDot3 - s2 * recipNorm) * dt;
+	q3 += (qDot4 - s3 * recipNorm) * dt;
+
+	// Normalise quaternion
+	recipNorm = rsqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q[0] = q0 * recipNorm;
+	q[1] = q1 * recipNorm;
+	q[2] = q2 * recipNorm;
+	q[3] = q3 * recipNorm;
+}
+
+
+// Roll, pitch and yaw in degrees of quaternion q
+static void quaternion_to_euler(double q0, double q1, double q2, double q3, double &roll, double &pitch, double &yaw)
+{
+	roll = atan2(2 * (q0 * q1 + q2 * q3), 1 - 2 * (q1 * q1 + q2 * q2)) * RAD_TO_DEG;
+	pitch = asin(max(-1.0, min(1.0, 2 * (q0 * q2 - q3 * q1)))) * RAD_TO_DEG;
+	yaw = atan2(2 * (q0 * q3 + q1 * q2), 1 - 2 * (q2 * q2 + q3 * q3)) * RAD_TO_DEG;
+}
+
+
+// Attitude quaternion from gravity and the tilt compensated magnetic field alone, used
+// to start the filter close to the answer
+void attitude_from_accel_mag(double ax, double ay, double az, double mx, double my, double mz, double q[4])
+{
+	double roll = atan2(ay, az);
+	double pitch = atan2(-ax, sqrt(ay * ay + az * az));
+	double bx = mx * cos(pitch) + my * sin(roll) * sin(pitch) + mz * cos(roll) * sin(pitch);
+	double by = my * cos(roll) - mz * sin(roll);
+	double yaw = atan2(-by, bx);
+
+	double cr = cos(roll / 2), sr = sin(roll / 2);
+	double cp = cos(pitch / 2), sp = sin(pitch / 2);
+	double cy = cos(yaw / 2), sy = sin(yaw / 2);
+	q[0] = cr * cp * cy + sr * sp * sy;
+	q[1] = sr * cp * cy - cr * sp * sy;
+	q[2] = cr * sp * cy + sr * cp * sy;
+	q[3] = cr * cp * sy - sr * sp * cy;
+}
+
+
+AttitudeFilter::AttitudeFilter(double gain) : beta(gain)
+{
+	reset();
+}
+
+
+// Forget the current attitude; the next record starts the filter again
+void AttitudeFilter::reset()
+{
+	q0 = 1;
+	q1 = q2 = q3 = 0;
+	last_ms = 0;
+	initialized = false;
+}
+
+
+// Update the attitude with one OBC record, using the OBC clock for the time step
+void AttitudeFilter::update(const OBCData &data)
+{
+	double dt = (data.ms - last_ms) / 1000.0;
+	if ( !initialized || dt <= 0 || dt > ATTITUDE_MAX_DT )
+	{
+		double q[4];
+		attitude_from_accel_mag(data.ax, data.ay, data.az, data.mx, data.my, data.mz, q);
+		q0 = q[0];
+		q1 = q[1];
+		q2 = q[2];
+		q3 = q[3];
+		initialized = true;
+	}
+	else
+	{
+		double q[4] = { q0, q1, q2, q3 };
+		madgwick_step(q, data.gx * OBC_GYRO_SCALE, data.gy * OBC_GYRO_SCALE, data.gz * OBC_GYRO_SCALE,
+			data.ax, data.ay, data.az, data.mx, data.my, data.mz, dt, beta);
+		q0 = q[0];
+		q1 = q[1];
+		q2 = q[2];
+		q3 = q[3];
+	}
+	last_ms = data.ms;
+}
+
+
+// Current attitude in degrees
+void AttitudeFilter::euler(double &roll, double &pitch, double &yaw) const
+{
+	quaternion_to_euler(q0, q1, q2, q3, roll, pitch, yaw);
+}
+
+
+// Attitude of every sample of a recorded flight.  ms holds the OBC time of each sample
+// and imu the ax, ay, az, gx, gy, gz, mx, my, mz columns.  The results match running
+// AttitudeFilter over the samples in order, to single precision.
+void attitude_batch(size_t n, const int64_t* ms, const double* const imu[9], double* roll, double* pitch, double* yaw, double beta)
+{
+	if ( n == 0 )
+		return;
+
+	// Lane k covers samples [begin[k], end[k]) and starts warm samples earlier
+	size_t segment = (n + LANES - 1) / LANES;
+	size_t begin[LANES], end[LANES], start[LANES];
+	size_t steps = 0;
+	for ( int k = 0; k < LANES; k++ )
+	{
+		begin[k] = min(n, k * segment);
+		end[k] = min(n, begin[k] + segment);
+		start[k] = (begin[k] > ATTITUDE_WARMUP)? begin[k] - ATTITUDE_WARMUP : 0;
+		steps = max(steps, end[k] - start[k]);
+	}
+
+	// Interleave the lanes so that each step loads whole vectors, converting to single
+	// precision and scaling the gyro on the way.  Lanes that have run out repeat their
+	// last sample with no time step.
+	vector<v4sf> in[9], dt(steps);
+	vector<int32_t> restart(steps);		// Bit k set when lane k starts over at this step
+	for ( int c = 0; c < 9; c++ )
+		in[c].resize(steps);
+	for ( int k = 0; k < LANES; k++ )
+	{
+		size_t count = end[k] - start[k];
+		for ( int c = 0; c < 9; c++ )
+		{
+			float scale = (c >= 3 && c < 6)? OBC_GYRO_SCALE : 1;
+			const double* src = imu[c] + start[k];
+			v4sf* dst = in[c].data();
+			for ( size_t step = 0; step < count; step++ )
+				dst[step][k] = src[step] * scale;
+			for ( size_t step = count; step < steps; step++ )
+				dst[step][k] = count? dst[count - 1][k] : 0;
+		}
+		for ( size_t step = 0; step < steps; step++ )
+		{
+			size_t i = start[k] + step;
+			float d = (step > 0 && step < count)? (ms[i] - ms[i - 1]) * 0.001f : 0;
+			bool again = step < count && (step == 0 || d <= 0 || d > ATTITUDE_MAX_DT);
+			dt[step][k] = again? 0 : d;
+			if ( again )
+				restart[step] |= 1 << k;
+		}
+	}
+
+	// Quaternion of every sample
+	vector<float> quat[4];
+	for ( int c = 0; c < 4; c++ )
+		quat[c].resize(n);
+
+	v4sf q[4] = { { 1, 1, 1, 1 }, { 0 }, { 0 }, { 0 } };
+	for ( size_t step = 0; step < steps; step++ )
+	{
+		if ( restart[step] )
+			for ( int k = 0; k < LANES; k++ )
+				if ( restart[step] & (1 << k) )
+				{
+					double r[4];
+					attitude_from_accel_mag(in[0][step][k], in[1][step][k], in[2][step][k],
+						in[6][step][k], in[7][step][k], in[8][step][k], r);
+					for ( int c = 0; c < 4; c++ )
+						q[c][k] = r[c];
+				}
+
+		madgwick_step(q, in[3][step], in[4][step], in[5][step], in[0][step], in[1][step], in[2][step],
+			in[6][step], in[7][step], in[8][step], dt[step], (float) beta);
+
+		for ( int k = 0; k < LANES; k++ )
+		{
+			size_t i = start[k] + step;
+			if ( i >= begin[k] && i < end[k] )
+				for ( int c = 0; c < 4; c++ )
+					quat[c][i] = q[c][k];
+		}
+	}
+
+	for ( size_t i = 0; i < n; i++ )
+		quaternion_to_euler(quat[0][i], quat[1][i], quat[2][i], quat[3][i], roll[i], pitch[i], yaw[i]);
+}
@@ -0,0 +1,49 @@
+//	OBCAttitude.h
+//	Interface for the IMU attitude estimator.  AttitudeFilter is a Madgwick MARG filter
+//	that is updated with every OBC record in the OBC reader thread, so each published
+//	record carries roll, pitch and yaw.  attitude_batch() runs the same filter over a
+//	recorded log, several segments of the flight at a time in SIMD lanes.
+//
+//	The accelerometer, gyroscope and magnetometer are assumed to share the IMU body axes.
+//	Accelerometer and magnetometer values are normalized, so their units don't matter;
+//	gyroscope values are in degrees per second (OBC_GYRO_SCALE converts them).  Angles are
+//	in degrees, yaw is magnetic heading.
+
+#ifndef _OBCAttitude_H_
+#define _OBCAttitude_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "OBCData.h"
+
+const double OBC_GYRO_SCALE = 3.14159265358979323846 / 180;	// Radians per second per gyro unit
+const double ATTITUDE_BETA = 0.1;		// Filter gain, larger trusts accel/mag more
+const double ATTITUDE_MAX_DT = 1.0;		// Longer gaps in seconds restart the filter
+const size_t ATTITUDE_WARMUP = 3000;		// Samples a batch lane runs before its segment
+
+
+// AttitudeFilter class definition
+class AttitudeFilter
+{
+public:
+	double q0, q1, q2, q3;	// Orientation quaternion
+
+	AttitudeFilter(double beta = ATTITUDE_BETA);
+	void reset();
+	void update(const OBCData &data);
+	void euler(double &roll, double &pitch, double &yaw) const;
+
+private:
+	double beta;
+	long last_ms;
+	bool initialized;
+};
+
+extern AttitudeFilter obc_attitude;
+
+extern void attitude_from_accel_mag(double ax, double ay, double az, double mx, double my, double mz, double q[4]);
+extern void attitude_batch(size_t n, const int64_t* ms, const double* const imu[9],
+	double* roll, double* pitch, double* yaw, double beta = ATTITUDE_BETA);
+
+#endif
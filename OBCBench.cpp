@@ -0,0 +1,555 @@
+//	OBCBench.cpp
+//	Benchmarks for the OBC data path.  Each mode times the current implementation
+//	against the implementation it replaced.
+//
+//	stream:	Throughput of the OBC record reader over a recorded stream.  If no
+//		file is given a synthetic recording is generated.
+//	publish: Reads per second of the latest OBC record by 1..N reader threads
+//		while the OBC thread keeps publishing.
+//	format:	Time of the OBCData text formatters against the ostringstream versions
+//		they replaced, after checking that both produce identical output.
+
+// System includes
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <random>
+#include <system_error>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <cstring>
+#include <unistd.h>
+
+// Local includes
+#include "OBCData.h"
+#include "OBCStream.h"
+#include "OBCFrame.h"
+
+// System namespace
+using namespace std;
+
+
+// Write a synthetic OBC recording of n records to a temporary file.
+// Return value: name of the file
+string make_recording(long n)
+{
+	char name[] = "/tmp/obcbenchXXXXXX";
+	int fd = mkstemp(name);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), name};
+	FILE* fp = fdopen(fd, "w");
+
+	for ( long i = 0; i < n; i++ )
+	{
+		long ms = 100 * i;
+		fprintf(fp, "$%ld,19,06,21,%02ld,%02ld,%02ld,%.7f,%.7f,%.2f", ms, (ms / 3600000) % 24, (ms / 60000) % 60,
+			(ms / 1000) % 60, 41.8781136 + i * 1e-6, -87.6297982 - i * 1e-6, 10000.0 + i * 0.1);
+		for ( int f = 0; f < 9; f++ )
+			fprintf(fp, ",%.2f", (f - 4) * 1.37 + (i % 100) * 0.01);
+		fprintf(fp, ";\r\n");
+	}
+	fclose(fp);
+	return name;
+}
+
+
+// Write the same synthetic recording as binary frames, one full frame followed by nine
+// IMU frames.
+// Return value: name of the file
+string make_frame_recording(long n)
+{
+	char name[] = "/tmp/obcbenchXXXXXX";
+	int fd = mkstemp(name);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), name};
+	FILE* fp = fdopen(fd, "w");
+
+	OBCData data = OBCData();
+	uint8_t frame[OBC_FRAME_MAX];
+	for ( long i = 0; i < n; i++ )
+	{
+		data.ms = 100 * i;
+		data.yy = 19;
+		data.mm = 6;
+		data.dd = 21;
+		data.hh = (data.ms / 3600000) % 24;
+		data.min = (data.ms / 60000) % 60;
+		data.ss = (data.ms / 1000) % 60;
+		data.lat = 41.8781136 + i * 1e-6;
+		data.lon = -87.6297982 - i * 1e-6;
+		data.alt = 10000.0 + i * 0.1;
+		double* imu[] = { &data.ax, &data.ay, &data.az, &data.gx, &data.gy, &data.gz, &data.mx, &data.my, &data.mz };
+		for ( int f = 0; f < 9; f++ )
+			*imu[f] = (f - 4) * 1.37 + (i % 100) * 0.01;
+		size_t len = encode_frame(data, (i % 10 == 0)? OBC_FRAME_FULL : OBC_FRAME_IMU, frame);
+		fwrite(frame, 1, len, fp);
+	}
+	fclose(fp);
+	return name;
+}
+
+
+// OBCData and SharedData as they were before SeqLock, with the input text in a
+// std::string and the record guarded by a mutex.
+struct LegacyOBCData
+{
+	bool obc_mode;
+	string input;
+	long ms;
+	int yy, mm, dd, hh, min, ss;
+	double lat, lon, alt;
+	double ax, ay, az, gx, gy, gz, mx, my, mz;
+
+	LegacyOBCData& operator=(const OBCData &data)
+	{
+		obc_mode = data.obc_mode;
+		input = data.input;
+		ms = data.ms;
+		yy = data.yy; mm = data.mm; dd = data.dd;
+		hh = data.hh; min = data.min; ss = data.ss;
+		lat = data.lat; lon = data.lon; alt = data.alt;
+		ax = data.ax; ay = data.ay; az = data.az;
+		gx = data.gx; gy = data.gy; gz = data.gz;
+		mx = data.mx; my = data.my; mz = data.mz;
+		return *this;
+	}
+};
+
+struct LegacySharedData
+{
+	mutex m;
+	LegacyOBCData obc_data;
+	bool available;
+} legacy_shared;
+
+
+// Exception-based field parser that OBCData used before parse_fixed().  Kept here
+// only as the reference for the benchmark.
+void legacy_parse_field(OBCData &data, string field, int pos)
+{
+	switch (pos)
+	{
+	case 0: data.ms = stol(field); break;
+	case 1: data.yy = stoi(field); break;
+	case 2: data.mm = stoi(field); break;
+	case 3: data.dd = stoi(field); break;
+	case 4: data.hh = stoi(field); break;
+	case 5: data.min = stoi(field); break;
+	case 6: data.ss = stoi(field); break;
+	case 7: data.lat = stod(field); break;
+	case 8: data.lon = stod(field); break;
+	case 9: data.alt = stod(field); break;
+	case 10: data.ax = stod(field); break;
+	case 11: data.ay = stod(field); break;
+	case 12: data.az = stod(field); break;
+	case 13: data.gx = stod(field); break;
+	case 14: data.gy = stod(field); break;
+	case 15: data.gz = stod(field); break;
+	case 16: data.mx = stod(field); break;
+	case 17: data.my = stod(field); break;
+	case 18: data.mz = stod(field); break;
+	}
+}
+
+
+// Byte-at-a-time reader that read_usb() used before OBCStream.  Kept here only as
+// the reference for the benchmark.
+long legacy_read(FILE* fp)
+{
+	int c = 0;
+	int pos = 0;
+	long records = 0;
+	string field;
+	string input;
+	OBCData input_data;
+	bool discard = true;
+
+	do {
+		try
+		{
+			c = fgetc(fp);
+			input += (char)c;
+			if ( discard && c != '$' )
+				continue;
+
+			if ( c == '$' )
+			{
+				discard = false;
+				pos = 0;
+				input_data = OBCData();
+				input = "";
+			}
+			else if ( c == ',' )
+			{
+				legacy_parse_field(input_data, field, pos);
+				pos++;
+				field = "";
+			}
+			else if ( c == ';' )
+			{
+				legacy_parse_field(input_data, field, pos);
+				field = "";
+
+				legacy_shared.m.lock();
+				legacy_shared.obc_data = input_data;
+				legacy_shared.obc_data.input = input;
+				legacy_shared.available = true;
+				legacy_shared.m.unlock();
+				records++;
+			}
+			else if ( isdigit(c) || c == '-' || c == '.' )
+			{
+				field += (char) c;
+			}
+		}
+		catch (const exception &e)
+		{
+			discard = true;
+		}
+
+	} while ( c != EOF );
+
+	return records;
+}
+
+
+// Reader used by read_usb()
+long stream_read(FILE* fp)
+{
+	OBCStream stream;
+	OBCData input_data;
+	int fd = fileno(fp);
+
+	while ( stream.fill(fd) > 0 )
+	{
+		while ( stream.next(input_data) )
+			shared_data.obc_data.store(input_data);
+	}
+	return stream.records;
+}
+
+
+// Time one pass of reader over filename.
+// Return value: throughput in MB/s
+double time_reader(long (*reader)(FILE*), const string &filename, long &records)
+{
+	FILE* fp = fopen(filename.c_str(), "r");
+	if ( fp == NULL )
+		throw system_error{errno, system_category(), filename};
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	rewind(fp);
+
+	auto t1 = chrono::steady_clock::now();
+	records = reader(fp);
+	auto t2 = chrono::steady_clock::now();
+	fclose(fp);
+
+	return size / chrono::duration<double>(t2 - t1).count() / 1e6;
+}
+
+
+void bench_stream(int argc, char* argv[])
+{
+	string filename;
+	bool temporary = false;
+	if ( argc > 0 )
+		filename = argv[0];
+	else
+	{
+		filename = make_recording(1000000);
+		temporary = true;
+	}
+
+	// Warm the page cache, then take the best of several passes
+	const int passes = 5;
+	double legacy = 0, current = 0;
+	long legacy_records = 0, current_records = 0;
+	for ( int i = 0; i < passes; i++ )
+	{
+		legacy = max(legacy, time_reader(legacy_read, filename, legacy_records));
+		current = max(current, time_reader(stream_read, filename, current_records));
+	}
+	if ( temporary )
+		unlink(filename.c_str());
+
+	cout << fixed << setprecision(1);
+	cout << "legacy fgetc reader: " << legacy << " MB/s, " << legacy_records << " records" << endl;
+	cout << "OBCStream reader:    " << current << " MB/s, " << current_records << " records" << endl;
+	cout << "speedup:             " << current / legacy << "x" << endl;
+
+	if ( temporary )
+	{
+		// Same records as binary frames
+		filename = make_frame_recording(1000000);
+		double frames = 0;
+		for ( int i = 0; i < passes; i++ )
+			frames = max(frames, time_reader(stream_read, filename, current_records));
+		unlink(filename.c_str());
+		cout << "OBCStream frames:    " << frames << " MB/s, " << current_records << " records" << endl;
+	}
+}
+
+
+// Run one publish trial: a writer stores records every period_us microseconds while
+// readers threads load the latest record as fast as they can for one second.
+// Return value: total loads per second over all readers
+double publish_trial(bool seqlock, int readers, int period_us)
+{
+	atomic<bool> running{true};
+	atomic<long> total{0};
+	OBCData sample = OBCData();
+	const char* text = "123456,19,06,21,12,30,05,41.8781136,-87.6297982,10000.12,0.10,0.20,9.81,1.00,2.00,3.00,40.00,50.00,60.00;";
+	strncpy(sample.input, text, MAX_RECORD - 1);
+
+	thread writer([&]() {
+		OBCData data = sample;
+		while ( running )
+		{
+			data.ms++;
+			if ( seqlock )
+				shared_data.obc_data.store(data);
+			else
+			{
+				legacy_shared.m.lock();
+				legacy_shared.obc_data = data;
+				legacy_shared.available = true;
+				legacy_shared.m.unlock();
+			}
+			this_thread::sleep_for(chrono::microseconds(period_us));
+		}
+	});
+
+	vector<thread> pool;
+	for ( int r = 0; r < readers; r++ )
+	{
+		pool.push_back(thread([&]() {
+			long n = 0;
+			long check = 0;
+			while ( running )
+			{
+				if ( seqlock )
+				{
+					OBCData data = shared_data.obc_data.load();
+					check += data.ms;
+				}
+				else
+				{
+					legacy_shared.m.lock();
+					LegacyOBCData data = legacy_shared.obc_data;
+					legacy_shared.m.unlock();
+					check += data.ms;
+				}
+				n++;
+			}
+			total += n + (check == -1);
+		}));
+	}
+
+	this_thread::sleep_for(chrono::seconds(1));
+	running = false;
+	writer.join();
+	for ( auto &t : pool )
+		t.join();
+	return total;
+}
+
+
+void bench_publish(int argc, char* argv[])
+{
+	int max_readers = (argc > 0)? atoi(argv[0]) : thread::hardware_concurrency();
+	if ( max_readers < 1 )
+		max_readers = 1;
+
+	cout << fixed << setprecision(2);
+	cout << "readers   mutex+string Mloads/s   SeqLock Mloads/s   (writer at 1 kHz)" << endl;
+	for ( int n = 1; n <= max_readers; n *= 2 )
+	{
+		double legacy = publish_trial(false, n, 1000) / 1e6;
+		double current = publish_trial(true, n, 1000) / 1e6;
+		cout << setw(7) << n << setw(26) << legacy << setw(19) << current << endl;
+		if ( n < max_readers && n * 2 > max_readers )
+			n = max_readers / 2;
+	}
+}
+
+
+// ostringstream formatters that OBCData used before CharWriter.  Kept here only as
+// the reference for the benchmark.
+string legacy_display(const OBCData &d)
+{
+	ostringstream output_line;
+	output_line << d.ms << " ";
+	output_line << d.yy << " ";
+	output_line << setw(2) << setfill('0') << d.mm << " ";
+	output_line << setw(2) << setfill('0') << d.dd << " ";
+	output_line << setw(2) << setfill('0') << d.hh << " ";
+	output_line << setw(2) << setfill('0') << d.min << " ";
+	output_line << setw(2) << setfill('0') << d.ss << " ";
+	output_line.flags(ios_base::fixed);
+	output_line.precision(5);
+	output_line << d.lat << " ";
+	output_line << d.lon << " ";
+	output_line.precision(2);
+	output_line << d.alt << " ";
+	output_line << d.ax << " ";
+	output_line << d.ay << " ";
+	output_line << d.az << " ";
+	output_line << d.gx << " ";
+	output_line << d.gy << " ";
+	output_line << d.gz << " ";
+	output_line << d.mx << " ";
+	output_line << d.my << " ";
+	output_line << d.mz;
+	return output_line.str();
+}
+
+string legacy_time_string(const OBCData &d)
+{
+	ostringstream output_line;
+	output_line << d.yy;
+	output_line << setw(2) << setfill('0') << d.mm;
+	output_line << setw(2) << setfill('0') << d.dd << "_";
+	output_line << setw(2) << setfill('0') << d.hh;
+	output_line << setw(2) << setfill('0') << d.min;
+	output_line << setw(2) << setfill('0') << d.ss << "_";
+	output_line << 1234567;
+	return output_line.str();
+}
+
+string legacy_gps_pos(const OBCData &d)
+{
+	ostringstream output_line;
+	output_line.flags(ios_base::fixed);
+	output_line << setprecision(5) << d.lat << ", " << d.lon << ", ";
+	output_line << setprecision(2) << d.alt;
+	return output_line.str();
+}
+
+string legacy_imu(const OBCData &d)
+{
+	ostringstream output_line;
+	output_line.flags(ios_base::fixed);
+	output_line << setprecision(2);
+	output_line << d.ax << ", " << d.ay << ", " << d.az << ", ";
+	output_line << d.gx << ", " << d.gy << ", " << d.gz << ", ";
+	output_line << d.mx << " ," << d.my << ", " << d.mz;
+	return output_line.str();
+}
+
+
+// Random record.  Some values are exact binary halves at the printed precision, the
+// cases where rounding is easiest to get wrong.
+OBCData random_record(mt19937_64 &rng)
+{
+	uniform_real_distribution<double> uniform(-200, 200);
+	uniform_int_distribution<int> small(-9, 99);
+	OBCData d = OBCData();
+	d.ms = rng() % 100000000;
+	d.yy = small(rng);
+	d.mm = small(rng);
+	d.dd = small(rng);
+	d.hh = small(rng);
+	d.min = small(rng);
+	d.ss = small(rng);
+	double* fields[] = { &d.lat, &d.lon, &d.alt, &d.ax, &d.ay, &d.az, &d.gx, &d.gy, &d.gz, &d.mx, &d.my, &d.mz };
+	for ( int i = 0; i < 12; i++ )
+	{
+		switch ( rng() % 4 )
+		{
+		case 0: *fields[i] = uniform(rng); break;
+		case 1: *fields[i] = (long) (uniform(rng) * 8) / 8.0; break;
+		case 2: *fields[i] = (long) (uniform(rng) * 1000) / 1000.0 + 0.005; break;
+		case 3: *fields[i] = -(double) (rng() % 2) * 0.001; break;
+		}
+	}
+	d.obc_mode = true;
+	return d;
+}
+
+
+void bench_format(int argc, char* argv[])
+{
+	const int n = (argc > 0)? atoi(argv[0]) : 200000;
+	mt19937_64 rng(1);
+	vector<OBCData> records;
+	for ( int i = 0; i < n; i++ )
+		records.push_back(random_record(rng));
+
+	// Check that output is identical.  The time string ends with clock(), so only
+	// the date and time part is compared.
+	char buf[OBC_TEXT_SIZE];
+	long mismatches = 0;
+	for ( auto &d : records )
+	{
+		string t = legacy_time_string(d);
+		bool same = (d.formatDisplay(buf, sizeof(buf)), legacy_display(d) == buf);
+		same = same && (d.formatGPSPos(buf, sizeof(buf)), legacy_gps_pos(d) == buf);
+		same = same && (d.formatIMU(buf, sizeof(buf)), legacy_imu(d) == buf);
+		d.formatTimeString(buf, sizeof(buf));
+		same = same && t.compare(0, t.rfind('_'), buf, string(buf).rfind('_')) == 0;
+		if ( !same && mismatches++ < 5 )
+			cerr << "mismatch: " << legacy_display(d) << endl;
+	}
+	cout << n << " records, " << mismatches << " mismatches" << endl;
+
+	// Time all four formatters per record
+	size_t check = 0;
+	auto t1 = chrono::steady_clock::now();
+	for ( auto &d : records )
+		check += legacy_display(d).size() + legacy_time_string(d).size() + legacy_gps_pos(d).size() + legacy_imu(d).size();
+	auto t2 = chrono::steady_clock::now();
+	for ( auto &d : records )
+		check += d.formatDisplay(buf, sizeof(buf)) + d.formatTimeString(buf, sizeof(buf)) + d.formatGPSPos(buf, sizeof(buf)) + d.formatIMU(buf, sizeof(buf));
+	auto t3 = chrono::steady_clock::now();
+
+	double legacy = chrono::duration<double, micro>(t2 - t1).count() / n;
+	double current = chrono::duration<double, micro>(t3 - t2).count() / n;
+	cout << fixed << setprecision(2);
+	cout << "ostringstream formatters: " << legacy << " us per record" << endl;
+	cout << "CharWriter formatters:    " << current << " us per record" << endl;
+	cout << "speedup:                  " << legacy / current << "x" << (check == 0? " " : "") << endl;
+}
+
+
+void usage()
+{
+	cerr << "usage: OBCBench stream [filename]" << endl;
+	cerr << "       OBCBench publish [max_readers]" << endl;
+	cerr << "       OBCBench format [records]" << endl;
+	exit(-1);
+}
+
+
+int main(int argc, char* argv[])
+{
+	if ( argc < 2 )
+		usage();
+
+	string mode = argv[1];
+	try
+	{
+		if ( mode == "stream" )
+			bench_stream(argc - 2, argv + 2);
+		else if ( mode == "publish" )
+			bench_publish(argc - 2, argv + 2);
+		else if ( mode == "format" )
+			bench_format(argc - 2, argv + 2);
+		else
+			usage();
+	}
+	catch (const system_error &e)
+	{
+		cerr << e.what() << endl;
+		exit(-1);
+	}
+	exit(0);
+}
@@ -8,19 +8,22 @@
 // System includes
 #include <string>
 #include <iostream>
-#include <iomanip>
-#include <sstream>
 #include <system_error>
 #include <thread>
-#include <mutex>
 #include <cstdio>
 #include <cerrno>
 #include <cctype>
+#include <climits>
 #include <ctime>
 #include <unistd.h>
 
 // Local includes
 #include "OBCData.h"
+#include "CharWriter.h"
+#include "OBCStream.h"
+#include "OBCHistory.h"
+#include "OBCLog.h"
+#include "OBCAttitude.h"
 
 // System namespace
 using namespace std;
@@ -35,184 +38,236 @@ SharedData shared_data;
 string get_time_string()
 {
 	time_t rawtime;
-	struct tm* timeinfo;
+	struct tm timeinfo;
 
+	// Called from every camera thread, so localtime() can't be used
 	time(&rawtime);
-	timeinfo = localtime(&rawtime);
+	localtime_r(&rawtime, &timeinfo);
 
 	char buffer[80];
-	strftime(buffer, sizeof(buffer), "%b %d %X", timeinfo);
+	strftime(buffer, sizeof(buffer), "%b %d %X", &timeinfo);
 	return string(buffer);
 }
 
 
-// Initialize USB device.
-// Attempt to open the device file and loop until successfully opened.
-FILE* init_usb(string dev_path, string timestr)
+// Publish a record received from the OBC to the shared buffer, the history and the
+// telemetry recorder.
+// Only the thread reading the OBC may call this.
+void publish_obc(OBCData &data)
 {
-	time_t tm1;
-	time(&tm1);
-	
-	// Attempt to open USB device repeatedly until successful
-	FILE* fp;
-	while ( (fp = fopen(dev_path.c_str(), "r")) == NULL )
+	int64_t now = monotonic_ns();
+	data.obc_mode = shared_data.obc_mode;
+	obc_attitude.update(data);
+	obc_attitude.euler(data.roll, data.pitch, data.yaw);
+	shared_data.obc_data.store(data);
+	obc_history.add(now, data);
+	obc_recorder.push(now, data);
+}
+
+
+// Read OBC data from a file or device opened with stdio until end of file.
+// Shared variable is updated with received data.  The flight software uses OBCLink
+// instead, which also reconnects the device.
+void read_usb(FILE* fp)
+{
+	OBCStream stream;
+	OBCData input_data;
+	int fd = fileno(fp);
+	ssize_t n;
+
+	while ( (n = stream.fill(fd)) != 0 )
 	{
-		if ( errno != EBUSY && errno != ENOENT )
+		if ( n < 0 )
 		{
-			system_error e {errno, system_category(), dev_path};
-			cerr << timestr << " " << e.what() << endl;
+			if ( errno == EINTR || errno == EAGAIN )
+				continue;
+			system_error e {errno, system_category(), "read_usb()"};
+			cerr << get_time_string() << " " << e.what() << endl;
+			break;
 		}
-		time_t tm2;
-		time(&tm2);
-		if ( 20 < difftime(tm2, tm1) )
+
+		while ( stream.next(input_data) )
 		{
-			throw system_error {errno, system_category(), timestr + " OBC not found on " + dev_path};
+			// Transfer input buffer to shared data
+			publish_obc(input_data);
 		}
-			
-		sleep(2);
 	}
 
-	// stty settings:
-	// speed 115200 baud; rows 0; columns 0; line = 0;
-	// intr = ^C; quit = ^\; erase = ^?; kill = ^U; eof = ^D; eol = <undef>; eol2 = <undef>; swtch = <undef>;
-	//  start = ^Q; stop = ^S;
-	// susp = ^Z; rprnt = ^R; werase = ^W; lnext = ^V; discard = ^O; min = 1; time = 0;
-	// -parenb -parodd -cmspar cs8 -hupcl -cstopb cread clocal -crtscts
-	// ignbrk -brkint -ignpar -parmrk -inpck -istrip -inlcr -igncr -icrnl -ixon -ixoff -iuclc -ixany -imaxbel -iutf8
-	// -opost -olcuc -ocrnl -onlcr -onocr -onlret -ofill -ofdel nl0 cr0 tab0 bs0 vt0 ff0
-	// -isig -icanon -iexten -echo -echoe -echok -echonl noflsh -xcase -tostop -echoprt -echoctl -echoke -flusho -extproc
+	fclose(fp);
+}
+
 
-	string magic{" 1:0:18b2:80:3:1c:7f:15:4:0:1:0:11:13:1a:0:12:f:17:16:0:0:0:0:0:0:0:0:0:0:0:0:0:0:0:0"};
-	string syscmd{"/bin/stty -F " + dev_path + magic};
-	system(syscmd.c_str());
+// Powers of ten that are exactly representable as a double
+static const double pow10_table[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-	cerr << timestr << " Configured USB device: " << dev_path << endl;
+// Longest digit string that fits in a long without overflow checks
+const int MAX_DIGITS = 18;
 
-	return fp;
+
+// Skip spaces and line ends around a field.
+static void trim_field(const char* &p, const char* &end)
+{
+	while ( p < end && isspace((unsigned char) *p) )
+		p++;
+	while ( end > p && isspace((unsigned char) end[-1]) )
+		end--;
 }
 
 
-// Read OBC data from the USB device continuously.
-// Shared variable is updated with received data
-void read_usb(FILE* fp)
+// Text for a FieldStatus value
+const char* field_status_string(FieldStatus status)
 {
-	int c;
-	int pos;
-	string field;
-	OBCData input_data;
-	bool discard = true;
+	switch (status)
+	{
+	case FIELD_OK: return "ok";
+	case FIELD_EMPTY: return "empty field";
+	case FIELD_INVALID: return "invalid character";
+	case FIELD_RANGE: return "too many digits";
+	}
+	return "unknown";
+}
 
-	do {
-		try
-		{
-			c = fgetc(fp);
-			input_data.input += (char)c;
-			if ( discard && c != '$' )
-				// Discard input data until next record delimiter
-				continue;
 
-			if ( c == '$' )
-			{
-				// Found start of record so reset input buffer
-				discard = false;
-				pos = 0;
-				input_data = OBCData();
-			}
-			else if ( c == ',' )
-			{
-				// Populate field at current position and clear field
-				input_data.parseField(field, pos);
-				pos++;
-				field = "";
-			}
-			else if ( c == ';' )
-			{
-				// Populate field at current position
-				input_data.parseField(field, pos);
-				field = "";
-
-				// Transfer input buffer to shared data
-				shared_data.m.lock();
-				input_data.obc_mode = shared_data.obc_data.obc_mode;
-				shared_data.obc_data = input_data;
-				shared_data.available = true;
-				shared_data.m.unlock();
-			}
-			else if ( isdigit(c) || c == '-' || c == '.' )
-			{
-				field += (char) c;
-			}
-		}
-		catch (const exception &e)
-		{
-			cerr << get_time_string() << " Exception in read_usb(), pos = " << pos;
-			cerr << " field = [" << field << "] " << e.what() << endl;
+// Parse an optionally signed decimal integer of up to MAX_DIGITS digits.
+FieldStatus parse_integer(const char* p, size_t len, long &value)
+{
+	const char* end = p + len;
+	trim_field(p, end);
 
-			// Ignore input until next record delimiter
-			discard = true;
-		}
+	bool negative = false;
+	if ( p < end && *p == '-' )
+	{
+		negative = true;
+		p++;
+	}
+	if ( p == end )
+		return FIELD_EMPTY;
+	if ( end - p > MAX_DIGITS )
+		return FIELD_RANGE;
 
-	} while ( c != EOF );
+	long n = 0;
+	for ( ; p < end; p++ )
+	{
+		unsigned d = (unsigned char) *p - '0';
+		if ( d > 9 )
+			return FIELD_INVALID;
+		n = n * 10 + d;
+	}
+	value = negative? -n : n;
+	return FIELD_OK;
+}
 
-	fclose(fp);
+
+// Parse an optionally signed fixed-point decimal such as -87.6297982.
+// The digits are accumulated as an integer and scaled once by an exact power of
+// ten, so the result is the correctly rounded double for up to 15 significant
+// digits, the same value stod() produces.
+FieldStatus parse_fixed(const char* p, size_t len, double &value)
+{
+	const char* end = p + len;
+	trim_field(p, end);
+
+	bool negative = false;
+	if ( p < end && *p == '-' )
+	{
+		negative = true;
+		p++;
+	}
+
+	long n = 0;
+	int digits = 0;
+	int decimals = 0;
+	bool point = false;
+	for ( ; p < end; p++ )
+	{
+		unsigned d = (unsigned char) *p - '0';
+		if ( d <= 9 )
+		{
+			if ( ++digits > MAX_DIGITS )
+				return FIELD_RANGE;
+			n = n * 10 + d;
+			decimals += point;
+		}
+		else if ( *p == '.' && !point )
+			point = true;
+		else
+			return FIELD_INVALID;
+	}
+	if ( digits == 0 )
+		return FIELD_EMPTY;
+
+	double v = (double) n / pow10_table[decimals];
+	value = negative? -v : v;
+	return FIELD_OK;
 }
 
 
-// Parse data read from the USB device
-void OBCData::parseField(string field, int pos)
+// Parse data read from the USB device.  Fields past the last known position are ignored.
+FieldStatus OBCData::parseField(const char* field, size_t len, int pos)
 {
+	long n = 0;
+	double *d = NULL;
 	switch (pos)
 	{
-	case 0: ms = stol(field); break;
-	case 1: yy = stoi(field); break;
-	case 2: mm = stoi(field); break;
-	case 3: dd = stoi(field); break;
-	case 4: hh = stoi(field); break;
-	case 5: min = stoi(field); break;
-	case 6: ss = stoi(field); break;
-	case 7: lat = stod(field); break;
-	case 8: lon = stod(field); break;
-	case 9: alt = stod(field); break;
-	case 10: ax = stod(field); break;
-	case 11: ay = stod(field); break;
-	case 12: az = stod(field); break;
-	case 13: gx = stod(field); break;
-	case 14: gy = stod(field); break;
-	case 15: gz = stod(field); break;
-	case 16: mx = stod(field); break;
-	case 17: my = stod(field); break;
-	case 18: mz = stod(field); break;
+	case 0:
+		return parse_integer(field, len, ms);
+	case 1: case 2: case 3: case 4: case 5: case 6:
+	{
+		FieldStatus status = parse_integer(field, len, n);
+		if ( status != FIELD_OK )
+			return status;
+		if ( n < INT_MIN || n > INT_MAX )
+			return FIELD_RANGE;
+		int *fields[] = { &yy, &mm, &dd, &hh, &min, &ss };
+		*fields[pos - 1] = (int) n;
+		return FIELD_OK;
 	}
+	case 7: d = &lat; break;
+	case 8: d = &lon; break;
+	case 9: d = &alt; break;
+	case 10: d = &ax; break;
+	case 11: d = &ay; break;
+	case 12: d = &az; break;
+	case 13: d = &gx; break;
+	case 14: d = &gy; break;
+	case 15: d = &gz; break;
+	case 16: d = &mx; break;
+	case 17: d = &my; break;
+	case 18: d = &mz; break;
+	default:
+		return FIELD_OK;
+	}
+	return parse_fixed(field, len, *d);
 }
 
 
 // Display the entire OBC data record
-string OBCData::display()
+size_t OBCData::formatDisplay(char* buf, size_t size) const
 {
-	ostringstream output_line;
-	output_line << ms << " ";
-	output_line << yy << " ";
-	output_line << setw(2) << setfill('0') << mm << " ";
-	output_line << setw(2) << setfill('0') << dd << " ";
-	output_line << setw(2) << setfill('0') << hh << " ";
-	output_line << setw(2) << setfill('0') << min << " ";
-	output_line << setw(2) << setfill('0') << ss << " ";
-	output_line.flags(ios_base::fixed);
-	output_line.precision(5);
-	output_line << lat << " ";
-	output_line << lon << " ";
-	output_line.precision(2);
-	output_line << alt << " ";
-	output_line << ax << " ";
-	output_line << ay << " ";
-	output_line << az << " ";
-	output_line << gx << " ";
-	output_line << gy << " ";
-	output_line << gz << " ";
-	output_line << mx << " ";
-	output_line << my << " ";
-	output_line << mz;
-	return output_line.str();
+	CharWriter out(buf, size);
+	out.integer(ms).ch(' ');
+	out.integer(yy).ch(' ');
+	out.integer(mm, 2).ch(' ');
+	out.integer(dd, 2).ch(' ');
+	out.integer(hh, 2).ch(' ');
+	out.integer(min, 2).ch(' ');
+	out.integer(ss, 2).ch(' ');
+	out.fixed(lat, 5).ch(' ');
+	out.fixed(lon, 5).ch(' ');
+	out.fixed(alt, 2).ch(' ');
+	out.fixed(ax, 2).ch(' ');
+	out.fixed(ay, 2).ch(' ');
+	out.fixed(az, 2).ch(' ');
+	out.fixed(gx, 2).ch(' ');
+	out.fixed(gy, 2).ch(' ');
+	out.fixed(gz, 2).ch(' ');
+	out.fixed(mx, 2).ch(' ');
+	out.fixed(my, 2).ch(' ');
+	out.fixed(mz, 2);
+	return out.length();
 }
 
 
@@ -220,58 +275,97 @@ string OBCData::display()
 //	YYYYMMDD_HHMMSS_NNNNNNN
 // The NNNNNNN value increases monotonically to provide a unique value during
 // the lifetime of program execution. 
-string OBCData::getTimeString()
+size_t OBCData::formatTimeString(char* buf, size_t size) const
 {
-	ostringstream output_line;
+	CharWriter out(buf, size);
 	if ( obc_mode )
 	{
-		//output_line << "OBC";
-		output_line << yy;
-		output_line << setw(2) << setfill('0') << mm;
-		output_line << setw(2) << setfill('0') << dd << "_";
-		output_line << setw(2) << setfill('0') << hh;
-		output_line << setw(2) << setfill('0') << min;
-		output_line << setw(2) << setfill('0') << ss << "_";
+		out.integer(yy);
+		out.integer(mm, 2);
+		out.integer(dd, 2).ch('_');
+		out.integer(hh, 2);
+		out.integer(min, 2);
+		out.integer(ss, 2).ch('_');
 	}
 	else
 	{
 		// OBC not available, so generate time string from local time
 		time_t rawtime;
-		struct tm* timeinfo;
+		struct tm timeinfo;
 
 		time(&rawtime);
-		timeinfo = localtime(&rawtime);
-		//output_line << "ODR";
-		output_line << timeinfo->tm_year + 1900;
-		output_line << setw(2) << setfill('0') << timeinfo->tm_mon;
-		output_line << setw(2) << setfill('0') << timeinfo->tm_mday << "_";
-		output_line << setw(2) << setfill('0') << timeinfo->tm_hour;
-		output_line << setw(2) << setfill('0') << timeinfo->tm_min;
-		output_line << setw(2) << setfill('0') << timeinfo->tm_sec << "_";
+		localtime_r(&rawtime, &timeinfo);
+		out.integer(timeinfo.tm_year + 1900);
+		out.integer(timeinfo.tm_mon, 2);
+		out.integer(timeinfo.tm_mday, 2).ch('_');
+		out.integer(timeinfo.tm_hour, 2);
+		out.integer(timeinfo.tm_min, 2);
+		out.integer(timeinfo.tm_sec, 2).ch('_');
 	}
 	// Use Odroid process time to provide a unique value
-	output_line << clock();
-	return output_line.str();
+	out.integer(clock());
+	return out.length();
+}
+
+
+size_t OBCData::formatGPSPos(char* buf, size_t size) const
+{
+	CharWriter out(buf, size);
+	out.fixed(lat, 5).str(", ").fixed(lon, 5).str(", ");
+	out.fixed(alt, 2);
+	return out.length();
+}
+
+
+size_t OBCData::formatIMU(char* buf, size_t size) const
+{
+	CharWriter out(buf, size);
+	out.fixed(ax, 2).str(", ").fixed(ay, 2).str(", ").fixed(az, 2).str(", ");
+	out.fixed(gx, 2).str(", ").fixed(gy, 2).str(", ").fixed(gz, 2).str(", ");
+	out.fixed(mx, 2).str(" ,").fixed(my, 2).str(", ").fixed(mz, 2);
+	return out.length();
+}
+
+
+size_t OBCData::formatAttitude(char* buf, size_t size) const
+{
+	CharWriter out(buf, size);
+	out.fixed(roll, 2).str(", ").fixed(pitch, 2).str(", ").fixed(yaw, 2);
+	return out.length();
+}
+
+
+// String versions of the formatters above
+string OBCData::display()
+{
+	char buf[OBC_TEXT_SIZE];
+	return string(buf, formatDisplay(buf, sizeof(buf)));
+}
+
+
+string OBCData::getTimeString()
+{
+	char buf[OBC_TEXT_SIZE];
+	return string(buf, formatTimeString(buf, sizeof(buf)));
 }
 
 
 string OBCData::getGPSPos()
 {
-	ostringstream output_line;
-	output_line.flags(ios_base::fixed);
-	output_line << setprecision(5) << lat << ", " << lon << ", ";
-	output_line << setprecision(2) << alt;
-	return output_line.str();
+	char buf[OBC_TEXT_SIZE];
+	return string(buf, formatGPSPos(buf, sizeof(buf)));
 }
 
 
 string OBCData::getIMU()
 {
-	ostringstream output_line;
-	output_line.flags(ios_base::fixed);
-	output_line << setprecision(2);
-	output_line << ax << ", " << ay << ", " << az << ", ";
-	output_line << gx << ", " << gy << ", " << gz << ", ";
-	output_line << mx << " ," << my << ", " << mz;
-	return output_line.str();
+	char buf[OBC_TEXT_SIZE];
+	return string(buf, formatIMU(buf, sizeof(buf)));
+}
+
+
+string OBCData::getAttitude()
+{
+	char buf[OBC_TEXT_SIZE];
+	return string(buf, formatAttitude(buf, sizeof(buf)));
 }
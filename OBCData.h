@@ -5,9 +5,26 @@
 #ifndef _OBCData_H_
 #define _OBCData_H_
 
+#include <string>
+#include <cstdio>
+
+#include "SeqLock.h"
+
 using namespace std;
 
 const int MAX_FIELDS=19;
+const int MAX_RECORD=256;	// Longest record accepted from the OBC
+const int OBC_TEXT_SIZE=384;	// Buffer size that holds any of the OBCData format*() results
+
+
+// Status codes returned when parsing an OBC field
+enum FieldStatus
+{
+	FIELD_OK,	// Field parsed
+	FIELD_EMPTY,	// Field contains no digits
+	FIELD_INVALID,	// Field contains characters that are not part of a number
+	FIELD_RANGE	// Field has too many digits for the value type
+};
 
 
 // OBCData class definition
@@ -15,7 +32,7 @@ class OBCData
 {
 public:
 	bool obc_mode;	// Flag indicating whether or not OBC is available.
-	string input;	// Input string as read
+	char input[MAX_RECORD];	// Input string as read
 	long ms;	// OBC internal time in milliseconds
 	int yy;		// Two digit year from GPS
 	int mm;		// Two digit month from GPS
@@ -35,27 +52,38 @@ public:
 	double mx;	// IMU magnetometer in the x-axis
 	double my;	// IMU magnetometer in the y-axis
 	double mz;	// IMU magnetometer in the z-axis
+	double roll;	// Estimated roll in degrees, filled in when the record is published
+	double pitch;	// Estimated pitch in degrees
+	double yaw;	// Estimated magnetic heading in degrees
 
-	void parseField(string field, int pos);
+	FieldStatus parseField(const char* field, size_t len, int pos);
+	size_t formatDisplay(char* buf, size_t size) const;
+	size_t formatTimeString(char* buf, size_t size) const;
+	size_t formatGPSPos(char* buf, size_t size) const;
+	size_t formatIMU(char* buf, size_t size) const;
+	size_t formatAttitude(char* buf, size_t size) const;
 	string display();
 	string getTimeString();
 	string getGPSPos();
 	string getIMU();
+	string getAttitude();
 };
 
 
-// Shared data buffer
+// Shared data buffer.  The OBC reader thread is the only writer of obc_data.
 struct SharedData
 {
-	mutex m;
-	OBCData obc_data;
-	bool available;		// Flag indicating data is available in shared data buffer
+	bool obc_mode;			// Flag indicating whether or not OBC is available
+	SeqLock<OBCData> obc_data;	// Most recent record from the OBC
 };
 
 extern SharedData shared_data;
 
 extern string get_time_string();
-extern FILE* init_usb(string dev_path, string timestr);
+extern const char* field_status_string(FieldStatus status);
+extern FieldStatus parse_integer(const char* p, size_t len, long &value);
+extern FieldStatus parse_fixed(const char* p, size_t len, double &value);
+extern void publish_obc(OBCData &data);
 extern void read_usb(FILE* fp);
 
 #endif
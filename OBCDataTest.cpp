@@ -6,7 +6,6 @@
 #include <iostream>
 #include <system_error>
 #include <thread>
-#include <mutex>
 #include <cstdio>
 #include <unistd.h>
 
@@ -39,27 +38,23 @@ int main(int argc, char* argv[])
 		throw system_error{errno, system_category(), filename};
 	}
 
-	shared_data.obc_data.obc_mode = true;
-	cerr << "shared_data.available: " << shared_data.available << endl;
+	shared_data.obc_mode = true;
+	cerr << "shared_data.obc_data.sequence(): " << shared_data.obc_data.sequence() << endl;
 
 	thread t1 {read_usb, fp};
 
+	unsigned last_seq = 0;
 	while (true)
 	{
+		// Sleep until the reader thread publishes a new record
+		if ( !shared_data.obc_data.wait(last_seq, 2000) )
+			continue;
+
 		OBCData data;
-		shared_data.m.lock();
-		if ( shared_data.available )
-		{
-			data = shared_data.obc_data;
-			shared_data.available = false;
-		}
-		shared_data.m.unlock();
-		if ( data.input != "" )
-		{
-			cout << "read: " << " " << data.input << endl;
-			cout << "parsed: " << data.display() << endl;
-			cout << "parsed: " << data.getTimeString() << endl;
-		}
-		//sleep(2);
+		last_seq = shared_data.obc_data.load(data);
+		cout << "read: " << " " << data.input << endl;
+		cout << "parsed: " << data.display() << endl;
+		cout << "parsed: " << data.getTimeString() << endl;
+		cout << "attitude: " << data.getAttitude() << endl;
 	}
 }
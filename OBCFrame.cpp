@@ -0,0 +1,154 @@
+//	OBCFrame.cpp
+//	Encoding and decoding of binary OBC frames.  See OBCFrame.h for the frame layout.
+
+// System includes
+#include <cstring>
+#include <cmath>
+
+// Local includes
+#include "OBCFrame.h"
+
+// System namespace
+using namespace std;
+
+
+// CRC-16/CCITT-FALSE lookup table
+struct CrcTable
+{
+	uint16_t entry[256];
+
+	CrcTable()
+	{
+		for ( int i = 0; i < 256; i++ )
+		{
+			uint16_t crc = i << 8;
+			for ( int bit = 0; bit < 8; bit++ )
+				crc = (crc & 0x8000)? (crc << 1) ^ 0x1021 : crc << 1;
+			entry[i] = crc;
+		}
+	}
+};
+
+static const CrcTable crc_table;
+
+
+// CRC-16/CCITT-FALSE of len bytes at p
+uint16_t crc16_ccitt(const uint8_t* p, size_t len)
+{
+	uint16_t crc = 0xFFFF;
+	while ( len-- )
+		crc = (crc << 8) ^ crc_table.entry[(crc >> 8) ^ *p++];
+	return crc;
+}
+
+
+// Little-endian field access
+static uint32_t get_u32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static float get_f32(const uint8_t* p)
+{
+	uint32_t u = get_u32(p);
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+static void put_u32(uint8_t* p, uint32_t u)
+{
+	p[0] = u;
+	p[1] = u >> 8;
+	p[2] = u >> 16;
+	p[3] = u >> 24;
+}
+
+static void put_f32(uint8_t* p, float f)
+{
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	put_u32(p, u);
+}
+
+
+// Encode data as a frame of the given type into out, which must hold OBC_FRAME_MAX bytes.
+// Return value: length of the frame in bytes
+size_t encode_frame(const OBCData &data, uint8_t type, uint8_t* out)
+{
+	uint8_t* p = out + OBC_FRAME_HEADER;
+	put_u32(p, data.ms);
+	p += 4;
+	if ( type == OBC_FRAME_FULL )
+	{
+		*p++ = data.yy;
+		*p++ = data.mm;
+		*p++ = data.dd;
+		*p++ = data.hh;
+		*p++ = data.min;
+		*p++ = data.ss;
+		put_u32(p, (int32_t) lround(data.lat * 1e7));
+		put_u32(p + 4, (int32_t) lround(data.lon * 1e7));
+		put_u32(p + 8, (int32_t) lround(data.alt * 100));
+		p += 12;
+	}
+	const double imu[] = { data.ax, data.ay, data.az, data.gx, data.gy, data.gz, data.mx, data.my, data.mz };
+	for ( int i = 0; i < 9; i++, p += 4 )
+		put_f32(p, imu[i]);
+
+	size_t payload = p - out - OBC_FRAME_HEADER;
+	out[0] = OBC_SYNC0;
+	out[1] = OBC_SYNC1;
+	out[2] = type;
+	out[3] = payload;
+	uint16_t crc = crc16_ccitt(out + 2, payload + 2);
+	*p++ = crc;
+	*p++ = crc >> 8;
+	return p - out;
+}
+
+
+// Decode the frame starting at p, with avail bytes available.  For an IMU frame the GPS
+// fields of data are left as they are.
+// Return value: FRAME_OK with the frame length in len, or why the frame wasn't decoded
+FrameStatus decode_frame(const uint8_t* p, size_t avail, size_t &len, OBCData &data)
+{
+	if ( avail < OBC_FRAME_HEADER )
+		return FRAME_SHORT;
+	if ( p[0] != OBC_SYNC0 || p[1] != OBC_SYNC1 )
+		return FRAME_BAD;
+
+	size_t payload = p[3];
+	if ( !(p[2] == OBC_FRAME_FULL && payload == OBC_FULL_PAYLOAD) && !(p[2] == OBC_FRAME_IMU && payload == OBC_IMU_PAYLOAD) )
+		return FRAME_BAD;
+
+	len = OBC_FRAME_HEADER + payload + OBC_FRAME_CRC;
+	if ( avail < len )
+		return FRAME_SHORT;
+
+	const uint8_t* q = p + OBC_FRAME_HEADER + payload;
+	if ( crc16_ccitt(p + 2, payload + 2) != (q[0] | (q[1] << 8)) )
+		return FRAME_CRC;
+
+	q = p + OBC_FRAME_HEADER;
+	data.ms = get_u32(q);
+	q += 4;
+	if ( p[2] == OBC_FRAME_FULL )
+	{
+		data.yy = *q++;
+		data.mm = *q++;
+		data.dd = *q++;
+		data.hh = *q++;
+		data.min = *q++;
+		data.ss = *q++;
+		data.lat = (int32_t) get_u32(q) / 1e7;
+		data.lon = (int32_t) get_u32(q + 4) / 1e7;
+		data.alt = (int32_t) get_u32(q + 8) / 100.0;
+		q += 12;
+	}
+	double* imu[] = { &data.ax, &data.ay, &data.az, &data.gx, &data.gy, &data.gz, &data.mx, &data.my, &data.mz };
+	for ( int i = 0; i < 9; i++, q += 4 )
+		*imu[i] = get_f32(q);
+	data.input[0] = '\0';
+	return FRAME_OK;
+}
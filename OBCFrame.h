@@ -0,0 +1,62 @@
+//	OBCFrame.h
+//	Binary framing of OBC records.  The OBC may send these frames instead of, or mixed
+//	with, the ASCII "$ms,yy,...;" records; OBCStream recognizes both.
+//
+//	Frame layout, all multi-byte values little-endian:
+//
+//	offset	size	field
+//	0	2	sync word 0xA5 0x5A
+//	2	1	frame type (OBC_FRAME_FULL or OBC_FRAME_IMU)
+//	3	1	payload length in bytes (58 or 40)
+//	4	n	payload
+//	4+n	2	CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) of bytes 2 .. 3+n
+//
+//	OBC_FRAME_FULL payload (58 bytes), a complete record:
+//	0	u32	ms	OBC internal time in milliseconds
+//	4	u8	yy, mm, dd, hh, min, ss	GPS date and time
+//	10	s32	lat	GPS latitude in 1e-7 degrees
+//	14	s32	lon	GPS longitude in 1e-7 degrees
+//	18	s32	alt	GPS altitude in centimetres
+//	22	f32	ax, ay, az, gx, gy, gz, mx, my, mz	IMU values (IEEE 754 single)
+//
+//	OBC_FRAME_IMU payload (40 bytes), an IMU sample between GPS updates:
+//	0	u32	ms
+//	4	f32	ax, ay, az, gx, gy, gz, mx, my, mz
+//	The GPS date, time and position are taken from the last full frame.
+//
+//	A full frame is 64 bytes and an IMU frame 46 bytes, against about 110 bytes for the
+//	text record, so the IMU rate can be raised 2.4x on the same 115200 baud link.
+
+#ifndef _OBCFrame_H_
+#define _OBCFrame_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "OBCData.h"
+
+const uint8_t OBC_SYNC0 = 0xA5;		// First byte of the sync word
+const uint8_t OBC_SYNC1 = 0x5A;		// Second byte of the sync word
+const uint8_t OBC_FRAME_FULL = 0x01;	// Frame type of a complete record
+const uint8_t OBC_FRAME_IMU = 0x02;	// Frame type of an IMU-only record
+const size_t OBC_FRAME_HEADER = 4;	// Sync word, type and length
+const size_t OBC_FRAME_CRC = 2;
+const size_t OBC_FULL_PAYLOAD = 58;
+const size_t OBC_IMU_PAYLOAD = 40;
+const size_t OBC_FRAME_MAX = OBC_FRAME_HEADER + OBC_FULL_PAYLOAD + OBC_FRAME_CRC;
+
+
+// Result of decoding a frame
+enum FrameStatus
+{
+	FRAME_OK,	// Frame decoded
+	FRAME_SHORT,	// More bytes are needed to decode the frame
+	FRAME_BAD,	// Not a frame header, resynchronize at the next byte
+	FRAME_CRC	// Frame failed the CRC check, resynchronize at the next byte
+};
+
+extern uint16_t crc16_ccitt(const uint8_t* p, size_t len);
+extern size_t encode_frame(const OBCData &data, uint8_t type, uint8_t* out);
+extern FrameStatus decode_frame(const uint8_t* p, size_t avail, size_t &len, OBCData &data);
+
+#endif
@@ -0,0 +1,213 @@
+//	OBCHistory.cpp
+//	Implementation of OBCHistory class.  Records are kept in a power-of-two ring indexed
+//	by a running count.  The search keys of each slot are mirrored in atomic arrays so a
+//	lookup can binary search without copying records.  Only the two records that bracket
+//	the requested time are copied out, through the per-slot SeqLock, and then checked
+//	against the keys in case the writer replaced them during the search.
+
+// System includes
+#include <algorithm>
+#include <ctime>
+#include <cerrno>
+
+// Local includes
+#include "OBCHistory.h"
+
+// System namespace
+using namespace std;
+
+// Records this close to being overwritten are not searched
+const unsigned long HISTORY_MARGIN = 8;
+
+OBCHistory obc_history;
+
+
+// Current local monotonic time in nanoseconds
+int64_t monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Sleep until monotonic time t.  Sleeping to an absolute time doesn't add up the
+// delays of waking, as repeated relative sleeps do.
+void sleep_until_ns(int64_t t)
+{
+	struct timespec ts;
+	ts.tv_sec = t / 1000000000;
+	ts.tv_nsec = t % 1000000000;
+	while ( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR )
+		;
+}
+
+
+// Angle in degrees between a and b, going the short way round through +-180
+static double interpolate_angle(double a, double b, double f)
+{
+	double d = b - a;
+	if ( d > 180 )
+		d -= 360;
+	else if ( d < -180 )
+		d += 360;
+	double r = a + d * f;
+	if ( r > 180 )
+		r -= 360;
+	else if ( r <= -180 )
+		r += 360;
+	return r;
+}
+
+
+// Linear interpolation of a record between a (f = 0) and b (f = 1).  OBC time, GPS
+// position, IMU values and attitude are interpolated; the GPS date and time fields and
+// the input text are taken from a.
+void interpolate_obc(const OBCData &a, const OBCData &b, double f, OBCData &out)
+{
+	out = a;
+	out.ms = a.ms + (long) ((b.ms - a.ms) * f + 0.5);
+	out.lat = a.lat + (b.lat - a.lat) * f;
+	out.lon = a.lon + (b.lon - a.lon) * f;
+	out.alt = a.alt + (b.alt - a.alt) * f;
+	out.ax = a.ax + (b.ax - a.ax) * f;
+	out.ay = a.ay + (b.ay - a.ay) * f;
+	out.az = a.az + (b.az - a.az) * f;
+	out.gx = a.gx + (b.gx - a.gx) * f;
+	out.gy = a.gy + (b.gy - a.gy) * f;
+	out.gz = a.gz + (b.gz - a.gz) * f;
+	out.mx = a.mx + (b.mx - a.mx) * f;
+	out.my = a.my + (b.my - a.my) * f;
+	out.mz = a.mz + (b.mz - a.mz) * f;
+	out.roll = interpolate_angle(a.roll, b.roll, f);
+	out.pitch = a.pitch + (b.pitch - a.pitch) * f;
+	out.yaw = interpolate_angle(a.yaw, b.yaw, f);
+}
+
+
+OBCHistory::OBCHistory() : count(0), ms_start(0), last_ms(0)
+{
+	for ( int i = 0; i < OBC_HISTORY_SIZE; i++ )
+	{
+		mono_keys[i].store(0, memory_order_relaxed);
+		ms_keys[i].store(0, memory_order_relaxed);
+	}
+}
+
+
+// Append a record received at local time mono_ns.  Must only be called from one thread,
+// with non-decreasing mono_ns.
+void OBCHistory::add(int64_t mono_ns, const OBCData &data)
+{
+	unsigned long n = count.load(memory_order_relaxed);
+	int slot = n & (OBC_HISTORY_SIZE - 1);
+
+	OBCSample sample;
+	sample.mono_ns = mono_ns;
+	sample.data = data;
+	slots[slot].store(sample);
+	mono_keys[slot].store(mono_ns, memory_order_relaxed);
+	ms_keys[slot].store(data.ms, memory_order_relaxed);
+
+	// OBC time went backwards, so the OBC restarted and older records can't be
+	// searched by OBC time
+	if ( n > 0 && data.ms < last_ms )
+		ms_start.store(n, memory_order_relaxed);
+	last_ms = data.ms;
+
+	count.store(n + 1, memory_order_release);
+}
+
+
+// Number of records ever added
+unsigned long OBCHistory::size() const
+{
+	return count.load(memory_order_acquire);
+}
+
+
+// Record at local monotonic time mono_ns, interpolated between neighbouring records
+HistoryStatus OBCHistory::atTime(int64_t mono_ns, OBCData &data) const
+{
+	return lookup(false, mono_ns, data);
+}
+
+
+// Record at OBC time ms, interpolated between neighbouring records
+HistoryStatus OBCHistory::atOBCTime(long ms, OBCData &data) const
+{
+	return lookup(true, ms, data);
+}
+
+
+HistoryStatus OBCHistory::lookup(bool by_ms, int64_t key, OBCData &data) const
+{
+	while ( true )
+	{
+		unsigned long n = count.load(memory_order_acquire);
+		if ( n == 0 )
+			return HISTORY_EMPTY;
+
+		// Searchable range of record numbers [lo, hi]
+		unsigned long lo = (n > OBC_HISTORY_SIZE - HISTORY_MARGIN)? n - (OBC_HISTORY_SIZE - HISTORY_MARGIN) : 0;
+		unsigned long hi = n - 1;
+		if ( by_ms )
+			lo = max(lo, min(ms_start.load(memory_order_relaxed), hi));
+
+		const atomic<int64_t>* mono = mono_keys;
+		const atomic<long>* ms = ms_keys;
+		auto key_at = [&](unsigned long i) -> int64_t {
+			int slot = i & (OBC_HISTORY_SIZE - 1);
+			return by_ms? ms[slot].load(memory_order_relaxed) : mono[slot].load(memory_order_relaxed);
+		};
+
+		// Find the last record at or before key
+		HistoryStatus status;
+		unsigned long i;
+		if ( key < key_at(lo) )
+		{
+			status = HISTORY_BEFORE;
+			i = lo;
+		}
+		else if ( key >= key_at(hi) )
+		{
+			status = HISTORY_AFTER;
+			i = hi;
+		}
+		else
+		{
+			status = HISTORY_INTERPOLATED;
+			unsigned long a = lo, b = hi;
+			while ( b - a > 1 )
+			{
+				unsigned long mid = a + (b - a) / 2;
+				if ( key_at(mid) <= key )
+					a = mid;
+				else
+					b = mid;
+			}
+			i = a;
+		}
+
+		// Copy out the bracketing records, then make sure the writer hasn't reused
+		// their slots in the meantime
+		OBCSample s1, s2;
+		slots[i & (OBC_HISTORY_SIZE - 1)].load(s1);
+		if ( status == HISTORY_INTERPOLATED )
+			slots[(i + 1) & (OBC_HISTORY_SIZE - 1)].load(s2);
+		if ( count.load(memory_order_acquire) - lo >= OBC_HISTORY_SIZE )
+			continue;
+
+		if ( status != HISTORY_INTERPOLATED )
+		{
+			data = s1.data;
+			return status;
+		}
+
+		double k1 = by_ms? s1.data.ms : s1.mono_ns;
+		double k2 = by_ms? s2.data.ms : s2.mono_ns;
+		double f = (k2 > k1)? (key - k1) / (k2 - k1) : 0;
+		interpolate_obc(s1.data, s2.data, f, data);
+		return status;
+	}
+}
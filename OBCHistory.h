@@ -0,0 +1,67 @@
+//	OBCHistory.h
+//	Interface for OBCHistory class.  This class keeps a bounded ring of the most recent
+//	OBC records, each stamped with the local monotonic time it was received.  Records can
+//	be looked up by local time or by OBC time, and GPS position and IMU values are
+//	interpolated between the two records that bracket the requested time.
+//
+//	The OBC reader thread is the only writer.  Lookups are lock-free binary searches and
+//	may be made from any number of threads.
+
+#ifndef _OBCHistory_H_
+#define _OBCHistory_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "OBCData.h"
+#include "SeqLock.h"
+
+const int OBC_HISTORY_SIZE = 256;	// Number of records kept, must be a power of two
+
+
+// Result of a history lookup
+enum HistoryStatus
+{
+	HISTORY_EMPTY,		// No records received yet, data is unchanged
+	HISTORY_INTERPOLATED,	// Requested time is between two records
+	HISTORY_BEFORE,		// Requested time is older than the oldest record, data is the oldest record
+	HISTORY_AFTER		// Requested time is newer than the latest record, data is the latest record
+};
+
+
+// One record in the history ring
+struct OBCSample
+{
+	int64_t mono_ns;	// Local monotonic time the record was received, in nanoseconds
+	OBCData data;
+};
+
+
+// OBCHistory class definition
+class OBCHistory
+{
+public:
+	OBCHistory();
+	void add(int64_t mono_ns, const OBCData &data);
+	HistoryStatus atTime(int64_t mono_ns, OBCData &data) const;
+	HistoryStatus atOBCTime(long ms, OBCData &data) const;
+	unsigned long size() const;
+
+private:
+	SeqLock<OBCSample> slots[OBC_HISTORY_SIZE];
+	std::atomic<int64_t> mono_keys[OBC_HISTORY_SIZE];	// Copy of slots[i].mono_ns for searching
+	std::atomic<long> ms_keys[OBC_HISTORY_SIZE];		// Copy of slots[i].data.ms for searching
+	std::atomic<unsigned long> count;			// Number of records ever added
+	std::atomic<unsigned long> ms_start;			// First record since the OBC clock was last reset
+	long last_ms;						// Writer only
+
+	HistoryStatus lookup(bool by_ms, int64_t key, OBCData &data) const;
+};
+
+extern OBCHistory obc_history;
+
+extern int64_t monotonic_ns();
+extern void sleep_until_ns(int64_t t);
+extern void interpolate_obc(const OBCData &a, const OBCData &b, double f, OBCData &out);
+
+#endif
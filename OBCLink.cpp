@@ -0,0 +1,295 @@
+//	OBCLink.cpp
+//	Implementation of OBCLink class.  One epoll loop waits on the serial port, an inotify
+//	watch of the device directory and a stop eventfd.  When the port hangs up or returns
+//	an error it is closed, and it is reopened when inotify reports the device node being
+//	created or its permissions being set by udev.  If the configured device is a ttyACM
+//	node, any ttyACM node that appears is accepted, since a re-enumerated OBC may come
+//	back under a different number.
+
+// System includes
+#include <string>
+#include <iostream>
+#include <system_error>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+// Local includes
+#include "OBCLink.h"
+#include "OBCHistory.h"
+
+// System namespace
+using namespace std;
+
+
+// Configure the serial port the way the OBC expects it.  This is the same setting
+// that used to be applied with stty:
+//	speed 115200 baud; min = 1; time = 0;
+//	-parenb cs8 -hupcl -cstopb cread clocal -crtscts
+//	ignbrk -brkint -icrnl -ixon -opost -isig -icanon -iexten -echo noflsh
+void configure_tty(int fd)
+{
+	struct termios tio;
+	if ( tcgetattr(fd, &tio) < 0 )
+		throw system_error{errno, system_category(), "tcgetattr()"};
+
+	tio.c_iflag = IGNBRK;
+	tio.c_oflag = 0;
+	tio.c_cflag = CS8 | CREAD | CLOCAL;
+	tio.c_lflag = NOFLSH;
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, B115200);
+	cfsetospeed(&tio, B115200);
+
+	if ( tcsetattr(fd, TCSANOW, &tio) < 0 )
+		throw system_error{errno, system_category(), "tcsetattr()"};
+}
+
+
+OBCLink::OBCLink(const string &path) :
+	dev_path(path), epoll_fd(-1), inotify_fd(-1), stop_fd(-1), tty_fd(-1),
+	running(false), is_connected(false), lost_ns(0)
+{
+	size_t slash = dev_path.rfind('/');
+	dev_dir = (slash == string::npos)? "." : dev_path.substr(0, slash + 1);
+	dev_name = (slash == string::npos)? dev_path : dev_path.substr(slash + 1);
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if ( epoll_fd < 0 )
+		throw system_error{errno, system_category(), "OBCLink: epoll_create1()"};
+
+	stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if ( stop_fd < 0 )
+		throw system_error{errno, system_category(), "OBCLink: eventfd()"};
+
+	inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if ( inotify_fd < 0 )
+		throw system_error{errno, system_category(), "OBCLink: inotify_init1()"};
+	if ( inotify_add_watch(inotify_fd, dev_dir.c_str(), IN_CREATE | IN_ATTRIB | IN_DELETE) < 0 )
+		throw system_error{errno, system_category(), "OBCLink: inotify_add_watch() " + dev_dir};
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = stop_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev);
+	ev.data.fd = inotify_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &ev);
+}
+
+
+OBCLink::~OBCLink()
+{
+	if ( tty_fd >= 0 )
+		close(tty_fd);
+	close(inotify_fd);
+	close(stop_fd);
+	close(epoll_fd);
+}
+
+
+// True while the serial port is open
+bool OBCLink::connected() const
+{
+	return is_connected;
+}
+
+
+// Ask run() to return.  May be called from any thread.
+void OBCLink::stop()
+{
+	running = false;
+	uint64_t one = 1;
+	if ( write(stop_fd, &one, sizeof(one)) < 0 )
+		cerr << get_time_string() << " OBCLink::stop(): " << strerror(errno) << endl;
+}
+
+
+// Check whether a device node name created in dev_dir is the OBC
+bool OBCLink::matches(const char* name) const
+{
+	if ( dev_name == name )
+		return true;
+	return dev_name.compare(0, 6, "ttyACM") == 0 && strncmp(name, "ttyACM", 6) == 0;
+}
+
+
+// Open and configure the serial port.
+// Return value: true if the port is open
+bool OBCLink::open_port(const string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if ( fd < 0 )
+	{
+		// The node may exist before udev has given us access to it
+		if ( errno != ENOENT && errno != EACCES && errno != EBUSY )
+		{
+			system_error e {errno, system_category(), path};
+			cerr << get_time_string() << " " << e.what() << endl;
+		}
+		return false;
+	}
+
+	try
+	{
+		configure_tty(fd);
+	}
+	catch (const system_error &e)
+	{
+		cerr << get_time_string() << " " << path << ": " << e.what() << endl;
+		close(fd);
+		return false;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.fd = fd;
+	if ( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0 )
+	{
+		system_error e {errno, system_category(), "OBCLink: epoll_ctl() " + path};
+		cerr << get_time_string() << " " << e.what() << endl;
+		close(fd);
+		return false;
+	}
+
+	tty_fd = fd;
+	port_path = path;
+	stream.reset();
+	is_connected = true;
+
+	cerr << get_time_string() << " Configured USB device: " << path;
+	if ( lost_ns != 0 )
+		cerr << ", link restored after " << (monotonic_ns() - lost_ns) / 1000000 << " ms";
+	cerr << endl;
+	return true;
+}
+
+
+// Close the serial port after it was removed or failed
+void OBCLink::close_port(const char* reason)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, tty_fd, NULL);
+	close(tty_fd);
+	tty_fd = -1;
+	is_connected = false;
+	lost_ns = monotonic_ns();
+
+	cerr << get_time_string() << " OBC link lost on " << port_path << ": " << reason;
+	cerr << " (" << stream.records << " records, " << stream.errors << " bad)" << endl;
+}
+
+
+// Read everything available from the serial port and publish the records
+void OBCLink::read_port()
+{
+	OBCData input_data;
+	ssize_t n;
+
+	while ( (n = stream.fill(tty_fd)) > 0 )
+	{
+		while ( stream.next(input_data) )
+			publish_obc(input_data);
+	}
+
+	if ( n == 0 )
+		close_port("end of file");
+	else if ( errno != EAGAIN && errno != EINTR )
+		close_port(strerror(errno));
+}
+
+
+// Drain inotify events and reconnect if the OBC device node appeared
+void OBCLink::handle_device_events()
+{
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	while ( (len = read(inotify_fd, buffer, sizeof(buffer))) > 0 )
+	{
+		for ( char* p = buffer; p < buffer + len; )
+		{
+			struct inotify_event* event = (struct inotify_event*) p;
+			p += sizeof(struct inotify_event) + event->len;
+			if ( event->len == 0 || !matches(event->name) )
+				continue;
+
+			if ( (event->mask & IN_DELETE) && tty_fd >= 0 && port_path == dev_dir + event->name )
+				close_port("device removed");
+			else if ( (event->mask & (IN_CREATE | IN_ATTRIB)) && tty_fd < 0 )
+				open_port(dev_dir + event->name);
+		}
+	}
+}
+
+
+// Reopen the port when no device event came: the configured device first, then any
+// other node in dev_dir it matches, in case the event for a renumbered node was missed.
+// Return value: true if the port is open
+bool OBCLink::open_any()
+{
+	if ( open_port(dev_path) )
+		return true;
+
+	DIR* dir = opendir(dev_dir.c_str());
+	if ( dir == NULL )
+		return false;
+	struct dirent* entry;
+	bool opened = false;
+	while ( !opened && (entry = readdir(dir)) != NULL )
+		if ( dev_name != entry->d_name && matches(entry->d_name) )
+			opened = open_port(dev_dir + entry->d_name);
+	closedir(dir);
+	return opened;
+}
+
+
+// Run the link until stop() is called.  Intended to be the body of the OBC thread.
+void OBCLink::run()
+{
+	running = true;
+	if ( !open_port(dev_path) )
+		cerr << get_time_string() << " OBC not found on " << dev_path << ", waiting for device" << endl;
+
+	while ( running )
+	{
+		struct epoll_event events[4];
+		int n = epoll_wait(epoll_fd, events, 4, (tty_fd < 0)? OBC_RETRY_MS : -1);
+		if ( n < 0 )
+		{
+			// Don't take the imaging down with this thread; wait and try again
+			if ( errno == EINTR )
+				continue;
+			system_error e {errno, system_category(), "OBCLink: epoll_wait()"};
+			cerr << get_time_string() << " " << e.what() << ", retrying in " << OBC_RETRY_MS << " ms" << endl;
+			this_thread::sleep_for(chrono::milliseconds(OBC_RETRY_MS));
+			continue;
+		}
+
+		for ( int i = 0; i < n; i++ )
+		{
+			if ( events[i].data.fd == inotify_fd )
+				handle_device_events();
+			else if ( events[i].data.fd == tty_fd )
+			{
+				if ( events[i].events & EPOLLIN )
+					read_port();
+				if ( tty_fd >= 0 && (events[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) )
+					close_port("hang up");
+			}
+		}
+
+		// Fallback in case a device event was missed
+		if ( n == 0 && tty_fd < 0 )
+			open_any();
+	}
+}
@@ -0,0 +1,55 @@
+//	OBCLink.h
+//	Interface for OBCLink class.  This class manages the serial link to the OBC.  The port
+//	is configured with termios, read from an epoll loop, and reopened as soon as the
+//	device node reappears after the OBC is unplugged or reset.  Device nodes are watched
+//	with inotify, so no time is spent polling for the device.
+
+#ifndef _OBCLink_H_
+#define _OBCLink_H_
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+#include "OBCStream.h"
+
+using namespace std;
+
+const int OBC_RETRY_MS = 1000;	// Retry interval while disconnected, in case a device event was missed
+
+
+// OBCLink class definition
+class OBCLink
+{
+public:
+	OBCLink(const string &dev_path);
+	~OBCLink();
+	void run();
+	void stop();
+	bool connected() const;
+
+private:
+	string dev_path;	// Configured device, e.g. /dev/ttyACM0
+	string dev_dir;		// Directory watched for the device node
+	string dev_name;	// File name of the configured device
+	string port_path;	// Device currently open
+	int epoll_fd;
+	int inotify_fd;
+	int stop_fd;
+	int tty_fd;
+	atomic<bool> running;
+	atomic<bool> is_connected;
+	int64_t lost_ns;	// Monotonic time the link was lost
+	OBCStream stream;
+
+	bool open_port(const string &path);
+	bool open_any();
+	void close_port(const char* reason);
+	void read_port();
+	void handle_device_events();
+	bool matches(const char* name) const;
+};
+
+extern void configure_tty(int fd);
+
+#endif
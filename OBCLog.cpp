@@ -0,0 +1,625 @@
+//	OBCLog.cpp
+//	Implementation of the OBC telemetry log writer, recorder thread and reader.  See
+//	OBCLog.h for the file layout.
+
+// System includes
+#include <string>
+#include <iostream>
+#include <system_error>
+#include <stdexcept>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Local includes
+#include "OBCLog.h"
+
+// System namespace
+using namespace std;
+
+const uint32_t BLOCK_MAGIC = 0x4b4c424f;	// "OBLK"
+const uint32_t INDEX_MAGIC = 0x5844494f;	// "OIDX"
+const uint32_t END_MAGIC = 0x444e454f;		// "OEND"
+const size_t NAME_SIZE = 16;			// Size of a column table entry
+
+OBCRecorder obc_recorder;
+
+const char* obc_log_columns[LOG_COLUMNS] = {
+	"mono_ns", "ms", "gps_time", "lat", "lon", "alt",
+	"ax", "ay", "az", "gx", "gy", "gz", "mx", "my", "mz",
+	"roll", "pitch", "yaw"
+};
+
+
+// On-disk structures
+struct LogFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t columns;
+	uint32_t block_records;
+	uint32_t index_blocks;
+	int64_t created;
+	char reserved[32];
+};
+
+struct LogBlockHeader
+{
+	uint32_t magic;
+	uint32_t count;
+	uint64_t size;
+	int64_t first_mono;
+	int64_t last_mono;
+	int64_t first_ms;
+	int64_t last_ms;
+};
+
+struct LogIndexHeader
+{
+	uint32_t magic;
+	uint32_t entries;
+	uint64_t prev;
+};
+
+struct LogIndexTrailer
+{
+	uint32_t magic;
+	uint32_t reserved;
+	uint64_t offset;
+};
+
+
+// Store a double in an i64 column slot without conversion
+static int64_t bits(double d)
+{
+	int64_t i;
+	memcpy(&i, &d, sizeof(i));
+	return i;
+}
+
+
+// WRITER
+
+OBCLogWriter::OBCLogWriter() : fd(-1), offset(0), last_index(0), count(0)
+{
+}
+
+
+OBCLogWriter::~OBCLogWriter()
+{
+	close();
+}
+
+
+// Create the log file and write its header
+void OBCLogWriter::open(const string &path)
+{
+	fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), path};
+
+	offset = 0;
+	last_index = 0;
+	count = 0;
+	unindexed.clear();
+	unindexed.reserve(OBC_LOG_INDEX_BLOCKS);
+
+	LogFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "NLOBCLOG", 8);
+	header.version = OBC_LOG_VERSION;
+	header.columns = LOG_COLUMNS;
+	header.block_records = OBC_LOG_BLOCK_RECORDS;
+	header.index_blocks = OBC_LOG_INDEX_BLOCKS;
+	header.created = time(NULL);
+	writeAll(&header, sizeof(header));
+
+	char names[LOG_COLUMNS][NAME_SIZE];
+	memset(names, 0, sizeof(names));
+	for ( int c = 0; c < LOG_COLUMNS; c++ )
+		strncpy(names[c], obc_log_columns[c], NAME_SIZE - 1);
+	writeAll(names, sizeof(names));
+}
+
+
+// Write the partial block and a final index block and close the file
+void OBCLogWriter::close()
+{
+	if ( fd < 0 )
+		return;
+
+	if ( count > 0 )
+		writeBlock();
+	if ( !unindexed.empty() )
+		writeIndex();
+	fdatasync(fd);
+	::close(fd);
+	fd = -1;
+}
+
+
+// Close the file after a write error, without the partial block or a final index.  A
+// reader finds the blocks written before the error by walking them.
+void OBCLogWriter::abort()
+{
+	if ( fd < 0 )
+		return;
+	::close(fd);
+	fd = -1;
+}
+
+
+// True from open() until the file is closed
+bool OBCLogWriter::isOpen() const
+{
+	return fd >= 0;
+}
+
+
+// Write the records of the partial block as a short block and sync the file, so they
+// survive a power cut
+void OBCLogWriter::flush()
+{
+	if ( fd < 0 || count == 0 )
+		return;
+	writeBlock();
+	fdatasync(fd);
+}
+
+
+// Add one record to the current block, writing the block when it is full
+void OBCLogWriter::append(int64_t mono_ns, const OBCData &data)
+{
+	columns[LOG_MONO_NS][count] = mono_ns;
+	columns[LOG_MS][count] = data.ms;
+	columns[LOG_GPS_TIME][count] = ((((data.yy * 100LL + data.mm) * 100 + data.dd) * 100 + data.hh) * 100 + data.min) * 100 + data.ss;
+	columns[LOG_LAT][count] = bits(data.lat);
+	columns[LOG_LON][count] = bits(data.lon);
+	columns[LOG_ALT][count] = bits(data.alt);
+	columns[LOG_AX][count] = bits(data.ax);
+	columns[LOG_AY][count] = bits(data.ay);
+	columns[LOG_AZ][count] = bits(data.az);
+	columns[LOG_GX][count] = bits(data.gx);
+	columns[LOG_GY][count] = bits(data.gy);
+	columns[LOG_GZ][count] = bits(data.gz);
+	columns[LOG_MX][count] = bits(data.mx);
+	columns[LOG_MY][count] = bits(data.my);
+	columns[LOG_MZ][count] = bits(data.mz);
+	columns[LOG_ROLL][count] = bits(data.roll);
+	columns[LOG_PITCH][count] = bits(data.pitch);
+	columns[LOG_YAW][count] = bits(data.yaw);
+
+	if ( ++count == OBC_LOG_BLOCK_RECORDS )
+		writeBlock();
+}
+
+
+void OBCLogWriter::writeAll(const void* p, size_t len)
+{
+	const char* q = (const char*) p;
+	while ( len > 0 )
+	{
+		ssize_t n = write(fd, q, len);
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			throw system_error{errno, system_category(), "OBCLogWriter: write()"};
+		}
+		q += n;
+		len -= n;
+		offset += n;
+	}
+}
+
+
+// Write the current block with one writev(), header followed by the used part of
+// each column
+void OBCLogWriter::writeBlock()
+{
+	LogBlockHeader header;
+	header.magic = BLOCK_MAGIC;
+	header.count = count;
+	header.size = sizeof(header) + (uint64_t) LOG_COLUMNS * count * sizeof(int64_t);
+	header.first_mono = columns[LOG_MONO_NS][0];
+	header.last_mono = columns[LOG_MONO_NS][count - 1];
+	header.first_ms = columns[LOG_MS][0];
+	header.last_ms = columns[LOG_MS][count - 1];
+
+	OBCLogBlockInfo info = { offset, count, header.first_mono, header.last_mono, header.first_ms, header.last_ms };
+
+	struct iovec iov[LOG_COLUMNS + 1];
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	for ( int c = 0; c < LOG_COLUMNS; c++ )
+	{
+		iov[c + 1].iov_base = columns[c];
+		iov[c + 1].iov_len = count * sizeof(int64_t);
+	}
+
+	ssize_t n = writev(fd, iov, LOG_COLUMNS + 1);
+	if ( n < 0 )
+		throw system_error{errno, system_category(), "OBCLogWriter: writev()"};
+	offset += n;
+	if ( (uint64_t) n < header.size )
+	{
+		// Short write, finish the rest piece by piece
+		uint64_t done = n;
+		for ( int i = 0; i <= LOG_COLUMNS; i++ )
+		{
+			if ( done >= iov[i].iov_len )
+			{
+				done -= iov[i].iov_len;
+				continue;
+			}
+			writeAll((char*) iov[i].iov_base + done, iov[i].iov_len - done);
+			done = 0;
+		}
+	}
+
+	count = 0;
+	unindexed.push_back(info);
+	if ( unindexed.size() == OBC_LOG_INDEX_BLOCKS )
+		writeIndex();
+}
+
+
+// Write an index block for the blocks written since the last one
+void OBCLogWriter::writeIndex()
+{
+	uint64_t start = offset;
+
+	LogIndexHeader header;
+	header.magic = INDEX_MAGIC;
+	header.entries = unindexed.size();
+	header.prev = last_index;
+	writeAll(&header, sizeof(header));
+	writeAll(unindexed.data(), unindexed.size() * sizeof(OBCLogBlockInfo));
+
+	LogIndexTrailer trailer;
+	trailer.magic = END_MAGIC;
+	trailer.reserved = 0;
+	trailer.offset = start;
+	writeAll(&trailer, sizeof(trailer));
+
+	last_index = start;
+	unindexed.clear();
+}
+
+
+// RECORDER
+
+OBCRecorder::OBCRecorder() : dropped(0), queue(NULL), head(0), tail(0), running(false)
+{
+}
+
+
+OBCRecorder::~OBCRecorder()
+{
+	stop();
+}
+
+
+// Create the log file and start the recorder thread
+void OBCRecorder::start(const string &path)
+{
+	writer.open(path);
+	if ( queue == NULL )
+		queue = new Entry[OBC_LOG_QUEUE_SIZE];
+	head = 0;
+	tail = 0;
+	running = true;
+	recorder = thread(&OBCRecorder::run, this);
+	cerr << get_time_string() << " Recording OBC telemetry to " << path << endl;
+}
+
+
+// Write out the queued records and close the log.  The thread is joined even if a write
+// error has stopped it, which leaves the log closed already.
+void OBCRecorder::stop()
+{
+	running = false;
+	if ( recorder.joinable() )
+		recorder.join();
+	if ( !writer.isOpen() )
+		return;
+	try
+	{
+		writer.close();
+	}
+	catch (const system_error &e)
+	{
+		cerr << get_time_string() << " OBCRecorder: " << e.what() << ", log not closed cleanly" << endl;
+		writer.abort();
+	}
+}
+
+
+// Queue a record for the log.  Only the OBC reader thread may call this.  Does nothing
+// if the recorder isn't running.
+void OBCRecorder::push(int64_t mono_ns, const OBCData &data)
+{
+	if ( !running )
+		return;
+
+	size_t h = head.load(memory_order_relaxed);
+	if ( h - tail.load(memory_order_acquire) == OBC_LOG_QUEUE_SIZE )
+	{
+		dropped++;
+		return;
+	}
+	Entry &e = queue[h & (OBC_LOG_QUEUE_SIZE - 1)];
+	e.mono_ns = mono_ns;
+	e.data = data;
+	head.store(h + 1, memory_order_release);
+}
+
+
+// Recorder thread.  Drains the queue every 100 ms, which at the highest OBC rates is a
+// small fraction of the queue, and flushes the partial block every OBC_LOG_FLUSH_MS.
+void OBCRecorder::run()
+{
+	bool more = true;
+	auto flushed = chrono::steady_clock::now();
+	while ( more )
+	{
+		more = running;
+		size_t t = tail.load(memory_order_relaxed);
+		size_t h = head.load(memory_order_acquire);
+		try
+		{
+			for ( ; t != h; t++ )
+			{
+				Entry &e = queue[t & (OBC_LOG_QUEUE_SIZE - 1)];
+				writer.append(e.mono_ns, e.data);
+			}
+			if ( chrono::steady_clock::now() - flushed >= chrono::milliseconds(OBC_LOG_FLUSH_MS) )
+			{
+				writer.flush();
+				flushed = chrono::steady_clock::now();
+			}
+		}
+		catch (const system_error &e)
+		{
+			cerr << get_time_string() << " OBCRecorder: " << e.what() << ", recording stopped" << endl;
+			writer.abort();
+			running = false;
+			return;
+		}
+		tail.store(t, memory_order_release);
+
+		if ( more )
+			this_thread::sleep_for(chrono::milliseconds(100));
+	}
+}
+
+
+// READER
+
+OBCLogReader::OBCLogReader() : map(NULL), map_size(0), ncolumns(0), records(0), from_index(false)
+{
+}
+
+
+OBCLogReader::~OBCLogReader()
+{
+	close();
+}
+
+
+// Map a log file and build its block table
+void OBCLogReader::open(const string &path)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), path};
+	struct stat st;
+	if ( fstat(fd, &st) < 0 )
+	{
+		int err = errno;
+		::close(fd);
+		throw system_error{err, system_category(), path};
+	}
+	map_size = st.st_size;
+	void* p = (map_size > 0)? mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	int err = errno;
+	::close(fd);
+	if ( p == MAP_FAILED )
+		throw system_error{map_size? err : EINVAL, system_category(), path};
+	map = (const uint8_t*) p;
+
+	const LogFileHeader* header = (const LogFileHeader*) map;
+	if ( map_size < sizeof(LogFileHeader) || memcmp(header->magic, "NLOBCLOG", 8) != 0 || header->version != OBC_LOG_VERSION )
+	{
+		close();
+		throw system_error{EINVAL, system_category(), path + " is not an OBC log"};
+	}
+	ncolumns = header->columns;
+	if ( (uint64_t) ncolumns * NAME_SIZE > map_size - sizeof(LogFileHeader) )
+	{
+		close();
+		throw system_error{EINVAL, system_category(), path + ": bad OBC log column table"};
+	}
+	const char* table = (const char*) (header + 1);
+	for ( uint32_t c = 0; c < ncolumns; c++ )
+		names.push_back(string(table + c * NAME_SIZE, strnlen(table + c * NAME_SIZE, NAME_SIZE)));
+
+	if ( !readIndex() )
+	{
+		block_table.clear();
+		walkBlocks();
+	}
+	records = 0;
+	for ( auto &b : block_table )
+		records += b.records;
+}
+
+
+void OBCLogReader::close()
+{
+	if ( map != NULL )
+		munmap((void*) map, map_size);
+	map = NULL;
+	map_size = 0;
+	ncolumns = 0;
+	records = 0;
+	names.clear();
+	block_table.clear();
+}
+
+
+// Check that a data block at offset lies within the file and holds count records of
+// every column
+bool OBCLogReader::validBlock(uint64_t offset, uint64_t count) const
+{
+	if ( offset < sizeof(LogFileHeader) || offset > map_size || map_size - offset < sizeof(LogBlockHeader) )
+		return false;
+	const LogBlockHeader* b = (const LogBlockHeader*) (map + offset);
+	return b->magic == BLOCK_MAGIC && b->count == count &&
+		b->size == sizeof(LogBlockHeader) + count * ncolumns * sizeof(int64_t) && b->size <= map_size - offset;
+}
+
+
+// Build the block table from the chain of index blocks ending at the end of the file.
+// Return value: false if the file doesn't end with a sound index block
+bool OBCLogReader::readIndex()
+{
+	if ( map_size < sizeof(LogIndexTrailer) )
+		return false;
+	const LogIndexTrailer* trailer = (const LogIndexTrailer*) (map + map_size - sizeof(LogIndexTrailer));
+	if ( trailer->magic != END_MAGIC )
+		return false;
+
+	// Follow the chain back to the first index block
+	vector<const LogIndexHeader*> chain;
+	uint64_t offset = trailer->offset;
+	while ( true )
+	{
+		if ( offset > map_size || map_size - offset < sizeof(LogIndexHeader) )
+			return false;
+		const LogIndexHeader* index = (const LogIndexHeader*) (map + offset);
+		if ( index->magic != INDEX_MAGIC )
+			return false;
+		if ( offset + sizeof(LogIndexHeader) + (uint64_t) index->entries * sizeof(OBCLogBlockInfo) > map_size )
+			return false;
+		chain.push_back(index);
+		if ( index->prev == 0 )
+			break;
+		if ( index->prev >= offset )
+			return false;
+		offset = index->prev;
+	}
+
+	for ( auto i = chain.rbegin(); i != chain.rend(); ++i )
+	{
+		const OBCLogBlockInfo* entries = (const OBCLogBlockInfo*) (*i + 1);
+		for ( uint32_t e = 0; e < (*i)->entries; e++ )
+			if ( !validBlock(entries[e].offset, entries[e].records) )
+				return false;
+		block_table.insert(block_table.end(), entries, entries + (*i)->entries);
+	}
+	from_index = true;
+	return true;
+}
+
+
+// Build the block table by walking every block from the start of the file.  The walk
+// stops at the first block that doesn't fit its header, such as a partially written
+// block or the zeroed tail of a file cut off by a power loss.
+void OBCLogReader::walkBlocks()
+{
+	from_index = false;
+	uint64_t offset = sizeof(LogFileHeader) + ncolumns * NAME_SIZE;
+	while ( offset + sizeof(uint32_t) <= map_size )
+	{
+		uint32_t magic = *(const uint32_t*) (map + offset);
+		if ( magic == BLOCK_MAGIC && offset + sizeof(LogBlockHeader) <= map_size )
+		{
+			const LogBlockHeader* b = (const LogBlockHeader*) (map + offset);
+			if ( !validBlock(offset, b->count) )
+				break;
+			OBCLogBlockInfo info = { offset, b->count, b->first_mono, b->last_mono, b->first_ms, b->last_ms };
+			block_table.push_back(info);
+			offset += b->size;
+		}
+		else if ( magic == INDEX_MAGIC && offset + sizeof(LogIndexHeader) <= map_size )
+		{
+			const LogIndexHeader* index = (const LogIndexHeader*) (map + offset);
+			offset += sizeof(LogIndexHeader) + (uint64_t) index->entries * sizeof(OBCLogBlockInfo) + sizeof(LogIndexTrailer);
+		}
+		else
+			break;
+	}
+}
+
+
+// Total number of records in the file
+uint64_t OBCLogReader::size() const
+{
+	return records;
+}
+
+
+// Data blocks in file order
+const vector<OBCLogBlockInfo>& OBCLogReader::blocks() const
+{
+	return block_table;
+}
+
+
+// True if the block table came from index blocks, i.e. the file was closed cleanly
+bool OBCLogReader::indexed() const
+{
+	return from_index;
+}
+
+
+// Column number of a named column.
+// Return value: column number, or -1 if there is no such column
+int OBCLogReader::findColumn(const string &name) const
+{
+	for ( size_t c = 0; c < names.size(); c++ )
+		if ( names[c] == name )
+			return c;
+	return -1;
+}
+
+
+// Copy one column of every block into out, which has room for size() values
+void OBCLogReader::copyColumn(int column, void* out) const
+{
+	if ( column < 0 || (uint32_t) column >= ncolumns )
+		throw out_of_range("OBCLogReader: no column " + to_string(column));
+
+	char* p = (char*) out;
+	for ( auto &b : block_table )
+	{
+		size_t n = b.records * sizeof(int64_t);
+		memcpy(p, map + b.offset + sizeof(LogBlockHeader) + column * n, n);
+		p += n;
+	}
+}
+
+
+// Read a whole f64 column
+void OBCLogReader::readColumn(int column, vector<double> &out) const
+{
+	out.resize(records);
+	copyColumn(column, out.data());
+}
+
+
+// Read a whole i64 column
+void OBCLogReader::readColumn(int column, vector<int64_t> &out) const
+{
+	out.resize(records);
+	copyColumn(column, out.data());
+}
@@ -0,0 +1,183 @@
+//	OBCLog.h
+//	Interface for the OBC telemetry log.  Every record received from the OBC is appended
+//	to a columnar binary file by a background recorder thread, so the full GPS/IMU
+//	trajectory of a flight is kept, not just the record current at each exposure.  On the
+//	ground the file is memory-mapped by OBCLogReader and whole columns are loaded with a
+//	few large copies.
+//
+//	File layout, all values in host (little-endian) byte order and 8-byte aligned:
+//
+//	File header (64 bytes)
+//		char[8]	magic "NLOBCLOG"
+//		u32	version (1)
+//		u32	number of columns C
+//		u32	maximum records per data block
+//		u32	data blocks per index block
+//		i64	local wall clock time the file was created (time_t)
+//		char[32] reserved
+//	Column table, C entries of 16 bytes: column name, NUL padded
+//
+//	Data block, appended each time the recorder has collected a block of records, and
+//	with the records collected so far every OBC_LOG_FLUSH_MS
+//		u32	magic 'OBLK'
+//		u32	number of records N
+//		u64	size of the block in bytes, including this header
+//		i64	first and last mono_ns, first and last OBC ms
+//		C columns of N values each, i64 or f64 as given by obc_log_columns
+//
+//	Index block, appended after every few data blocks and when the file is closed
+//		u32	magic 'OIDX'
+//		u32	number of entries E
+//		u64	offset of the previous index block, 0 if none
+//		E entries of 48 bytes: u64 block offset, u64 records, i64 first and last
+//		mono_ns, i64 first and last OBC ms
+//		u32	magic 'OEND'
+//		u32	reserved
+//		u64	offset of this index block
+//
+//	A file that was closed cleanly ends with an index block, and the reader follows the
+//	chain of index blocks back from the end.  If the recorder died the reader walks the
+//	data blocks from the start instead, and a partially written last block is ignored,
+//	so a power cut loses at most the last OBC_LOG_FLUSH_MS of records.
+
+#ifndef _OBCLog_H_
+#define _OBCLog_H_
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include "OBCData.h"
+
+using namespace std;
+
+const uint32_t OBC_LOG_VERSION = 1;
+const uint32_t OBC_LOG_BLOCK_RECORDS = 1024;	// Records per data block
+const uint32_t OBC_LOG_INDEX_BLOCKS = 16;	// Data blocks per index block
+const size_t OBC_LOG_QUEUE_SIZE = 1024;		// Records the recorder can fall behind, a power of two
+const int OBC_LOG_FLUSH_MS = 1000;		// Longest time records wait in a partial block
+
+// Columns of the log, in file order
+enum OBCLogColumn
+{
+	LOG_MONO_NS,	// i64, local monotonic receive time in nanoseconds
+	LOG_MS,		// i64, OBC time in milliseconds
+	LOG_GPS_TIME,	// i64, GPS date and time as the decimal number yymmddhhmmss
+	LOG_LAT, LOG_LON, LOG_ALT,	// f64
+	LOG_AX, LOG_AY, LOG_AZ,		// f64
+	LOG_GX, LOG_GY, LOG_GZ,		// f64
+	LOG_MX, LOG_MY, LOG_MZ,		// f64
+	LOG_ROLL, LOG_PITCH, LOG_YAW,	// f64, attitude estimate in degrees
+	LOG_COLUMNS
+};
+
+extern const char* obc_log_columns[LOG_COLUMNS];
+
+
+// Time ranges of one data block
+struct OBCLogBlockInfo
+{
+	uint64_t offset;	// File offset of the block
+	uint64_t records;
+	int64_t first_mono;
+	int64_t last_mono;
+	int64_t first_ms;
+	int64_t last_ms;
+};
+
+
+// Writes the log file.  Not thread safe; OBCRecorder owns one in its thread.
+class OBCLogWriter
+{
+public:
+	OBCLogWriter();
+	~OBCLogWriter();
+	void open(const string &path);
+	void append(int64_t mono_ns, const OBCData &data);
+	void flush();
+	void close();
+	void abort();
+	bool isOpen() const;
+
+private:
+	int fd;
+	uint64_t offset;		// Current end of file
+	uint64_t last_index;		// Offset of the last index block
+	uint32_t count;			// Records in the current block
+	int64_t columns[LOG_COLUMNS][OBC_LOG_BLOCK_RECORDS];	// Current block, f64 columns stored bitwise
+	vector<OBCLogBlockInfo> unindexed;	// Blocks written since the last index block
+
+	void writeAll(const void* p, size_t len);
+	void writeBlock();
+	void writeIndex();
+};
+
+
+// Background thread that takes records from the OBC reader thread and appends them to
+// the log.  push() never blocks; if the recorder falls too far behind records are
+// dropped and counted.
+class OBCRecorder
+{
+public:
+	atomic<unsigned long> dropped;	// Records lost because the queue was full
+
+	OBCRecorder();
+	~OBCRecorder();
+	void start(const string &path);
+	void stop();
+	void push(int64_t mono_ns, const OBCData &data);
+
+private:
+	struct Entry
+	{
+		int64_t mono_ns;
+		OBCData data;
+	};
+
+	Entry* queue;			// Single producer, single consumer ring
+	atomic<size_t> head;		// Next entry to write, advanced by push()
+	atomic<size_t> tail;		// Next entry to read, advanced by the recorder thread
+	atomic<bool> running;
+	OBCLogWriter writer;
+	thread recorder;
+
+	void run();
+};
+
+extern OBCRecorder obc_recorder;
+
+
+// Reads a log file through a read-only memory mapping
+class OBCLogReader
+{
+public:
+	OBCLogReader();
+	~OBCLogReader();
+	void open(const string &path);
+	void close();
+	uint64_t size() const;
+	int findColumn(const string &name) const;
+	void readColumn(int column, vector<double> &out) const;
+	void readColumn(int column, vector<int64_t> &out) const;
+	const vector<OBCLogBlockInfo>& blocks() const;
+	bool indexed() const;
+
+private:
+	const uint8_t* map;
+	size_t map_size;
+	uint32_t ncolumns;
+	uint64_t records;
+	bool from_index;		// Block table was read from the index chain
+	vector<string> names;
+	vector<OBCLogBlockInfo> block_table;
+
+	bool validBlock(uint64_t offset, uint64_t count) const;
+	bool readIndex();
+	void walkBlocks();
+	void copyColumn(int column, void* out) const;
+};
+
+#endif
@@ -0,0 +1,190 @@
+//	OBCStream.cpp
+//	Implementation of OBCStream class.  Bytes from the OBC are read into a fixed buffer and
+//	records are located and tokenized where they lie.  When the buffer fills
+//	up only the unfinished tail record (at most MAX_RECORD bytes) is moved back to the front,
+//	so each byte is copied at most once after it is read.
+
+// System includes
+#include <string>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+// Local includes
+#include "OBCStream.h"
+#include "OBCFrame.h"
+
+// System namespace
+using namespace std;
+
+
+OBCStream::OBCStream()
+{
+	reset();
+}
+
+
+// Discard all buffered data and clear the counters
+void OBCStream::reset()
+{
+	head = 0;
+	tail = 0;
+	records = 0;
+	frames = 0;
+	errors = 0;
+	discarded = 0;
+	last = OBCData();
+}
+
+
+// Read the next block of data from fd into the free end of the buffer.
+// Return value: result of read(), i.e. bytes read, 0 on EOF or -1 on error.
+ssize_t OBCStream::fill(int fd)
+{
+	if ( head == tail )
+	{
+		// Everything consumed, start over at the front of the buffer
+		head = 0;
+		tail = 0;
+	}
+	else if ( OBC_BUFFER_SIZE - tail < MAX_RECORD )
+	{
+		// Move the unfinished record to the front to make room
+		memmove(buffer, buffer + head, tail - head);
+		tail -= head;
+		head = 0;
+	}
+
+	ssize_t n = read(fd, buffer + tail, OBC_BUFFER_SIZE - tail);
+	if ( n > 0 )
+		tail += n;
+	return n;
+}
+
+
+// Find the first text record delimiter or binary frame sync byte in [p, end).
+// Return value: pointer to it, or NULL if there is none
+static char* find_start(char* p, char* end)
+{
+	for ( ; p < end; p++ )
+		if ( *p == '$' || (uint8_t) *p == OBC_SYNC0 )
+			return p;
+	return NULL;
+}
+
+
+// Extract the next complete record from the buffer into data.  Text records and binary
+// frames may be mixed in the stream.
+// Return value: true if a record was parsed, false if more data is needed.
+bool OBCStream::next(OBCData &data)
+{
+	while ( head < tail )
+	{
+		// Discard input data until next record delimiter
+		char* start = find_start(buffer + head, buffer + tail);
+		if ( start == NULL )
+		{
+			discarded += tail - head;
+			head = tail;
+			return false;
+		}
+		discarded += start - (buffer + head);
+		head = start - buffer;
+
+		if ( (uint8_t) *start == OBC_SYNC0 )
+		{
+			// Binary frame, decoded on top of the last record so an IMU frame
+			// keeps the last GPS fix
+			size_t len;
+			switch ( decode_frame((const uint8_t*) start, tail - head, len, last) )
+			{
+			case FRAME_SHORT:
+				return false;
+			case FRAME_CRC:
+				errors++;
+				// Fall through
+			case FRAME_BAD:
+				// Not a frame, resynchronize at the next byte
+				discarded++;
+				head++;
+				continue;
+			case FRAME_OK:
+				head += len;
+				frames++;
+				records++;
+				data = last;
+				return true;
+			}
+		}
+
+		// Look for the end of the record
+		char* rec = start + 1;
+		char* end = (char*) memchr(rec, ';', buffer + tail - rec);
+		size_t avail = (end ? end : buffer + tail) - rec;
+
+		// A new start delimiter before the end restarts the record
+		char* restart = find_start(rec, rec + avail);
+		if ( restart != NULL )
+		{
+			discarded += restart - start;
+			head = restart - buffer;
+			continue;
+		}
+
+		if ( end == NULL )
+		{
+			if ( avail < MAX_RECORD )
+				// Wait for the rest of the record
+				return false;
+
+			// Too long to be a record, skip this delimiter
+			discarded++;
+			head++;
+			continue;
+		}
+
+		head = end + 1 - buffer;
+		if ( parseRecord(rec, end - rec, data) )
+		{
+			records++;
+			last = data;
+			return true;
+		}
+		errors++;
+	}
+	return false;
+}
+
+
+// Split one record (the text between '$' and ';') into fields and parse them.
+// Return value: true if all fields were parsed.
+bool OBCStream::parseRecord(const char* rec, size_t len, OBCData &data)
+{
+	data = OBCData();
+
+	// Keep the input text (including the terminating ';') for display
+	size_t n = (len + 1 < MAX_RECORD)? len + 1 : MAX_RECORD - 1;
+	memcpy(data.input, rec, n);
+	data.input[n] = '\0';
+
+	const char* end = rec + len;
+	const char* field = rec;
+	for ( int pos = 0; field <= end; pos++ )
+	{
+		const char* comma = (const char*) memchr(field, ',', end - field);
+		if ( comma == NULL )
+			comma = end;
+
+		FieldStatus status = data.parseField(field, comma - field, pos);
+		if ( status != FIELD_OK )
+		{
+			cerr << get_time_string() << " Bad OBC field in read_usb(), pos = " << pos << " field = [";
+			cerr.write(field, comma - field);
+			cerr << "] " << field_status_string(status) << endl;
+			return false;
+		}
+		field = comma + 1;
+	}
+	return true;
+}
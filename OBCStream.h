@@ -0,0 +1,42 @@
+//	OBCStream.h
+//	Interface for OBCStream class.  This class buffers the byte stream read from the OBC
+//	and splits it into "$field,field,...;" text records or binary frames (see OBCFrame.h)
+//	in place.  Data is read in large blocks
+//	with read() into a fixed receive buffer, so no heap allocation is done per byte, field
+//	or record.
+
+#ifndef _OBCStream_H_
+#define _OBCStream_H_
+
+#include <cstddef>
+#include <sys/types.h>
+
+#include "OBCData.h"
+
+const size_t OBC_BUFFER_SIZE = 4096;	// Size of the receive buffer in bytes
+
+
+// OBCStream class definition
+class OBCStream
+{
+public:
+	unsigned long records;		// Number of records successfully parsed
+	unsigned long frames;		// Number of those records that were binary frames
+	unsigned long errors;		// Number of records discarded due to bad fields or CRC
+	unsigned long discarded;	// Number of bytes skipped while looking for a record
+
+	OBCStream();
+	ssize_t fill(int fd);
+	bool next(OBCData &data);
+	void reset();
+
+private:
+	char buffer[OBC_BUFFER_SIZE];
+	size_t head;	// Offset of the first unconsumed byte
+	size_t tail;	// Offset one past the last valid byte
+	OBCData last;	// Last record parsed, the base for IMU-only frames
+
+	bool parseRecord(const char* rec, size_t len, OBCData &data);
+};
+
+#endif
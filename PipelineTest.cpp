@@ -0,0 +1,636 @@
+//	PipelineTest.cpp
+//	Checks of the imaging pipeline that run without cameras or an OBC.  Each check
+//	prints what it measured and PASS or FAIL; the exit status is the number of failed
+//	checks.  With no arguments every check runs.
+//
+//	PipelineTest [check ...]
+//		coordinator	Camera sequences run in parallel and their errors are kept
+//			per camera
+//		writer		A full write queue blocks the camera, or drops its lowest
+//			priority images
+//		sync		Synchronized triggers don't deadlock when a camera fails or
+//			is late, and the frames it missed are counted
+//		schedule	Cycles are released on the grid of deadlines, and an overrun
+//			skips deadlines or catches up by the policy
+//		quicklook	The vectorized demosaic and block means match a scalar
+//			reference for frame sizes from 2x2 to 2448x2048
+//		stack		The mean, median and clip kernels match a scalar reference
+//			for 2 to 16 images and odd pixel counts
+//		calibration	Dark subtraction and hot pixel replacement match a scalar
+//			reference, at the edges of rows and for clustered hot pixels,
+//			and saturated pixels stay saturated
+
+// System includes
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Local includes
+#include "CycleCoordinator.h"
+#include "ImageWriter.h"
+#include "SyncTrigger.h"
+#include "CycleScheduler.h"
+#include "OBCHistory.h"
+#include "QuickLook.h"
+#include "Stacker.h"
+#include "Calibration.h"
+
+// System namespace
+using namespace std;
+
+const int SEQUENCE_MS = 100;		// Length of a simulated camera sequence
+const double CYCLE_SLACK_S = 0.03;	// Allowed on top of one sequence per cycle
+const int WRITE_MS = 20;		// Time a simulated image write takes
+const int SUBMIT_MS = 2;		// Time between simulated images
+const int WRITER_IMAGES = 24;
+const int SYNC_CYCLES = 20;
+const int SYNC_FRAMES = 6;		// Frames per cycle
+const int SYNC_ARM_US = 3000;		// Longest simulated arm time
+const unsigned SYNC_TEST_TIMEOUT_MS = 50;
+const int SYNC_DEADLOCK_S = 30;		// A run taking longer has deadlocked
+const int SCHEDULE_PERIOD_MS = 20;
+const int SCHEDULE_CYCLES = 12;
+const int SCHEDULE_WORK_MS = 2;		// Time a simulated cycle takes
+const int SCHEDULE_OVERRUN_MS = 50;	// Time the overrunning cycle takes, 2.5 periods
+const int SCHEDULE_OVERRUN_CYCLE = 4;
+const uint32_t QUICKLOOK_SIZES[][2] = { { 2, 2 }, { 3, 5 }, { 17, 9 }, { 40, 33 }, { 101, 64 }, { 2448, 2048 } };
+const size_t KERNEL_PIXELS[] = { 1, 7, 8, 9, 15, 17, 1001, 65537 };
+const uint32_t CALIBRATION_WIDTHS[] = { 1, 2, 5, 8, 17, 2448 };
+const int CALIBRATION_TEST_ROWS = 6;
+const int32_t CALIBRATION_WEIGHTS[] = { 0, 4096, 1365, -4 * 4096, 5 * 4096 - 1 };	// Of 4096
+
+atomic<bool> sync_finished(false);	// Set when the sync check's cameras are done
+
+
+// Print the outcome of a check
+static bool report(const string &name, bool ok)
+{
+	cout << name << ": " << (ok? "PASS" : "FAIL") << endl;
+	return ok;
+}
+
+
+// One to four cameras each take SEQUENCE_MS per cycle; a cycle must take about as long
+// as one camera.  Camera 1 throws and camera 2 reports an error in its last cycle, and
+// the errors must be kept for those cameras only.
+bool check_coordinator()
+{
+	bool ok = true;
+	for ( int n = 1; n <= 4; n++ )
+	{
+		int cycle = 0;
+		const int cycles = 3;
+		CycleCoordinator coordinator(n, [&cycle](int camera, CycleResult &result)
+		{
+			this_thread::sleep_for(chrono::milliseconds(SEQUENCE_MS));
+			if ( cycle == cycles - 1 && camera == 1 )
+				throw runtime_error("thrown");
+			if ( cycle == cycles - 1 && camera == 2 )
+			{
+				result.ok = false;
+				result.error = "reported";
+			}
+		});
+
+		double longest = 0;
+		for ( cycle = 0; cycle < cycles; cycle++ )
+			longest = max(longest, coordinator.runCycle());
+		cout << "  " << n << " cameras: longest cycle " << fixed << setprecision(3) << longest << " s" << endl;
+		ok = ok && longest < SEQUENCE_MS / 1000.0 + CYCLE_SLACK_S;
+
+		const vector<CycleResult> &results = coordinator.results();
+		for ( int camera = 0; camera < n; camera++ )
+		{
+			bool failed = camera == 1 || camera == 2;
+			if ( results[camera].ok == failed )
+			{
+				cout << "  camera " << camera << " of " << n << ": ok " << results[camera].ok << ", error \"" <<
+					results[camera].error << "\"" << endl;
+				ok = false;
+			}
+		}
+	}
+	return report("coordinator", ok);
+}
+
+
+// Submit WRITER_IMAGES images of 2 cameras faster than 2 threads can write them, to
+// queues of 4 images.  Four of them, late in the run when the queues are full, have a
+// lower priority.  Returns the writer's counters and which images were not written.
+static WriterStats run_writer(WriterPolicy policy, vector<bool> &lost, vector<bool> &low)
+{
+	ImageWriter writer(2, 4, 2, policy);
+	mutex lock;
+	lost.assign(WRITER_IMAGES, false);
+	low.assign(WRITER_IMAGES, false);
+	for ( int i = 0; i < WRITER_IMAGES; i++ )
+	{
+		low[i] = i == 14 || i == 17 || i == 20 || i == 23;
+		WriteJob job;
+		job.camera = i % 2;
+		job.priority = low[i]? 0 : 1;
+		job.format = IMAGE_RAW;
+		job.scale = 1;
+		job.filename = to_string(i);
+		job.write = [](const string &, const Frame &) { this_thread::sleep_for(chrono::milliseconds(WRITE_MS)); };
+		job.done = [&lost, &lock, i](bool ok, const string &) { lock_guard<mutex> guard(lock); lost[i] = !ok; };
+		writer.submit(job);
+		this_thread::sleep_for(chrono::milliseconds(SUBMIT_MS));
+	}
+	writer.flush();
+	return writer.stats();
+}
+
+
+// With the block policy every image is written and some submits wait; with the drop
+// policy no submit waits, and the low priority images are dropped first
+bool check_writer()
+{
+	vector<bool> lost, low;
+	WriterStats block = run_writer(WRITER_BLOCK, lost, low);
+	cout << "  block: " << block.written << " written, " << block.dropped << " dropped, " << block.blocked <<
+		" submits waited" << endl;
+	bool ok = block.written == WRITER_IMAGES && block.dropped == 0 && block.blocked > 0;
+
+	WriterStats drop = run_writer(WRITER_DROP, lost, low);
+	int low_lost = 0;
+	for ( int i = 0; i < WRITER_IMAGES; i++ )
+		low_lost += low[i] && lost[i];
+	cout << "  drop: " << drop.written << " written, " << drop.dropped << " dropped, of them " << low_lost <<
+		" of 4 low priority, " << drop.blocked << " submits waited" << endl;
+	ok = ok && drop.blocked == 0 && drop.dropped > 0 && low_lost == 4 && drop.written + drop.dropped == WRITER_IMAGES;
+	return report("writer", ok);
+}
+
+
+// Three cameras trigger SYNC_FRAMES frames per cycle after random arm times.  Camera 2
+// fails before arriving at one frame and camera 1 arrives after the timeout at another;
+// those two frames must be counted as partial and every other frame triggered by all.
+bool check_sync()
+{
+	const int cameras = 3;
+	const int fail_cycle = 5, fail_frame = 2;
+	const int late_cycle = 10, late_frame = 3;
+	SyncTrigger sync(SYNC_TEST_TIMEOUT_MS);
+	int cycle = 0;
+	int late_triggered = 0;
+
+	// Fails the run rather than hanging if the cameras deadlock
+	thread([]
+	{
+		this_thread::sleep_for(chrono::seconds(SYNC_DEADLOCK_S));
+		if ( !sync_finished )
+		{
+			cout << "sync: FAIL, deadlocked" << endl;
+			exit(-1);
+		}
+	}).detach();
+
+	CycleCoordinator coordinator(cameras, [&](int camera, CycleResult &)
+	{
+		mt19937 random(camera * 1000 + cycle);
+		uniform_int_distribution<int> arm_us(0, SYNC_ARM_US);
+		for ( int frame = 0; frame < SYNC_FRAMES; frame++ )
+		{
+			SyncArrival arrival(&sync, frame);
+			this_thread::sleep_for(chrono::microseconds(arm_us(random)));
+			if ( cycle == fail_cycle && frame == fail_frame && camera == 2 )
+				continue;
+			if ( cycle == late_cycle && frame == late_frame && camera == 1 )
+				this_thread::sleep_for(chrono::milliseconds(SYNC_TEST_TIMEOUT_MS * 2));
+			if ( arrival.wait() )
+			{
+				sync.record(camera, frame, monotonic_ns());
+				if ( cycle == late_cycle && frame == late_frame && camera == 1 )
+					late_triggered++;
+			}
+		}
+	});
+
+	for ( cycle = 0; cycle < SYNC_CYCLES; cycle++ )
+	{
+		sync.begin(cameras);
+		coordinator.runCycle();
+	}
+	sync_finished = true;
+
+	SkewStats stats = sync.stats();
+	cout << "  " << stats.frames << " frames, " << stats.partial << " partial, skew median " << stats.median_us <<
+		" us, max " << stats.max_us << " us" << endl;
+	bool ok = stats.partial == 2 && stats.frames == (size_t) SYNC_CYCLES * SYNC_FRAMES && late_triggered == 0;
+	return report("sync", ok);
+}
+
+
+// Release SCHEDULE_CYCLES cycles of SCHEDULE_WORK_MS, one of them taking
+// SCHEDULE_OVERRUN_MS, and return each cycle's deadline in periods after the first
+static ScheduleStats run_schedule(OverrunPolicy policy, vector<double> &deadlines)
+{
+	CycleScheduler scheduler(SCHEDULE_PERIOD_MS / 1000.0, policy);
+	deadlines.clear();
+	int64_t first = 0;
+	for ( int cycle = 0; cycle < SCHEDULE_CYCLES; cycle++ )
+	{
+		int64_t deadline = scheduler.wait();
+		if ( cycle == 0 )
+			first = deadline;
+		deadlines.push_back((deadline - first) / (SCHEDULE_PERIOD_MS * 1e6));
+		int ms = cycle == SCHEDULE_OVERRUN_CYCLE? SCHEDULE_OVERRUN_MS : SCHEDULE_WORK_MS;
+		this_thread::sleep_for(chrono::milliseconds(ms));
+	}
+	return scheduler.stats();
+}
+
+
+// Print the deadlines of a schedule run
+static void print_schedule(const string &name, const ScheduleStats &stats, const vector<double> &deadlines)
+{
+	cout << "  " << name << ": " << stats.overruns << " overruns, " << stats.skipped << " skipped, jitter max " <<
+		fixed << setprecision(0) << stats.jitter_max_us << " us, deadlines";
+	for ( double deadline : deadlines )
+		cout << " " << setprecision(2) << deadline;
+	cout << endl;
+}
+
+
+// The overrunning cycle ends half way between the second and third deadlines after its
+// own.  Skip drops those two and keeps the grid; catch up releases them late, back to
+// back, and is on time again by the third.
+bool check_schedule()
+{
+	vector<double> deadlines;
+	ScheduleStats skip = run_schedule(OVERRUN_SKIP, deadlines);
+	print_schedule("skip", skip, deadlines);
+	bool ok = skip.overruns == 1 && skip.skipped == 2 && skip.cycles == SCHEDULE_CYCLES &&
+		skip.jitter_max_us < SCHEDULE_PERIOD_MS * 1000 / 2;
+	for ( int cycle = 0; cycle < SCHEDULE_CYCLES; cycle++ )
+		ok = ok && deadlines[cycle] == cycle + (cycle > SCHEDULE_OVERRUN_CYCLE? 2 : 0);
+
+	ScheduleStats catchup = run_schedule(OVERRUN_CATCH_UP, deadlines);
+	print_schedule("catchup", catchup, deadlines);
+	ok = ok && catchup.overruns == 2 && catchup.skipped == 0 && catchup.cycles == SCHEDULE_CYCLES;
+	for ( int cycle = 0; cycle < SCHEDULE_CYCLES; cycle++ )
+		ok = ok && deadlines[cycle] == cycle;
+	return report("schedule", ok);
+}
+
+
+// Pixel of the CFA with coordinates outside it mirrored back in
+static unsigned cfa_at(const vector<uint16_t> &cfa, uint32_t width, uint32_t height, int64_t x, int64_t y)
+{
+	if ( x < 0 )
+		x = -x;
+	if ( x >= width )
+		x = 2 * ((int64_t) width - 1) - x;
+	if ( y < 0 )
+		y = -y;
+	if ( y >= height )
+		y = 2 * ((int64_t) height - 1) - y;
+	return cfa[(size_t) y * width + x];
+}
+
+
+// Bilinear demosaic one pixel at a time, as QuickLook.h describes it
+static void reference_bilinear(const vector<uint16_t> &cfa, uint32_t width, uint32_t height, vector<uint16_t> &rgb)
+{
+	rgb.resize((size_t) width * height * 3);
+	for ( uint32_t y = 0; y < height; y++ )
+		for ( uint32_t x = 0; x < width; x++ )
+		{
+			auto at = [&](int dx, int dy) { return cfa_at(cfa, width, height, (int64_t) x + dx, (int64_t) y + dy); };
+			unsigned c = at(0, 0);
+			unsigned h = (at(-1, 0) + at(1, 0)) / 2;
+			unsigned v = (at(0, -1) + at(0, 1)) / 2;
+			unsigned cross = (at(-1, 0) + at(1, 0) + at(0, -1) + at(0, 1)) / 4;
+			unsigned diag = (at(-1, -1) + at(1, -1) + at(-1, 1) + at(1, 1)) / 4;
+
+			// RGGB: red at even x of even rows, blue at odd x of odd rows
+			unsigned values[2][2][3] = {
+				{ { c, cross, diag }, { h, c, v } },
+				{ { v, c, h }, { diag, cross, c } }
+			};
+			for ( int i = 0; i < 3; i++ )
+				rgb[((size_t) y * width + x) * 3 + i] = values[y & 1][x & 1][i] * 16;
+		}
+}
+
+
+// Mean of the red, green and blue pixels of each scale by scale block
+static void reference_binned(const vector<uint16_t> &cfa, uint32_t width, uint32_t height, int scale,
+	vector<uint16_t> &rgb)
+{
+	uint32_t out_width = width / scale, out_height = height / scale;
+	rgb.resize((size_t) out_width * out_height * 3);
+	for ( uint32_t oy = 0; oy < out_height; oy++ )
+		for ( uint32_t ox = 0; ox < out_width; ox++ )
+		{
+			uint32_t sum[3] = { 0, 0, 0 };
+			for ( int y = 0; y < scale; y++ )
+				for ( int x = 0; x < scale; x++ )
+					sum[(y & 1) + (x & 1)] += cfa[((size_t) oy * scale + y) * width + ox * scale + x];
+			uint32_t count = scale * scale / 4;
+			uint16_t* out = &rgb[((size_t) oy * out_width + ox) * 3];
+			out[0] = sum[0] * 16 / count;
+			out[1] = sum[1] * 16 / (2 * count);
+			out[2] = sum[2] * 16 / count;
+		}
+}
+
+
+// Both quick-look paths on random 12-bit frames of QUICKLOOK_SIZES, at every scale that
+// leaves a pixel, must give exactly the reference values
+bool check_quicklook()
+{
+	mt19937 random(22);
+	uniform_int_distribution<int> pixel(0, 4095);
+	bool ok = true;
+	for ( auto &size : QUICKLOOK_SIZES )
+	{
+		uint32_t width = size[0], height = size[1];
+		vector<uint16_t> cfa((size_t) width * height);
+		for ( auto &p : cfa )
+			p = pixel(random);
+
+		for ( int scale = 1; scale <= QUICKLOOK_MAX_SCALE && scale <= (int) min(width, height); scale *= 2 )
+		{
+			vector<uint16_t> expected, rgb;
+			if ( scale == 1 )
+			{
+				reference_bilinear(cfa, width, height, expected);
+				rgb.resize(expected.size());
+				demosaic_bilinear(cfa.data(), width, height, rgb.data());
+			}
+			else
+			{
+				reference_binned(cfa, width, height, scale, expected);
+				rgb.resize(expected.size());
+				demosaic_binned(cfa.data(), width, height, scale, rgb.data());
+			}
+
+			size_t differ = 0;
+			for ( size_t i = 0; i < rgb.size(); i++ )
+				differ += rgb[i] != expected[i];
+			if ( differ > 0 )
+			{
+				cout << "  " << width << "x" << height << " scale " << scale << ": " << differ << " of " <<
+					rgb.size() << " values differ" << endl;
+				ok = false;
+			}
+		}
+	}
+	return report("quicklook", ok);
+}
+
+
+// Random 12-bit pixels of n images: a sky level per pixel with noise, and now and then
+// a saturated pixel in one image, as from a cosmic ray
+static void stack_images(mt19937 &random, int n, size_t pixels, vector<vector<uint16_t> > &images)
+{
+	uniform_int_distribution<int> level(0, 3800), ray(0, 49);
+	normal_distribution<float> noise(0, 20);
+	images.assign(n, vector<uint16_t>(pixels));
+	for ( size_t i = 0; i < pixels; i++ )
+	{
+		int sky = level(random);
+		for ( int k = 0; k < n; k++ )
+		{
+			int v = ray(random) == 0? 4095 : sky + (int) lround(noise(random));
+			images[k][i] = min(max(v, 0), 4095);
+		}
+	}
+}
+
+
+// Sigma-clipped mean of the values of one pixel times 2^STACK_SHIFT, as Stacker.h
+// describes it.  Sets borderline if a value is too near the limit for float arithmetic
+// to decide the same way.
+static double reference_clip(const vector<double> &x, bool &borderline)
+{
+	int n = x.size();
+	double kept = 0, all = 0;
+	int count = 0;
+	for ( int k = 0; k < n; k++ )
+	{
+		double others = 0;
+		for ( int j = 0; j < n; j++ )
+			others += j == k? 0 : x[j];
+		double mean = others / (n - 1);
+		double square = 0;
+		for ( int j = 0; j < n; j++ )
+			square += j == k? 0 : (x[j] - mean) * (x[j] - mean);
+
+		// The value's deviation also has the uncertainty of the others' mean
+		double variance = max(square / (n - 2) * n / (n - 1), (double) STACK_CLIP_FLOOR * STACK_CLIP_FLOOR);
+		double deviation = (x[k] - mean) * (x[k] - mean);
+		double limit = variance * STACK_CLIP_SIGMA * STACK_CLIP_SIGMA;
+		borderline = borderline || fabs(deviation - limit) < 1e-3 * limit;
+		if ( deviation <= limit )
+		{
+			kept += x[k];
+			count++;
+		}
+		all += x[k];
+	}
+	return count > 0? kept / count * 16 : all / n * 16;
+}
+
+
+// Each kernel on every n from 2 to STACK_MAX_FRAMES and KERNEL_PIXELS pixels.  The mean
+// must be within 1 of the exact mean and the median exact.  The clipped mean must be
+// within 1 of the reference, except where a value is on the limit.
+bool check_stack()
+{
+	mt19937 random(23);
+	bool ok = true;
+	size_t pixels_checked = 0, borderline_pixels = 0;
+	for ( int n = 2; n <= STACK_MAX_FRAMES; n++ )
+		for ( size_t pixels : KERNEL_PIXELS )
+		{
+			vector<vector<uint16_t> > images;
+			stack_images(random, n, pixels, images);
+			const uint16_t* pointers[STACK_MAX_FRAMES];
+			for ( int k = 0; k < n; k++ )
+				pointers[k] = images[k].data();
+
+			vector<uint16_t> mean(pixels), median(pixels), clip(pixels);
+			stack_mean(pointers, n, pixels, mean.data());
+			stack_median(pointers, n, pixels, median.data());
+			stack_clip(pointers, n, pixels, clip.data());
+
+			size_t differ[3] = { 0, 0, 0 };
+			for ( size_t i = 0; i < pixels; i++ )
+			{
+				vector<double> x(n);
+				for ( int k = 0; k < n; k++ )
+					x[k] = images[k][i];
+				double sum = 0;
+				for ( double v : x )
+					sum += v;
+				differ[0] += fabs(mean[i] - sum * 16 / n) > 1;
+
+				sort(x.begin(), x.end());
+				double middle = n & 1? x[n / 2] * 16 : (x[n / 2 - 1] + x[n / 2]) * 8;
+				differ[1] += median[i] != middle;
+
+				bool borderline = false;
+				double expected = n < 3? sum * 16 / n : reference_clip(x, borderline);
+				borderline_pixels += borderline;
+				differ[2] += !borderline && fabs(clip[i] - expected) > 1;
+				pixels_checked++;
+			}
+
+			const char* names[3] = { "mean", "median", "clip" };
+			for ( int m = 0; m < 3; m++ )
+				if ( differ[m] > 0 )
+				{
+					cout << "  " << names[m] << " of " << n << " images, " << pixels << " pixels: " << differ[m] <<
+						" differ" << endl;
+					ok = false;
+				}
+		}
+	cout << "  " << pixels_checked << " pixels, " << borderline_pixels << " on the clip limit not compared" << endl;
+	return report("stack", ok);
+}
+
+
+// Dark subtraction of one pixel, as Calibration.h describes it
+static uint16_t reference_dark(uint16_t pixel, uint16_t a, uint16_t b, int32_t weight)
+{
+	if ( pixel >= 4095 )
+		return 4095;
+	double dark = a + floor(((double) b - a) * weight / 4096 + 0.5);
+	double v = floor(pixel + CALIBRATION_PEDESTAL - dark / (1 << CALIBRATION_SHIFT) + 0.5);
+	return min(max(v, 0.0), 4095.0);
+}
+
+
+// Dark subtraction for KERNEL_PIXELS pixels, some of them saturated, and
+// CALIBRATION_WEIGHTS between and beyond the two darks, which range from none to hot;
+// hot pixel replacement for rows of CALIBRATION_WIDTHS, some of them replaced in strips.
+// Both must be exact, and saturated pixels must stay saturated.
+bool check_calibration()
+{
+	mt19937 random(25);
+	uniform_int_distribution<int> pixel(0, 4095), dark(0, 400 << CALIBRATION_SHIFT), hot_dark(0, 65535);
+	uniform_int_distribution<int> one_in(0, 19);
+	bool ok = true;
+
+	for ( size_t count : KERNEL_PIXELS )
+		for ( int32_t weight : CALIBRATION_WEIGHTS )
+		{
+			vector<uint16_t> pixels(count), a(count), b(count);
+			for ( size_t i = 0; i < count; i++ )
+			{
+				pixels[i] = one_in(random) == 0? 4095 : pixel(random);
+				a[i] = one_in(random) == 0? hot_dark(random) : dark(random);
+				b[i] = one_in(random) == 0? hot_dark(random) : dark(random);
+			}
+			vector<uint16_t> corrected(pixels);
+			subtract_dark(corrected.data(), a.data(), b.data(), weight, count);
+
+			size_t differ = 0, unsaturated = 0;
+			for ( size_t i = 0; i < count; i++ )
+			{
+				differ += corrected[i] != reference_dark(pixels[i], a[i], b[i], weight);
+				unsaturated += pixels[i] == 4095 && corrected[i] != 4095;
+			}
+			if ( differ > 0 )
+			{
+				cout << "  dark, " << count << " pixels, weight " << weight << ": " << differ << " differ, " <<
+					unsaturated << " saturated pixels changed" << endl;
+				ok = false;
+			}
+		}
+
+	for ( uint32_t width : CALIBRATION_WIDTHS )
+	{
+		// Hot pixels in runs, so that some have hot neighbours, and at the row ends
+		size_t count = (size_t) width * CALIBRATION_TEST_ROWS;
+		vector<uint16_t> pixels(count);
+		vector<bool> is_hot(count);
+		vector<uint32_t> hot;
+		for ( size_t i = 0; i < count; i++ )
+		{
+			pixels[i] = pixel(random);
+			uint32_t x = i % width;
+			is_hot[i] = one_in(random) < 3 || (i >= 2 && is_hot[i - 2] && one_in(random) < 10) || x == 0 ||
+				x + 1 == width;
+			if ( is_hot[i] )
+				hot.push_back(i);
+		}
+
+		vector<uint16_t> expected(pixels);
+		for ( uint32_t h : hot )
+		{
+			uint32_t x = h % width;
+			bool left = x >= 2 && !is_hot[h - 2];
+			bool right = x + 2 < width && !is_hot[h + 2];
+			if ( left && right )
+				expected[h] = (pixels[h - 2] + pixels[h + 2] + 1) / 2;
+			else if ( left || right )
+				expected[h] = pixels[left? h - 2 : h + 2];
+		}
+
+		// Whole image, then in strips of one and two rows
+		for ( int rows : { CALIBRATION_TEST_ROWS, 2, 1 } )
+		{
+			vector<uint16_t> replaced(pixels);
+			for ( int y = 0; y < CALIBRATION_TEST_ROWS; y += rows )
+				replace_hot_pixels(replaced.data(), width, hot.data(), hot.size(), (size_t) y * width,
+					(size_t) min(y + rows, CALIBRATION_TEST_ROWS) * width);
+			if ( replaced != expected )
+			{
+				cout << "  hot pixels, width " << width << ", strips of " << rows << " rows differ" << endl;
+				ok = false;
+			}
+		}
+	}
+	return report("calibration", ok);
+}
+
+
+int main(int argc, char* argv[])
+{
+	vector<pair<string, function<bool()> > > checks = {
+		{ "coordinator", check_coordinator },
+		{ "writer", check_writer },
+		{ "sync", check_sync },
+		{ "schedule", check_schedule },
+		{ "quicklook", check_quicklook },
+		{ "stack", check_stack },
+		{ "calibration", check_calibration }
+	};
+
+	int failed = 0;
+	for ( auto &check : checks )
+	{
+		bool wanted = argc < 2;
+		for ( int i = 1; i < argc; i++ )
+			wanted = wanted || check.first == argv[i];
+		if ( wanted && !check.second() )
+			failed++;
+	}
+	for ( int i = 1; i < argc; i++ )
+	{
+		bool known = false;
+		for ( auto &check : checks )
+			known = known || check.first == argv[i];
+		if ( !known )
+		{
+			cerr << "usage: PipelineTest [check ...]" << endl;
+			exit(-1);
+		}
+	}
+	exit(failed);
+}
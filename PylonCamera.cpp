@@ -0,0 +1,181 @@
+//	PylonCamera.cpp
+//	Implementation of PylonCamera class.
+
+// System includes
+#include <memory>
+
+// Local includes
+#include "PylonCamera.h"
+
+// System namespace
+using namespace std;
+
+// Pylon namespaces
+using namespace Pylon;
+using namespace GenApi;
+
+
+// Copy the chunk data of a grab result into frame.  The requested exposure time is
+// kept if the camera didn't send the actual one.
+static void read_chunks(const CGrabResultPtr &result, Frame &frame)
+{
+	frame.metadata = false;
+	frame.timestamp = 0;
+	frame.gain_db = 0;
+	frame.counter = 0;
+	if ( !result->IsChunkDataAvailable() )
+		return;
+
+	INodeMap &chunks = result->GetChunkDataNodeMap();
+	CIntegerPtr timestamp(chunks.GetNode("ChunkTimestamp"));
+	CFloatPtr exposure(chunks.GetNode("ChunkExposureTime"));
+	CFloatPtr gain(chunks.GetNode("ChunkGain"));
+	CIntegerPtr counter(chunks.GetNode("ChunkCounterValue"));
+	if ( !IsReadable(counter) )
+		counter = chunks.GetNode("ChunkFramecounter");
+
+	frame.metadata = true;
+	if ( IsReadable(timestamp) )
+		frame.timestamp = timestamp->GetValue();
+	if ( IsReadable(exposure) )
+		frame.exposure_us = exposure->GetValue();
+	if ( IsReadable(gain) )
+		frame.gain_db = gain->GetValue();
+	if ( IsReadable(counter) )
+		frame.counter = counter->GetValue();
+}
+
+
+// The camera must be open
+PylonCamera::PylonCamera(CBaslerUsbInstantCamera &c, size_t buffers) :
+	camera(c), engine(c, buffers), temp(0), exposure_us(0), trigger_ns(0)
+{
+	serial = camera.GetDeviceInfo().GetSerialNumber().c_str();
+	model = camera.GetDeviceInfo().GetModelName().c_str();
+	try
+	{
+		sample();
+	}
+	catch (const CameraError &e)
+	{
+		// Tried again at the next sample()
+	}
+}
+
+
+string PylonCamera::serialNumber()
+{
+	return serial;
+}
+
+
+string PylonCamera::modelName()
+{
+	return model;
+}
+
+
+// Temperature when sample() was last called
+double PylonCamera::temperature()
+{
+	return temp;
+}
+
+
+void PylonCamera::sample()
+{
+	try
+	{
+		temp = camera.DeviceTemperature.GetValue();
+	}
+	catch (const GenericException &e)
+	{
+		throw CameraError(e.what());
+	}
+}
+
+
+void PylonCamera::arm(double us)
+{
+	try
+	{
+		engine.arm(us);
+		exposure_us = us;
+	}
+	catch (const TimeoutException &e)
+	{
+		throw CameraTimeout(e.what());
+	}
+	catch (const GenericException &e)
+	{
+		throw CameraError(e.what());
+	}
+}
+
+
+int64_t PylonCamera::trigger()
+{
+	try
+	{
+		trigger_ns = engine.trigger();
+		return trigger_ns;
+	}
+	catch (const GenericException &e)
+	{
+		throw CameraError(e.what());
+	}
+}
+
+
+// The frame shares ownership of the grab result, which gives the buffer back to the
+// engine's frame pool when the frame is released
+bool PylonCamera::retrieve(Frame &frame, string &error)
+{
+	CGrabResultPtr result;
+	try
+	{
+		if ( !engine.retrieve(result) )
+		{
+			error = result? result->GetErrorDescription().c_str() : "no grab result";
+			return false;
+		}
+	}
+	catch (const TimeoutException &e)
+	{
+		throw CameraTimeout(e.what());
+	}
+	catch (const GenericException &e)
+	{
+		throw CameraError(e.what());
+	}
+
+	frame.pixels = (const uint16_t*) result->GetBuffer();
+	frame.width = result->GetWidth();
+	frame.height = result->GetHeight();
+	frame.size = result->GetImageSize();
+	frame.trigger_ns = trigger_ns;
+	frame.exposure_us = exposure_us;
+	try
+	{
+		read_chunks(result, frame);
+	}
+	catch (const GenericException &e)
+	{
+		frame.metadata = false;
+	}
+	frame.owner = make_shared<CGrabResultPtr>(result);
+	return true;
+}
+
+
+bool PylonCamera::removed()
+{
+	return camera.IsCameraDeviceRemoved();
+}
+
+
+void PylonCamera::close()
+{
+	engine.stop();
+	camera.Close();
+}
@@ -0,0 +1,46 @@
+//	PylonCamera.h
+//	Interface for PylonCamera class.  A camera source for a Basler USB camera, grabbing
+//	through a CaptureEngine.  A frame keeps its pylon grab result, and so the grab
+//	buffer, until the last copy of the frame is released.  Frame metadata is taken from
+//	the chunk data, the serial number and model name are read when the camera is
+//	wrapped and the temperature when sample() is called.  Pylon exceptions are turned
+//	into CameraError and CameraTimeout.
+
+#ifndef _PylonCamera_H_
+#define _PylonCamera_H_
+
+#include <string>
+
+#include <pylon/PylonIncludes.h>
+#include <pylon/usb/BaslerUsbInstantCamera.h>
+
+#include "CameraSource.h"
+#include "CaptureEngine.h"
+
+
+// PylonCamera class definition
+class PylonCamera : public CameraSource
+{
+public:
+	PylonCamera(Pylon::CBaslerUsbInstantCamera &camera, size_t buffers = SOURCE_BUFFERS);
+	string serialNumber();
+	string modelName();
+	double temperature();
+	void sample();
+	void arm(double exposure_us);
+	int64_t trigger();
+	bool retrieve(Frame &frame, string &error);
+	bool removed();
+	void close();
+
+private:
+	Pylon::CBaslerUsbInstantCamera &camera;
+	CaptureEngine engine;
+	string serial;
+	string model;
+	double temp;
+	double exposure_us;
+	int64_t trigger_ns;
+};
+
+#endif
@@ -0,0 +1,229 @@
+//	QuickLook.cpp
+//	Demosaicing and reducing BayerRG12 frames, see QuickLook.h.  The inner loops work on
+//	eight pixels at a time with GCC vector extensions, which compile to SSE2 on x86 and
+//	NEON on the Odroid.  The bilinear demosaic computes every neighbour mean for all eight
+//	pixels and picks the ones each pixel needs by its colour; the edge pixels, which have
+//	neighbours missing, mirror them from the other side and are done one at a time.
+
+// System includes
+#include <system_error>
+#include <cstring>
+#include <cerrno>
+
+// Local includes
+#include "QuickLook.h"
+
+// System namespace
+using namespace std;
+
+typedef uint16_t v8hu __attribute__ ((vector_size (16)));
+
+const int QUICKLOOK_SHIFT = 4;		// 12-bit values to 16 bits
+
+
+// Scale 1 for full size, or a power of 2 up to QUICKLOOK_MAX_SCALE
+bool quicklook_scale_ok(int scale)
+{
+	return scale >= 1 && scale <= QUICKLOOK_MAX_SCALE && (scale & (scale - 1)) == 0;
+}
+
+
+static inline v8hu load(const uint16_t* p)
+{
+	v8hu v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+// Interleave eight pixels of each colour into 24 RGB values
+static inline void store_rgb(v8hu red, v8hu green, v8hu blue, uint16_t* out)
+{
+	const v8hu rg0 = { 0, 8, 0, 1, 9, 0, 2, 10 }, rgb0 = { 0, 1, 8, 3, 4, 9, 6, 7 };
+	const v8hu rg1 = { 0, 3, 11, 0, 4, 12, 0, 5 }, rgb1 = { 10, 1, 2, 11, 4, 5, 12, 7 };
+	const v8hu rg2 = { 13, 0, 6, 14, 0, 7, 15, 0 }, rgb2 = { 0, 13, 2, 3, 14, 5, 6, 15 };
+	v8hu v[3];
+	v[0] = __builtin_shuffle(__builtin_shuffle(red, green, rg0), blue, rgb0);
+	v[1] = __builtin_shuffle(__builtin_shuffle(red, green, rg1), blue, rgb1);
+	v[2] = __builtin_shuffle(__builtin_shuffle(red, green, rg2), blue, rgb2);
+	memcpy(out, v, sizeof(v));
+}
+
+
+// Neighbour coordinate mirrored into the image; the mirror is an odd number of pixels
+// away, so it has the colour of the missing neighbour
+static inline uint32_t mirror(int64_t i, uint32_t size)
+{
+	if ( i < 0 )
+		return -i;
+	if ( i >= size )
+		return 2 * (size - 1) - i;
+	return i;
+}
+
+
+// Demosaic one pixel whose neighbours may be outside the image
+static void demosaic_pixel(const uint16_t* cfa, uint32_t width, uint32_t height, uint32_t x, uint32_t y, uint16_t* out)
+{
+	const uint16_t* up = cfa + (size_t) mirror((int64_t) y - 1, height) * width;
+	const uint16_t* row = cfa + (size_t) y * width;
+	const uint16_t* down = cfa + (size_t) mirror((int64_t) y + 1, height) * width;
+	uint32_t left = mirror((int64_t) x - 1, width), right = mirror((int64_t) x + 1, width);
+
+	unsigned c = row[x];
+	unsigned h = (row[left] + row[right]) >> 1;
+	unsigned v = (up[x] + down[x]) >> 1;
+	unsigned cross = (row[left] + row[right] + up[x] + down[x]) >> 2;
+	unsigned diag = (up[left] + up[right] + down[left] + down[right]) >> 2;
+
+	unsigned r, g, b;
+	if ( (y & 1) == 0 )
+	{
+		r = (x & 1)? h : c;
+		g = (x & 1)? c : cross;
+		b = (x & 1)? v : diag;
+	}
+	else
+	{
+		r = (x & 1)? diag : v;
+		g = (x & 1)? cross : c;
+		b = (x & 1)? c : h;
+	}
+	out[0] = r << QUICKLOOK_SHIFT;
+	out[1] = g << QUICKLOOK_SHIFT;
+	out[2] = b << QUICKLOOK_SHIFT;
+}
+
+
+// Full size RGB image of width * height * 3 values from the CFA, which must be at least
+// 2 by 2 pixels
+void demosaic_bilinear(const uint16_t* cfa, uint32_t width, uint32_t height, uint16_t* rgb)
+{
+	const v8hu even = { 0xffff, 0, 0xffff, 0, 0xffff, 0, 0xffff, 0 };	// Lanes at even x
+
+	for ( uint32_t y = 0; y < height; y++ )
+	{
+		uint16_t* out = rgb + (size_t) y * width * 3;
+		if ( y == 0 || y + 1 == height )
+		{
+			for ( uint32_t x = 0; x < width; x++ )
+				demosaic_pixel(cfa, width, height, x, y, out + 3 * x);
+			continue;
+		}
+
+		const uint16_t* up = cfa + (size_t) (y - 1) * width;
+		const uint16_t* row = up + width;
+		const uint16_t* down = row + width;
+		bool red_row = (y & 1) == 0;
+
+		demosaic_pixel(cfa, width, height, 0, y, out);
+		demosaic_pixel(cfa, width, height, 1, y, out + 3);
+
+		// Starting at an even x keeps the colours in the same lanes, and the last
+		// block must leave a pixel to the right of it
+		uint32_t x = 2;
+		for ( ; x + 9 <= width; x += 8 )
+		{
+			v8hu c = load(row + x), l = load(row + x - 1), r = load(row + x + 1);
+			v8hu u = load(up + x), d = load(down + x);
+			v8hu h = (l + r) >> 1;
+			v8hu v = (u + d) >> 1;
+			v8hu cross = (l + r + u + d) >> 2;
+			v8hu diag = (load(up + x - 1) + load(up + x + 1) + load(down + x - 1) + load(down + x + 1)) >> 2;
+
+			v8hu red, green, blue;
+			if ( red_row )
+			{
+				red = (even & c) | (~even & h);
+				green = (even & cross) | (~even & c);
+				blue = (even & diag) | (~even & v);
+			}
+			else
+			{
+				red = (even & v) | (~even & diag);
+				green = (even & c) | (~even & cross);
+				blue = (even & h) | (~even & c);
+			}
+			red <<= QUICKLOOK_SHIFT;
+			green <<= QUICKLOOK_SHIFT;
+			blue <<= QUICKLOOK_SHIFT;
+
+			store_rgb(red, green, blue, out + 3 * x);
+		}
+		for ( ; x < width; x++ )
+			demosaic_pixel(cfa, width, height, x, y, out + 3 * x);
+	}
+}
+
+
+// RGB image of (width / scale) * (height / scale) * 3 values, each the mean of a block of
+// the CFA; scale is 2 to QUICKLOOK_MAX_SCALE and partial blocks at the edges are left out
+void demosaic_binned(const uint16_t* cfa, uint32_t width, uint32_t height, int scale, uint16_t* rgb)
+{
+	static thread_local vector<uint16_t> sums;
+
+	// Per column sums over the even rows and over the odd rows of a block
+	sums.resize(2 * (size_t) width);
+	uint16_t* even_sum = sums.data();
+	uint16_t* odd_sum = even_sum + width;
+
+	// Each colour sum covers (scale / 2)^2 pixels, green twice that
+	int shift = 0;
+	while ( (2 << shift) < scale )
+		shift++;
+	shift *= 2;
+
+	uint32_t out_width = width / scale, out_height = height / scale;
+	for ( uint32_t oy = 0; oy < out_height; oy++ )
+	{
+		memset(even_sum, 0, 2 * width * sizeof(uint16_t));
+		for ( int i = 0; i < scale; i++ )
+		{
+			const uint16_t* row = cfa + ((size_t) oy * scale + i) * width;
+			uint16_t* sum = (i & 1)? odd_sum : even_sum;
+			uint32_t x = 0;
+			for ( ; x + 8 <= width; x += 8 )
+			{
+				v8hu s = load(sum + x) + load(row + x);
+				memcpy(sum + x, &s, sizeof(s));
+			}
+			for ( ; x < width; x++ )
+				sum[x] += row[x];
+		}
+
+		uint16_t* out = rgb + (size_t) oy * out_width * 3;
+		for ( uint32_t ox = 0; ox < out_width; ox++ )
+		{
+			uint32_t r = 0, g = 0, b = 0;
+			const uint16_t* e = even_sum + (size_t) ox * scale;
+			const uint16_t* o = odd_sum + (size_t) ox * scale;
+			for ( int i = 0; i < scale; i += 2 )
+			{
+				r += e[i];
+				g += e[i + 1] + o[i];
+				b += o[i + 1];
+			}
+			out[3 * ox] = (r << QUICKLOOK_SHIFT) >> shift;
+			out[3 * ox + 1] = (g << QUICKLOOK_SHIFT) >> (shift + 1);
+			out[3 * ox + 2] = (b << QUICKLOOK_SHIFT) >> shift;
+		}
+	}
+}
+
+
+// Quick-look image of a frame reduced by scale, into rgb resized to fit
+void make_quicklook(const Frame &frame, int scale, vector<uint16_t> &rgb, uint32_t &width, uint32_t &height)
+{
+	if ( !quicklook_scale_ok(scale) )
+		throw system_error{EINVAL, system_category(), "quick-look scale " + to_string(scale)};
+	width = frame.width / scale;
+	height = frame.height / scale;
+	if ( frame.width < 2 || frame.height < 2 || width == 0 || height == 0 )
+		throw system_error{EINVAL, system_category(), "frame too small for a quick-look image"};
+
+	rgb.resize((size_t) width * height * 3);
+	if ( scale == 1 )
+		demosaic_bilinear(frame.pixels, frame.width, frame.height, rgb.data());
+	else
+		demosaic_binned(frame.pixels, frame.width, frame.height, scale, rgb.data());
+}
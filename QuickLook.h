@@ -0,0 +1,27 @@
+//	QuickLook.h
+//	Quick-look colour images made from a BayerRG12 frame that was taken anyway, instead
+//	of a separate exposure.  At full size the CFA is demosaiced bilinearly: each missing
+//	colour is the mean of the nearest pixels of that colour.  Reduced by a scale of 2 to
+//	16, each output pixel is the mean of the red, green and blue pixels of a scale by
+//	scale block, which is cheaper and has less noise.  Output is 16-bit RGB, the 12-bit
+//	values shifted to the full 16-bit range, rows top to bottom.
+
+#ifndef _QuickLook_H_
+#define _QuickLook_H_
+
+#include <vector>
+#include <cstdint>
+
+#include "Frame.h"
+
+using namespace std;
+
+const int QUICKLOOK_MAX_SCALE = 16;		// Block sums of 12-bit pixels fit 16 bits
+
+
+extern bool quicklook_scale_ok(int scale);
+extern void demosaic_bilinear(const uint16_t* cfa, uint32_t width, uint32_t height, uint16_t* rgb);
+extern void demosaic_binned(const uint16_t* cfa, uint32_t width, uint32_t height, int scale, uint16_t* rgb);
+extern void make_quicklook(const Frame &frame, int scale, vector<uint16_t> &rgb, uint32_t &width, uint32_t &height);
+
+#endif
@@ -0,0 +1,369 @@
+//	RawCodec.cpp
+//	Lossless coding of BayerRG12 frames, see RawCodec.h for the format.  The residuals
+//	of a row are computed eight pixels at a time with GCC vector extensions, which
+//	compile to SSE2 on x86 and NEON on the Odroid; the Rice coder works through them one
+//	at a time with a 64-bit bit buffer that is flushed 32 bits at a time.
+
+// System includes
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Local includes
+#include "RawCodec.h"
+
+// System namespace
+using namespace std;
+
+typedef uint16_t v8hu __attribute__ ((vector_size (16)));
+
+
+// Residual modulo 2^16 to its unsigned code
+static inline uint16_t zigzag(uint16_t d)
+{
+	return (d << 1) ^ (0 - (d >> 15));
+}
+
+
+static inline uint16_t unzigzag(uint16_t u)
+{
+	return (u >> 1) ^ (0 - (u & 1));
+}
+
+
+// (a + b) / 2 rounded down, without overflowing 16 bits
+static inline uint16_t average(uint16_t a, uint16_t b)
+{
+	return (a >> 1) + (b >> 1) + (a & b & 1);
+}
+
+
+// Coded residuals of a row.  up is the row two above in the same tile, or NULL.
+static void row_residuals(const uint16_t* row, const uint16_t* up, uint32_t width, uint16_t* out)
+{
+	const v8hu zero = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	const v8hu one = zero + 1;
+
+	uint32_t x = 0;
+	for ( ; x < 2 && x < width; x++ )
+		out[x] = zigzag(row[x] - (up ? up[x] : 0));
+
+	if ( up == NULL )
+	{
+		for ( ; x + 8 <= width; x += 8 )
+		{
+			v8hu p, a;
+			memcpy(&p, row + x, sizeof(p));
+			memcpy(&a, row + x - 2, sizeof(a));
+			v8hu d = p - a;
+			d = (d << 1) ^ (zero - (d >> 15));
+			memcpy(out + x, &d, sizeof(d));
+		}
+		for ( ; x < width; x++ )
+			out[x] = zigzag(row[x] - row[x - 2]);
+	}
+	else
+	{
+		for ( ; x + 8 <= width; x += 8 )
+		{
+			v8hu p, a, b;
+			memcpy(&p, row + x, sizeof(p));
+			memcpy(&a, row + x - 2, sizeof(a));
+			memcpy(&b, up + x, sizeof(b));
+			v8hu d = p - ((a >> 1) + (b >> 1) + (a & b & one));
+			d = (d << 1) ^ (zero - (d >> 15));
+			memcpy(out + x, &d, sizeof(d));
+		}
+		for ( ; x < width; x++ )
+			out[x] = zigzag(row[x] - average(row[x - 2], up[x]));
+	}
+}
+
+
+// Writes codes of up to 32 bits, least significant bit first
+struct BitWriter
+{
+	uint8_t* out;
+	uint64_t acc;
+	unsigned bits;
+
+	BitWriter(uint8_t* o) : out(o), acc(0), bits(0) {}
+
+	void put(uint64_t value, unsigned length)
+	{
+		acc |= value << bits;
+		bits += length;
+		if ( bits >= 32 )
+		{
+			uint32_t word = acc;
+			memcpy(out, &word, sizeof(word));
+			out += sizeof(word);
+			acc >>= 32;
+			bits -= 32;
+		}
+	}
+
+	// Write the bits left over and return the end of the output
+	uint8_t* finish()
+	{
+		for ( ; bits > 0; bits -= min(bits, 8u) )
+		{
+			*out++ = acc;
+			acc >>= 8;
+		}
+		return out;
+	}
+};
+
+
+// Reads codes of up to 32 bits.  Past the end of the input it reads zeros and counts
+// them, so a truncated tile is found without checking every read.
+struct BitReader
+{
+	const uint8_t* in;
+	const uint8_t* end;
+	uint64_t acc;
+	unsigned bits;
+	size_t past;		// Bytes of zeros read after the end
+
+	BitReader(const uint8_t* i, size_t size) : in(i), end(i + size), acc(0), bits(0), past(0) {}
+
+	// Make at least 32 bits available
+	void fill()
+	{
+		if ( bits >= 32 )
+			return;
+		uint32_t word = 0;
+		size_t left = end - in;
+		if ( left >= sizeof(word) )
+		{
+			memcpy(&word, in, sizeof(word));
+			in += sizeof(word);
+		}
+		else
+		{
+			memcpy(&word, in, left);
+			in = end;
+			past += sizeof(word) - left;
+		}
+		acc |= (uint64_t) word << bits;
+		bits += 32;
+	}
+
+	uint32_t take(unsigned length)
+	{
+		uint32_t value = acc & ((1ull << length) - 1);
+		acc >>= length;
+		bits -= length;
+		return value;
+	}
+
+	bool overrun() const
+	{
+		return past * 8 > bits;
+	}
+};
+
+
+// Most bytes a tile can take
+size_t tile_bound(uint32_t width, uint32_t rows)
+{
+	size_t n = (size_t) width * rows;
+	return n * 4 + (n + RICE_BLOCK - 1) / RICE_BLOCK / 2 + 16;
+}
+
+
+// Code a tile of rows at pixels into out, which has room for tile_bound() bytes.
+// Returns the bytes used.
+size_t encode_tile(const uint16_t* pixels, uint32_t width, uint32_t rows, uint8_t* out)
+{
+	static thread_local vector<uint16_t> values;
+
+	size_t n = (size_t) width * rows;
+	if ( values.size() < n )
+		values.resize(n);
+	for ( uint32_t y = 0; y < rows; y++ )
+	{
+		const uint16_t* row = pixels + (size_t) y * width;
+		row_residuals(row, (y >= 2)? row - 2 * width : NULL, width, values.data() + (size_t) y * width);
+	}
+
+	BitWriter writer(out);
+	for ( size_t i = 0; i < n; i += RICE_BLOCK )
+	{
+		const uint16_t* u = values.data() + i;
+		size_t m = min(RICE_BLOCK, n - i);
+
+		// Largest k with 2^k no more than the mean value
+		uint32_t sum = 0;
+		for ( size_t j = 0; j < m; j++ )
+			sum += u[j];
+		unsigned k = 0;
+		while ( k < 15 && ((uint32_t) m << (k + 1)) <= sum )
+			k++;
+		writer.put(k, 4);
+
+		uint32_t mask = (1u << k) - 1;
+		for ( size_t j = 0; j < m; j++ )
+		{
+			unsigned q = u[j] >> k;
+			if ( q < RICE_ESCAPE )
+				writer.put(((uint64_t) (u[j] & mask) << (q + 1)) | (1u << q), q + 1 + k);
+			else
+				writer.put(((uint64_t) u[j] << (RICE_ESCAPE + 1)) | (1u << RICE_ESCAPE), RICE_ESCAPE + 1 + 16);
+		}
+	}
+	return writer.finish() - out;
+}
+
+
+// Decode a tile of size bytes into rows at pixels.  Returns false if the data is
+// corrupt or truncated.
+bool decode_tile(const uint8_t* in, size_t size, uint32_t width, uint32_t rows, uint16_t* pixels)
+{
+	size_t n = (size_t) width * rows;
+	BitReader reader(in, size);
+	for ( size_t i = 0; i < n; i += RICE_BLOCK )
+	{
+		size_t m = min(RICE_BLOCK, n - i);
+		reader.fill();
+		unsigned k = reader.take(4);
+		for ( size_t j = 0; j < m; j++ )
+		{
+			reader.fill();
+			unsigned q = __builtin_ctzll(reader.acc | (1ull << (RICE_ESCAPE + 1)));
+			if ( q > RICE_ESCAPE )
+				return false;
+			if ( q < RICE_ESCAPE )
+			{
+				reader.take(q + 1);
+				pixels[i + j] = (q << k) | reader.take(k);
+			}
+			else
+			{
+				reader.take(RICE_ESCAPE + 1);
+				pixels[i + j] = reader.take(16);
+			}
+		}
+	}
+	if ( reader.overrun() )
+		return false;
+
+	// Undo the prediction in place, each pixel depending on ones already restored
+	for ( uint32_t y = 0; y < rows; y++ )
+	{
+		uint16_t* row = pixels + (size_t) y * width;
+		const uint16_t* up = (y >= 2)? row - 2 * width : NULL;
+		for ( uint32_t x = 0; x < width; x++ )
+		{
+			uint16_t predicted;
+			if ( x >= 2 )
+				predicted = up ? average(row[x - 2], up[x]) : row[x - 2];
+			else
+				predicted = up ? up[x] : 0;
+			row[x] = predicted + unzigzag(row[x]);
+		}
+	}
+	return true;
+}
+
+
+// Code a frame, tiles in parallel on the pool
+void encode_lossless(const Frame &frame, TilePool &pool, LosslessFrame &coded)
+{
+	uint32_t width = frame.width, height = frame.height;
+	uint32_t tiles = (height + LOSSLESS_TILE_ROWS - 1) / LOSSLESS_TILE_ROWS;
+
+	coded.tile_capacity = tile_bound(width, LOSSLESS_TILE_ROWS);
+	size_t need = coded.tile_capacity * tiles;
+	if ( coded.capacity < need )
+	{
+		coded.data.reset(new uint8_t[need]);
+		coded.capacity = need;
+	}
+	coded.table.assign(2 + tiles, 0);
+	coded.table[0] = LOSSLESS_TILE_ROWS;
+	coded.table[1] = tiles;
+
+	pool.run(tiles, [&](int t) {
+		uint32_t y = t * LOSSLESS_TILE_ROWS;
+		uint32_t rows = min(LOSSLESS_TILE_ROWS, height - y);
+		coded.table[2 + t] = encode_tile(frame.pixels + (size_t) y * width, width, rows, coded.data.get() + t * coded.tile_capacity);
+	});
+
+	PackedHeader &header = coded.header;
+	packed_header(frame, header);
+	memcpy(header.magic, "NRLC", 4);
+	header.version = LOSSLESS_VERSION;
+	header.header_size = sizeof(header) + coded.table.size() * sizeof(uint32_t);
+	header.pixel_format = PFNC_BAYER_RG12;
+	header.data_size = 0;
+	for ( uint32_t t = 0; t < tiles; t++ )
+		header.data_size += coded.table[2 + t];
+}
+
+
+// Read a compressed file and decode its pixels, of which there is room for capacity,
+// tiles in parallel on the pool
+void read_lossless(const string &path, PackedHeader &header, uint16_t* pixels, size_t capacity, TilePool &pool)
+{
+	static thread_local vector<uint8_t> data;
+	uint32_t layout[2];
+	vector<uint32_t> sizes;
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), path};
+	try
+	{
+		read_all(fd, path, &header, sizeof(header));
+		if ( memcmp(header.magic, "NRLC", 4) != 0 || header.header_size < sizeof(header) + sizeof(layout) )
+			throw system_error{EINVAL, system_category(), path + ": not a compressed raw file"};
+		if ( header.version > LOSSLESS_VERSION || header.pixel_format != PFNC_BAYER_RG12 )
+			throw system_error{EINVAL, system_category(), path + ": unsupported compressed raw file"};
+		if ( (size_t) header.width * header.height > capacity )
+			throw system_error{EINVAL, system_category(), path + ": image larger than the buffer"};
+
+		read_all(fd, path, layout, sizeof(layout));
+		if ( layout[0] == 0 || layout[1] != ((uint64_t) header.height + layout[0] - 1) / layout[0] ||
+			header.header_size != sizeof(header) + sizeof(layout) + (size_t) layout[1] * sizeof(uint32_t) )
+			throw system_error{EINVAL, system_category(), path + ": corrupt tile table"};
+		sizes.resize(layout[1]);
+		read_all(fd, path, sizes.data(), sizes.size() * sizeof(uint32_t));
+		uint64_t total = 0;
+		for ( size_t t = 0; t < sizes.size(); t++ )
+			total += sizes[t];
+		if ( total != header.data_size )
+			throw system_error{EINVAL, system_category(), path + ": corrupt tile table"};
+
+		if ( data.size() < header.data_size )
+			data.resize(header.data_size);
+		read_all(fd, path, data.data(), header.data_size);
+	}
+	catch (...)
+	{
+		close(fd);
+		throw;
+	}
+	close(fd);
+
+	vector<size_t> offsets(sizes.size());
+	for ( size_t t = 1; t < sizes.size(); t++ )
+		offsets[t] = offsets[t - 1] + sizes[t - 1];
+
+	atomic<bool> corrupt(false);
+	uint32_t width = header.width, height = header.height, tile_rows = layout[0];
+	const uint8_t* in = data.data();
+	pool.run(sizes.size(), [&](int t) {
+		uint32_t y = t * tile_rows;
+		uint32_t rows = min(tile_rows, height - y);
+		if ( !decode_tile(in + offsets[t], sizes[t], width, rows, pixels + (size_t) y * width) )
+			corrupt = true;
+	});
+	if ( corrupt )
+		throw system_error{EINVAL, system_category(), path + ": corrupt tile data"};
+}
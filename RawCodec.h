@@ -0,0 +1,73 @@
+//	RawCodec.h
+//	Lossless compression of BayerRG12 frames.  Night frames are mostly dark sky, so after
+//	predicting each pixel from its neighbours of the same colour the residuals are small
+//	and Rice codes take a few bits each.  A frame is cut into strips of rows (tiles) that
+//	are coded independently, so all cores compress and decompress one frame at once.
+//	The rawpack program decompresses the files on the ground.
+//
+//	File layout, all values in host (little-endian) byte order:
+//
+//	Header (64 bytes), as for a packed file (see RawPack.h) except
+//		char[4]	magic "NRLC"
+//		u16	header size: 64 plus the tile table
+//		u32	PFNC pixel format of the decoded pixels, 0x01100011 BayerRG12
+//		u32	bytes of tile data
+//
+//	Tile table
+//		u32	rows per tile, the last tile may have fewer
+//		u32	number of tiles
+//		u32	bytes of each tile
+//
+//	Tile data, the tiles one after the other.  Each pixel p is predicted from the pixel
+//	two to its left, a, and two above, b, which have the same colour: (a + b) / 2 rounded
+//	down, or a or b alone in the first two columns or rows of the tile, or 0 for the top
+//	left four.  The residual d = p - prediction modulo 2^16 is mapped to an unsigned value
+//	u = 2d for d >= 0, u = -2d - 1 for d < 0, taking d as a signed 16-bit value.  The
+//	values of a tile, in rows top to bottom, are coded in blocks of 32 (the last block
+//	may be shorter), each a 4-bit Rice parameter k followed by a code per value: with
+//	q = u >> k, either q zero bits, a one bit and the low k bits of u if q < 15, or 15 zero
+//	bits, a one bit and all 16 bits of u.  Bits are packed starting with the least
+//	significant bit of each byte.
+
+#ifndef _RawCodec_H_
+#define _RawCodec_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "Frame.h"
+#include "RawPack.h"
+#include "TilePool.h"
+
+using namespace std;
+
+const uint16_t LOSSLESS_VERSION = 1;
+const uint32_t PFNC_BAYER_RG12 = 0x01100011;
+const uint32_t LOSSLESS_TILE_ROWS = 64;		// Rows per tile, even to keep the Bayer phase
+const size_t RICE_BLOCK = 32;			// Values per Rice parameter
+const unsigned RICE_ESCAPE = 15;		// Quotient that escapes to a 16-bit value
+
+
+// A frame coded into tiles, ready to write.  Tile t is at data + t * tile_capacity.
+struct LosslessFrame
+{
+	PackedHeader header;
+	vector<uint32_t> table;			// Rows per tile, tiles, size of each tile
+	unique_ptr<uint8_t[]> data;
+	size_t capacity;			// Bytes allocated at data
+	size_t tile_capacity;
+
+	LosslessFrame() : capacity(0), tile_capacity(0) {}
+	const uint8_t* tile(uint32_t t) const { return data.get() + t * tile_capacity; }
+};
+
+extern size_t tile_bound(uint32_t width, uint32_t rows);
+extern size_t encode_tile(const uint16_t* pixels, uint32_t width, uint32_t rows, uint8_t* out);
+extern bool decode_tile(const uint8_t* in, size_t size, uint32_t width, uint32_t rows, uint16_t* pixels);
+extern void encode_lossless(const Frame &frame, TilePool &pool, LosslessFrame &coded);
+extern void read_lossless(const string &path, PackedHeader &header, uint16_t* pixels, size_t capacity, TilePool &pool);
+
+#endif
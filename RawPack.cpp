@@ -0,0 +1,193 @@
+//	RawPack.cpp
+//	Packing and unpacking 12-bit pixels.  The kernels work on eight pixels at a time as
+//	two 64-bit lanes of four, using GCC vector extensions, which compile to SSE2 on x86
+//	and NEON on the Odroid.  Four 16-bit pixels in a lane become 48 bits, and the two
+//	lanes are stored 6 bytes apart; each store writes 2 bytes too many, which the next
+//	store or the scalar tail overwrites.
+
+// System includes
+#include <vector>
+#include <system_error>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Local includes
+#include "RawPack.h"
+
+// System namespace
+using namespace std;
+
+typedef uint64_t v2du __attribute__ ((vector_size (16)));
+
+
+// Bytes of packed pixel data
+size_t packed_size(size_t pixels)
+{
+	return pixels / 2 * 3 + (pixels & 1) * 2;
+}
+
+
+// Pack the last pixels one pair at a time
+static void pack_tail(const uint16_t* in, size_t pixels, uint8_t* out)
+{
+	size_t i = 0;
+	for ( ; i + 1 < pixels; i += 2 )
+	{
+		unsigned a = in[i] & 0xfff, b = in[i + 1] & 0xfff;
+		out[0] = a;
+		out[1] = (a >> 8) | (b << 4);
+		out[2] = b >> 4;
+		out += 3;
+	}
+	if ( i < pixels )
+	{
+		out[0] = in[i];
+		out[1] = (in[i] >> 8) & 0xf;
+	}
+}
+
+
+static void unpack_tail(const uint8_t* in, size_t pixels, uint16_t* out)
+{
+	size_t i = 0;
+	for ( ; i + 1 < pixels; i += 2 )
+	{
+		out[i] = in[0] | ((in[1] & 0xf) << 8);
+		out[i + 1] = (in[1] >> 4) | (in[2] << 4);
+		in += 3;
+	}
+	if ( i < pixels )
+		out[i] = in[0] | ((in[1] & 0xf) << 8);
+}
+
+
+// Pack pixels into packed_size(pixels) bytes at out.  Bits above the 12th are dropped.
+void pack12(const uint16_t* in, size_t pixels, uint8_t* out)
+{
+	const v2du m0 = { 0xfff, 0xfff };
+	const v2du m1 = { 0xfff000ull, 0xfff000ull };
+	const v2du m2 = { 0xfff000000ull, 0xfff000000ull };
+	const v2du m3 = { 0xfff000000000ull, 0xfff000000000ull };
+
+	// Stop while 8 more pixels follow, so the extra bytes stored stay in the output
+	size_t i = 0;
+	for ( ; i + 16 <= pixels; i += 8 )
+	{
+		v2du x;
+		memcpy(&x, in + i, sizeof(x));
+		x = (x & m0) | ((x >> 4) & m1) | ((x >> 8) & m2) | ((x >> 12) & m3);
+		uint64_t a = x[0], b = x[1];
+		memcpy(out, &a, sizeof(a));
+		memcpy(out + 6, &b, sizeof(b));
+		out += 12;
+	}
+	pack_tail(in + i, pixels - i, out);
+}
+
+
+// Unpack packed_size(pixels) bytes at in into pixels
+void unpack12(const uint8_t* in, size_t pixels, uint16_t* out)
+{
+	const v2du m0 = { 0xfff, 0xfff };
+	const v2du m1 = { 0xfff0000ull, 0xfff0000ull };
+	const v2du m2 = { 0xfff00000000ull, 0xfff00000000ull };
+	const v2du m3 = { 0xfff000000000000ull, 0xfff000000000000ull };
+
+	// 8-byte loads of 6-byte groups read 2 bytes ahead, which are there while 8 more
+	// pixels follow
+	size_t i = 0;
+	for ( ; i + 16 <= pixels; i += 8 )
+	{
+		uint64_t a, b;
+		memcpy(&a, in, sizeof(a));
+		memcpy(&b, in + 6, sizeof(b));
+		v2du x = { a, b };
+		x = (x & m0) | ((x << 4) & m1) | ((x << 8) & m2) | ((x << 12) & m3);
+		memcpy(out + i, &x, sizeof(x));
+		in += 12;
+	}
+	unpack_tail(in, pixels - i, out + i);
+}
+
+
+// Header for a frame
+void packed_header(const Frame &frame, PackedHeader &header)
+{
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "NR12", 4);
+	header.version = PACKED_VERSION;
+	header.header_size = sizeof(header);
+	header.width = frame.width;
+	header.height = frame.height;
+	header.pixel_format = PFNC_BAYER_RG12P;
+	header.data_size = packed_size((size_t) frame.width * frame.height);
+	header.trigger_ns = frame.trigger_ns;
+	header.timestamp = frame.timestamp;
+	header.counter = frame.counter;
+	header.exposure_us = frame.exposure_us;
+	header.gain_db = frame.gain_db;
+	header.metadata = frame.metadata;
+}
+
+
+// Read exactly size bytes
+void read_all(int fd, const string &path, void* buffer, size_t size)
+{
+	char* p = (char*) buffer;
+	while ( size > 0 )
+	{
+		ssize_t n = read(fd, p, size);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n < 0 )
+			throw system_error{errno, system_category(), path};
+		if ( n == 0 )
+			throw system_error{EINVAL, system_category(), path + ": file is truncated"};
+		p += n;
+		size -= n;
+	}
+}
+
+
+// Read and check the header of a packed file, leaving fd at the pixel data
+void read_packed_header(int fd, const string &path, PackedHeader &header)
+{
+	read_all(fd, path, &header, sizeof(header));
+	if ( memcmp(header.magic, "NR12", 4) != 0 || header.header_size < sizeof(header) )
+		throw system_error{EINVAL, system_category(), path + ": not a packed raw file"};
+	if ( header.version > PACKED_VERSION || header.pixel_format != PFNC_BAYER_RG12P ||
+		header.data_size != packed_size((size_t) header.width * header.height) )
+		throw system_error{EINVAL, system_category(), path + ": unsupported packed raw file"};
+	if ( lseek(fd, header.header_size, SEEK_SET) < 0 )
+		throw system_error{errno, system_category(), path};
+}
+
+
+// Read a packed file and unpack its pixels, of which there is room for capacity
+void read_packed(const string &path, PackedHeader &header, uint16_t* pixels, size_t capacity)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), path};
+	try
+	{
+		read_packed_header(fd, path, header);
+		size_t n = (size_t) header.width * header.height;
+		if ( n > capacity )
+			throw system_error{EINVAL, system_category(), path + ": image larger than the buffer"};
+
+		// Read into the end of the pixel buffer and unpack forwards; the packed data
+		// stays ahead of the pixels written
+		uint8_t* packed = (uint8_t*) (pixels + n) - header.data_size;
+		read_all(fd, path, packed, header.data_size);
+		unpack12(packed, n, pixels);
+	}
+	catch (...)
+	{
+		close(fd);
+		throw;
+	}
+	close(fd);
+}
@@ -0,0 +1,69 @@
+//	RawPack.h
+//	Packed 12-bit raw image files.  The camera delivers BayerRG12 in 16-bit words, so a
+//	quarter of a plain raw file is padding.  A packed file (.r12) holds the same pixels
+//	in 12 bits each, PFNC BayerRG12p, behind a header with the frame's metadata.  The
+//	rawpack program unpacks them on the ground.
+//
+//	File layout, all values in host (little-endian) byte order:
+//
+//	Header (64 bytes)
+//		char[4]	magic "NR12"
+//		u16	version (1)
+//		u16	header size in bytes, pixel data starts here
+//		u32	width
+//		u32	height
+//		u32	PFNC pixel format of the pixel data, 0x010C0059 BayerRG12p
+//		u32	bytes of pixel data
+//		i64	trigger time, local monotonic ns
+//		i64	camera timestamp, ns on USB cameras, 0 if unknown
+//		i64	camera frame counter, 0 if unknown
+//		f64	exposure time in us
+//		f32	gain in dB
+//		u32	1 if the camera timestamp, counter and gain are known, else 0
+//
+//	Pixel data, rows top to bottom with no padding.  Each pair of pixels p0, p1 takes
+//	three bytes: p0 bits 0-7; p0 bits 8-11 in the low and p1 bits 0-3 in the high
+//	nibble; p1 bits 4-11.  An odd last pixel takes two bytes, the high nibble 0.
+
+#ifndef _RawPack_H_
+#define _RawPack_H_
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "Frame.h"
+
+using namespace std;
+
+const uint16_t PACKED_VERSION = 1;
+const uint32_t PFNC_BAYER_RG12P = 0x010C0059;
+
+
+// Header of a packed raw file
+struct PackedHeader
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t pixel_format;
+	uint32_t data_size;
+	int64_t trigger_ns;
+	int64_t timestamp;
+	int64_t counter;
+	double exposure_us;
+	float gain_db;
+	uint32_t metadata;
+};
+
+extern size_t packed_size(size_t pixels);
+extern void pack12(const uint16_t* in, size_t pixels, uint8_t* out);
+extern void unpack12(const uint8_t* in, size_t pixels, uint16_t* out);
+extern void packed_header(const Frame &frame, PackedHeader &header);
+extern void read_all(int fd, const string &path, void* buffer, size_t size);
+extern void read_packed_header(int fd, const string &path, PackedHeader &header);
+extern void read_packed(const string &path, PackedHeader &header, uint16_t* pixels, size_t capacity);
+
+#endif
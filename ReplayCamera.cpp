@@ -0,0 +1,127 @@
+//	ReplayCamera.cpp
+//	Implementation of ReplayCamera class.  Raw files are read straight into the frame buffer,
+//	packed and compressed files are decoded into it.
+//	The exposure time the frame is requested with is ignored.
+
+// System includes
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Local includes
+#include "ReplayCamera.h"
+#include "RawPack.h"
+#include "RawCodec.h"
+
+// System namespace
+using namespace std;
+
+
+// Serial number of a replay camera: the last component of its directory
+string replay_serial(const string &dir)
+{
+	string path = dir;
+	while ( path.size() > 1 && path[path.size() - 1] == '/' )
+		path.erase(path.size() - 1);
+	size_t slash = path.rfind('/');
+	return (slash == string::npos)? path : path.substr(slash + 1);
+}
+
+
+ReplayCamera::ReplayCamera(const string &d, uint32_t w, uint32_t h, double fps) :
+	SoftwareCamera(replay_serial(d), w, h, fps), dir(d), next(0)
+{
+	if ( !dir.empty() && dir[dir.size() - 1] != '/' )
+		dir += '/';
+
+	DIR* dp = opendir(dir.c_str());
+	if ( dp == NULL )
+		throw CameraError(dir + ": " + strerror(errno));
+	struct dirent* entry;
+	while ( (entry = readdir(dp)) != NULL )
+	{
+		size_t len = strlen(entry->d_name);
+		if ( len > 4 && (strcmp(entry->d_name + len - 4, ".raw") == 0 || strcmp(entry->d_name + len - 4, ".r12") == 0 ||
+			strcmp(entry->d_name + len - 4, ".rlc") == 0) )
+			files.push_back(entry->d_name);
+	}
+	closedir(dp);
+
+	if ( files.empty() )
+		throw CameraError(dir + ": no .raw, .r12 or .rlc files to replay");
+	sort(files.begin(), files.end());
+
+	for ( const string &file : files )
+		if ( file.compare(file.size() - 4, 4, ".rlc") == 0 )
+		{
+			pool.reset(new TilePool(REPLAY_THREADS));
+			break;
+		}
+}
+
+
+string ReplayCamera::modelName()
+{
+	return "Replay of " + dir;
+}
+
+
+void ReplayCamera::fill(uint16_t* buffer, double)
+{
+	string path = dir + files[next];
+	next = (next + 1) % files.size();
+
+	bool packed = path.compare(path.size() - 4, 4, ".r12") == 0;
+	if ( packed || path.compare(path.size() - 4, 4, ".rlc") == 0 )
+	{
+		PackedHeader header;
+		try
+		{
+			if ( packed )
+				read_packed(path, header, buffer, (size_t) width * height);
+			else
+				read_lossless(path, header, buffer, (size_t) width * height, *pool);
+		}
+		catch (const system_error &e)
+		{
+			throw CameraError(e.what());
+		}
+		if ( header.width != width || header.height != height )
+			throw CameraError(path + ": not a " + to_string(width) + "x" + to_string(height) + " image");
+		return;
+	}
+
+	size_t size = (size_t) width * height * sizeof(uint16_t);
+	int fd = open(path.c_str(), O_RDONLY);
+	if ( fd < 0 )
+		throw CameraError(path + ": " + strerror(errno));
+
+	struct stat st;
+	if ( fstat(fd, &st) < 0 || (size_t) st.st_size != size )
+	{
+		::close(fd);
+		throw CameraError(path + ": not a " + to_string(width) + "x" + to_string(height) + " BayerRG12 raw file");
+	}
+
+	char* p = (char*) buffer;
+	size_t done = 0;
+	while ( done < size )
+	{
+		ssize_t n = read(fd, p + done, size - done);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+		{
+			string error = (n < 0)? strerror(errno) : "unexpected end of file";
+			::close(fd);
+			throw CameraError(path + ": " + error);
+		}
+		done += n;
+	}
+	::close(fd);
+}
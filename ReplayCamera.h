@@ -0,0 +1,43 @@
+//	ReplayCamera.h
+//	Interface for ReplayCamera class.  A camera source that delivers the .raw, .r12 and
+//	.rlc files saved in a directory, in name order, starting over after the last one.
+//	The serial number is the directory name, which for a camera directory written by
+//	baslerctrl is the serial number of the camera that took the images.
+//
+//	Compressed files are decoded in the camera's thread, on a TilePool of the camera's own
+//	of REPLAY_THREADS threads counting the camera's, as Calibration does, so that the
+//	replay isn't held up by the image writers' batches on the shared pool.
+
+#ifndef _ReplayCamera_H_
+#define _ReplayCamera_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "CameraSource.h"
+#include "TilePool.h"
+
+const int REPLAY_THREADS = 2;		// Threads decoding a replay camera's .rlc files
+
+
+// ReplayCamera class definition
+class ReplayCamera : public SoftwareCamera
+{
+public:
+	ReplayCamera(const string &dir, uint32_t width, uint32_t height, double fps);
+	string modelName();
+
+protected:
+	void fill(uint16_t* buffer, double exposure_us);
+
+private:
+	string dir;
+	vector<string> files;
+	size_t next;
+	unique_ptr<TilePool> pool;	// Made when there are .rlc files to decode
+};
+
+extern string replay_serial(const string &dir);
+
+#endif
@@ -0,0 +1,191 @@
+//	SeqLock.h
+//	Interface and implementation of the SeqLock class template.  A SeqLock publishes
+//	the latest value of a trivially copyable type from a single writer thread to any
+//	number of reader threads.  The writer never waits, readers never block the writer
+//	or each other, and neither side allocates.  A reader that overlaps a store simply
+//	copies the value again.
+//
+//	The value is stored as an array of relaxed atomic words bracketed by a sequence
+//	counter that is odd while a store is in progress, so concurrent copies are not data
+//	races under the C++11 memory model.
+//
+//	Consumers that want every new value can sleep in wait() instead of polling.  wait()
+//	blocks on a futex on the sequence counter, and store() only makes the wake-up system
+//	call when some thread is actually waiting.
+
+#ifndef _SeqLock_H_
+#define _SeqLock_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <ctime>
+#include <cerrno>
+#include <type_traits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+
+template <class T>
+class SeqLock
+{
+	static_assert(std::is_trivially_copyable<T>::value, "SeqLock requires a trivially copyable type");
+
+public:
+	SeqLock();
+	void store(const T &value);
+	unsigned load(T &value) const;
+	T load() const;
+	unsigned sequence() const;
+	bool wait(unsigned last_seq, int timeout_ms = -1) const;
+
+private:
+	static const size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	std::atomic<unsigned> seq;		// Even when stable, odd while a store is in progress
+	std::atomic<uint64_t> words[WORDS];	// Value of T
+	mutable std::atomic<int> waiters;	// Threads blocked in wait()
+
+	static_assert(sizeof(std::atomic<unsigned>) == sizeof(int), "futex needs a 32-bit sequence counter");
+};
+
+
+// The initial value is all zero bits, i.e. a value initialized T for the types used here.
+template <class T>
+SeqLock<T>::SeqLock() : seq(0), waiters(0)
+{
+	for ( size_t i = 0; i < WORDS; i++ )
+		words[i].store(0, std::memory_order_relaxed);
+}
+
+
+// Publish a new value.  Must only be called from one thread.
+template <class T>
+void SeqLock<T>::store(const T &value)
+{
+	uint64_t buffer[WORDS] = {};
+	memcpy(buffer, &value, sizeof(T));
+
+	unsigned s = seq.load(std::memory_order_relaxed);
+	seq.store(s + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for ( size_t i = 0; i < WORDS; i++ )
+		words[i].store(buffer[i], std::memory_order_relaxed);
+
+	seq.store(s + 2, std::memory_order_release);
+
+	// Either a waiter sees the new sequence number or we see the waiter
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if ( waiters.load(std::memory_order_relaxed) > 0 )
+		syscall(SYS_futex, &seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+
+// Copy the most recently published value into value.
+// Return value: sequence number of the copied value.  This increases by 2 with every
+// store, and is 0 if nothing has been published yet.
+template <class T>
+unsigned SeqLock<T>::load(T &value) const
+{
+	uint64_t buffer[WORDS];
+	unsigned s1, s2;
+
+	do {
+		s1 = seq.load(std::memory_order_acquire);
+		if ( s1 & 1 )
+		{
+			// Store in progress
+			s2 = s1 + 1;
+			continue;
+		}
+
+		for ( size_t i = 0; i < WORDS; i++ )
+			buffer[i] = words[i].load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		s2 = seq.load(std::memory_order_relaxed);
+	} while ( s1 != s2 );
+
+	memcpy(&value, buffer, sizeof(T));
+	return s1;
+}
+
+
+template <class T>
+T SeqLock<T>::load() const
+{
+	T value;
+	load(value);
+	return value;
+}
+
+
+// Sequence number of the most recently published value, odd if a store is in progress
+template <class T>
+unsigned SeqLock<T>::sequence() const
+{
+	return seq.load(std::memory_order_acquire);
+}
+
+
+
+// Block until a value newer than the one with sequence number last_seq is published, or
+// until timeout_ms milliseconds have passed.  A negative timeout waits forever.
+// Return value: true if a newer value is available, false on timeout
+template <class T>
+bool SeqLock<T>::wait(unsigned last_seq, int timeout_ms) const
+{
+	struct timespec deadline;
+	if ( timeout_ms >= 0 )
+	{
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if ( deadline.tv_nsec >= 1000000000L )
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	waiters.fetch_add(1, std::memory_order_seq_cst);
+	bool available = false;
+	while ( true )
+	{
+		unsigned s = seq.load(std::memory_order_seq_cst);
+		if ( s != last_seq && !(s & 1) )
+		{
+			available = true;
+			break;
+		}
+
+		struct timespec timeout;
+		struct timespec* ptimeout = NULL;
+		if ( timeout_ms >= 0 )
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			timeout.tv_sec = deadline.tv_sec - now.tv_sec;
+			timeout.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+			if ( timeout.tv_nsec < 0 )
+			{
+				timeout.tv_sec--;
+				timeout.tv_nsec += 1000000000L;
+			}
+			if ( timeout.tv_sec < 0 )
+				break;
+			ptimeout = &timeout;
+		}
+
+		// Sleeps only if the sequence number is still s
+		if ( syscall(SYS_futex, &seq, FUTEX_WAIT_PRIVATE, s, ptimeout, NULL, 0) < 0 && errno == ETIMEDOUT )
+			break;
+	}
+	waiters.fetch_sub(1, std::memory_order_relaxed);
+	return available;
+}
+
+#endif
@@ -0,0 +1,445 @@
+//	SourceCatalog.cpp
+//	Implementation of SourceExtractor class and reading catalog files.  Binning takes
+//	sixteen pixels of two rows at a time with GCC vector extensions, which compile to SSE2
+//	on x86 and NEON on the Odroid.  Strips of rows are binned and labelled, and rows of
+//	cells measured, by the threads of the pool; only filtering the cells, joining the
+//	strips and summing the sources is serial, and that is over cells and runs, not
+//	pixels.
+
+// System includes
+#include <algorithm>
+#include <system_error>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Local includes
+#include "SourceCatalog.h"
+#include "RawPack.h"
+
+// System namespace
+using namespace std;
+
+typedef uint16_t v8hu __attribute__ ((vector_size (16)));
+typedef uint32_t v4su __attribute__ ((vector_size (16)));
+
+const float LOW_PERCENTILE = 0.1587f;	// One sigma below the median of a normal distribution
+
+
+static inline v8hu load(const uint16_t* p)
+{
+	v8hu v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+static inline void store(uint16_t* p, v8hu v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+
+// Low halves of the 32-bit lanes of a and then b
+static inline v8hu narrow(v4su a, v4su b)
+{
+	const v8hu even = { 0, 2, 4, 6, 8, 10, 12, 14 };
+	return __builtin_shuffle((v8hu) a, (v8hu) b, even);
+}
+
+
+static inline v8hu maximum(v8hu a, v8hu b)
+{
+	v8hu greater = (v8hu) (a > b);
+	return (a & greater) | (b & ~greater);
+}
+
+
+// Sums and brightest pixels of the eight 2x2 blocks in 16 pixels of two rows
+static inline void bin16(const uint16_t* top, const uint16_t* bottom, uint16_t* sums, uint16_t* peaks)
+{
+	v8hu a0 = load(top), a1 = load(top + 8);
+	v8hu b0 = load(bottom), b1 = load(bottom + 8);
+
+	v4su s0 = (v4su) (a0 + b0), s1 = (v4su) (a1 + b1);
+	store(sums, narrow((s0 & 0xffff) + (s0 >> 16), (s1 & 0xffff) + (s1 >> 16)));
+
+	v4su m0 = (v4su) maximum(a0, b0), m1 = (v4su) maximum(a1, b1);
+	v4su low0 = m0 & 0xffff, high0 = m0 >> 16;
+	v4su low1 = m1 & 0xffff, high1 = m1 >> 16;
+	v4su greater0 = (v4su) (low0 > high0), greater1 = (v4su) (low1 > high1);
+	store(peaks, narrow((low0 & greater0) | (high0 & ~greater0), (low1 & greater1) | (high1 & ~greater1)));
+}
+
+
+// Root of a run, halving the path on the way
+static uint32_t find(vector<SourceRun> &runs, uint32_t i)
+{
+	while ( runs[i].parent != i )
+	{
+		runs[i].parent = runs[runs[i].parent].parent;
+		i = runs[i].parent;
+	}
+	return i;
+}
+
+
+// Join the sources of two runs under the root that comes first
+static void unite(vector<SourceRun> &runs, uint32_t a, uint32_t b)
+{
+	a = find(runs, a);
+	b = find(runs, b);
+	if ( a < b )
+		runs[b].parent = a;
+	else if ( b < a )
+		runs[a].parent = b;
+}
+
+
+// Join runs [begin, end) of a row to the 8-connected runs [above, above_end) of the row
+// above.  Both are in order of x.
+static void connect(vector<SourceRun> &runs, size_t above, size_t above_end, size_t begin, size_t end)
+{
+	for ( size_t r = begin; r < end; r++ )
+	{
+		while ( above < above_end && runs[above].x1 + 1 < runs[r].x0 )
+			above++;
+		for ( size_t q = above; q < above_end && runs[q].x0 <= runs[r].x1 + 1; q++ )
+			unite(runs, q, r);
+	}
+}
+
+
+SourceExtractor::SourceExtractor() :
+	width(0), height(0), cells_x(0), cells_y(0)
+{
+}
+
+
+// Find the sources of a 12-bit frame.  The header is filled in except for the OBC
+// position.
+void SourceExtractor::extract(const Frame &frame, TilePool &pool, CatalogHeader &header, vector<CatalogSource> &sources)
+{
+	width = frame.width / 2;
+	height = frame.height / 2;
+	cells_x = max((width + CATALOG_CELL - 1) / CATALOG_CELL, 1u);
+	cells_y = max((height + CATALOG_CELL - 1) / CATALOG_CELL, 1u);
+	sums.resize((size_t) width * height);
+	peaks.resize(sums.size());
+	cell_background.resize((size_t) cells_x * cells_y);
+	cell_noise.resize(cell_background.size());
+
+	// Interpolation between the centres of the cells to either side of each column
+	column_cell.resize(width);
+	column_weight.resize(width);
+	for ( uint32_t x = 0; x < width; x++ )
+	{
+		float t = max((x + 0.5f) / CATALOG_CELL - 0.5f, 0.0f);
+		column_cell[x] = min((uint32_t) t, cells_x - 1);
+		column_weight[x] = min(t - column_cell[x], 1.0f);
+	}
+
+	int count = (height + CATALOG_STRIP - 1) / CATALOG_STRIP;
+	strips.resize(count);
+	pool.run(count, [&](int t) { bin(frame, t); });
+	pool.run(cells_y, [&](int t) { measure(t); });
+	filter(cell_background);
+	filter(cell_noise);
+	pool.run(count, [&](int t) { label(t); });
+	join();
+
+	// Sources in raster order, or the brightest of them
+	vector<uint32_t> roots;
+	for ( uint32_t i = 0; i < runs.size(); i++ )
+		if ( runs[i].parent == i && runs[i].blocks >= CATALOG_MIN_BLOCKS )
+			roots.push_back(i);
+	size_t detected = roots.size();
+	if ( roots.size() > CATALOG_MAX_SOURCES )
+	{
+		nth_element(roots.begin(), roots.begin() + CATALOG_MAX_SOURCES, roots.end(),
+			[this](uint32_t a, uint32_t b) { return runs[a].flux > runs[b].flux; });
+		roots.resize(CATALOG_MAX_SOURCES);
+		sort(roots.begin(), roots.end());
+	}
+
+	sources.resize(roots.size());
+	for ( size_t i = 0; i < roots.size(); i++ )
+	{
+		const SourceRun &run = runs[roots[i]];
+		CatalogSource &source = sources[i];
+		source.x = (float) (2 * run.fx / run.flux + 0.5);
+		source.y = (float) (2 * run.fy / run.flux + 0.5);
+		source.flux = (float) run.flux;
+		source.area = 4 * run.blocks;
+		source.peak = run.peak;
+		source.flags = run.flags;
+		source.background = (float) (run.background / run.blocks);
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "NSRC", 4);
+	header.version = CATALOG_VERSION;
+	header.header_size = sizeof(header);
+	header.width = frame.width;
+	header.height = frame.height;
+	header.sources = sources.size();
+	header.detected = detected;
+	header.trigger_ns = frame.trigger_ns;
+	header.timestamp = frame.timestamp;
+	header.counter = frame.counter;
+	header.exposure_us = frame.exposure_us;
+
+	// Medians over the cells, reordering the cells, which are measured again for the
+	// next frame
+	nth_element(cell_background.begin(), cell_background.begin() + cell_background.size() / 2, cell_background.end());
+	header.background = cell_background[cell_background.size() / 2];
+	nth_element(cell_noise.begin(), cell_noise.begin() + cell_noise.size() / 2, cell_noise.end());
+	header.noise = cell_noise[cell_noise.size() / 2];
+}
+
+
+// Bin the block rows of a strip
+void SourceExtractor::bin(const Frame &frame, uint32_t strip)
+{
+	uint32_t end = min((strip + 1) * CATALOG_STRIP, height);
+	for ( uint32_t y = strip * CATALOG_STRIP; y < end; y++ )
+	{
+		const uint16_t* top = frame.pixels + (size_t) 2 * y * frame.width;
+		const uint16_t* bottom = top + frame.width;
+		uint16_t* sum = sums.data() + (size_t) y * width;
+		uint16_t* peak = peaks.data() + (size_t) y * width;
+
+		uint32_t x = 0;
+		for ( ; x + 8 <= width; x += 8 )
+			bin16(top + 2 * x, bottom + 2 * x, sum + x, peak + x);
+		for ( ; x < width; x++ )
+		{
+			const uint16_t* p = top + 2 * x;
+			const uint16_t* q = bottom + 2 * x;
+			sum[x] = p[0] + p[1] + q[0] + q[1];
+			peak[x] = max(max(p[0], p[1]), max(q[0], q[1]));
+		}
+	}
+}
+
+
+// Background and noise of a row of cells
+void SourceExtractor::measure(uint32_t cy)
+{
+	uint16_t values[CATALOG_CELL * CATALOG_CELL];
+	for ( uint32_t cx = 0; cx < cells_x; cx++ )
+	{
+		size_t n = 0;
+		for ( uint32_t y = cy * CATALOG_CELL; y < min((cy + 1) * CATALOG_CELL, height); y++ )
+		{
+			const uint16_t* row = sums.data() + (size_t) y * width;
+			for ( uint32_t x = cx * CATALOG_CELL; x < min((cx + 1) * CATALOG_CELL, width); x++ )
+				values[n++] = row[x];
+		}
+
+		float background = 0, noise = CATALOG_NOISE_FLOOR;
+		if ( n > 0 )
+		{
+			nth_element(values, values + n / 2, values + n);
+			size_t low = (size_t) (n * LOW_PERCENTILE);
+			nth_element(values, values + low, values + n / 2);
+			background = values[n / 2];
+			noise = max(background - values[low], CATALOG_NOISE_FLOOR);
+		}
+		cell_background[(size_t) cy * cells_x + cx] = background;
+		cell_noise[(size_t) cy * cells_x + cx] = noise;
+	}
+}
+
+
+// Median of each cell and its neighbours, fewer at the edges of the frame
+void SourceExtractor::filter(vector<float> &cells)
+{
+	cell_scratch = cells;
+	for ( uint32_t cy = 0; cy < cells_y; cy++ )
+		for ( uint32_t cx = 0; cx < cells_x; cx++ )
+		{
+			float values[9];
+			int n = 0;
+			for ( uint32_t y = (cy > 0)? cy - 1 : 0; y <= min(cy + 1, cells_y - 1); y++ )
+				for ( uint32_t x = (cx > 0)? cx - 1 : 0; x <= min(cx + 1, cells_x - 1); x++ )
+					values[n++] = cell_scratch[(size_t) y * cells_x + x];
+			nth_element(values, values + n / 2, values + n);
+			cells[(size_t) cy * cells_x + cx] = values[n / 2];
+		}
+}
+
+
+// Find the runs of blocks above the threshold in a strip and join them within it
+void SourceExtractor::label(uint32_t strip)
+{
+	vector<SourceRun> &out = strips[strip].runs;
+	out.clear();
+	vector<float> row_background(cells_x), row_threshold(cells_x);
+
+	uint32_t begin = strip * CATALOG_STRIP;
+	uint32_t end = min(begin + CATALOG_STRIP, height);
+	size_t above = 0, above_end = 0;
+	for ( uint32_t y = begin; y < end; y++ )
+	{
+		// Cells interpolated to this row
+		float t = max((y + 0.5f) / CATALOG_CELL - 0.5f, 0.0f);
+		uint32_t cy0 = min((uint32_t) t, cells_y - 1);
+		uint32_t cy1 = min(cy0 + 1, cells_y - 1);
+		float wy = min(t - cy0, 1.0f);
+		for ( uint32_t cx = 0; cx < cells_x; cx++ )
+		{
+			size_t i0 = (size_t) cy0 * cells_x + cx, i1 = (size_t) cy1 * cells_x + cx;
+			row_background[cx] = cell_background[i0] + wy * (cell_background[i1] - cell_background[i0]);
+			float noise = cell_noise[i0] + wy * (cell_noise[i1] - cell_noise[i0]);
+			row_threshold[cx] = row_background[cx] + CATALOG_SIGMA * noise;
+		}
+
+		const uint16_t* sum = sums.data() + (size_t) y * width;
+		const uint16_t* peak = peaks.data() + (size_t) y * width;
+		size_t row_begin = out.size();
+		bool open = false;
+		for ( uint32_t x = 0; x < width; x++ )
+		{
+			uint32_t c0 = column_cell[x], c1 = min(c0 + 1, cells_x - 1);
+			float w = column_weight[x];
+			float threshold = row_threshold[c0] + w * (row_threshold[c1] - row_threshold[c0]);
+			if ( sum[x] <= threshold )
+			{
+				open = false;
+				continue;
+			}
+
+			if ( !open )
+			{
+				SourceRun run;
+				run.y = y;
+				run.x0 = x;
+				run.parent = out.size();
+				run.blocks = 0;
+				run.peak = 0;
+				run.flags = ( y == 0 || y + 1 == height )? SOURCE_EDGE : 0;
+				run.flux = run.fx = run.fy = run.background = 0;
+				out.push_back(run);
+				open = true;
+			}
+			SourceRun &run = out.back();
+			float background = row_background[c0] + w * (row_background[c1] - row_background[c0]);
+			float flux = sum[x] - background;
+			run.x1 = x;
+			run.blocks++;
+			run.peak = max(run.peak, peak[x]);
+			run.flux += flux;
+			run.fx += (double) flux * x;
+			run.fy += (double) flux * y;
+			run.background += background;
+		}
+
+		for ( size_t r = row_begin; r < out.size(); r++ )
+		{
+			if ( out[r].x0 == 0 || out[r].x1 + 1 == width )
+				out[r].flags |= SOURCE_EDGE;
+			if ( out[r].peak >= CATALOG_SATURATED )
+				out[r].flags |= SOURCE_SATURATED;
+		}
+		connect(out, above, above_end, row_begin, out.size());
+		above = row_begin;
+		above_end = out.size();
+		if ( y == begin )
+			strips[strip].first_end = out.size();
+		strips[strip].last_begin = row_begin;
+	}
+}
+
+
+// Gather the runs of all strips, join the strips and sum each source into its root run
+void SourceExtractor::join()
+{
+	runs.clear();
+	for ( size_t s = 0; s < strips.size(); s++ )
+	{
+		uint32_t offset = runs.size();
+		for ( size_t i = 0; i < strips[s].runs.size(); i++ )
+		{
+			runs.push_back(strips[s].runs[i]);
+			runs.back().parent += offset;
+		}
+		if ( s > 0 )
+		{
+			size_t above_end = offset;
+			size_t above = above_end - (strips[s - 1].runs.size() - strips[s - 1].last_begin);
+			connect(runs, above, above_end, offset, offset + strips[s].first_end);
+		}
+	}
+
+	for ( uint32_t i = 0; i < runs.size(); i++ )
+	{
+		uint32_t root = find(runs, i);
+		if ( root == i )
+			continue;
+		SourceRun &source = runs[root];
+		source.blocks += runs[i].blocks;
+		source.peak = max(source.peak, runs[i].peak);
+		source.flags |= runs[i].flags;
+		source.flux += runs[i].flux;
+		source.fx += runs[i].fx;
+		source.fy += runs[i].fy;
+		source.background += runs[i].background;
+	}
+}
+
+
+// Position of a catalog from the OBC record at the middle of the exposure
+void catalog_position(int64_t exposure_mid, HistoryStatus status, const OBCData &data, CatalogPosition &position)
+{
+	memset(&position, 0, sizeof(position));
+	position.exposure_mid = exposure_mid;
+	position.status = status;
+	if ( status == HISTORY_EMPTY )
+		return;
+	position.obc_ms = data.ms;
+	position.gps_time = ((((data.yy * 100LL + data.mm) * 100 + data.dd) * 100 + data.hh) * 100 + data.min) * 100 + data.ss;
+	position.lat = data.lat;
+	position.lon = data.lon;
+	position.alt = data.alt;
+	position.ax = data.ax;
+	position.ay = data.ay;
+	position.az = data.az;
+	position.gx = data.gx;
+	position.gy = data.gy;
+	position.gz = data.gz;
+	position.mx = data.mx;
+	position.my = data.my;
+	position.mz = data.mz;
+	position.roll = data.roll;
+	position.pitch = data.pitch;
+	position.yaw = data.yaw;
+}
+
+
+// Read a catalog file
+void read_catalog(const string &path, CatalogHeader &header, vector<CatalogSource> &sources)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), path};
+	try
+	{
+		read_all(fd, path, &header, sizeof(header));
+		if ( memcmp(header.magic, "NSRC", 4) != 0 || header.header_size < sizeof(header) )
+			throw system_error{EINVAL, system_category(), path + ": not a source catalog"};
+		if ( header.version > CATALOG_VERSION )
+			throw system_error{EINVAL, system_category(), path + ": unsupported source catalog"};
+		if ( lseek(fd, header.header_size, SEEK_SET) < 0 )
+			throw system_error{errno, system_category(), path};
+		sources.resize(header.sources);
+		read_all(fd, path, sources.data(), sources.size() * sizeof(CatalogSource));
+	}
+	catch (...)
+	{
+		close(fd);
+		throw;
+	}
+	close(fd);
+}
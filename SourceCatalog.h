@@ -0,0 +1,180 @@
+//	SourceCatalog.h
+//	Interface for SourceExtractor class.  Finds the light sources of a frame on board and
+//	lists them in a catalog file (.src) a few kilobytes long, tagged with the OBC position
+//	and attitude at the middle of the exposure, so the sources of every frame of a flight
+//	are kept even when most of the images are not.
+//
+//	Sources are found in the frame binned to 2x2 CFA blocks, the sum of one pixel of each
+//	colour, which removes the Bayer pattern without demosaicing.  The background and its
+//	noise are estimated in cells of CATALOG_CELL blocks, from the median and the 16th
+//	percentile, which sources brighter than the sky don't move, median filtered over 3x3
+//	cells so that a source filling a cell doesn't raise its background, and interpolated
+//	between the cell centres.  Blocks more than CATALOG_SIGMA times the noise above the
+//	background are labelled into 8-connected sources by runs, in strips of rows on a
+//	TilePool; the strips are joined where their runs touch.  Sources are not deblended.
+//
+//	File layout, all values in host (little-endian) byte order:
+//
+//	Header (216 bytes)
+//		char[4]	magic "NSRC"
+//		u16	version (1)
+//		u16	header size in bytes, the sources start here
+//		u32	frame width
+//		u32	frame height
+//		u32	number of sources S in the file
+//		u32	number of sources found, more than S if only the brightest were kept
+//		i64	trigger time, local monotonic ns
+//		i64	camera timestamp, ns on USB cameras, 0 if unknown
+//		i64	camera frame counter, 0 if unknown
+//		f64	exposure time in us
+//		f32	median background of a 2x2 block in ADU
+//		f32	median noise of a 2x2 block in ADU
+//		i64	middle of the exposure, local monotonic ns
+//		u32	OBC position: 0 none, 1 interpolated, 2 before the oldest record, 3 after
+//			the latest, as HistoryStatus in OBCHistory.h
+//		u32	reserved
+//		i64	OBC time in ms
+//		i64	GPS date and time as the decimal number yymmddhhmmss
+//		f64	latitude, longitude, altitude
+//		f64	IMU acceleration, gyroscope and magnetometer x, y and z
+//		f64	roll, pitch and yaw in degrees
+//
+//	Sources (24 bytes each), in raster order of their top left pixel
+//		f32	x, y of the centroid in pixels of the frame, pixel centres at integers
+//		f32	flux above the background in ADU, summed over the source's pixels
+//		u32	pixels in the source, 4 per 2x2 block
+//		u16	brightest pixel value
+//		u16	flags: 1 a pixel is saturated, 2 the source touches the frame edge
+//		f32	mean background of a 2x2 block under the source in ADU
+
+#ifndef _SourceCatalog_H_
+#define _SourceCatalog_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "Frame.h"
+#include "TilePool.h"
+#include "OBCData.h"
+#include "OBCHistory.h"
+
+using namespace std;
+
+const uint16_t CATALOG_VERSION = 1;
+const uint32_t CATALOG_CELL = 64;		// Blocks per side of a background cell
+const uint32_t CATALOG_STRIP = 32;		// Block rows binned and labelled per tile
+const float CATALOG_SIGMA = 5.0f;		// Detection threshold in noise sigmas
+const float CATALOG_NOISE_FLOOR = 1.0f;		// ADU, for cells with no measurable noise
+const uint32_t CATALOG_MIN_BLOCKS = 2;		// Smaller sources are mostly hot pixels
+const size_t CATALOG_MAX_SOURCES = 16384;	// Brightest kept in a crowded frame
+const uint16_t CATALOG_SATURATED = 4095;
+const uint16_t SOURCE_SATURATED = 1;
+const uint16_t SOURCE_EDGE = 2;
+
+
+// OBC record at the middle of an exposure
+struct CatalogPosition
+{
+	int64_t exposure_mid;
+	uint32_t status;	// HistoryStatus of the lookup
+	uint32_t reserved;
+	int64_t obc_ms;
+	int64_t gps_time;
+	double lat, lon, alt;
+	double ax, ay, az;
+	double gx, gy, gz;
+	double mx, my, mz;
+	double roll, pitch, yaw;
+};
+
+
+// Header of a catalog file
+struct CatalogHeader
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t sources;
+	uint32_t detected;
+	int64_t trigger_ns;
+	int64_t timestamp;
+	int64_t counter;
+	double exposure_us;
+	float background;
+	float noise;
+	CatalogPosition position;
+};
+
+
+// One source of a catalog
+struct CatalogSource
+{
+	float x;
+	float y;
+	float flux;
+	uint32_t area;
+	uint16_t peak;
+	uint16_t flags;
+	float background;
+};
+
+
+// Horizontal run of blocks above the threshold, with the sums of its blocks.  The root
+// run of a source ends up with the sums of the whole source.
+struct SourceRun
+{
+	uint32_t y;
+	uint32_t x0, x1;	// First and last block
+	uint32_t parent;	// Union-find link, to itself at a root
+	uint32_t blocks;
+	uint16_t peak;
+	uint16_t flags;
+	double flux;		// Sums of the flux, flux times x and y, and background
+	double fx, fy;
+	double background;
+};
+
+
+// SourceExtractor class definition.  The work buffers are kept for the next frame.
+class SourceExtractor
+{
+public:
+	SourceExtractor();
+	void extract(const Frame &frame, TilePool &pool, CatalogHeader &header, vector<CatalogSource> &sources);
+
+private:
+	// Runs of one strip, in raster order
+	struct Strip
+	{
+		vector<SourceRun> runs;
+		size_t first_end;	// Runs in the strip's first row
+		size_t last_begin;	// First run in its last row
+	};
+
+	uint32_t width, height;		// In blocks
+	uint32_t cells_x, cells_y;
+	vector<uint16_t> sums;		// Binned frame
+	vector<uint16_t> peaks;		// Brightest pixel of each block
+	vector<float> cell_background;
+	vector<float> cell_noise;
+	vector<float> cell_scratch;	// Cells before filtering
+	vector<uint32_t> column_cell;	// Cell left of each block column, for interpolation
+	vector<float> column_weight;	// Weight of the cell right of it
+	vector<Strip> strips;
+	vector<SourceRun> runs;		// All strips, parents made global
+
+	void bin(const Frame &frame, uint32_t strip);
+	void measure(uint32_t cell_row);
+	void filter(vector<float> &cells);
+	void label(uint32_t strip);
+	void join();
+};
+
+extern void catalog_position(int64_t exposure_mid, HistoryStatus status, const OBCData &data, CatalogPosition &position);
+extern void read_catalog(const string &path, CatalogHeader &header, vector<CatalogSource> &sources);
+
+#endif
@@ -0,0 +1,347 @@
+//	Stacker.cpp
+//	Implementation of FrameStacker class and the stacking kernels.  The kernels work on
+//	eight pixels at a time with GCC vector extensions, which compile to SSE2 on x86 and
+//	NEON on the Odroid.  The mean is a sum in 16-bit lanes scaled by a fixed-point
+//	reciprocal in 32-bit lanes; the median sorts the images of each lane with a
+//	compare-exchange network; sigma clipping is done in float, four pixels at a time.
+//	Pixels are split into even and odd 32-bit lanes for the wider arithmetic, and 12-bit
+//	values are converted to and from float by adding 2^23, which needs no conversion
+//	instructions.
+
+// System includes
+#include <algorithm>
+#include <cstring>
+
+// Local includes
+#include "Stacker.h"
+
+// System namespace
+using namespace std;
+
+typedef uint16_t v8hu __attribute__ ((vector_size (16)));
+typedef int16_t v8hi __attribute__ ((vector_size (16)));
+typedef uint32_t v4su __attribute__ ((vector_size (16)));
+typedef int32_t v4si __attribute__ ((vector_size (16)));
+typedef float v4sf __attribute__ ((vector_size (16)));
+
+const float FLOAT_MAGIC = 8388608.0f;		// 2^23: integers below it are exact mantissas
+
+
+static inline v8hu load(const uint16_t* p)
+{
+	v8hu v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+static inline void store(uint16_t* p, v8hu v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+
+// Integers below 2^23 to float and back, rounding to nearest
+static inline v4sf to_float(v4su u)
+{
+	const v4su magic = { 0x4b000000, 0x4b000000, 0x4b000000, 0x4b000000 };
+	return (v4sf) (u | magic) - FLOAT_MAGIC;
+}
+
+
+static inline v4su to_int(v4sf f)
+{
+	return (v4su) (f + FLOAT_MAGIC) & 0x7fffff;
+}
+
+
+static inline v4sf select(v4si mask, v4sf a, v4sf b)
+{
+	return (v4sf) (((v4si) a & mask) | ((v4si) b & ~mask));
+}
+
+
+// Mean of n images times 2^STACK_SHIFT, to within 1.  With n at most STACK_MAX_FRAMES
+// the sum of 12-bit pixels fits 16 bits, and the sum times the 20-bit reciprocal fits 32.
+void stack_mean(const uint16_t* const* images, int n, size_t pixels, uint16_t* out)
+{
+	const uint32_t scale = ((1u << (16 + STACK_SHIFT)) + n / 2) / n;
+
+	size_t i = 0;
+	for ( ; i + 8 <= pixels; i += 8 )
+	{
+		v8hu sum = load(images[0] + i);
+		for ( int k = 1; k < n; k++ )
+			sum += load(images[k] + i);
+		v4su even = (v4su) sum & 0xffff;
+		v4su odd = (v4su) sum >> 16;
+		even = (even * scale + 0x8000) >> 16;
+		odd = (odd * scale + 0x8000) >> 16;
+		store(out + i, (v8hu) (even | (odd << 16)));
+	}
+	for ( ; i < pixels; i++ )
+	{
+		uint32_t sum = 0;
+		for ( int k = 0; k < n; k++ )
+			sum += images[k][i];
+		out[i] = (sum * scale + 0x8000) >> 16;
+	}
+}
+
+
+// Put the smaller of each lane in a and the larger in b.  12-bit values compare the same
+// signed, which SSE2 and NEON both do directly.
+static inline void sort2(v8hi &a, v8hi &b)
+{
+	v8hi less = a < b;
+	v8hi low = (a & less) | (b & ~less);
+	b = (b & less) | (a & ~less);
+	a = low;
+}
+
+
+// Median of n images times 2^STACK_SHIFT
+void stack_median(const uint16_t* const* images, int n, size_t pixels, uint16_t* out)
+{
+	v8hi v[STACK_MAX_FRAMES];
+
+	size_t i = 0;
+	for ( ; i + 8 <= pixels; i += 8 )
+	{
+		for ( int k = 0; k < n; k++ )
+			v[k] = (v8hi) load(images[k] + i);
+
+		// Odd-even transposition sort: n rounds sort n values
+		for ( int round = 0; round < n; round++ )
+			for ( int k = round & 1; k + 1 < n; k += 2 )
+				sort2(v[k], v[k + 1]);
+
+		if ( n & 1 )
+			store(out + i, (v8hu) v[n / 2] << STACK_SHIFT);
+		else
+			store(out + i, ((v8hu) v[n / 2 - 1] + (v8hu) v[n / 2]) << (STACK_SHIFT - 1));
+	}
+	for ( ; i < pixels; i++ )
+	{
+		uint16_t values[STACK_MAX_FRAMES];
+		for ( int k = 0; k < n; k++ )
+			values[k] = images[k][i];
+		sort(values, values + n);
+		if ( n & 1 )
+			out[i] = values[n / 2] << STACK_SHIFT;
+		else
+			out[i] = (values[n / 2 - 1] + values[n / 2]) << (STACK_SHIFT - 1);
+	}
+}
+
+
+// Clipped mean of four pixels of n >= 3 images, times 2^STACK_SHIFT.  With d the
+// deviation of a value from the mean of all n and q the sum of the d^2, the value's
+// deviation from the mean of the others is d n / (n - 1), and the variance of the
+// others is (q - d^2 n / (n - 1)) / (n - 2).  The deviation of a value that belongs has
+// n / (n - 1) times that variance, from the uncertainty of the others' mean.
+static inline v4sf clip4(const v4sf* x, int n)
+{
+	const float a = (float) n / (n - 1);
+	const float b = a / (n - 2);
+	const float limit = STACK_CLIP_SIGMA * STACK_CLIP_SIGMA;
+	const v4sf floor = { STACK_CLIP_FLOOR * STACK_CLIP_FLOOR, STACK_CLIP_FLOOR * STACK_CLIP_FLOOR,
+		STACK_CLIP_FLOOR * STACK_CLIP_FLOOR, STACK_CLIP_FLOOR * STACK_CLIP_FLOOR };
+	const v4sf zero = { 0, 0, 0, 0 };
+	const v4sf one = zero + 1.0f;
+	v4sf d[STACK_MAX_FRAMES];
+
+	v4sf sum = x[0];
+	for ( int k = 1; k < n; k++ )
+		sum += x[k];
+	v4sf mean = sum * (1.0f / n);
+	v4sf q = zero;
+	for ( int k = 0; k < n; k++ )
+	{
+		d[k] = x[k] - mean;
+		q += d[k] * d[k];
+	}
+
+	v4sf kept = zero, count = zero;
+	for ( int k = 0; k < n; k++ )
+	{
+		v4sf deviation = d[k] * a;
+		v4sf variance = (q - d[k] * deviation) * b;	// Expected square deviation
+		variance = select(variance < floor, floor, variance);
+		v4si keep = deviation * deviation <= variance * limit;
+		kept += select(keep, x[k], zero);
+		count += select(keep, one, zero);
+	}
+
+	// Values spread so widely that none is kept: the plain mean
+	v4si none = count == zero;
+	kept = select(none, sum, kept);
+	count = select(none, zero + (float) n, count);
+	return kept / count * (float) (1 << STACK_SHIFT);
+}
+
+
+// Sigma-clipped mean of n images times 2^STACK_SHIFT; the mean for fewer than 3
+void stack_clip(const uint16_t* const* images, int n, size_t pixels, uint16_t* out)
+{
+	if ( n < 3 )
+	{
+		stack_mean(images, n, pixels, out);
+		return;
+	}
+
+	const v4sf zero = { 0, 0, 0, 0 };
+	v4sf even[STACK_MAX_FRAMES], odd[STACK_MAX_FRAMES];
+	size_t i = 0;
+	for ( ; i + 8 <= pixels; i += 8 )
+	{
+		for ( int k = 0; k < n; k++ )
+		{
+			v8hu v = load(images[k] + i);
+			even[k] = to_float((v4su) v & 0xffff);
+			odd[k] = to_float((v4su) v >> 16);
+		}
+		v4su low = to_int(clip4(even, n));
+		v4su high = to_int(clip4(odd, n));
+		store(out + i, (v8hu) (low | (high << 16)));
+	}
+
+	// The last pixels go through the same arithmetic one per lane
+	for ( ; i < pixels; i++ )
+	{
+		for ( int k = 0; k < n; k++ )
+			even[k] = zero + (float) images[k][i];
+		out[i] = to_int(clip4(even, n))[0];
+	}
+}
+
+
+StackBurst::StackBurst() : count(0)
+{
+}
+
+
+// Combine the images of the burst, tiles in parallel on the pool.  The combined frame
+// has the first image's metadata.  Returns false if there are no images.
+bool StackBurst::combine(StackMethod method, TilePool &pool, Frame &combined)
+{
+	if ( count == 0 )
+		return false;
+
+	size_t pixels = (size_t) first.width * first.height;
+	if ( !result || result.use_count() > 1 )
+		result = make_shared<vector<uint16_t> >(pixels);
+	else
+		result->resize(pixels);
+
+	int n = count;
+	uint16_t* out = result->data();
+	int tiles = (pixels + STACK_TILE - 1) / STACK_TILE;
+	pool.run(tiles, [&](int t) {
+		size_t begin = t * STACK_TILE;
+		size_t length = min(STACK_TILE, pixels - begin);
+		const uint16_t* tile[STACK_MAX_FRAMES];
+		for ( int k = 0; k < n; k++ )
+			tile[k] = images[k].data() + begin;
+		if ( method == STACK_MEDIAN )
+			stack_median(tile, n, length, out + begin);
+		else if ( method == STACK_CLIP )
+			stack_clip(tile, n, length, out + begin);
+		else
+			stack_mean(tile, n, length, out + begin);
+	});
+
+	combined = first;
+	combined.pixels = out;
+	combined.size = pixels * sizeof(uint16_t);
+	combined.owner = result;
+	return true;
+}
+
+
+FrameStacker::FrameStacker()
+{
+}
+
+
+// Start a new burst
+void FrameStacker::reset()
+{
+	if ( burst )
+		burst->count = 0;
+}
+
+
+// Collect the next burst in kept buffers that are no longer being combined.  If all of
+// them still are, the burst gets buffers of its own, freed once it is combined.
+void FrameStacker::start()
+{
+	burst.reset();
+	for ( size_t i = 0; i < bursts.size() && !burst; i++ )
+		if ( bursts[i].use_count() == 1 )
+			burst = bursts[i];
+	if ( !burst )
+	{
+		burst = make_shared<StackBurst>();
+		if ( bursts.size() < STACK_BURSTS )
+			bursts.push_back(burst);
+	}
+	burst->count = 0;
+}
+
+
+// Copy an image into the stack.  Returns false if the stack is full or the image size
+// differs from the first.
+bool FrameStacker::add(const Frame &frame)
+{
+	if ( !burst )
+		start();
+	StackBurst &b = *burst;
+	if ( b.count >= STACK_MAX_FRAMES || (b.count > 0 && (frame.width != b.first.width || frame.height != b.first.height)) )
+		return false;
+
+	if ( (int) b.images.size() <= b.count )
+		b.images.resize(b.count + 1);
+	b.images[b.count].assign(frame.pixels, frame.pixels + (size_t) frame.width * frame.height);
+	if ( b.count == 0 )
+	{
+		b.first = frame;
+		b.first.pixels = NULL;
+		b.first.owner.reset();
+	}
+	b.count++;
+	return true;
+}
+
+
+// Images added since reset()
+int FrameStacker::size() const
+{
+	return burst? burst->count : 0;
+}
+
+
+// Hand the images added over to be combined, and start a new burst
+shared_ptr<StackBurst> FrameStacker::take()
+{
+	shared_ptr<StackBurst> taken = burst;
+	burst.reset();
+	return taken;
+}
+
+
+// Name of a method in the imaging plan
+const char* stack_method_string(StackMethod method)
+{
+	switch ( method )
+	{
+	case STACK_MEAN:
+		return "mean";
+	case STACK_MEDIAN:
+		return "median";
+	case STACK_CLIP:
+		return "clip";
+	default:
+		return "none";
+	}
+}
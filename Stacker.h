@@ -0,0 +1,90 @@
+//	Stacker.h
+//	Interface for FrameStacker class.  Combines the images of a burst into one image with
+//	less noise on board, so a flight that only needs the stacks stores one image instead
+//	of the whole burst.  Each image is copied into the stacker as it arrives, so its grab
+//	buffer goes straight back to the camera.  At the end of the burst take() hands the
+//	copies over as a StackBurst, whose combine() reduces them on a TilePool in another
+//	thread, usually an image writer, while the stacker collects the next burst in
+//	another set of buffers.
+//
+//	Methods, per pixel:
+//		mean	The mean of the images.
+//		median	The middle value, or the mean of the two middle values.
+//		clip	The mean of the values that are within STACK_CLIP_SIGMA standard
+//			deviations of the mean of the other values, the standard deviation
+//			being estimated from the other values too and at least
+//			STACK_CLIP_FLOOR.  Leaving the tested value out lets a single cosmic
+//			ray or satellite trail be rejected even from a burst of 3 to 5 images.
+//			Needs at least 3 images; fewer are averaged.
+//
+//	The combined image has the frame size and Bayer pattern of the images, with 16 times
+//	the pixel values, so its 16-bit values keep 4 bits of the precision gained.  Images
+//	must be 12-bit.
+
+#ifndef _Stacker_H_
+#define _Stacker_H_
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "Frame.h"
+#include "TilePool.h"
+
+using namespace std;
+
+const int STACK_MAX_FRAMES = 16;		// Sums of 12-bit pixels fit 16 bits
+const int STACK_SHIFT = 4;			// Fraction bits of a combined pixel
+const float STACK_CLIP_SIGMA = 4.0f;		// Wide, as a few values give a rough estimate
+const float STACK_CLIP_FLOOR = 1.0f;		// ADU, keeps quantized values from being clipped
+const size_t STACK_TILE = 65536;		// Pixels per tile on the pool
+const size_t STACK_BURSTS = 2;			// Sets of buffers kept for the next bursts
+
+
+// How the images of a stack are combined
+enum StackMethod
+{
+	STACK_NONE,
+	STACK_MEAN,
+	STACK_MEDIAN,
+	STACK_CLIP
+};
+
+
+// Images of one burst, combined by whichever thread holds it
+struct StackBurst
+{
+	vector<vector<uint16_t> > images;	// Copies, kept for a later burst
+	int count;				// Images in the burst
+	Frame first;				// Metadata of the first image, without its pixels
+	shared_ptr<vector<uint16_t> > result;	// Reused once the previous result is written
+
+	StackBurst();
+	bool combine(StackMethod method, TilePool &pool, Frame &combined);
+};
+
+
+// FrameStacker class definition
+class FrameStacker
+{
+public:
+	FrameStacker();
+	void reset();
+	bool add(const Frame &frame);
+	int size() const;
+	shared_ptr<StackBurst> take();
+
+private:
+	shared_ptr<StackBurst> burst;			// Burst being collected
+	vector<shared_ptr<StackBurst> > bursts;	// Kept buffers, free when no one else holds them
+
+	void start();
+};
+
+extern void stack_mean(const uint16_t* const* images, int n, size_t pixels, uint16_t* out);
+extern void stack_median(const uint16_t* const* images, int n, size_t pixels, uint16_t* out);
+extern void stack_clip(const uint16_t* const* images, int n, size_t pixels, uint16_t* out);
+extern const char* stack_method_string(StackMethod method);
+
+#endif
@@ -0,0 +1,226 @@
+//	SyncTrigger.cpp
+//	Implementation of SyncTrigger class.  Arrivals are counted under a mutex; the last
+//	camera to arrive releases the frame by advancing an atomic counter that the waiting
+//	threads spin on.  A camera that times out waiting releases the frame itself with
+//	whoever has arrived, and cameras that arrive after that are told they are late.
+//	A camera that arrives at a later frame than the current one, which happens when it
+//	skipped the current frame, waits for its turn before it is counted.
+//
+//	Each frame's skew is written to the sync log as
+//		cycle, frame, cameras triggered, cameras, skew_us, offset_us of each camera
+//	where a camera's offset is its trigger time after the first camera's, or -1 if it
+//	missed the frame.
+
+// System includes
+#include <algorithm>
+#include <system_error>
+#include <cerrno>
+#include <thread>
+
+// Local includes
+#include "SyncTrigger.h"
+#include "OBCHistory.h"
+
+// System namespace
+using namespace std;
+
+
+SyncTrigger::SyncTrigger(unsigned timeout) :
+	timeout_ms(timeout), cameras(0), cycle(0), frame(0), arrived(0), skipped(0), released(0), partial(0), log(NULL)
+{
+	for ( int i = 0; i < SYNC_SLOTS; i++ )
+		slots[i].frame = -1;
+}
+
+
+SyncTrigger::~SyncTrigger()
+{
+	if ( log != NULL )
+		fclose(log);
+}
+
+
+// Write the skew of every frame to path, appending if it exists
+void SyncTrigger::openLog(const string &path)
+{
+	log = fopen(path.c_str(), "a");
+	if ( log == NULL )
+		throw system_error{errno, system_category(), path};
+}
+
+
+// Start an imaging cycle with the given number of cameras.  Call before the camera
+// threads start the cycle.
+void SyncTrigger::begin(int n)
+{
+	lock_guard<mutex> guard(lock);
+	cameras = min(n, SYNC_MAX_CAMERAS);
+	cycle++;
+	frame = 0;
+	arrived = 0;
+	skipped = 0;
+	released.store(0, memory_order_relaxed);
+	for ( int i = 0; i < SYNC_SLOTS; i++ )
+		slots[i].frame = -1;
+}
+
+
+// Wait until every camera has arrived at frame, then return true so the caller triggers.
+// Returns false if the frame was released without this camera.
+bool SyncTrigger::arrive(int f)
+{
+	int64_t deadline = monotonic_ns() + (int64_t) timeout_ms * 1000000;
+	if ( !waitTurn(f, deadline) )
+		return false;
+	{
+		lock_guard<mutex> guard(lock);
+		if ( f < frame )
+			return false;
+		if ( ++arrived == cameras )
+		{
+			release();
+			return true;
+		}
+	}
+
+	if ( waitTurn(f + 1, deadline) )
+		return true;
+
+	// The others took too long; go ahead with whoever has arrived
+	lock_guard<mutex> guard(lock);
+	if ( frame == f )
+		release();
+	return true;
+}
+
+
+// Count a camera as arrived at frame without it triggering, e.g. after an error
+void SyncTrigger::skip(int f)
+{
+	waitTurn(f, monotonic_ns() + (int64_t) timeout_ms * 1000000);
+	lock_guard<mutex> guard(lock);
+	if ( f < frame )
+		return;
+	skipped++;
+	if ( ++arrived == cameras )
+		release();
+}
+
+
+// Spin until frame f is the one cameras are arriving at, or a later one.  Returns
+// false at the deadline.
+bool SyncTrigger::waitTurn(int f, int64_t deadline)
+{
+	while ( released.load(memory_order_acquire) < f )
+	{
+		if ( monotonic_ns() > deadline )
+			return false;
+		this_thread::yield();
+	}
+	return true;
+}
+
+
+// Release the current frame.  Called with the lock held.
+void SyncTrigger::release()
+{
+	FrameTimes &slot = slots[frame % SYNC_SLOTS];
+	if ( slot.frame >= 0 && slot.recorded < slot.expected )
+		finish(slot);	// A camera never recorded its trigger
+	slot.frame = frame;
+	slot.expected = arrived - skipped;
+	slot.recorded = 0;
+	for ( int i = 0; i < SYNC_MAX_CAMERAS; i++ )
+		slot.present[i] = false;
+	if ( slot.expected == 0 )
+		slot.frame = -1;
+
+	frame++;
+	arrived = 0;
+	skipped = 0;
+	released.store(frame, memory_order_release);
+}
+
+
+// Record when camera triggered frame, after a successful arrive()
+void SyncTrigger::record(int camera, int f, int64_t trigger_ns)
+{
+	lock_guard<mutex> guard(lock);
+	FrameTimes &slot = slots[f % SYNC_SLOTS];
+	if ( slot.frame != f || camera < 0 || camera >= SYNC_MAX_CAMERAS )
+		return;
+	slot.times[camera] = trigger_ns;
+	slot.present[camera] = true;
+	if ( ++slot.recorded == slot.expected )
+		finish(slot);
+}
+
+
+// Compute and log the skew of a frame.  Called with the lock held.
+void SyncTrigger::finish(FrameTimes &slot)
+{
+	int64_t first = INT64_MAX, last = INT64_MIN;
+	for ( int i = 0; i < cameras; i++ )
+		if ( slot.present[i] )
+		{
+			first = min(first, slot.times[i]);
+			last = max(last, slot.times[i]);
+		}
+
+	if ( slot.recorded < cameras )
+		partial++;
+	if ( slot.recorded > 1 )
+		skews_us.push_back((last - first) / 1000.0);
+
+	if ( log != NULL && slot.recorded > 0 )
+	{
+		fprintf(log, "%llu,%d,%d,%d,%.1f", (unsigned long long) cycle, slot.frame, slot.recorded, cameras, (last - first) / 1000.0);
+		for ( int i = 0; i < cameras; i++ )
+			fprintf(log, ",%.1f", slot.present[i]? (slot.times[i] - first) / 1000.0 : -1.0);
+		fprintf(log, "\n");
+		fflush(log);
+	}
+	slot.frame = -1;
+}
+
+
+// Skew distribution of the frames finished since the last call
+SkewStats SyncTrigger::stats()
+{
+	lock_guard<mutex> guard(lock);
+	SkewStats s = SkewStats();
+	s.frames = skews_us.size();
+	s.partial = partial;
+	if ( !skews_us.empty() )
+	{
+		sort(skews_us.begin(), skews_us.end());
+		size_t n = skews_us.size();
+		s.median_us = skews_us[n / 2];
+		s.p90_us = skews_us[min(n - 1, n * 90 / 100)];
+		s.p99_us = skews_us[min(n - 1, n * 99 / 100)];
+		s.max_us = skews_us[n - 1];
+	}
+	skews_us.clear();
+	partial = 0;
+	return s;
+}
+
+
+SyncArrival::SyncArrival(SyncTrigger* s, int f) : sync(s), frame(f), done(false)
+{
+}
+
+
+SyncArrival::~SyncArrival()
+{
+	if ( sync != NULL && !done )
+		sync->skip(frame);
+}
+
+
+// Arrive at the frame.  Without a SyncTrigger this returns true at once.
+bool SyncArrival::wait()
+{
+	done = true;
+	return (sync == NULL) || sync->arrive(frame);
+}
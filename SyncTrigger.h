@@ -0,0 +1,97 @@
+//	SyncTrigger.h
+//	Interface for SyncTrigger class.  In synchronized mode every camera thread arms its
+//	camera, waits here until all cameras are armed, and then triggers at once.  Waiting
+//	threads spin, so they are released within microseconds of the last camera arriving.
+//	The trigger times of each frame are recorded, and the spread between the first and
+//	last camera is the frame's skew.
+//
+//	Frames are numbered from 0 in each imaging cycle and every camera must arrive, or
+//	skip, every frame number in order.  A camera that is not armed within the timeout
+//	is left out of the frame rather than holding the others up.
+
+#ifndef _SyncTrigger_H_
+#define _SyncTrigger_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+
+using namespace std;
+
+const int SYNC_MAX_CAMERAS = 8;
+const int SYNC_SLOTS = 4;		// Frames whose trigger times can be outstanding at once
+const unsigned SYNC_TIMEOUT_MS = 3000;	// Longest wait for the other cameras
+
+
+// Skew distribution since the last call to SyncTrigger::stats()
+struct SkewStats
+{
+	size_t frames;		// Frames triggered by more than one camera
+	size_t partial;		// Frames that some cameras missed
+	double median_us;
+	double p90_us;
+	double p99_us;
+	double max_us;
+};
+
+
+// SyncTrigger class definition
+class SyncTrigger
+{
+public:
+	SyncTrigger(unsigned timeout_ms = SYNC_TIMEOUT_MS);
+	~SyncTrigger();
+	void openLog(const string &path);
+	void begin(int cameras);
+	bool arrive(int frame);
+	void skip(int frame);
+	void record(int camera, int frame, int64_t trigger_ns);
+	SkewStats stats();
+
+private:
+	// Trigger times of one frame
+	struct FrameTimes
+	{
+		int frame;
+		int expected;		// Cameras that were released together
+		int recorded;
+		int64_t times[SYNC_MAX_CAMERAS];
+		bool present[SYNC_MAX_CAMERAS];
+	};
+
+	unsigned timeout_ms;
+	mutex lock;
+	int cameras;
+	uint64_t cycle;
+	int frame;			// Frame cameras are arriving at
+	int arrived;			// Cameras that have arrived at it
+	int skipped;			// Of those, cameras that won't trigger
+	atomic<int> released;		// Frames released so far in this cycle
+	FrameTimes slots[SYNC_SLOTS];
+	vector<double> skews_us;	// Skews since the last stats()
+	size_t partial;
+	FILE* log;
+
+	bool waitTurn(int frame, int64_t deadline);
+	void release();
+	void finish(FrameTimes &slot);
+};
+
+// Releases a frame for a camera that leaves take_exposures() without arriving
+class SyncArrival
+{
+public:
+	SyncArrival(SyncTrigger* sync, int frame);
+	~SyncArrival();
+	bool wait();
+
+private:
+	SyncTrigger* sync;
+	int frame;
+	bool done;
+};
+
+#endif
@@ -0,0 +1,82 @@
+//	SyntheticCamera.cpp
+//	Implementation of SyntheticCamera class.  The scene is generated once.  Each frame
+//	scales it to the exposure time and adds noise read from a different offset of a
+//	noise table, so consecutive frames differ without generating noise per frame.
+
+// System includes
+#include <random>
+#include <cmath>
+#include <algorithm>
+
+// Local includes
+#include "SyntheticCamera.h"
+
+// System namespace
+using namespace std;
+
+const size_t NOISE_EXTRA = 65536;	// Noise table entries beyond one frame
+
+
+SyntheticCamera::SyntheticCamera(const string &sn, uint32_t w, uint32_t h, double fps) :
+	SoftwareCamera(sn, w, h, fps), signal((size_t) w * h), noise((size_t) w * h + NOISE_EXTRA)
+{
+	mt19937 random(w * 7919 + h);
+	normal_distribution<float> read_noise(SYNTHETIC_BIAS, 3);
+	for ( size_t i = 0; i < noise.size(); i++ )
+		noise[i] = (uint16_t) max(0.0f, read_noise(random));
+
+	// Sky brighter towards the bottom of the frame, with the colour response of each
+	// CFA position
+	vector<float> scene((size_t) w * h);
+	for ( uint32_t y = 0; y < h; y++ )
+		for ( uint32_t x = 0; x < w; x++ )
+			scene[(size_t) y * w + x] = 40 + 30.0f * y / h;
+
+	// Stars with a Gaussian profile and a steep brightness distribution
+	uniform_real_distribution<float> uniform(0, 1);
+	const float sigma = 1.5f;
+	for ( size_t s = 0; s < SYNTHETIC_STARS; s++ )
+	{
+		float cx = uniform(random) * w;
+		float cy = uniform(random) * h;
+		float peak = 100 * pow(40.0f, uniform(random) * uniform(random) * 1.5f);
+		int r = (int) (4 * sigma);
+		for ( int y = max(0, (int) cy - r); y <= min((int) h - 1, (int) cy + r); y++ )
+			for ( int x = max(0, (int) cx - r); x <= min((int) w - 1, (int) cx + r); x++ )
+			{
+				float d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+				scene[(size_t) y * w + x] += peak * exp(-d2 / (2 * sigma * sigma));
+			}
+	}
+
+	const float response[2][2] = { { 0.8f, 1.0f }, { 1.0f, 0.6f } };	// R G / G B
+	for ( uint32_t y = 0; y < h; y++ )
+		for ( uint32_t x = 0; x < w; x++ )
+		{
+			float v = scene[(size_t) y * w + x] * response[y & 1][x & 1];
+			signal[(size_t) y * w + x] = (uint16_t) min(v, 65535.0f);
+		}
+}
+
+
+string SyntheticCamera::modelName()
+{
+	return "Synthetic BayerRG12";
+}
+
+
+void SyntheticCamera::fill(uint16_t* buffer, double exposure_us)
+{
+	size_t n = signal.size();
+	const uint16_t* s = signal.data();
+	const uint16_t* z = noise.data() + (count * 4099) % NOISE_EXTRA;
+
+	// Scale in 1/256ths, so that signal * scale fits 32 bits up to 256 times the
+	// reference exposure
+	uint32_t scale = (uint32_t) min(exposure_us / SYNTHETIC_REFERENCE_US * 256, 65535.0);
+	for ( size_t i = 0; i < n; i++ )
+	{
+		uint32_t v = z[i] + ((s[i] * scale) >> 8);
+		buffer[i] = (uint16_t) min(v, 4095u);
+	}
+}
@@ -0,0 +1,34 @@
+//	SyntheticCamera.h
+//	Interface for SyntheticCamera class.  A camera source that generates a BayerRG12 star
+//	field over a sky background with read noise.  The signal scales with the exposure
+//	time and clips at 4095 like the real sensor, so exposure control can be tested too.
+
+#ifndef _SyntheticCamera_H_
+#define _SyntheticCamera_H_
+
+#include <vector>
+#include <cstdint>
+
+#include "CameraSource.h"
+
+const double SYNTHETIC_REFERENCE_US = 100000;	// Exposure time the stored signal is for
+const uint16_t SYNTHETIC_BIAS = 64;		// Black level
+const size_t SYNTHETIC_STARS = 400;
+
+
+// SyntheticCamera class definition
+class SyntheticCamera : public SoftwareCamera
+{
+public:
+	SyntheticCamera(const string &serial, uint32_t width, uint32_t height, double fps);
+	string modelName();
+
+protected:
+	void fill(uint16_t* buffer, double exposure_us);
+
+private:
+	vector<uint16_t> signal;	// Signal at the reference exposure
+	vector<uint16_t> noise;		// Bias plus read noise, longer than a frame
+};
+
+#endif
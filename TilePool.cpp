@@ -0,0 +1,122 @@
+//	TilePool.cpp
+//	Implementation of TilePool class.  The batch number is the start signal, as in
+//	CycleCoordinator; tiles are claimed from an atomic counter so fast threads take more
+//	of them.  The first exception a tile throws is rethrown by run() after all the other
+//	tiles have finished.
+
+// System includes
+#include <algorithm>
+
+// Local includes
+#include "TilePool.h"
+
+// System namespace
+using namespace std;
+
+
+// A pool with threads in all, counting the thread that calls run(); 0 for one per core
+TilePool::TilePool(int threads) :
+	task(NULL), tiles(0), next(0), batch(0), pending(0), quit(false)
+{
+	if ( threads <= 0 )
+		threads = max(1u, thread::hardware_concurrency());
+	for ( int i = 1; i < threads; i++ )
+		workers.push_back(thread(&TilePool::work, this));
+}
+
+
+TilePool::~TilePool()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		quit = true;
+	}
+	start_cv.notify_all();
+	for ( size_t i = 0; i < workers.size(); i++ )
+		workers[i].join();
+}
+
+
+// Run task on tiles 0 to tiles - 1 and wait for all of them
+void TilePool::run(int count, const TileTask &t)
+{
+	lock_guard<mutex> turn(run_lock);
+	{
+		lock_guard<mutex> guard(lock);
+		task = &t;
+		tiles = count;
+		next = 0;
+		error = nullptr;
+		pending = workers.size();
+		batch++;
+	}
+	start_cv.notify_all();
+	take();
+
+	exception_ptr failed;
+	{
+		unique_lock<mutex> guard(lock);
+		done_cv.wait(guard, [this] { return pending == 0; });
+		task = NULL;
+		failed = error;
+	}
+	if ( failed )
+		rethrow_exception(failed);
+}
+
+
+// Threads in the pool, counting the caller of run()
+int TilePool::threads() const
+{
+	return workers.size() + 1;
+}
+
+
+// Claim and run tiles until there are none left
+void TilePool::take()
+{
+	int tile;
+	while ( (tile = next++) < tiles )
+	{
+		try
+		{
+			(*task)(tile);
+		}
+		catch (...)
+		{
+			lock_guard<mutex> guard(lock);
+			if ( !error )
+				error = current_exception();
+		}
+	}
+}
+
+
+void TilePool::work()
+{
+	uint64_t done = 0;
+	while ( true )
+	{
+		{
+			unique_lock<mutex> guard(lock);
+			start_cv.wait(guard, [this, done] { return quit || batch != done; });
+			if ( quit )
+				return;
+			done = batch;
+		}
+
+		take();
+
+		lock_guard<mutex> guard(lock);
+		if ( --pending == 0 )
+			done_cv.notify_one();
+	}
+}
+
+
+// Pool shared by the image writers and camera threads, one thread per core
+TilePool& tile_pool()
+{
+	static TilePool pool;
+	return pool;
+}
@@ -0,0 +1,54 @@
+//	TilePool.h
+//	Interface for TilePool class.  Runs the tiles of one image on all cores: run() hands
+//	tile numbers out to the pool's threads and the calling thread until none are left,
+//	and returns when every tile is done.  Threads that call run() at the same time take
+//	turns, so two writer threads compressing frames don't oversubscribe the cores.
+
+#ifndef _TilePool_H_
+#define _TilePool_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <exception>
+#include <cstdint>
+
+using namespace std;
+
+// Work on one tile
+typedef function<void(int tile)> TileTask;
+
+
+// TilePool class definition
+class TilePool
+{
+public:
+	TilePool(int threads = 0);
+	~TilePool();
+	void run(int tiles, const TileTask &task);
+	int threads() const;
+
+private:
+	vector<thread> workers;
+	mutex run_lock;			// Held by the thread in run()
+	mutex lock;
+	condition_variable start_cv;	// Signals a new batch of tiles or shutdown
+	condition_variable done_cv;	// Signals the last worker finishing to run()
+	const TileTask* task;
+	int tiles;
+	atomic<int> next;		// Next tile to hand out
+	uint64_t batch;			// Number of the current batch
+	int pending;			// Workers still in the current batch
+	exception_ptr error;		// First exception thrown by a tile
+	bool quit;
+
+	void work();
+	void take();
+};
+
+extern TilePool& tile_pool();
+
+#endif
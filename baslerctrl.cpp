@@ -1,49 +1,86 @@
 //	baslerctrl.cpp
 //	This program performs one image capture cycle using the Basler USB camera.
 //	An image capture cycle consists of a sequence of images taken with varying
-//	exposures. Both raw and TIFF versions of the images are saved to a specified
-//	directory and named based on the time the image was taken, the exposure, the
-//	image number in the sequence, and the camera ID. Metadata for each image is
-//	also logged to the standard output.
+//	exposures, given by the imaging plan (see ImagingPlan.h). Both raw and TIFF
+//	versions of the images are saved to a specified directory and named based on
+//	the time the image was taken, the exposure, the image number in the sequence,
+//	and the camera ID. Metadata for each image is also logged to the standard output.
+//
+//	The cameras are camera sources (see CameraSource.h), so the program also runs
+//	without cameras or pylon on synthetic or replayed frames for ground testing.
 
 // System includes
 #include <iostream>
+#include <vector>
+#include <algorithm>
 #include <sstream>
 #include <system_error>
 #include <thread>
 #include <mutex>
 #include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <cerrno>
+#include <climits>
+#include <cmath>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <csignal>
 #include <dirent.h>
 
+#ifdef HAVE_PYLON
 // Pylon API header files
 #include <pylon/PylonIncludes.h>
 #include <pylon/usb/BaslerUsbInstantCamera.h>
 #include <pylon/usb/BaslerUsbInstantCameraArray.h>
+#endif
 
 // Local include
 #include "OBCData.h"
+#include "OBCHistory.h"
+#include "OBCLink.h"
+#include "OBCLog.h"
+#include "CharWriter.h"
+#include "CameraSource.h"
+#ifdef HAVE_PYLON
+#include "PylonCamera.h"
+#endif
+#include "CycleCoordinator.h"
+#include "ImagingPlan.h"
+#include "CycleScheduler.h"
+#include "AutoExposure.h"
+#include "Stacker.h"
+#include "TilePool.h"
+#include "Calibration.h"
+#include "ImageWriter.h"
+#include "SyncTrigger.h"
 
 // System namespace
 using namespace std;
 
+#ifdef HAVE_PYLON
 // Pylon and Basler namespaces
 using namespace Pylon;
 using namespace GenApi;
 using namespace Basler_UsbCameraParams;
+#endif
 
 
 // GLOBAL VARIABLES
 string dev_path = "/dev/ttyACM0";
 //string image_dir = "/media/odroid/NITELITE2/FlightImages/";
 string image_dir = "/home/odroid/Pictures";
-string camera_dir[3];
+vector<string> camera_dir;
+vector<CalibrationStatus> calibration_status;	// Of each camera's last frame, logged when it changes
+mutex log_lock;		// Keeps lines written by the camera and writer threads whole
+const int WRITER_REPORT_CYCLES = 12;	// Imaging cycles between image writer reports
+volatile sig_atomic_t stop_signal = 0;	// SIGTERM or SIGINT once a stop was requested
+#ifdef HAVE_PYLON
+CBaslerUsbInstantCameraArray* basler_cameras = NULL;	// Cameras of the pylon source
+#endif
 
 
 // Create a formatted string from the current system time
@@ -61,6 +98,7 @@ string camera_dir[3];
 //}
 
 
+#ifdef HAVE_PYLON
 // Enumerate the connected cameras and initialize each one.
 // Return value: number of cameras initialized
 int initialize_cameras(CBaslerUsbInstantCameraArray &cameras)
@@ -109,10 +147,45 @@ int initialize_cameras(CBaslerUsbInstantCameraArray &cameras)
 
 	return i;
 }
+#endif
+
+
+// Open the camera sources given on the command line, in order.  The pylon source adds
+// every connected Basler camera.
+void open_cameras(const vector<string> &specs, vector<CameraSource*> &sources)
+{
+	for ( size_t s = 0; s < specs.size(); s++ )
+	{
+		if ( specs[s] == "pylon" )
+		{
+#ifdef HAVE_PYLON
+			if ( basler_cameras != NULL )
+				continue;
+
+			// Initialize Pylon runtime before using any Pylon methods
+			cerr << get_time_string() << " Initializing Pylon" << endl;
+			PylonInitialize();
+			basler_cameras = new CBaslerUsbInstantCameraArray;
+			int n = initialize_cameras(*basler_cameras);
+			for ( int i = 0; i < n; i++ )
+				sources.push_back(new PylonCamera((*basler_cameras)[i]));
+#else
+			throw CameraError("pylon camera source not available in this build");
+#endif
+		}
+		else
+		{
+			CameraSource* source = open_camera_source(specs[s], sources.size());
+			cerr << get_time_string() << " Camera " << sources.size() << " " << source->modelName();
+			cerr << " sn: " << source->serialNumber() << " opened" << endl;
+			sources.push_back(source);
+		}
+	}
+}
 
 
 // Check for existence of top level image_dir and create if not there.
-int check_image_dir()
+void check_image_dir()
 {
 	// Make sure image_dir contains a trailing '/'
 	if ( image_dir.at(image_dir.length() - 1) != '/' )
@@ -133,13 +206,14 @@ int check_image_dir()
 
 // Check for the existence of the camera image directories and create if not there.
 // This uses global variable "image_dir".
-void initialize_image_dirs(CBaslerUsbInstantCameraArray &cameras)
+void initialize_image_dirs(vector<CameraSource*> &cameras)
 {
 	// Check for camera directories
-	for ( int i = 0; i < cameras.GetSize(); i++ )
+	camera_dir.resize(cameras.size());
+	for ( size_t i = 0; i < cameras.size(); i++ )
 	{
-		String_t sn = cameras[i].GetDeviceInfo().GetSerialNumber();
-		if ( String_t("N/A") == sn )
+		string sn = cameras[i]->serialNumber();
+		if ( sn == "N/A" )
 		{
 			cerr << get_time_string() << " initialize_image_dirs(): Camera " << i << " not accessible" << endl;
 			continue;
@@ -174,133 +248,463 @@ void initialize_image_dirs(CBaslerUsbInstantCameraArray &cameras)
 
 
 // Release camera resources
-void terminate_cameras(CBaslerUsbInstantCameraArray &cameras)
+void terminate_cameras(vector<CameraSource*> &cameras)
 {
-	for ( int i = 0; i < cameras.GetSize(); i++ )
-		cameras[i].Close();
+	for ( size_t i = 0; i < cameras.size(); i++ )
+	{
+		cameras[i]->close();
+		delete cameras[i];
+	}
+	cameras.clear();
 
 	cerr << get_time_string() << " Cameras terminated" << endl;
 }
 
 
-// Create a filename from the image capture parameters.
-gcstring create_filename(string timestr, int cameraID, int exposure, string sn, int seq, EImageFileFormat format)
+// Create a filename from the image capture parameters.  A combined stack is tagged with
+// its method, e.g. _0_50_5_mean.rlc for the mean of 5 images.
+string create_filename(const char* timestr, int cameraID, int exposure, string sn, int seq, ImageFormat format,
+	const char* tag = NULL)
+{
+	char filename[PATH_MAX];
+	CharWriter out(filename, sizeof(filename));
+	out.str(camera_dir[cameraID].c_str()).str(timestr).ch('_').integer(cameraID).ch('_').integer(exposure).ch('_').integer(seq);
+	if ( tag != NULL )
+		out.ch('_').str(tag);
+	out.str(image_extension(format));
+	return string(filename);
+}
+
+
+// Create a filename for a log of this run, e.g. the OBC telemetry log.
+string run_filename(const char* prefix, const char* extension)
 {
-	ostringstream filename;
-	filename << camera_dir[cameraID] << timestr << "_" << cameraID << "_" << exposure << "_" << seq;
-	filename << (( format == ImageFileFormat_Tiff )? ".tiff" : ".raw");
-	return gcstring(filename.str().c_str());
+	time_t rawtime;
+	time(&rawtime);
+	char buffer[80];
+	strftime(buffer, sizeof(buffer), "%Y%m%d_%H%M%S", localtime(&rawtime));
+	return image_dir + prefix + buffer + extension;
 }
 
 
-// Capture an image from each camera in the camera array
-void take_exposures(CBaslerUsbInstantCamera &camera, int exposure_time, int stacks, int cameraNum, EImageFileFormat format)
+// Metadata of an image, logged by the writer thread once the image has been written
+struct ImageLogEntry
 {
-	CGrabResultPtr ptrGrabResult;
+	string odroid_time;
+	string obc_time;
+	int camera;
+	string serial_number;
+	int exposure_time;
+	int idx;
+	double internal_temp;
+	string filename;
+	int64_t exposure_mid;	// Monotonic time of the middle of the exposure
+	double exposure_us;	// Exposure time reported by the camera
+	int64_t counter;	// Camera frame counter and timestamp
+	int64_t timestamp;
+
+	void write(bool ok, const string &error);
+};
+
+
+// Write the image log line.  Position and attitude are looked up now, when the OBC
+// record following the exposure has most likely arrived.
+void ImageLogEntry::write(bool ok, const string &error)
+{
+	OBCData data = OBCData();	// Zeros if there is no OBC data yet
+	char gps[OBC_TEXT_SIZE], imu[OBC_TEXT_SIZE], attitude[OBC_TEXT_SIZE];
+	if ( ok )
+	{
+		obc_history.atTime(exposure_mid, data);
+		data.formatGPSPos(gps, sizeof(gps));
+		data.formatIMU(imu, sizeof(imu));
+		data.formatAttitude(attitude, sizeof(attitude));
+	}
 
-	for(int idx = 0; idx < stacks; idx++)
+	lock_guard<mutex> guard(log_lock);
+	cout << odroid_time << ", " << obc_time << ", " << camera << ", " << serial_number << ", " << exposure_time << ", " << idx;
+	cout << ", " << internal_temp << ", " << filename;
+	if ( ok )
+		cout << ", " << gps << ", " << imu << ", " << attitude << ", " << exposure_us << ", " << counter << ", " << timestamp << endl;
+	else
 	{
-		string serial_number("");
-		double internal_temp = 0;
-
-		// Get most recent OBC data from the shared buffer
-		OBCData data;
-		shared_data.m.lock();
-		data = shared_data.obc_data;
-		shared_data.m.unlock();
-		
-		// Strings for OBC time and Odroid time
-		string obc_time = data.getTimeString();
-		string odroid_time = get_time_string();
+		cout << ", write failed: " << error << endl;
+		cerr << odroid_time << " write failed: " << filename << ": " << error << endl;
+	}
+}
 
-		try
+
+// Images of a combined stack collected by a camera's worker thread, with the log entry
+// of the first one for the combined image
+struct CameraStack
+{
+	FrameStacker stacker;
+	ImageLogEntry entry;
+	int64_t last_mid;	// Middle of the last exposure added
+};
+
+
+// Capture one image of a camera's sequence and queue it for writing.  With sync set,
+// the image is triggered together with the other cameras.  Frames with automatic
+// exposure times also go to the camera's auto exposure controller.  Fixed exposures
+// are left out, as a short one can't show how much a longer one would saturate.
+// Images of a combined stack are added to the camera's stacker, and only written
+// themselves if the plan keeps them.  Frames are calibrated before anything else sees
+// them.
+void take_exposure(CameraSource &camera, ImageWriter &writer, SyncTrigger* sync, AutoExposure &ae, CameraStack &stack,
+	const Calibration &calibration, const PlanStep &step, int cameraNum)
+{
+	Frame frame;
+	double exposure_us = (step.exposure_ms > 0)? step.exposure_ms * 1000.0 : ae.exposure(step.min_ms * 1000.0, step.max_ms * 1000.0);
+	int exposure_ms = (int) lround(exposure_us / 1000);
+	string serial_number("");
+	double internal_temp = 0;
+
+	// Get most recent OBC data from the shared buffer
+	OBCData data = shared_data.obc_data.load();
+	
+	// Strings for OBC time and Odroid time
+	char obc_time[OBC_TEXT_SIZE];
+	data.formatTimeString(obc_time, sizeof(obc_time));
+	string odroid_time = get_time_string();
+
+	try
+	{
+		// Lets the other cameras go ahead if this one fails before triggering
+		SyncArrival arrival(sync, step.frame);
+
+		// Both cached, so reading them costs no camera transfers
+		serial_number = camera.serialNumber();
+		internal_temp = camera.temperature();
+
+		// The exposure starts at the software trigger, so its midpoint is half
+		// the exposure time after it
+		camera.arm(exposure_us);
+		bool together = arrival.wait();
+		int64_t trigger_ns = camera.trigger();
+		if ( sync != NULL && together )
+			sync->record(cameraNum, step.frame, trigger_ns);
+
+		string error;
+		if ( camera.retrieve(frame, error) )
 		{
-			serial_number = camera.GetDeviceInfo().GetSerialNumber().c_str();
-			internal_temp = camera.DeviceTemperature.GetValue();
-			camera.ExposureTime.SetValue(exposure_time * 1000); // in microseconds
+			if ( calibration.loaded() )
+			{
+				CalibrationStatus status = calibration.apply(frame, internal_temp);
+				if ( status != calibration_status[cameraNum] )
+				{
+					lock_guard<mutex> guard(log_lock);
+					cerr << odroid_time << " Camera " << cameraNum << " calibration from " << exposure_ms << " ms image " <<
+						step.index << " on: " << calibration_status_string(status);
+					if ( status == CALIBRATION_NO_DARK )
+						cerr << " (" << internal_temp << " C, darks within " << CALIBRATION_TEMP_BIN << " C)";
+					else if ( status == CALIBRATION_SIZE )
+						cerr << " (" << frame.width << "x" << frame.height << ")";
+					cerr << endl;
+					calibration_status[cameraNum] = status;
+				}
+			}
+			if ( step.exposure_ms == 0 )
+				ae.update(frame);
+
+			ImageLogEntry entry;
+			entry.odroid_time = odroid_time;
+			entry.obc_time = obc_time;
+			entry.camera = cameraNum;
+			entry.serial_number = serial_number;
+			entry.exposure_time = exposure_ms;
+			entry.idx = step.index;
+			entry.internal_temp = internal_temp;
+			entry.filename = create_filename(obc_time, cameraNum, exposure_ms, serial_number, step.index, step.format);
+			entry.exposure_mid = trigger_ns + (int64_t) (exposure_us * 500);
+			entry.exposure_us = frame.exposure_us;
+			entry.counter = frame.counter;
+			entry.timestamp = frame.timestamp;
+
+			if ( step.combine != STACK_NONE && stack.stacker.add(frame) )
+			{
+				if ( stack.stacker.size() == 1 )
+					stack.entry = entry;
+				stack.last_mid = entry.exposure_mid;
+			}
 
-			if ( camera.GrabOne(1000, ptrGrabResult) && ptrGrabResult->GrabSucceeded() )
+			// Raw, packed and lossless stacks are the science data; TIFFs and quick-look
+			// images go first when images are dropped
+			WriteJob job;
+			job.camera = cameraNum;
+			job.priority = ( step.format != IMAGE_TIFF )? 1 : 0;
+			job.format = step.format;
+			job.scale = 1;
+			job.filename = entry.filename;
+			job.image = frame;
+			job.done = [entry](bool ok, const string &error) mutable { entry.write(ok, error); };
+			if ( step.keep )
+				writer.submit(job);
+
+			// The quick-look image is demosaiced by a writer thread from the same
+			// frame, which stays in its grab buffer until both are written
+			if ( step.quicklook > 0 )
 			{
-				gcstring gc_filename = create_filename(obc_time, cameraNum, exposure_time, serial_number, idx, format);
-				CImagePersistence::Save(format, gc_filename, ptrGrabResult);
-				cout << odroid_time << ", " << obc_time << ", " << cameraNum << ", " << serial_number << ", " << exposure_time << ", " << idx;
-				cout << ", " << internal_temp << ", " << gc_filename;
-				cout << ", " << data.getGPSPos() << ", " << data.getIMU() << endl;
+				entry.filename = create_filename(obc_time, cameraNum, exposure_ms, serial_number, step.index, IMAGE_QUICKLOOK);
+				WriteJob look;
+				look.camera = cameraNum;
+				look.priority = 0;
+				look.format = IMAGE_QUICKLOOK;
+				look.scale = step.quicklook;
+				look.filename = entry.filename;
+				look.image = frame;
+				look.done = [entry](bool ok, const string &error) mutable { entry.write(ok, error); };
+				writer.submit(look);
 			}
-			else
+
+			// Catalogs are a few kilobytes and cover every frame, so they are dropped
+			// last.  Like the log entry, the OBC position is looked up when written.
+			if ( step.catalog )
 			{
-				// Handle grab failed error
-				cout << odroid_time << ", " << obc_time << ", " << cameraNum << ", " << serial_number << ", " << exposure_time << ", " << idx;
-				cout << ", " << internal_temp << ", grab failed: " << ptrGrabResult->GetErrorDescription() << endl;
-				cerr << odroid_time << " grab failed: " << ptrGrabResult->GetErrorDescription() << endl;
+				entry.filename = create_filename(obc_time, cameraNum, exposure_ms, serial_number, step.index, IMAGE_CATALOG);
+				int64_t exposure_mid = entry.exposure_mid;
+				WriteJob catalog;
+				catalog.camera = cameraNum;
+				catalog.priority = 2;
+				catalog.format = IMAGE_CATALOG;
+				catalog.scale = 1;
+				catalog.filename = entry.filename;
+				catalog.image = frame;
+				catalog.write = [exposure_mid](const string &path, const Frame &image)
+				{
+					OBCData data = OBCData();
+					CatalogPosition position;
+					catalog_position(exposure_mid, obc_history.atTime(exposure_mid, data), data, position);
+					write_catalog(path, image, position);
+				};
+				catalog.done = [entry](bool ok, const string &error) mutable { entry.write(ok, error); };
+				writer.submit(catalog);
 			}
 		}
-		catch (const TimeoutException &te)
+		else
 		{
-			// Catch timeout exception thrown from GrabOne()
-			cout << odroid_time << ", " << obc_time << ", " << cameraNum << ", " << serial_number << ", " << exposure_time << ", " << idx;
-			cout << ", " << internal_temp << ", grab failed: TimeoutException" << te.what() << endl;
-			cout.flush();
-			cerr << odroid_time << " TimeoutException occurred in GrabOne(): " << te.what() << endl;
-			cerr.flush();
+			// Handle grab failed error
+			lock_guard<mutex> guard(log_lock);
+			cout << odroid_time << ", " << obc_time << ", " << cameraNum << ", " << serial_number << ", " << exposure_ms << ", " << step.index;
+			cout << ", " << internal_temp << ", grab failed: " << error << endl;
+			cerr << odroid_time << " grab failed: " << error << endl;
+		}
+		frame.release();
+	}
+	catch (const CameraTimeout &te)
+	{
+		// Catch timeout exception thrown from grab()
+		lock_guard<mutex> guard(log_lock);
+		cout << odroid_time << ", " << obc_time << ", " << cameraNum << ", " << serial_number << ", " << exposure_ms << ", " << step.index;
+		cout << ", " << internal_temp << ", grab failed: TimeoutException" << te.what() << endl;
+		cout.flush();
+		cerr << odroid_time << " TimeoutException occurred in grab(): " << te.what() << endl;
+		cerr.flush();
+	}
+	catch (const CameraError &e)
+	{
+		// Camera error handling.
+		lock_guard<mutex> guard(log_lock);
+		cout << odroid_time << ", " << obc_time << ", " << cameraNum << ", " << serial_number << ", " << exposure_ms << ", " << step.index;
+		cout << ", " << internal_temp << ", grab failed: " << e.what() << endl;
+		cout.flush();
+		cerr << odroid_time << " An exception occurred in grab(): " << e.what() << endl;
+		cerr.flush();
+	}
+}
+
+
+// Queue the images collected for a combined stack to be combined and written by a
+// writer thread, so the camera goes on to its next exposure at once.  The result is
+// logged as one image of their exposure time, with the number of images in place of
+// the index, taken at the middle of the first and last exposures.  It is science data
+// like the images themselves.  A stack cut short by a failed exposure is saved with
+// the images it has.
+void save_stack(ImageWriter &writer, CameraStack &stack, const PlanStep &step)
+{
+	if ( stack.stacker.size() == 0 )
+		return;
+
+	ImageLogEntry entry = stack.entry;
+	entry.idx = stack.stacker.size();
+	entry.exposure_mid = entry.exposure_mid + (stack.last_mid - entry.exposure_mid) / 2;
+	entry.filename = create_filename(entry.obc_time.c_str(), entry.camera, entry.exposure_time, entry.serial_number,
+		entry.idx, step.combined, stack_method_string(step.combine));
+	shared_ptr<StackBurst> burst = stack.stacker.take();
+
+	WriteJob job;
+	job.camera = entry.camera;
+	job.priority = 1;
+	job.format = step.combined;
+	job.scale = 1;
+	job.filename = entry.filename;
+	StackMethod method = step.combine;
+	ImageFormat format = step.combined;
+	job.write = [burst, method, format](const string &path, const Frame &)
+	{
+		Frame combined;
+		burst->combine(method, tile_pool(), combined);
+		write_image(format, path, combined);
+	};
+	job.done = [entry](bool ok, const string &error) mutable { entry.write(ok, error); };
+	writer.submit(job);
+}
+
+
+// Map the calibration file of each camera.  A camera without one, or with a file that
+// can't be used, takes uncalibrated frames.
+void load_calibrations(const string &dir, const vector<string> &serials, vector<Calibration> &calibrations)
+{
+	for ( size_t i = 0; i < serials.size(); i++ )
+	{
+		string path = dir + "/" + serials[i] + CALIBRATION_EXTENSION;
+		try
+		{
+			calibrations[i].open(path);
+			cerr << get_time_string() << " Camera " << i << " calibration " << path << ": " << calibrations[i].darks() <<
+				" darks, " << calibrations[i].hotPixels() << " hot pixels" << endl;
 		}
-		catch (const GenericException &e)
+		catch (const system_error &e)
 		{
-			// Pylon error handling.
-			cout << odroid_time << ", " << obc_time << ", " << cameraNum << ", " << serial_number << ", " << exposure_time << ", " << idx;
-			cout << ", " << internal_temp << ", grab failed: " << e.what() << endl;
-			cout.flush();
-			cerr << odroid_time << " An exception occurred in GrabOne() or CImagePersistence::Save(): " << e.what() << endl;
-			cerr.flush();
+			cerr << get_time_string() << " Camera " << i << " not calibrated: " << e.what() << endl;
 		}
-
 	}
 }
 
 
-// Take exposures for one imaging cycle consisting of 5 raw images at 50ms and one TIFF image at 100ms.
-void imaging_cycle(CBaslerUsbInstantCameraArray &cameras)
+// Take exposures on one camera for an imaging cycle, as laid out by the plan.  This runs
+// in the camera's worker thread.
+void camera_sequence(vector<CameraSource*> &cameras, const ImagingPlan &plan, vector<AutoExposure> &ae,
+	vector<CameraStack> &stacks, const vector<Calibration> &calibrations, ImageWriter &writer, SyncTrigger* sync, int idx,
+	CycleResult &result)
 {
-	string timestring;
+	const PlanStep* steps = plan.steps(idx);
+	size_t count = plan.size(idx);
 
-	for(int idx = 0; idx < cameras.GetSize(); idx++)
+	for ( size_t i = 0; i < count; i++ )
 	{
 		try
 		{
-			take_exposures(cameras[idx], 50, 5, idx, ImageFileFormat_Raw);
+			if ( steps[i].index == 0 )
+				stacks[idx].stacker.reset();
+			take_exposure(*cameras[idx], writer, sync, ae[idx], stacks[idx], calibrations[idx], steps[i], idx);
 		}
-		catch (const GenericException &e)
+		catch (const CameraError &e)
 		{
-			timestring = get_time_string();
-			cerr << timestring << " An exception occurred in take_exposures(): " << e.what() << endl;
-			if ( cameras[idx].IsCameraDeviceRemoved() )
+			string timestring = get_time_string();
+			lock_guard<mutex> guard(log_lock);
+			cerr << timestring << " An exception occurred in take_exposure(): " << e.what() << endl;
+			if ( cameras[idx]->removed() )
 			{
 				cerr << timestring << " Camera " << idx << " removed" << endl;
 			}
 			cerr.flush();
+			result.ok = false;
+			result.error = e.what();
 		}
 
+		// Outside the try, so the images of a stack whose last exposure failed are kept
+		if ( steps[i].combine != STACK_NONE && steps[i].index + 1 == steps[i].count )
+			save_stack(writer, stacks[idx], steps[i]);
 	}
-	for(int idx = 0; idx < cameras.GetSize(); idx++)
+
+	// Frames of longer sequences on other cameras
+	if ( sync != NULL )
+		for ( int frame = count; frame < plan.frames(); frame++ )
+			sync->skip(frame);
+}
+
+
+// Run one imaging cycle on all cameras at once
+void imaging_cycle(CycleCoordinator &coordinator, SyncTrigger* sync, int cameras)
+{
+	if ( sync != NULL )
+		sync->begin(cameras);
+	double seconds = coordinator.runCycle();
+
+	const vector<CycleResult> &results = coordinator.results();
+	for ( size_t idx = 0; idx < results.size(); idx++ )
+		if ( !results[idx].ok )
+		{
+			lock_guard<mutex> guard(log_lock);
+			cerr << get_time_string() << " Imaging cycle took " << seconds << " s, camera " << idx;
+			cerr << " failed after " << results[idx].seconds << " s: " << results[idx].error << endl;
+		}
+}
+
+
+// Read the camera temperatures while no camera is capturing
+void sample_cameras(vector<CameraSource*> &cameras)
+{
+	for ( size_t i = 0; i < cameras.size(); i++ )
 	{
 		try
 		{
-			take_exposures(cameras[idx], 100, 1, idx, ImageFileFormat_Tiff);
+			cameras[i]->sample();
 		}
-		catch (const GenericException &e)
+		catch (const CameraError &e)
 		{
-			timestring = get_time_string();
-			cerr << timestring << " An exception occurred in take_exposures(): " << e.what() << endl;
-			if ( cameras[idx].IsCameraDeviceRemoved() )
-			{
-				cerr << timestring << " Camera " << idx << " removed" << endl;
-			}
-			cerr.flush();
+			lock_guard<mutex> guard(log_lock);
+			cerr << get_time_string() << " Failed to read camera " << i << " temperature: " << e.what() << endl;
 		}
 	}
 }
 
 
+// Log the cycle cadence since the last report: overruns, release jitter and the period,
+// with their histograms
+void report_schedule(CycleScheduler &scheduler)
+{
+	ScheduleStats stats = scheduler.stats();
+	lock_guard<mutex> guard(log_lock);
+	cerr << get_time_string() << " Cycle schedule: " << stats.cycles << " cycles, " << stats.overruns << " overruns, ";
+	cerr << stats.skipped << " skipped, period " << stats.period_mean_s << " s (" << stats.period_min_s << " to " << stats.period_max_s << "), ";
+	cerr << "jitter " << stats.jitter_mean_us << " us (max " << stats.jitter_max_us << ")" << endl;
+	cerr << get_time_string() << " Cycle jitter:";
+	for ( int i = 0; i < SCHEDULE_BUCKETS; i++ )
+		cerr << " " << schedule_bucket_string(i) << " " << stats.jitter[i];
+	cerr << ", period error:";
+	for ( int i = 0; i < SCHEDULE_BUCKETS; i++ )
+		cerr << " " << schedule_bucket_string(i) << " " << stats.period[i];
+	cerr << endl;
+}
+
+
+// Log the state of the auto exposure controllers that are in use
+void report_exposure(vector<AutoExposure> &ae)
+{
+	lock_guard<mutex> guard(log_lock);
+	for ( size_t i = 0; i < ae.size(); i++ )
+		if ( ae[i].updates > 0 )
+		{
+			cerr << get_time_string() << " Auto exposure camera " << i << ": next " << ae[i].exposure_us / 1000 << " ms, level ";
+			cerr << ae[i].level << " ADU, " << ae[i].saturated * 100 << "% saturated" << endl;
+		}
+}
+
+
+// Log the image writer's queue depth and latencies since the last report
+void report_writer(ImageWriter &writer)
+{
+	WriterStats stats = writer.stats();
+	lock_guard<mutex> guard(log_lock);
+	cerr << get_time_string() << " Image writer: " << stats.written << " written, " << stats.failed << " failed, ";
+	cerr << stats.dropped << " dropped, " << stats.blocked << " blocked, queue depth " << stats.depth << " (max " << stats.max_depth << "), ";
+	cerr << "wait " << stats.wait_mean_ms << " ms (max " << stats.wait_max_ms << "), ";
+	cerr << "write " << stats.write_mean_ms << " ms (max " << stats.write_max_ms << ")" << endl;
+}
+
+
+// Log the distribution of the trigger skew between cameras since the last report
+void report_skew(SyncTrigger &sync)
+{
+	SkewStats stats = sync.stats();
+	lock_guard<mutex> guard(log_lock);
+	cerr << get_time_string() << " Trigger skew: " << stats.frames << " frames, " << stats.partial << " missed by a camera, ";
+	cerr << "median " << stats.median_us << " us, 90% " << stats.p90_us << " us, 99% " << stats.p99_us << " us, max " << stats.max_us << " us" << endl;
+}
+
+
 void usage(char* argv[])
 {
 	cout << "Usage: " << argv[0] << " [OPTIONS] [directory path] [device path]" << endl;
@@ -308,7 +712,18 @@ void usage(char* argv[])
 	cout << "  -h    Display command line usage (this message)" << endl;
 	cout << "  -d    Daemon mode (use for flight operations)" << endl;
 	cout << "  -n    No OBC mode (use for ground testing without OBC)" << endl;
-	cout << "  -w s  Wait for s seconds between imaging cycles (default is 5 seconds)" << endl;
+	cout << "  -w s  Start an imaging cycle every s seconds (default is 5 seconds)" << endl;
+	cout << "  -o p  On a cycle overrun, skip the missed cycles or catch up with them (skip or catchup, default is skip)" << endl;
+	cout << "  -q n  Queue up to n images per camera for writing (default is " << WRITER_DEPTH << ")" << endl;
+	cout << "  -t n  Write images with n threads (default is " << WRITER_THREADS << ")" << endl;
+	cout << "  -p    Drop images when the write queue is full instead of waiting; TIFFs are dropped first" << endl;
+	cout << "  -s    Trigger the cameras together and log the skew between them to sync_<time>.csv" << endl;
+	cout << "  -f f  Take the images listed in plan file f (default is 5x50 ms raw, 1x100 ms TIFF)" << endl;
+	cout << "  -k d  Subtract darks and replace hot pixels with the calibration files <serial number>.cal in d" << endl;
+	cout << "  -c c  Add camera source c, one of (default is pylon):" << endl;
+	cout << "          pylon                    All connected Basler cameras" << endl;
+	cout << "          synthetic[:WxH][@fps]    Generated star field frames" << endl;
+	cout << "          replay:dir[:WxH][@fps]   The .raw, .r12 or .rlc files in dir, repeated" << endl;
 	cout << "Defaults:" << endl;
 	cout << "  [directory path] = " << image_dir << endl;
 	cout << "  [device path] = " << dev_path << endl;
@@ -316,6 +731,29 @@ void usage(char* argv[])
 }
 
 
+// Note a stop request.  The imaging loop ends after the current cycle, and the images
+// and OBC records still queued are written out.
+void request_stop(int sig)
+{
+	stop_signal = sig;
+}
+
+
+// Stop on SIGTERM and SIGINT instead of being killed.  The imaging process restarts
+// interrupted calls; the monitor process has its wait interrupted, so it can pass the
+// signal on to its child.
+void install_stop_handlers(bool restart)
+{
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = request_stop;
+	sa.sa_flags = restart? SA_RESTART : 0;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+}
+
+
 // Convert process to a daemon.
 void daemonize()
 {
@@ -360,10 +798,11 @@ void daemonize()
 // This function forks a child process to operate the Basler cameras and then
 // calls wait() to monitor the child. If the child process should exit, the
 // termination status is written to the error log and a new child is forked.
-// The parent process should never return from this function.
+// A stop signal is passed on to the child, and the parent exits once the child
+// has stopped. The parent process should never return from this function.
 void monitor_child()
 {
-	while (true)
+	while ( !stop_signal )
 	{
 		// Fork a child process
 		pid_t pid = fork();
@@ -373,12 +812,17 @@ void monitor_child()
 		{
 			// Child process continues and operates Basler
 			cerr << get_time_string() << " monitor_child(): child process forked" << endl;
-			break;
+			install_stop_handlers(true);
+			return;
 		}
+		install_stop_handlers(false);
 
 		// Wait for status of child
 		int wstatus;
-		pid = wait(&wstatus);
+		pid_t child = pid;
+		while ( (pid = waitpid(child, &wstatus, 0)) == -1 && errno == EINTR )
+			if ( stop_signal )
+				kill(child, stop_signal);
 		if ( pid == -1 )
 			throw system_error{errno, system_category(), " monitor_child(): wait() failed"};
 
@@ -393,6 +837,8 @@ void monitor_child()
 			cerr << "continued" << endl;
 	}
 
+	cerr << get_time_string() << " monitor_child(): stopped by signal " << stop_signal << endl;
+	exit(EXIT_SUCCESS);
 }
 
 
@@ -401,8 +847,16 @@ int main(int argc, char* argv[])
 	// Check command line parameters
 	bool id_set = false;
 	bool daemon = false;
-	int cycle_delay = 5;
-	shared_data.obc_data.obc_mode = true;
+	double cycle_period = 5;
+	OverrunPolicy overrun_policy = OVERRUN_SKIP;
+	size_t writer_depth = WRITER_DEPTH;
+	int writer_threads = WRITER_THREADS;
+	WriterPolicy writer_policy = WRITER_BLOCK;
+	bool synchronized = false;
+	vector<string> sources;
+	string plan_file;
+	string calibration_dir;
+	shared_data.obc_mode = true;
 
 	for ( int i = 1; i < argc; i++ )
 	{
@@ -411,9 +865,30 @@ int main(int argc, char* argv[])
 		if ( string("-d") == argv[i] )
 			daemon = true;
 		else if ( string("-n") == argv[i] )
-			shared_data.obc_data.obc_mode = false;
+			shared_data.obc_mode = false;
 		else if ( string("-w") == argv[i] )
-			cycle_delay = atoi(argv[++i]);
+			cycle_period = atof(argv[++i]);
+		else if ( string("-o") == argv[i] && i + 1 < argc )
+		{
+			string policy = argv[++i];
+			if ( policy != "skip" && policy != "catchup" )
+				usage(argv);
+			overrun_policy = (policy == "skip")? OVERRUN_SKIP : OVERRUN_CATCH_UP;
+		}
+		else if ( string("-q") == argv[i] )
+			writer_depth = atoi(argv[++i]);
+		else if ( string("-t") == argv[i] )
+			writer_threads = atoi(argv[++i]);
+		else if ( string("-p") == argv[i] )
+			writer_policy = WRITER_DROP;
+		else if ( string("-s") == argv[i] )
+			synchronized = true;
+		else if ( string("-f") == argv[i] && i + 1 < argc )
+			plan_file = argv[++i];
+		else if ( string("-c") == argv[i] && i + 1 < argc )
+			sources.push_back(argv[++i]);
+		else if ( string("-k") == argv[i] && i + 1 < argc )
+			calibration_dir = argv[++i];
 		else
 		{
 			if ( !id_set )
@@ -429,16 +904,37 @@ int main(int argc, char* argv[])
 	}
 	cerr << get_time_string() << " Daemon mode " << (daemon? "enabled" : "disabled");
 	cerr << ", OBC mode ";
-	if ( shared_data.obc_data.obc_mode )
+	if ( shared_data.obc_mode )
 		cerr << "enabled, timecodes are from OBC";
 	else
 		cerr << "disabled, timecodes are from Odroid";
-	cerr << ", imaging cycle delay = " << cycle_delay << endl;
+	cerr << ", imaging cycle period = " << cycle_period << " s, " << overrun_policy_string(overrun_policy) << " on overrun";
+	cerr << ", cameras triggered " << (synchronized? "together" : "independently") << endl;
+
+	if ( sources.empty() )
+		sources.push_back("pylon");
+
+	// A queued image holds a grab buffer, and the camera needs some left to grab into
+	if ( writer_depth < 1 || writer_depth > SOURCE_BUFFERS - 2 )
+	{
+		writer_depth = min(max(writer_depth, (size_t) 1), SOURCE_BUFFERS - 2);
+		cerr << get_time_string() << " Write queue limited to " << writer_depth << " images per camera" << endl;
+	}
+	writer_threads = max(writer_threads, 1);
+	cerr << get_time_string() << " Image writer: " << writer_threads << " threads, " << writer_depth;
+	cerr << " images per camera, " << writer_policy_string(writer_policy) << " when full" << endl;
+
+	install_stop_handlers(true);
 
 	try
 	{
 		check_image_dir();
 
+		// Read the plan before anything starts, so a bad plan stops the program
+		ImagingPlan plan;
+		if ( !plan_file.empty() )
+			plan.load(plan_file);
+
 		if ( daemon )
 		{
 			daemonize();
@@ -447,43 +943,115 @@ int main(int argc, char* argv[])
 
 		cerr << get_time_string() << " Image directory path: " << image_dir << ", USB device path: " << dev_path << endl;
 
-		if ( shared_data.obc_data.obc_mode )
+		if ( shared_data.obc_mode )
 		{
-			// Initialize USB device and start reading data
+			// Start the OBC link.  Imaging starts right away and OBC data is
+			// used as soon as the device appears.
 			cerr << get_time_string() << " Connecting to OBC" << endl;
-			FILE* fp = init_usb(dev_path, get_time_string());
-			thread t1 {read_usb, fp};
+			obc_recorder.start(run_filename("obc_", ".obl"));
+			OBCLink* obc_link = new OBCLink(dev_path);
+			thread t1 {&OBCLink::run, obc_link};
 			t1.detach();
 		}
 
-		// Initialize Pylon runtime before using any Pylon methods 
-		cerr << get_time_string() << " Initializing Pylon" << endl;
-		PylonInitialize();
-
 		// Initialize the cameras and create camera image directories
-		CBaslerUsbInstantCameraArray cameras;
-		int n = initialize_cameras(cameras);
+		vector<CameraSource*> cameras;
+		open_cameras(sources, cameras);
+		int n = cameras.size();
 		if ( n > 0 )
 		{
 			initialize_image_dirs(cameras);
 
-			// Start the imaging cycle
-			while ( true )
+			vector<string> serials;
+			for ( int i = 0; i < n; i++ )
+				serials.push_back(cameras[i]->serialNumber());
+			plan.compile(serials);
+			cerr << get_time_string() << " Imaging plan " << (plan_file.empty()? "(default)" : plan_file) << ":" << endl;
+			plan.print(cerr, get_time_string() + "   ");
+
+			// Auto exposure for the cameras with automatic exposure times
+			vector<AutoExposure> ae(n);
+			for ( int i = 0; i < n; i++ )
 			{
-				imaging_cycle(cameras);
-				sleep(cycle_delay);
+				int min_ms, max_ms;
+				if ( plan.autoLimits(i, min_ms, max_ms) )
+					ae[i].setLimits(min_ms * 1000.0, max_ms * 1000.0);
+			}
+
+			// Dark and hot pixel calibration of the cameras that have a file
+			vector<Calibration> calibrations(n);
+			calibration_status.assign(n, CALIBRATION_OK);
+			if ( !calibration_dir.empty() )
+				load_calibrations(calibration_dir, serials, calibrations);
+
+			// Synchronized triggering
+			SyncTrigger* sync = NULL;
+			if ( synchronized )
+			{
+				sync = new SyncTrigger();
+				sync->openLog(run_filename("sync_", ".csv"));
+			}
+
+			{
+				// Images are written in the background.  Queued images hold camera buffers, so
+				// the cameras' threads stop and the writer writes out its queue before the
+				// cameras are closed.
+				vector<CameraStack> stacks(n);
+				ImageWriter writer(n, writer_depth, writer_threads, writer_policy);
+
+				// One worker thread per camera
+				CycleCoordinator coordinator(n,
+					[&cameras, &plan, &ae, &stacks, &calibrations, &writer, sync](int idx, CycleResult &result)
+					{ camera_sequence(cameras, plan, ae, stacks, calibrations, writer, sync, idx, result); });
+
+				// Start the imaging cycle on every deadline of the schedule
+				CycleScheduler scheduler(cycle_period, overrun_policy);
+				for ( int cycle = 1; ; cycle++ )
+				{
+					scheduler.wait();
+					if ( stop_signal )
+					{
+						cerr << get_time_string() << " Stopping on signal " << stop_signal << endl;
+						break;
+					}
+					imaging_cycle(coordinator, sync, n);
+					sample_cameras(cameras);
+					if ( cycle % WRITER_REPORT_CYCLES == 0 )
+					{
+						report_schedule(scheduler);
+						report_exposure(ae);
+						report_writer(writer);
+						if ( sync != NULL )
+							report_skew(*sync);
+					}
+				}
+				writer.flush();
 			}
 
 			// Clean up
+			delete sync;
 			terminate_cameras(cameras);
 		}
 	}
+#ifdef HAVE_PYLON
 	catch (const GenericException &e)
 	{
 		// Pylon error handling.
 		cerr << get_time_string() << " An exception occurred: " << e.what() << endl;
 		exit(-1);
 	}
+#endif
+	catch (const PlanError &e)
+	{
+		cerr << get_time_string() << " " << e.what() << endl;
+		exit(-1);
+	}
+	catch (const CameraError &e)
+	{
+		// Camera source error handling.
+		cerr << get_time_string() << " Camera error: " << e.what() << endl;
+		exit(-1);
+	}
 	catch (const system_error &e)
 	{
 		// System error handling.
@@ -491,8 +1059,17 @@ int main(int argc, char* argv[])
 		exit(-1);
 	}
 
+#ifdef HAVE_PYLON
 	// Release all Pylon resources
-	PylonTerminate();
+	if ( basler_cameras != NULL )
+	{
+		delete basler_cameras;
+		PylonTerminate();
+	}
+#endif
+
+	// Write out the last partial block of OBC records
+	obc_recorder.stop();
 
 	cerr << get_time_string() << " Program terminated normally" << endl;
 	exit(0);
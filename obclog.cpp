@@ -0,0 +1,207 @@
+//	obclog.cpp
+//	Ground tool for OBC telemetry logs written by baslerctrl.
+//
+//	obclog info file		Summary of the log
+//	obclog csv file			Write every record as CSV to the standard output
+//	obclog imu file			Time loading the IMU trajectory of the whole log
+//	obclog attitude file		Recompute the attitude of every record and write
+//					it as CSV to the standard output
+//	obclog convert input file	Convert a recorded OBC stream (text records or
+//					binary frames) into a log
+
+// System includes
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <system_error>
+#include <stdexcept>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Local includes
+#include "OBCData.h"
+#include "OBCStream.h"
+#include "OBCLog.h"
+#include "OBCAttitude.h"
+
+// System namespace
+using namespace std;
+
+
+void info(const string &filename)
+{
+	OBCLogReader log;
+	log.open(filename);
+
+	cout << filename << ": " << log.size() << " records in " << log.blocks().size() << " blocks";
+	cout << (log.indexed()? ", indexed" : ", not closed cleanly, blocks found by scanning") << endl;
+	if ( log.size() > 0 )
+	{
+		const OBCLogBlockInfo &first = log.blocks().front();
+		const OBCLogBlockInfo &last = log.blocks().back();
+		cout << "OBC time " << first.first_ms << " .. " << last.last_ms << " ms, ";
+		cout << fixed << setprecision(1) << (last.last_mono - first.first_mono) / 1e9 << " s" << endl;
+	}
+	cout << "columns:";
+	for ( int c = 0; c < LOG_COLUMNS; c++ )
+		if ( log.findColumn(obc_log_columns[c]) >= 0 )
+			cout << " " << obc_log_columns[c];
+	cout << endl;
+}
+
+
+void csv(const string &filename)
+{
+	OBCLogReader log;
+	log.open(filename);
+
+	// Logs from before the attitude estimator have no attitude columns
+	int ncolumns = LOG_COLUMNS;
+	while ( log.findColumn(obc_log_columns[ncolumns - 1]) < 0 )
+		ncolumns--;
+
+	vector<vector<int64_t> > ints(LOG_LAT);
+	vector<vector<double> > doubles(ncolumns - LOG_LAT);
+	for ( int c = 0; c < ncolumns; c++ )
+	{
+		int column = log.findColumn(obc_log_columns[c]);
+		if ( c < LOG_LAT )
+			log.readColumn(column, ints[c]);
+		else
+			log.readColumn(column, doubles[c - LOG_LAT]);
+		cout << obc_log_columns[c] << ((c < ncolumns - 1)? "," : "\n");
+	}
+
+	for ( uint64_t i = 0; i < log.size(); i++ )
+	{
+		printf("%lld,%lld,%012lld", (long long) ints[LOG_MONO_NS][i], (long long) ints[LOG_MS][i], (long long) ints[LOG_GPS_TIME][i]);
+		printf(",%.7f,%.7f,%.2f", doubles[0][i], doubles[1][i], doubles[2][i]);
+		for ( size_t c = 3; c < doubles.size(); c++ )
+			printf(",%.4f", doubles[c][i]);
+		printf("\n");
+	}
+}
+
+
+void imu(const string &filename)
+{
+	auto t1 = chrono::steady_clock::now();
+
+	OBCLogReader log;
+	log.open(filename);
+	vector<int64_t> t;
+	vector<vector<double> > values(9);
+	log.readColumn(log.findColumn("mono_ns"), t);
+	for ( int c = 0; c < 9; c++ )
+		log.readColumn(log.findColumn(obc_log_columns[LOG_AX + c]), values[c]);
+
+	auto t2 = chrono::steady_clock::now();
+	double s = chrono::duration<double>(t2 - t1).count();
+	cout << "Loaded " << log.size() << " IMU samples in " << fixed << setprecision(3) << s * 1000 << " ms" << endl;
+}
+
+
+void attitude(const string &filename)
+{
+	OBCLogReader log;
+	log.open(filename);
+	vector<int64_t> ms;
+	vector<vector<double> > values(9);
+	log.readColumn(log.findColumn("ms"), ms);
+	for ( int c = 0; c < 9; c++ )
+		log.readColumn(log.findColumn(obc_log_columns[LOG_AX + c]), values[c]);
+
+	size_t n = ms.size();
+	const double* imu[9];
+	for ( int c = 0; c < 9; c++ )
+		imu[c] = values[c].data();
+	vector<double> roll(n), pitch(n), yaw(n);
+
+	auto t1 = chrono::steady_clock::now();
+	attitude_batch(n, ms.data(), imu, roll.data(), pitch.data(), yaw.data());
+	auto t2 = chrono::steady_clock::now();
+	double s = chrono::duration<double>(t2 - t1).count();
+	cerr << "Attitude of " << n << " samples in " << fixed << setprecision(3) << s * 1000 << " ms" << endl;
+
+	printf("ms,roll,pitch,yaw\n");
+	for ( size_t i = 0; i < n; i++ )
+		printf("%lld,%.2f,%.2f,%.2f\n", (long long) ms[i], roll[i], pitch[i], yaw[i]);
+}
+
+
+void convert(const string &input, const string &filename)
+{
+	int fd = open(input.c_str(), O_RDONLY);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), input};
+
+	OBCLogWriter log;
+	log.open(filename);
+
+	// Recordings have no receive times, so OBC time stands in for them
+	OBCStream stream;
+	OBCData data;
+	AttitudeFilter filter;
+	while ( stream.fill(fd) > 0 )
+		while ( stream.next(data) )
+		{
+			filter.update(data);
+			filter.euler(data.roll, data.pitch, data.yaw);
+			log.append(data.ms * 1000000LL, data);
+		}
+	log.close();
+	close(fd);
+
+	cout << stream.records << " records converted, " << stream.errors << " bad" << endl;
+}
+
+
+void usage()
+{
+	cerr << "usage: obclog info file" << endl;
+	cerr << "       obclog csv file" << endl;
+	cerr << "       obclog imu file" << endl;
+	cerr << "       obclog attitude file" << endl;
+	cerr << "       obclog convert input file" << endl;
+	exit(-1);
+}
+
+
+int main(int argc, char* argv[])
+{
+	if ( argc < 3 )
+		usage();
+
+	string cmd = argv[1];
+	try
+	{
+		if ( cmd == "info" )
+			info(argv[2]);
+		else if ( cmd == "csv" )
+			csv(argv[2]);
+		else if ( cmd == "imu" )
+			imu(argv[2]);
+		else if ( cmd == "attitude" )
+			attitude(argv[2]);
+		else if ( cmd == "convert" && argc > 3 )
+			convert(argv[2], argv[3]);
+		else
+			usage();
+	}
+	catch (const system_error &e)
+	{
+		cerr << e.what() << endl;
+		exit(-1);
+	}
+	catch (const out_of_range &e)
+	{
+		cerr << e.what() << endl;
+		exit(-1);
+	}
+	exit(0);
+}
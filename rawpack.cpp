@@ -0,0 +1,546 @@
+//	rawpack.cpp
+//	Ground tool for packed 12-bit raw files (.r12, see RawPack.h), compressed raw files
+//	(.rlc, see RawCodec.h) and source catalogs (.src, see SourceCatalog.h) written by
+//	baslerctrl, and for the calibration files (.cal, see Calibration.h) it reads.
+//
+//	rawpack info file ...		Print the header of each file
+//	rawpack unpack file [output]	Write the pixels of a packed or compressed file as
+//					a 16-bit raw file, the same as a raw file from
+//					baslerctrl; output defaults to the file name with
+//					.raw instead of .r12 or .rlc
+//	rawpack pack WxH file [output]	Pack a 16-bit raw file of the given size
+//	rawpack compress WxH file [output]
+//					Compress a 16-bit raw file of the given size
+//	rawpack sources file ...	Print the header and sources of each catalog
+//	rawpack extract WxH file [output]
+//					Write the catalog of a raw file of the given size,
+//					or of a packed or compressed file, without an OBC
+//					position
+//	rawpack calibrate WxH serial output exposure_ms:temperature:file ...
+//					Write a calibration file for the camera with the
+//					given serial number from master darks, combined
+//					images of the given size as raw files or packed
+//					or compressed files, taken at each exposure time
+//					and temperature; hot pixels are found in all of them
+//	rawpack time [WxH file ...]	Time packing and unpacking a full size frame,
+//					compressing and decompressing a synthetic star
+//					field and each file given, which may be raw files
+//					of the given size or packed or compressed files,
+//					extracting the sources of the star field and
+//					calibrating it
+
+// System includes
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <system_error>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Local includes
+#include "Frame.h"
+#include "ImageFile.h"
+#include "RawPack.h"
+#include "RawCodec.h"
+#include "TilePool.h"
+#include "SourceCatalog.h"
+#include "Calibration.h"
+#include "CameraSource.h"
+#include "SyntheticCamera.h"
+
+// System namespace
+using namespace std;
+
+const int TIME_REPEATS = 20;
+
+
+// Output file name: file with its extension replaced
+static string output_name(const string &file, const char* extension)
+{
+	size_t dot = file.rfind('.');
+	size_t slash = file.rfind('/');
+	if ( dot == string::npos || (slash != string::npos && dot < slash) )
+		return file + extension;
+	return file.substr(0, dot) + extension;
+}
+
+
+static bool has_extension(const string &file, const char* extension)
+{
+	size_t len = strlen(extension);
+	return file.size() > len && file.compare(file.size() - len, len, extension) == 0;
+}
+
+
+// Frame viewing pixels that belong to the caller
+static Frame frame_of(vector<uint16_t> &pixels, uint32_t width, uint32_t height)
+{
+	Frame frame;
+	frame.pixels = pixels.data();
+	frame.width = width;
+	frame.height = height;
+	frame.size = (size_t) width * height * sizeof(uint16_t);
+	frame.owner = shared_ptr<void>(pixels.data(), [](void*) {});
+	return frame;
+}
+
+
+// Header of a packed or compressed file, without checking more than the magic
+static void read_header(const string &filename, PackedHeader &header)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), filename};
+	try
+	{
+		read_all(fd, filename, &header, sizeof(header));
+	}
+	catch (...)
+	{
+		close(fd);
+		throw;
+	}
+	close(fd);
+	if ( memcmp(header.magic, "NR12", 4) != 0 && memcmp(header.magic, "NRLC", 4) != 0 )
+		throw system_error{EINVAL, system_category(), filename + ": not a packed or compressed raw file"};
+}
+
+
+// Read a raw file of the given size
+static void read_raw(const string &filename, uint32_t width, uint32_t height, vector<uint16_t> &pixels)
+{
+	pixels.resize((size_t) width * height);
+	int fd = open(filename.c_str(), O_RDONLY);
+	if ( fd < 0 )
+		throw system_error{errno, system_category(), filename};
+	ssize_t n = read(fd, pixels.data(), pixels.size() * sizeof(uint16_t));
+	int error = errno;
+	close(fd);
+	if ( n < 0 )
+		throw system_error{error, system_category(), filename};
+	if ( (size_t) n != pixels.size() * sizeof(uint16_t) )
+		throw system_error{EINVAL, system_category(), filename + ": not a " + to_string(width) + "x" + to_string(height) + " raw file"};
+}
+
+
+// Read the pixels of a packed or compressed file
+static void read_coded(const string &filename, PackedHeader &header, vector<uint16_t> &pixels)
+{
+	read_header(filename, header);
+	pixels.resize((size_t) header.width * header.height);
+	if ( memcmp(header.magic, "NRLC", 4) == 0 )
+		read_lossless(filename, header, pixels.data(), pixels.size(), tile_pool());
+	else
+		read_packed(filename, header, pixels.data(), pixels.size());
+}
+
+
+void info(const string &filename)
+{
+	PackedHeader header;
+	read_header(filename, header);
+	bool compressed = memcmp(header.magic, "NRLC", 4) == 0;
+
+	cout << filename << ": " << header.width << "x" << header.height;
+	if ( compressed )
+		cout << " BayerRG12 compressed to " << header.data_size << " bytes, ratio " <<
+			(double) header.width * header.height * 2 / max(header.data_size, 1u);
+	else
+		cout << " BayerRG12p, " << header.data_size << " bytes";
+	cout << ", exposure " << header.exposure_us << " us, triggered at " << header.trigger_ns << " ns";
+	if ( header.metadata )
+		cout << ", camera timestamp " << header.timestamp << ", frame " << header.counter << ", gain " << header.gain_db << " dB";
+	cout << endl;
+}
+
+
+void unpack(const string &filename, string output)
+{
+	PackedHeader header;
+	vector<uint16_t> pixels;
+	read_coded(filename, header, pixels);
+
+	if ( output.empty() )
+		output = output_name(filename, ".raw");
+	write_raw(output, frame_of(pixels, header.width, header.height));
+	cout << output << endl;
+}
+
+
+void pack(ImageFormat format, const string &size, const string &filename, string output)
+{
+	uint32_t width = 0, height = 0;
+	double fps = 0;
+	parse_source_options(size, width, height, fps);
+
+	vector<uint16_t> pixels;
+	read_raw(filename, width, height, pixels);
+
+	if ( output.empty() )
+		output = output_name(filename, image_extension(format));
+	write_image(format, output, frame_of(pixels, width, height));
+	cout << output << endl;
+}
+
+
+// Print a catalog as the header followed by one line per source
+void sources(const string &filename)
+{
+	CatalogHeader header;
+	vector<CatalogSource> list;
+	read_catalog(filename, header, list);
+
+	const CatalogPosition &p = header.position;
+	cout << filename << ": " << header.width << "x" << header.height << ", " << header.sources << " of " <<
+		header.detected << " sources, background " << header.background << " noise " << header.noise <<
+		" ADU per 2x2, exposure " << header.exposure_us << " us, triggered at " << header.trigger_ns << " ns" << endl;
+	if ( p.status == HISTORY_EMPTY )
+		cout << "  no OBC position" << endl;
+	else
+		cout << "  OBC " << p.obc_ms << " ms, GPS " << p.gps_time << ", " << fixed << setprecision(6) << p.lat << ", " <<
+			p.lon << ", " << setprecision(2) << p.alt << " m, roll " << p.roll << " pitch " << p.pitch << " yaw " << p.yaw <<
+			defaultfloat << endl;
+	cout << "x, y, flux, pixels, peak, flags, background" << endl;
+	cout << fixed;
+	for ( size_t i = 0; i < list.size(); i++ )
+		cout << setprecision(2) << list[i].x << ", " << list[i].y << ", " << setprecision(0) << list[i].flux << ", " <<
+			list[i].area << ", " << list[i].peak << ", " << list[i].flags << ", " << setprecision(1) << list[i].background << endl;
+	cout << defaultfloat;
+}
+
+
+void extract(const string &size, const string &filename, string output)
+{
+	vector<uint16_t> pixels;
+	Frame frame;
+	if ( has_extension(filename, ".r12") || has_extension(filename, ".rlc") )
+	{
+		PackedHeader header;
+		read_coded(filename, header, pixels);
+		frame = frame_of(pixels, header.width, header.height);
+		frame.trigger_ns = header.trigger_ns;
+		frame.exposure_us = header.exposure_us;
+		frame.metadata = header.metadata;
+		frame.timestamp = header.timestamp;
+		frame.gain_db = header.gain_db;
+		frame.counter = header.counter;
+	}
+	else
+	{
+		uint32_t width = 0, height = 0;
+		double fps = 0;
+		parse_source_options(size, width, height, fps);
+		read_raw(filename, width, height, pixels);
+		frame = frame_of(pixels, width, height);
+	}
+
+	if ( output.empty() )
+		output = output_name(filename, image_extension(IMAGE_CATALOG));
+	write_image(IMAGE_CATALOG, output, frame);
+	cout << output << endl;
+}
+
+
+// Build a calibration file from master darks given as exposure_ms:temperature:file.  The
+// temperatures are rounded to the centre of their bin.
+void calibrate(const string &size, const string &serial, const string &output, int argc, char* argv[])
+{
+	uint32_t width = 0, height = 0;
+	double fps = 0;
+	parse_source_options(size, width, height, fps);
+	size_t count = (size_t) width * height;
+
+	vector<CalibrationDark> entries;
+	vector<vector<uint16_t>> pixels(argc);
+	vector<const uint16_t*> darks;
+	vector<uint32_t> hot;
+	for ( int i = 0; i < argc; i++ )
+	{
+		string arg = argv[i];
+		size_t first = arg.find(':');
+		size_t second = (first == string::npos)? string::npos : arg.find(':', first + 1);
+		if ( second == string::npos )
+			throw system_error{EINVAL, system_category(), arg + ": not exposure_ms:temperature:file"};
+		CalibrationDark entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.exposure_us = atof(arg.substr(0, first).c_str()) * 1000.0;
+		entry.temperature = round(atof(arg.substr(first + 1, second - first - 1).c_str()) / CALIBRATION_TEMP_BIN) *
+			CALIBRATION_TEMP_BIN;
+		string filename = arg.substr(second + 1);
+
+		if ( has_extension(filename, ".r12") || has_extension(filename, ".rlc") )
+		{
+			PackedHeader header;
+			read_coded(filename, header, pixels[i]);
+			if ( header.width != width || header.height != height )
+				throw system_error{EINVAL, system_category(), filename + ": not " + size};
+		}
+		else
+			read_raw(filename, width, height, pixels[i]);
+		find_hot_pixels(pixels[i].data(), count, hot);
+		entries.push_back(entry);
+		darks.push_back(pixels[i].data());
+		cout << filename << ": " << entry.exposure_us << " us at " << entry.temperature << " C" << endl;
+	}
+
+	write_calibration(output, serial, width, height, entries, darks, hot);
+	cout << output << ": " << entries.size() << " darks, " << hot.size() << " hot pixels" << endl;
+}
+
+
+// Pack and unpack a frame of random pixels and check that nothing changed
+void time_packing()
+{
+	size_t n = (size_t) DEFAULT_WIDTH * DEFAULT_HEIGHT;
+	vector<uint16_t> pixels(n), unpacked(n);
+	vector<uint8_t> packed(packed_size(n));
+	mt19937 random(1);
+	for ( size_t i = 0; i < n; i++ )
+		pixels[i] = random() & 0xfff;
+
+	auto start = chrono::steady_clock::now();
+	for ( int i = 0; i < TIME_REPEATS; i++ )
+		pack12(pixels.data(), n, packed.data());
+	double pack_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / TIME_REPEATS;
+
+	start = chrono::steady_clock::now();
+	for ( int i = 0; i < TIME_REPEATS; i++ )
+		unpack12(packed.data(), n, unpacked.data());
+	double unpack_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / TIME_REPEATS;
+
+	cout << DEFAULT_WIDTH << "x" << DEFAULT_HEIGHT << ": pack " << pack_ms << " ms (" << n * 2 / pack_ms / 1000 << " MB/s), ";
+	cout << "unpack " << unpack_ms << " ms (" << n * 2 / unpack_ms / 1000 << " MB/s), ";
+	cout << ((pixels == unpacked)? "round trip exact" : "ROUND TRIP FAILED") << endl;
+}
+
+
+// Compress and decompress a frame on the pool, returning the mean times in ms
+static void time_pool(const Frame &frame, TilePool &pool, LosslessFrame &coded, vector<uint16_t> &decoded,
+	double &encode_ms, double &decode_ms)
+{
+	uint32_t tiles = (frame.height + LOSSLESS_TILE_ROWS - 1) / LOSSLESS_TILE_ROWS;
+	atomic<bool> corrupt(false);
+	auto decode = [&](int t) {
+		uint32_t y = t * LOSSLESS_TILE_ROWS;
+		uint32_t rows = min(LOSSLESS_TILE_ROWS, frame.height - y);
+		if ( !decode_tile(coded.tile(t), coded.table[2 + t], frame.width, rows, decoded.data() + (size_t) y * frame.width) )
+			corrupt = true;
+	};
+
+	auto start = chrono::steady_clock::now();
+	for ( int i = 0; i < TIME_REPEATS; i++ )
+		encode_lossless(frame, pool, coded);
+	encode_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / TIME_REPEATS;
+
+	start = chrono::steady_clock::now();
+	for ( int i = 0; i < TIME_REPEATS; i++ )
+		pool.run(tiles, decode);
+	decode_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / TIME_REPEATS;
+	if ( corrupt )
+		decoded.clear();
+}
+
+
+// Compression ratio and speed on one thread and on all cores
+static void time_codec(const string &name, vector<uint16_t> &pixels, uint32_t width, uint32_t height)
+{
+	Frame frame = frame_of(pixels, width, height);
+	LosslessFrame coded;
+	vector<uint16_t> decoded(pixels.size());
+	TilePool single(1);
+	TilePool &all = tile_pool();
+	double encode1_ms, decode1_ms, encode_ms, decode_ms;
+
+	time_pool(frame, single, coded, decoded, encode1_ms, decode1_ms);
+	bool exact = decoded == pixels;
+	if ( all.threads() > 1 )
+	{
+		time_pool(frame, all, coded, decoded, encode_ms, decode_ms);
+		exact = exact && decoded == pixels;
+	}
+
+	double mb = frame.size / 1e6;
+	cout << name << ": ratio " << (double) frame.size / coded.header.data_size << " (" <<
+		coded.header.data_size * 8.0 / pixels.size() << " bits/pixel)" << endl;
+	cout << "  1 thread:  compress " << encode1_ms << " ms (" << mb / encode1_ms * 1000 << " MB/s), decompress " <<
+		decode1_ms << " ms (" << mb / decode1_ms * 1000 << " MB/s)" << endl;
+	if ( all.threads() > 1 )
+		cout << "  " << all.threads() << " threads: compress " << encode_ms << " ms (" << mb / encode_ms * 1000 <<
+			" MB/s), decompress " << decode_ms << " ms (" << mb / decode_ms * 1000 << " MB/s)" << endl;
+	cout << "  " << (exact ? "round trip exact" : "ROUND TRIP FAILED") << endl;
+}
+
+
+// Source extraction on one thread and on all cores
+static void time_extraction(const Frame &frame)
+{
+	SourceExtractor extractor;
+	CatalogHeader header;
+	vector<CatalogSource> sources;
+	TilePool single(1);
+	TilePool &all = tile_pool();
+
+	auto start = chrono::steady_clock::now();
+	for ( int i = 0; i < TIME_REPEATS; i++ )
+		extractor.extract(frame, single, header, sources);
+	double single_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / TIME_REPEATS;
+	cout << "  extract " << header.sources << " sources: 1 thread " << single_ms << " ms";
+
+	if ( all.threads() > 1 )
+	{
+		start = chrono::steady_clock::now();
+		for ( int i = 0; i < TIME_REPEATS; i++ )
+			extractor.extract(frame, all, header, sources);
+		double all_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / TIME_REPEATS;
+		cout << ", " << all.threads() << " threads " << all_ms << " ms";
+	}
+	cout << endl;
+}
+
+
+// Calibration of a frame with a dark interpolated between two on one thread and on all
+// cores.  The frame is copied back each time, outside the timing.
+static void time_calibration(const Frame &frame)
+{
+	string path = "/tmp/rawpack-time" + string(CALIBRATION_EXTENSION);
+	size_t count = (size_t) frame.width * frame.height;
+	vector<uint16_t> a(count, 200 << CALIBRATION_SHIFT), b(count, 300 << CALIBRATION_SHIFT);
+	vector<uint32_t> hot;
+	for ( size_t i = 0; i < count; i += 997 )
+		hot.push_back(i);
+	vector<CalibrationDark> entries(2);
+	memset(entries.data(), 0, entries.size() * sizeof(CalibrationDark));
+	entries[0].exposure_us = SYNTHETIC_REFERENCE_US / 2;
+	entries[1].exposure_us = SYNTHETIC_REFERENCE_US * 2;
+	write_calibration(path, "TIME", frame.width, frame.height, entries, { a.data(), b.data() }, hot);
+	Calibration calibration;
+	calibration.open(path);
+	unlink(path.c_str());
+
+	vector<uint16_t> pixels(count);
+	Frame copy = frame_of(pixels, frame.width, frame.height);
+	copy.exposure_us = SYNTHETIC_REFERENCE_US;
+	TilePool single(1);
+	TilePool &all = tile_pool();
+	double single_ms = 0, all_ms = 0;
+	for ( int i = 0; i < TIME_REPEATS; i++ )
+	{
+		memcpy(pixels.data(), frame.pixels, count * sizeof(uint16_t));
+		auto start = chrono::steady_clock::now();
+		calibration.apply(copy, 0, single);
+		single_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / TIME_REPEATS;
+		memcpy(pixels.data(), frame.pixels, count * sizeof(uint16_t));
+		start = chrono::steady_clock::now();
+		calibration.apply(copy, 0, all);
+		all_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / TIME_REPEATS;
+	}
+	cout << "  calibrate " << hot.size() << " hot pixels: 1 thread " << single_ms << " ms";
+	if ( all.threads() > 1 )
+		cout << ", " << all.threads() << " threads " << all_ms << " ms";
+	cout << endl;
+}
+
+
+void time_kernels(int argc, char* argv[])
+{
+	cout << fixed << setprecision(2);
+	time_packing();
+
+	// Star field at the reference exposure
+	SyntheticCamera camera("SYN0", DEFAULT_WIDTH, DEFAULT_HEIGHT, 0);
+	Frame frame;
+	int64_t trigger_ns;
+	string error;
+	if ( !camera.grab(SYNTHETIC_REFERENCE_US, frame, trigger_ns, error) )
+		throw CameraError(error);
+	vector<uint16_t> pixels(frame.pixels, frame.pixels + (size_t) frame.width * frame.height);
+	time_codec("synthetic star field", pixels, frame.width, frame.height);
+	time_extraction(frame);
+	time_calibration(frame);
+
+	if ( argc < 2 )
+		return;
+	uint32_t width = 0, height = 0;
+	double fps = 0;
+	parse_source_options(argv[0], width, height, fps);
+	for ( int i = 1; i < argc; i++ )
+	{
+		string filename = argv[i];
+		if ( has_extension(filename, ".r12") || has_extension(filename, ".rlc") )
+		{
+			PackedHeader header;
+			read_coded(filename, header, pixels);
+			time_codec(filename, pixels, header.width, header.height);
+		}
+		else
+		{
+			read_raw(filename, width, height, pixels);
+			time_codec(filename, pixels, width, height);
+		}
+	}
+}
+
+
+void usage()
+{
+	cerr << "usage: rawpack info file ..." << endl;
+	cerr << "       rawpack unpack file [output]" << endl;
+	cerr << "       rawpack pack WxH file [output]" << endl;
+	cerr << "       rawpack compress WxH file [output]" << endl;
+	cerr << "       rawpack sources file ..." << endl;
+	cerr << "       rawpack extract WxH file [output]" << endl;
+	cerr << "       rawpack calibrate WxH serial output exposure_ms:temperature:file ..." << endl;
+	cerr << "       rawpack time [WxH file ...]" << endl;
+	exit(-1);
+}
+
+
+int main(int argc, char* argv[])
+{
+	if ( argc < 2 )
+		usage();
+
+	string cmd = argv[1];
+	try
+	{
+		if ( cmd == "info" && argc > 2 )
+			for ( int i = 2; i < argc; i++ )
+				info(argv[i]);
+		else if ( cmd == "unpack" && argc > 2 )
+			unpack(argv[2], (argc > 3)? argv[3] : "");
+		else if ( cmd == "pack" && argc > 3 )
+			pack(IMAGE_PACKED, argv[2], argv[3], (argc > 4)? argv[4] : "");
+		else if ( cmd == "compress" && argc > 3 )
+			pack(IMAGE_LOSSLESS, argv[2], argv[3], (argc > 4)? argv[4] : "");
+		else if ( cmd == "sources" && argc > 2 )
+			for ( int i = 2; i < argc; i++ )
+				sources(argv[i]);
+		else if ( cmd == "extract" && argc > 3 )
+			extract(argv[2], argv[3], (argc > 4)? argv[4] : "");
+		else if ( cmd == "calibrate" && argc > 5 )
+			calibrate(argv[2], argv[3], argv[4], argc - 5, argv + 5);
+		else if ( cmd == "time" )
+			time_kernels(argc - 2, argv + 2);
+		else
+			usage();
+	}
+	catch (const system_error &e)
+	{
+		cerr << e.what() << endl;
+		exit(-1);
+	}
+	catch (const CameraError &e)
+	{
+		cerr << e.what() << endl;
+		exit(-1);
+	}
+	exit(0);
+}